@@ -4,30 +4,52 @@
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <fnmatch.h>
+#include <limits.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <strings.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
 #include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
+#include <zlib.h>
 
-//BACKLOG_10 defines the maximum no of waiting connections we allow
-#define BACKLOG_10 16
+#include "dfscore.h"
+
+//BACKLOG_10 defines the maximum no of waiting connections we allow (the kernel caps it at
+//net.core.somaxconn); "socket backlog" in DFS_CONF replaces it
+#define BACKLOG_10 1024
 
 //LINE_MAX_10 defines the max length of one text line we can send or receive
 #define LINE_MAX_10 4096
 
-//the size of the copy buffer
-#define CHUNK_10   8192
+//the most storage classes and backend instances (shards) the routing table can hold
+#define MAX_CLASSES_10 16
+#define MAX_NODES_10 64
+//the most copies a class may keep of each file
+#define MAX_REPLICAS_10 5
 
-// Ports for S1,S2,S3 and S4 where S1 listens and S2/S3/S4 are live
+// Ports for S1,S2,S3 and S4 where S1 listens and S2/S3/S4 are live; a backend host of
+// unix:<path> is reached over that socket and its port is ignored
 static const char *S1_LISTEN_HOST_10 = "0.0.0.0";
 static int S1_LISTEN_PORT_10 = 5001;
 static const char *S2_HOST_10 = "127.0.0.1";
@@ -37,25 +59,151 @@ static int S3_PORT_10 = 5003;
 static const char *S4_HOST_10 = "127.0.0.1";
 static int S4_PORT_10 = 5004;
 
-// sends exactly n_10 bytes to fd_10
-static ssize_t write_fully_10(int fd_10, const void *buf_10, size_t n_10)
+// byte accounting for STATS: the client socket of this child and the backend leg in progress
+static int stat_cfd_10 = -1, stat_leg_fd_10 = -1;
+static unsigned long long stat_cin_10, stat_cout_10, stat_leg_in_10, stat_leg_out_10;
+static int stat_req_err_10, leg_replied_10;
+
+// tracing: request id of the command being served and the wait on the current backend leg
+static int trace_fd_10 = -1;
+static char trace_rid_10[33];
+static int leg_rid_pending_10;
+static unsigned long long leg_wait_t0_10;
+// when the current leg connected, and how long its first reply line took
+static unsigned long long leg_t0_10, leg_hdr_us_10;
+static unsigned long long wall_us_10(void);
+static unsigned long long now_us_10(void);
+static void trace_span_10(const char *name_10, const char *cat_10, unsigned long long t0_10);
+static void count_io_10(int fd_10, ssize_t n_10, int out_10)
 {
-    const char *p_10 = (const char*)buf_10; size_t left_10 = n_10;
-    while (left_10 > 0)
+    if (n_10 <= 0)
+        return;
+    if (fd_10 == stat_cfd_10)
+        *(out_10 ? &stat_cout_10 : &stat_cin_10) += (unsigned long long)n_10;
+    else if (fd_10 == stat_leg_fd_10)
+        *(out_10 ? &stat_leg_out_10 : &stat_leg_in_10) += (unsigned long long)n_10;
+}
+
+// OUTPUT: what goes to the client is gathered in obuf_10 and sent when the command is done, when
+// S1 is about to read from the client again, or when the buffer fills; a write that does not fit
+// goes out in the same sendmsg as what is gathered ahead of it. A listing or a small file so
+// takes one or a few syscalls rather than one per line or chunk. A send in the middle of a reply
+// carries MSG_MORE, so its partial last segment waits for the rest; the flush at the end pushes
+// it. A streaming reply (DISPP, TREE, REMOVER) also flushes whenever it is about to wait on a
+// backend, so what is merged so far reaches the client first. Legs to the backends are written
+// directly
+#define OBUF_10 65536
+static struct
+{
+    int fd, held;   /* held: a MSG_MORE send may have left a partial segment queued */
+    size_t n;
+    char buf[OBUF_10];
+} obuf_10 = { -1, 0, 0, { 0 } };
+
+static int obuf_send_10(struct iovec *iov_10, int cnt_10, int more_10)
+{
+    while (cnt_10 > 0)
     {
-        ssize_t w_10 = write(fd_10, p_10, left_10);
+        struct msghdr m_10;
+        memset(&m_10, 0, sizeof m_10);
+        m_10.msg_iov = iov_10;
+        m_10.msg_iovlen = (size_t)cnt_10;
+        ssize_t w_10 = sendmsg(obuf_10.fd, &m_10, more_10 ? MSG_MORE : 0);
         if (w_10 < 0)
         {
             if (errno == EINTR) continue;
             return -1;
         }
-        left_10 -= (size_t)w_10; p_10 += w_10;
+        for (; cnt_10 > 0 && (size_t)w_10 >= iov_10->iov_len; ++iov_10, --cnt_10)
+            w_10 -= (ssize_t)iov_10->iov_len;
+        if (cnt_10 > 0)
+        {
+            iov_10->iov_base = (char*)iov_10->iov_base + w_10;
+            iov_10->iov_len -= (size_t)w_10;
+        }
+    }
+    obuf_10.held = more_10;
+    return 0;
+}
+static int SOCK_NODELAY_10;   // defined with the other socket options below
+// the end of a reply: everything gathered goes out now
+static int obuf_flush_10(void)
+{
+    if (obuf_10.n)
+    {
+        struct iovec iov_10 = { obuf_10.buf, obuf_10.n };
+        obuf_10.n = 0;
+        return obuf_send_10(&iov_10, 1, 0);
+    }
+    if (obuf_10.held)
+    {
+        // nothing left to send without MSG_MORE; setting TCP_NODELAY pushes the held segment
+        int one_10 = 1;
+        setsockopt(obuf_10.fd, IPPROTO_TCP, TCP_NODELAY, &one_10, sizeof one_10);
+        if (!SOCK_NODELAY_10)
+        {
+            // the push is done; go back to the configured `socket nodelay off`
+            one_10 = 0;
+            setsockopt(obuf_10.fd, IPPROTO_TCP, TCP_NODELAY, &one_10, sizeof one_10);
+        }
+        obuf_10.held = 0;
+    }
+    return 0;
+}
+// a streaming reply is about to read fd_10: unless it has input already, what is gathered goes
+// out now instead of waiting behind the backend
+static int obuf_idle_10(int fd_10)
+{
+    struct pollfd pf_10 = { fd_10, POLLIN, 0 };
+    if (!obuf_10.n || poll(&pf_10, 1, 0) > 0)
+        return 0;
+    return obuf_flush_10();
+}
+static ssize_t obuf_write_10(const void *buf_10, size_t n_10)
+{
+    if (obuf_10.n + n_10 <= OBUF_10)
+    {
+        memcpy(obuf_10.buf + obuf_10.n, buf_10, n_10);
+        obuf_10.n += n_10;
+    }
+    else
+    {
+        struct iovec iov_10[2] = { { obuf_10.buf, obuf_10.n }, { (void*)buf_10, n_10 } };
+        obuf_10.n = 0;
+        if (obuf_send_10(iov_10, 2, 1) != 0)
+            return -1;
     }
+    count_io_10(obuf_10.fd, (ssize_t)n_10, 1);
+    return (ssize_t)n_10;
+}
+// a forked process starts with nothing gathered: what the parent had is sent before the fork
+static void obuf_prefork_10(void)
+{
+    if (obuf_10.fd >= 0)
+        obuf_flush_10();
+}
+static void obuf_child_10(void)
+{
+    obuf_10.fd = -1;
+    obuf_10.n = 0;
+    obuf_10.held = 0;
+}
+
+// sends exactly n_10 bytes to fd_10
+static ssize_t write_fully_10(int fd_10, const void *buf_10, size_t n_10)
+{
+    if (fd_10 == obuf_10.fd)
+        return obuf_write_10(buf_10, n_10);
+    if (write_all_10(fd_10, buf_10, n_10) < 0)
+        return -1;
+    count_io_10(fd_10, (ssize_t)n_10, 1);
     return (ssize_t)n_10;
 }
 // this function reads n bytes from fd_10 and if the connection gets closed it stops
 static ssize_t read_fully_10(int fd_10, void *buf_10, size_t n_10)
 {
+    if (fd_10 == obuf_10.fd && obuf_flush_10() != 0)
+        return -1;
     char *p_10 = (char*)buf_10; size_t left_10 = n_10;
     while (left_10 > 0)
     {
@@ -67,96 +215,159 @@ static ssize_t read_fully_10(int fd_10, void *buf_10, size_t n_10)
             if (errno == EINTR) continue;
             return -1;
         }
+        count_io_10(fd_10, r_10, 0);
         left_10 -= (size_t)r_10; p_10 += r_10;
     }
     return (ssize_t)n_10;
 }
-// reads text until a newline and stoes it into into buf_10
-static int read_line_10(int fd_10, char *buf_10, size_t cap_10)
+// a reply read on the leg being timed (got_10: with something in it)
+static void leg_seen_10(int fd_10, int got_10)
 {
-    size_t i_10 = 0;
-    while (i_10 + 1 < cap_10)
+    if (got_10 && fd_10 == stat_leg_fd_10)
     {
-        char c_10; ssize_t r_10 = read(fd_10, &c_10, 1);
-        if (r_10 == 0)
-            break;
-        if (r_10 < 0)
-        {
-            if (errno == EINTR) continue;
-            return -1;
-        }
-        if (c_10 == '\n') break;
-        buf_10[i_10++] = c_10;
+        if (!leg_replied_10)
+            leg_hdr_us_10 = now_us_10() - leg_t0_10;
+        leg_replied_10 = 1;   /* the backend is alive, whatever it answered */
+    }
+    // first reply line from a backend ends the "backend_wait" span
+    if (leg_wait_t0_10 && fd_10 == stat_leg_fd_10)
+    {
+        trace_span_10("backend_wait", "S1", leg_wait_t0_10);
+        leg_wait_t0_10 = 0;
     }
-    buf_10[i_10] = '\0';
-    return (int)i_10;
+}
+// reads text until a newline and stoes it into into buf_10
+static int read_line_10(int fd_10, char *buf_10, size_t cap_10)
+{
+    if (fd_10 == obuf_10.fd && obuf_flush_10() != 0)
+        return -1;
+    size_t got_10;
+    int n_10 = read_line_fd_10(fd_10, buf_10, cap_10, &got_10);
+    count_io_10(fd_10, (ssize_t)got_10, 0);
+    if (n_10 < 0)
+        return -1;
+    leg_seen_10(fd_10, n_10 > 0);
+    return n_10;
 }
 
-// Turn "~S1/.." from the argument into an absolute path under "/home/USER/S1/..."
-// also creates the directory if it does not exists
-static char *build_s1_path_10(const char *rel_10, int mk_10)
+// checks if "~S1/..." is present in path
+static int path_is_s1_10(const char *p_10)
 {
-    const char *home_10 = getenv("HOME"); if (!home_10) home_10 = ".";
-    char *base_10 = NULL; asprintf(&base_10, "%s/%s", home_10, "S1");
-    if (mk_10)
-        mkdir(base_10, 0700);
+    return (p_10 && strncmp(p_10, "~S1/", 4) == 0);
+}
+
+// TIMEOUTS: a backend gets CONNECT_MS_10 to accept a connection, then every read or write on
+// the leg may wait at most the timeout of its operation ("timeout" lines in DFS_CONF), so a hung
+// backend ties up a child for a bounded time. The timeouts are per call, not per transfer: a
+// large file still moves as long as its bytes keep coming
+enum { BOP_STORE_10, BOP_FETCH_10, BOP_DELETE_10, BOP_LIST_10, BOP_TAR_10, BOP_STAT_10, BOP_WALK_10, BOP_COUNT_10 };
+static const char *BOP_NAMES_10[BOP_COUNT_10] = { "store", "fetch", "delete", "list", "tar", "stat", "walk" };
+static int CONNECT_MS_10 = 1000;
+static int BOP_MS_10[BOP_COUNT_10] = { 10000, 10000, 5000, 5000, 60000, 5000, 60000 };   /* tar and walk read a whole store first */
+
+// BREAKERS: after BREAKER_FAILS_10 calls in a row that got no answer, a backend's breaker opens
+// and calls to it fail at once; a prober process tries it every BREAKER_MS_10 and closes it again
+static int BREAKER_FAILS_10 = 3;   /* 0: no breakers */
+static int BREAKER_MS_10 = 2000;
 
-    char *out_10 = NULL;
-    if (rel_10 && rel_10[0])
+// SOCKETS ("socket" lines in DFS_CONF): the options of client connections, which accepted
+// sockets inherit from the listener, and of backend legs
+static int SOCK_BACKLOG_10 = BACKLOG_10;
+static int SOCK_NODELAY_10 = 1;    /* else a kept connection (libdfsclient) waits on its delayed ack */
+static int SOCK_BUF_KB_10 = 0;     /* 0: the kernel sizes them (a set size turns its autotuning off) */
+static int SOCK_KA_IDLE_10 = 60;   /* s before the first probe of an idle connection; 0: no keepalive */
+static int SOCK_KA_INTVL_10 = 10;
+static int SOCK_KA_CNT_10 = 5;
+static int SOCK_DEFER_S_10 = 5;    /* accept() waits up to this for the first line; 0: off */
+
+// one "socket <option> <value>..." line; -1 when it is not understood
+static int sock_conf_10(const char *opt_10, char **save_10)
+{
+    char *v_10 = strtok_r(NULL, " \t\r\n", save_10);
+    if (!v_10)
+        return -1;
+    int off_10 = !strcmp(v_10, "off"), n_10 = atoi(v_10);
+    if (!strcmp(opt_10, "backlog") && n_10 > 0)
+        SOCK_BACKLOG_10 = n_10;
+    else if (!strcmp(opt_10, "nodelay") && (off_10 || !strcmp(v_10, "on")))
+        SOCK_NODELAY_10 = !off_10;
+    else if (!strcmp(opt_10, "buffers") && (off_10 || n_10 > 0))
+        SOCK_BUF_KB_10 = off_10 ? 0 : n_10;
+    else if (!strcmp(opt_10, "defer_accept") && (off_10 || n_10 > 0))
+        SOCK_DEFER_S_10 = off_10 ? 0 : n_10;
+    else if (!strcmp(opt_10, "keepalive") && (off_10 || n_10 > 0))
     {
-        const char *r_10 = rel_10;
-        if (strncmp(r_10, "~S1/", 4) == 0) r_10 += 4;  /* strip prefix */
-        asprintf(&out_10, "%s/%s", base_10, r_10);
+        char *i_10 = strtok_r(NULL, " \t\r\n", save_10);
+        char *c_10 = strtok_r(NULL, " \t\r\n", save_10);
+        if ((i_10 && atoi(i_10) < 1) || (c_10 && atoi(c_10) < 1))
+            return -1;
+        SOCK_KA_IDLE_10 = off_10 ? 0 : n_10;
+        if (i_10)
+            SOCK_KA_INTVL_10 = atoi(i_10);
+        if (c_10)
+            SOCK_KA_CNT_10 = atoi(c_10);
     }
     else
+        return -1;
+    return 0;
+}
+
+// applies the SOCKETS options before connect() or listen(), so a receive buffer set here
+// is the one the handshake scales the window for
+static void sock_tune_10(int fd_10)
+{
+    int one_10 = 1;
+    if (SOCK_NODELAY_10)
+        setsockopt(fd_10, IPPROTO_TCP, TCP_NODELAY, &one_10, sizeof one_10);
+    if (SOCK_BUF_KB_10)
     {
-        out_10 = strdup(base_10);
+        int b_10 = SOCK_BUF_KB_10 * 1024;
+        setsockopt(fd_10, SOL_SOCKET, SO_SNDBUF, &b_10, sizeof b_10);
+        setsockopt(fd_10, SOL_SOCKET, SO_RCVBUF, &b_10, sizeof b_10);
     }
-    free(base_10);
-
-    if (mk_10 && out_10)
+    if (SOCK_KA_IDLE_10)
     {
-        // mkdir -p for parents
-        char *tmp_10 = strdup(out_10);
-        for (char *p_10 = tmp_10 + 1; *p_10; ++p_10)
-        {
-            if (*p_10 == '/')
-            {
-                *p_10 = '\0';
-                mkdir(tmp_10, 0700);
-                *p_10 = '/';
-            }
-        }
-        struct stat st_10;
-        if (stat(out_10, &st_10) != 0)
-            mkdir(out_10, 0700);
-        free(tmp_10);
+        setsockopt(fd_10, SOL_SOCKET, SO_KEEPALIVE, &one_10, sizeof one_10);
+        setsockopt(fd_10, IPPROTO_TCP, TCP_KEEPIDLE, &SOCK_KA_IDLE_10, sizeof SOCK_KA_IDLE_10);
+        setsockopt(fd_10, IPPROTO_TCP, TCP_KEEPINTVL, &SOCK_KA_INTVL_10, sizeof SOCK_KA_INTVL_10);
+        setsockopt(fd_10, IPPROTO_TCP, TCP_KEEPCNT, &SOCK_KA_CNT_10, sizeof SOCK_KA_CNT_10);
     }
-    return out_10;
-}
-//this functions gets the file extension from the arguments
-static const char *ext_lower_10(const char *name_10)
-{
-    static char out_10[16];
-    const char *dot_10 = strrchr(name_10, '.');
-    if (!dot_10)
-        return "";
-    size_t n_10 = sizeof(out_10) - 1;
-    strncpy(out_10, dot_10, n_10); out_10[n_10] = 0;
-    for (char *p_10 = out_10; *p_10; ++p_10)
-        *p_10 = (char)tolower((unsigned char)*p_10);
-    return out_10;
 }
-// checks if "~S1/..." is present in path
-static int path_is_s1_10(const char *p_10)
+
+// bounds every later read and write on the socket to ms
+static void sock_timeout_10(int fd_10, int ms_10)
 {
-    return (p_10 && strncmp(p_10, "~S1/", 4) == 0);
+    struct timeval tv_10;
+    tv_10.tv_sec = ms_10 / 1000;
+    tv_10.tv_usec = (ms_10 % 1000) * 1000;
+    setsockopt(fd_10, SOL_SOCKET, SO_RCVTIMEO, &tv_10, sizeof tv_10);
+    setsockopt(fd_10, SOL_SOCKET, SO_SNDTIMEO, &tv_10, sizeof tv_10);
 }
 
 //These are the Network helpers
-//This function opens a TCP connection for host:port
-static int connect_to_10(const char *host_10, int port_10)
+//This function opens a TCP connection for host:port, giving up after ms; a host of
+//unix:<path> (port 0) is a backend on this machine, reached over an AF_UNIX socket instead
+static int connect_to_10(const char *host_10, int port_10, int ms_10)
 {
+    if (!strncmp(host_10, "unix:", 5))
+    {
+        struct sockaddr_un u_10; memset(&u_10, 0, sizeof u_10);
+        u_10.sun_family = AF_UNIX;
+        snprintf(u_10.sun_path, sizeof u_10.sun_path, "%s", host_10 + 5);
+        int fd_10 = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd_10 < 0)
+            return -1;
+        // a unix connect only waits while the backend's listen queue is full, bounded by this
+        sock_timeout_10(fd_10, ms_10);
+        if (connect(fd_10, (struct sockaddr*)&u_10, sizeof u_10) != 0)
+        {
+            int e_10 = errno;
+            close(fd_10);
+            errno = e_10 == EAGAIN ? ETIMEDOUT : e_10;
+            return -1;
+        }
+        return fd_10;
+    }
     int fd_10 = socket(AF_INET, SOCK_STREAM, 0);
     if (fd_10 < 0) return -1;
     struct sockaddr_in a_10; memset(&a_10, 0, sizeof a_10);
@@ -166,11 +377,31 @@ static int connect_to_10(const char *host_10, int port_10)
         close(fd_10);
         return -1;
     }
-    if (connect(fd_10, (struct sockaddr*)&a_10, sizeof a_10) != 0)
+    sock_tune_10(fd_10);
+    // non-blocking, so a host that never answers costs ms instead of the kernel's SYN retries
+    int fl_10 = fcntl(fd_10, F_GETFL, 0);
+    fcntl(fd_10, F_SETFL, fl_10 | O_NONBLOCK);
+    int rc_10 = connect(fd_10, (struct sockaddr*)&a_10, sizeof a_10);
+    if (rc_10 != 0 && errno == EINPROGRESS)
+    {
+        struct pollfd pf_10 = { fd_10, POLLOUT, 0 };
+        int err_10 = ETIMEDOUT; socklen_t el_10 = sizeof err_10;
+        while ((rc_10 = poll(&pf_10, 1, ms_10)) < 0 && errno == EINTR)
+            ;
+        if (rc_10 == 1 && getsockopt(fd_10, SOL_SOCKET, SO_ERROR, &err_10, &el_10) == 0 && err_10 == 0)
+            rc_10 = 0;
+        else
+        {
+            rc_10 = -1;
+            errno = err_10 ? err_10 : ETIMEDOUT;
+        }
+    }
+    if (rc_10 != 0)
     {
         close(fd_10);
         return -1;
     }
+    fcntl(fd_10, F_SETFL, fl_10);
     return fd_10;
 }
 // adds '\n' at the end of a line
@@ -184,805 +415,5811 @@ static int send_line_10(int fd_10, const char *fmt_10, ...)
     size_t len_10 = strlen(buf_10);
     if (len_10 + 1 >= sizeof buf_10)
         return -1;
+    // any error reply to the client marks the current request as failed in STATS
+    if (fd_10 == stat_cfd_10 && (!strncmp(buf_10, "ERR|", 4) || !strncmp(buf_10, "FILENOTFOUND|", 13) || !strncmp(buf_10, "REMERR|", 7)))
+        stat_req_err_10 = 1;
     buf_10[len_10++] = '\n';
+    // the first line on a backend leg carries the request id in the same write,
+    // so the extra line never sits behind Nagle waiting for an ACK
+    if (fd_10 == stat_leg_fd_10 && leg_rid_pending_10)
+    {
+        leg_rid_pending_10 = 0;
+        if (trace_fd_10 >= 0)
+            leg_wait_t0_10 = wall_us_10();
+        if (trace_rid_10[0])
+        {
+            char out_10[LINE_MAX_10 + 40];
+            int k_10 = snprintf(out_10, sizeof out_10, "RID|%s\n", trace_rid_10);
+            memcpy(out_10 + k_10, buf_10, len_10);
+            return (write_fully_10(fd_10, out_10, (size_t)k_10 + len_10) == (ssize_t)((size_t)k_10 + len_10)) ? 0 : -1;
+        }
+    }
     return (write_fully_10(fd_10, buf_10, len_10) == (ssize_t)len_10) ? 0 : -1;
 }
 
-// picks a backend port and chooses where to the send the files based on file extensions
-static int pick_backend_port_10(const char *ext_10)
+// STATS: request counters and latency histograms shared by all S1 children
+// the region is mmap'd MAP_SHARED before the accept loop, so every forked child adds into it;
+// each child writes to the stripe picked by its pid with relaxed atomic adds (no locks) and
+// STATS sums the stripes when asked
+#define STAT_STRIPES_10 16
+#define STAT_BUCKETS_10 128   /* 4 buckets per power of two of microseconds */
+
+enum { CMD_UPLOADF_10, CMD_DOWNLF_10, CMD_REMOVEF_10, CMD_DOWNTAR_10, CMD_DISP_10, CMD_STATS_10, CMD_ROUTES_10, CMD_REBALANCE_10, CMD_OTHER_10, CMD_COUNT_10 };
+static const char *CMD_NAMES_10[CMD_COUNT_10] = { "UPLOADF", "DOWNLF", "REMOVEF", "DOWNTAR", "DISP", "STATS", "ROUTES", "REBALANCE", "OTHER" };
+
+struct op_stats_10
+{
+    unsigned long long requests, errors, bytes_in, bytes_out, lat_sum_us;
+    unsigned long long hist[STAT_BUCKETS_10];
+};
+struct stat_stripe_10
 {
-    if (strcmp(ext_10, ".pdf") == 0)
-        return S2_PORT_10;
-    if (strcmp(ext_10, ".txt") == 0)
-        return S3_PORT_10;
-    if (strcmp(ext_10, ".zip") == 0)
-        return S4_PORT_10;
+    struct op_stats_10 cmd[CMD_COUNT_10];
+    struct op_stats_10 backend[MAX_NODES_10];   /* backend legs, per backend instance */
+} __attribute__((aligned(64)));
 
-    return -1;
+// gauges and backend health that are not per request, kept after the stripes
+struct stat_global_10
+{
+    unsigned long long accepted, active, inflight, start_s;
+    unsigned long long hedges, hedge_wins, lists_dropped;   /* see HEDGED READS */
+    struct
+    {
+        unsigned long long down, fails, hdr_us;   /* hdr_us: moving average of the first reply */
+        unsigned long long open;                  /* breaker open: calls fail without a connect */
+        unsigned long long hdr_n, hdr_hist[STAT_BUCKETS_10];   /* recent first replies, halved every 1024 */
+    } backend[MAX_NODES_10];
+};
+
+static struct stat_stripe_10 *STATS_10 = NULL;
+static struct stat_global_10 *STATG_10 = NULL;
+
+static int stats_init_10(void)
+{
+    size_t sz_10 = sizeof(struct stat_stripe_10) * STAT_STRIPES_10 + sizeof(struct stat_global_10);
+    void *p_10 = mmap(NULL, sz_10, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    if (p_10 == MAP_FAILED)
+        return -1;
+    STATS_10 = (struct stat_stripe_10*)p_10;   /* anonymous mappings start zeroed */
+    STATG_10 = (struct stat_global_10*)(STATS_10 + STAT_STRIPES_10);
+    STATG_10->start_s = (unsigned long long)time(NULL);
+    return 0;
 }
-static const char *pick_backend_host_10(const char *ext_10)
+
+static unsigned long long now_us_10(void)
 {
-    if (strcmp(ext_10, ".pdf") == 0)
-        return S2_HOST_10;
-    if (strcmp(ext_10, ".txt") == 0)
-        return S3_HOST_10;
-    if (strcmp(ext_10, ".zip") == 0)
-        return S4_HOST_10;
+    struct timespec ts_10;
+    clock_gettime(CLOCK_MONOTONIC, &ts_10);
+    return (unsigned long long)ts_10.tv_sec * 1000000ULL + (unsigned long long)ts_10.tv_nsec / 1000ULL;
+}
 
-    return NULL;
+// bucket b covers [2^(b/4) * (4 + b%4)/4 ...) microseconds, i.e. ~19% wide buckets
+static int stat_bucket_10(unsigned long long us_10)
+{
+    if (us_10 < 4)
+        return (int)us_10;
+    int lg_10 = 63 - __builtin_clzll(us_10);
+    int b_10 = lg_10 * 4 + (int)((us_10 >> (lg_10 - 2)) & 3);
+    return b_10 < STAT_BUCKETS_10 ? b_10 : STAT_BUCKETS_10 - 1;
+}
+static unsigned long long stat_bucket_upper_10(int b_10)
+{
+    if (b_10 < 4)
+        return (unsigned long long)b_10 + 1;
+    if (b_10 < 8)
+        return 4;   /* unused: 4us and up start at bucket 8 */
+    int lg_10 = b_10 / 4;
+    return (1ULL << lg_10) + ((unsigned long long)(b_10 % 4 + 1) << (lg_10 - 2));
 }
 
-// These are the File helpers
-// gets n bytes from a socket and writes to a file
-static int recv_file_to_path_10(int fd_10, const char *dst_path_10, size_t size_10)
+static void stat_add_10(struct op_stats_10 *o_10, unsigned long long us_10, int err_10, unsigned long long in_10, unsigned long long out_10)
 {
-    int out_10 = open(dst_path_10, O_CREAT|O_TRUNC|O_WRONLY, 0600);
-    if (out_10 < 0)
-        return -1;
-    char *buf_10 = (char*)malloc(CHUNK_10);
-    if (!buf_10)
-    {
-        close(out_10);
-        return -1;
-    }
-    size_t left_10 = size_10;
-    while (left_10 > 0)
+    __atomic_fetch_add(&o_10->requests, 1, __ATOMIC_RELAXED);
+    if (err_10)
+        __atomic_fetch_add(&o_10->errors, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&o_10->bytes_in, in_10, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&o_10->bytes_out, out_10, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&o_10->lat_sum_us, us_10, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&o_10->hist[stat_bucket_10(us_10)], 1, __ATOMIC_RELAXED);
+}
+static struct stat_stripe_10 *my_stripe_10(void)
+{
+    return &STATS_10[(unsigned)getpid() % STAT_STRIPES_10];
+}
+
+// one request from the client, timed from the parsed command line to the last reply byte
+static void stat_cmd_done_10(int cmd_10, unsigned long long t0_10)
+{
+    if (!STATS_10)
+        return;
+    stat_add_10(&my_stripe_10()->cmd[cmd_10], now_us_10() - t0_10, stat_req_err_10, stat_cin_10, stat_cout_10);
+}
+
+// a backend leg: its socket is remembered by leg_connect_10 so its bytes get counted
+static unsigned long long stat_leg_begin_10(void)
+{
+    stat_leg_in_10 = stat_leg_out_10 = 0;
+    leg_replied_10 = 0;
+    leg_hdr_us_10 = 0;
+    return now_us_10();
+}
+// a backend that answered anything is up; one we could not reach or that hung up is down
+static void stat_leg_add_10(int backend_10, unsigned long long t0_10, int ok_10, int replied_10,
+    unsigned long long hdr_10, unsigned long long in_10, unsigned long long out_10)
+{
+    if (!STATS_10 || backend_10 < 0)
+        return;
+    stat_add_10(&my_stripe_10()->backend[backend_10], now_us_10() - t0_10, !ok_10, in_10, out_10);
+    if (replied_10)
     {
-        size_t want_10 = left_10 > CHUNK_10 ? CHUNK_10 : left_10;
-        ssize_t r_10 = read_fully_10(fd_10, buf_10, want_10);
-        if (r_10 <= 0)
+        // an eighth of each new sample, so one slow reply moves a replica down but not out
+        unsigned long long avg_10 = __atomic_load_n(&STATG_10->backend[backend_10].hdr_us, __ATOMIC_RELAXED);
+        __atomic_store_n(&STATG_10->backend[backend_10].hdr_us, avg_10 ? (avg_10 * 7 + hdr_10) / 8 : hdr_10 + 1, __ATOMIC_RELAXED);
+        // the histogram forgets half of what it holds every 1024 replies, so its percentiles follow
+        // the backend's recent behaviour; whichever child crosses the mark does the halving
+        __atomic_fetch_add(&STATG_10->backend[backend_10].hdr_hist[stat_bucket_10(hdr_10)], 1, __ATOMIC_RELAXED);
+        if (__atomic_add_fetch(&STATG_10->backend[backend_10].hdr_n, 1, __ATOMIC_RELAXED) == 1024)
         {
-            free(buf_10);
-            close(out_10);
-            return -1;
-        }
-        if (write_fully_10(out_10, buf_10, (size_t)r_10) != r_10)
-        {
-            free(buf_10);
-            close(out_10);
-            return -1;
+            for (int b_10 = 0; b_10 < STAT_BUCKETS_10; ++b_10)
+                __atomic_store_n(&STATG_10->backend[backend_10].hdr_hist[b_10],
+                    __atomic_load_n(&STATG_10->backend[backend_10].hdr_hist[b_10], __ATOMIC_RELAXED) / 2, __ATOMIC_RELAXED);
+            __atomic_store_n(&STATG_10->backend[backend_10].hdr_n, 0, __ATOMIC_RELAXED);
         }
-        left_10 -= (size_t)r_10;
+        __atomic_store_n(&STATG_10->backend[backend_10].down, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&STATG_10->backend[backend_10].fails, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&STATG_10->backend[backend_10].open, 0, __ATOMIC_RELAXED);
     }
-    free(buf_10);
-    close(out_10);
-    return 0;
-}
-//sends the entire file to fd_10 (reads a file and push bytes to the socket)
-static int send_file_from_path_10(int fd_10, const char *src_path_10, size_t *osz_10)
-{
-    int in_10 = open(src_path_10, O_RDONLY);
-    if (in_10 < 0)
-        return -1;
-    struct stat st_10;
-    if (fstat(in_10, &st_10) != 0)
+    else
     {
-        close(in_10);
-        return -1;
+        __atomic_store_n(&STATG_10->backend[backend_10].down, 1, __ATOMIC_RELAXED);
+        unsigned long long fails_10 = __atomic_add_fetch(&STATG_10->backend[backend_10].fails, 1, __ATOMIC_RELAXED);
+        if (BREAKER_FAILS_10 > 0 && fails_10 >= (unsigned long long)BREAKER_FAILS_10)
+            __atomic_store_n(&STATG_10->backend[backend_10].open, 1, __ATOMIC_RELAXED);
     }
-    if (osz_10) *osz_10 = (size_t)st_10.st_size;
+}
+static void stat_leg_end_10(int backend_10, unsigned long long t0_10, int ok_10)
+{
+    stat_leg_fd_10 = -1;
+    stat_leg_add_10(backend_10, t0_10, ok_10, leg_replied_10, leg_hdr_us_10, stat_leg_in_10, stat_leg_out_10);
+}
 
-    char *buf_10 = (char*)malloc(CHUNK_10);
-    if (!buf_10)
+// sums all stripes of one counter set
+static void stat_sum_10(struct op_stats_10 *out_10, int backend_10, int idx_10)
+{
+    memset(out_10, 0, sizeof *out_10);
+    for (int s_10 = 0; s_10 < STAT_STRIPES_10; ++s_10)
     {
-        close(in_10);
-        return -1;
+        const struct op_stats_10 *o_10 = backend_10 ? &STATS_10[s_10].backend[idx_10] : &STATS_10[s_10].cmd[idx_10];
+        out_10->requests   += __atomic_load_n(&o_10->requests, __ATOMIC_RELAXED);
+        out_10->errors     += __atomic_load_n(&o_10->errors, __ATOMIC_RELAXED);
+        out_10->bytes_in   += __atomic_load_n(&o_10->bytes_in, __ATOMIC_RELAXED);
+        out_10->bytes_out  += __atomic_load_n(&o_10->bytes_out, __ATOMIC_RELAXED);
+        out_10->lat_sum_us += __atomic_load_n(&o_10->lat_sum_us, __ATOMIC_RELAXED);
+        for (int b_10 = 0; b_10 < STAT_BUCKETS_10; ++b_10)
+            out_10->hist[b_10] += __atomic_load_n(&o_10->hist[b_10], __ATOMIC_RELAXED);
     }
-    for (;;)
+}
+// upper bound of the bucket holding the p-th quantile
+static unsigned long long stat_pct_10(const struct op_stats_10 *o_10, double p_10)
+{
+    if (o_10->requests == 0)
+        return 0;
+    unsigned long long total_10 = 0;
+    for (int b_10 = 0; b_10 < STAT_BUCKETS_10; ++b_10)
+        total_10 += o_10->hist[b_10];
+    unsigned long long want_10 = (unsigned long long)(p_10 * (double)total_10 + 0.999999), seen_10 = 0;
+    for (int b_10 = 0; b_10 < STAT_BUCKETS_10; ++b_10)
     {
-        ssize_t r_10 = read(in_10, buf_10, CHUNK_10);
-        if (r_10 < 0)
-        {
-            if (errno==EINTR) continue;
-            free(buf_10); close(in_10);
-            return -1;
-        }
-        if (r_10 == 0) break;
-        if (write_fully_10(fd_10, buf_10, (size_t)r_10) != r_10)
-        {
-            free(buf_10);
-            close(in_10);
-            return -1;
-        }
+        seen_10 += o_10->hist[b_10];
+        if (seen_10 >= want_10 && seen_10 > 0)
+            return stat_bucket_upper_10(b_10);
     }
-    free(buf_10);
-    close(in_10);
-    return 0;
+    return stat_bucket_upper_10(STAT_BUCKETS_10 - 1);
 }
 
-// small helper for saving copies
-//keeps files that user downloads like tar files etc
-static int path_exists_10(const char *p_10)
+// writes one counter line plus its non-empty histogram buckets as upper_us:count pairs
+static void stat_send_one_10(int fd_10, const char *kind_10, const char *name_10, const struct op_stats_10 *o_10)
 {
-    struct stat st_10; return (stat(p_10, &st_10) == 0);
+    send_line_10(fd_10, "%s|%s|%llu|%llu|%llu|%llu|%llu|%llu|%llu|%llu", kind_10, name_10,
+        o_10->requests, o_10->errors, o_10->bytes_in, o_10->bytes_out,
+        o_10->requests ? o_10->lat_sum_us / o_10->requests : 0ULL,
+        stat_pct_10(o_10, 0.50), stat_pct_10(o_10, 0.99), stat_pct_10(o_10, 0.999));
+    char hist_10[LINE_MAX_10 - 64]; size_t h_10 = 0;
+    hist_10[0] = '\0';
+    for (int b_10 = 0; b_10 < STAT_BUCKETS_10 && h_10 + 48 < sizeof hist_10; ++b_10)
+        if (o_10->hist[b_10])
+            h_10 += (size_t)snprintf(hist_10 + h_10, sizeof hist_10 - h_10, "%s%llu:%llu", h_10 ? "," : "",
+                stat_bucket_upper_10(b_10), o_10->hist[b_10]);
+    send_line_10(fd_10, "HIST|%s|%s", name_10, hist_10);
 }
-static char *unique_dest_path_10(const char *dir_10, const char *name_10)
+
+// ROUTING: the storage class that keeps a file is picked by its lowercased extension.
+// The table is read from the file named by DFS_CONF at startup (built-in defaults otherwise):
+//   class <name> <ip>:<port> [...]   a backend storage class and its shards ("local" is S1's own disk)
+//   route <class> <.ext> [.ext ...]  extensions kept by that class
+//   default <class>                  where every other extension goes (none = refused)
+//   vnodes <n>                       points per shard on the consistent hash ring (default 64)
+//   from <class> <ip>:<port> [...]   the shards the class had before, while it is rebalanced
+//   replicas <class> <n> [<w>]       keep n copies of each file, an upload needs w of them (majority)
+//   hedge <percentile|off>           when a replica read is hedged (default 95, see HEDGED READS)
+//   timeout <connect|op> <ms>        connect deadline, or the read/write timeout of a backend
+//                                    operation (store fetch delete list tar stat walk), see TIMEOUTS
+//   breaker <fails|off> [<ms>]       open a backend's breaker after that many failed calls, probe every ms
+//   cache <mem MB|off> [<disk MB> [<ms>]]  read cache tiers, and how long a cached file is served
+//                                    before it is checked (default 64 MB, no disk, 30 s), see READ CACHE
+//   writeback <on|off> [<legs> [<batch>]]  acknowledge uploads once journaled (default off, see WRITE-BACK)
+// The extensions are then put into a perfect hash (ROUTES_10 and route_10 in dfscore.c), so
+// routing a request costs two hashes and one strcmp however many extensions are configured
+
+struct vnode_10
+{
+    unsigned point;
+    int node;
+};
+// a stretch of the ring (up to and including hi) and its replicas before and after a rebalance
+struct seg_10
+{
+    unsigned hi;
+    int from[MAX_REPLICAS_10], to[MAX_REPLICAS_10];
+    int nf, nt;
+};
+// progress of a rebalance, shared between the migrator and REBALANCE status
+struct rebal_10
+{
+    int pid;                     /* the migrator, 0 when none is running */
+    unsigned long long files, bytes, failed;
+    char phase[16];
+};
+struct sclass_10
 {
-    char *dst_10 = NULL;
-    asprintf(&dst_10, "%s/%s", dir_10, name_10);
-    if(!path_exists_10(dst_10))
-        return dst_10;
+    char name[32];
+    int local;
+    int first, count;            /* its shards are NODES_10[first .. first+count) */
+    struct vnode_10 *ring;       /* count * VNODES_10 points, sorted */
+    int replicas, wquorum;       /* copies of each file, and how many an upload waits for */
+    int from[MAX_NODES_10], nfrom;   /* the previous shards ("from" line), 0 when not rebalancing */
+    struct vnode_10 *old_ring;
+    struct seg_10 *segs;         /* every ring stretch, old and new points merged */
+    int nsegs;
+    unsigned plan;               /* fingerprint of the two layouts, checked against the saved state */
+    unsigned char *seg_state;    /* SEG_*_10 per stretch, shared by every child */
+    struct rebal_10 *rb;
+};
+// one backend instance; its stats and health are kept per node
+struct node_10
+{
+    char name[40];               /* the class name, class#i when sharded, class#old<i> when retiring */
+    char host[112];              /* an IP, or unix:<path> with port 0 */
+    char addr[120];              /* as written in the config: ip:port or unix:<path> */
+    int port, cls;
+};
 
-    const char *dot_10 = strrchr(name_10, '.');
-    size_t base_len_10 = (dot_10 && dot_10 != name_10) ? (size_t)(dot_10 - name_10) : strlen(name_10);
-    char *base_10 = strndup(name_10, base_len_10);
-    const char *ext_10 = (dot_10 && dot_10 != name_10) ? dot_10 : "";
+static struct sclass_10 CLASSES_10[MAX_CLASSES_10];
+static int NCLASSES_10;
+static struct node_10 NODES_10[MAX_NODES_10];
+static int NNODES_10;
+static int VNODES_10 = 64;
+static int HEDGE_PCT_10 = 95;
+static int CACHE_MEM_MB_10 = 64, CACHE_DISK_MB_10 = 0, CACHE_REVAL_MS_10 = 30000;   /* see READ CACHE */
+static int WB_ON_10 = 0, WB_LEGS_10 = 2, WB_BATCH_10 = 8;   /* see WRITE-BACK */
 
-    free(dst_10); dst_10 = NULL;
-    for(int n_10=1;;++n_10)
-    {
-        asprintf(&dst_10, "%s/%s_%d%s", dir_10, base_10, n_10, ext_10);
-        if(!path_exists_10(dst_10))
+// SHARDING: a class with several backends spreads its files over them by consistent hashing.
+// Each shard owns VNODES_10 points on a 32 bit ring and a file belongs to the first point at or
+// after the hash of its path, so adding a shard only moves the files that land on its points
+static int vnode_cmp_10(const void *a_10, const void *b_10)
+{
+    const struct vnode_10 *aa_10 = (const struct vnode_10*)a_10;
+    const struct vnode_10 *bb_10 = (const struct vnode_10*)b_10;
+    if (aa_10->point != bb_10->point)
+        return aa_10->point < bb_10->point ? -1 : 1;
+    return aa_10->node - bb_10->node;
+}
+// VNODES_10 points for each of the given shards, sorted; returns how many
+static int ring_make_10(const int *nodes_10, int n_10, struct vnode_10 **out_10)
+{
+    struct vnode_10 *ring_10 = (struct vnode_10*)malloc(sizeof(struct vnode_10) * n_10 * VNODES_10);
+    if (!ring_10)
+        return -1;
+    int k_10 = 0;
+    for (int i_10 = 0; i_10 < n_10; ++i_10)
+        for (int v_10 = 0; v_10 < VNODES_10; ++v_10)
         {
-            free(base_10);
-            return dst_10;
+            // points hang off the address, so reordering the config keeps every placement
+            char id_10[136];
+            snprintf(id_10, sizeof id_10, "%s#%d", NODES_10[nodes_10[i_10]].addr, v_10);
+            ring_10[k_10].point = ph_hash_10(id_10, 0x52494e47u);
+            ring_10[k_10++].node = nodes_10[i_10];
         }
-        free(dst_10);
-        dst_10 = NULL;
-    }
+    qsort(ring_10, (size_t)k_10, sizeof(struct vnode_10), vnode_cmp_10);
+    *out_10 = ring_10;
+    return k_10;
 }
-
-// copies files to S1 directory
-static int archive_copy_10(const char *subdir_10, const char *name_10, const char *src_path_10)
+static int set_has_10(const int *set_10, int n_10, int x_10)
 {
-    char *rel_10 = NULL;
-    asprintf(&rel_10, "~S1/%s", subdir_10);
-    char *adir_10 = build_s1_path_10(rel_10, 1);  /* ensure dir exists */
-    free(rel_10);
-
-    char *dst_10 = unique_dest_path_10(adir_10, name_10);
-    free(adir_10);
-    if(!dst_10)
-        return -1;
-
-    int in_10 = open(src_path_10, O_RDONLY);
-    if (in_10 < 0)
+    for (int i_10 = 0; i_10 < n_10; ++i_10)
+        if (set_10[i_10] == x_10)
+            return 1;
+    return 0;
+}
+// replicas of hash h: the shard of the first point at or after it (wrapping past the last point),
+// then the next distinct shards going round the ring; returns how many were found
+static int ring_owners_10(const struct vnode_10 *ring_10, int npts_10, unsigned h_10, int want_10, int *out_10)
+{
+    int lo_10 = 0, hi_10 = npts_10;
+    while (lo_10 < hi_10)
     {
-        free(dst_10);
-        return -1;
+        int mid_10 = (lo_10 + hi_10) / 2;
+        if (ring_10[mid_10].point < h_10)
+            lo_10 = mid_10 + 1;
+        else
+            hi_10 = mid_10;
     }
-    int out_10 = open(dst_10, O_CREAT|O_TRUNC|O_WRONLY, 0600);
-    if (out_10 < 0)
+    int got_10 = 0;
+    for (int k_10 = 0; k_10 < npts_10 && got_10 < want_10; ++k_10)
     {
-        close(in_10);
-        free(dst_10);
-        return -1;
+        int node_10 = ring_10[(lo_10 + k_10) % npts_10].node;
+        if (!set_has_10(out_10, got_10, node_10))
+            out_10[got_10++] = node_10;
     }
+    return got_10;
+}
 
-    char *buf_10 = (char*)malloc(CHUNK_10);
-    if(!buf_10)
-    {
-        close(in_10);
-        close(out_10);
-        free(dst_10);
-        return -1;
-    }
-    for(;;)
+static void rebal_load_10(int cls_10);
+static int plan_build_10(struct sclass_10 *cl_10);
+
+static int ring_build_10(void)
+{
+    for (int c_10 = 0; c_10 < NCLASSES_10; ++c_10)
     {
-        ssize_t r_10 = read(in_10, buf_10, CHUNK_10);
-        if(r_10 < 0)
+        struct sclass_10 *cl_10 = &CLASSES_10[c_10];
+        if (!cl_10->local && cl_10->replicas > cl_10->count)
         {
-            if(errno==EINTR) continue;
-            free(buf_10); close(in_10);
-            close(out_10);
-            free(dst_10);
+            fprintf(stderr, "[S1] class %s has fewer shards than replicas\n", cl_10->name);
             return -1;
         }
-        if(r_10 == 0) break;
-
-        if(write_fully_10(out_10, buf_10, (size_t)r_10) != r_10)
-        {
-            free(buf_10); close(in_10); close(out_10); free(dst_10);
+        if (cl_10->count < 2 && !cl_10->nfrom)
+            continue;
+        int nodes_10[MAX_NODES_10];
+        for (int i_10 = 0; i_10 < cl_10->count; ++i_10)
+            nodes_10[i_10] = cl_10->first + i_10;
+        if (ring_make_10(nodes_10, cl_10->count, &cl_10->ring) < 0)
             return -1;
+        if (cl_10->nfrom)
+        {
+            if (plan_build_10(cl_10) != 0)
+                return -1;
+            rebal_load_10(c_10);
         }
     }
-    free(buf_10); close(in_10); close(out_10); free(dst_10);
     return 0;
 }
 
-// Backend operations for S2/S3/S4
-// send a non .c file to the relevant backend server
-static int forward_store_10(const char *ext_10, const char *rel_dir_10, const char *fname_10, const char *tmp_path_10)
+// the hashed key of a file: its path under ~S1 with "~S1/", "./" and doubled slashes removed,
+// so "~S1/a//b.pdf" uploaded to "~S1/a/" and fetched as "~S1/a/b.pdf" land on the same shard
+static void shard_key_10(const char *dir_10, const char *name_10, char *out_10, size_t cap_10)
 {
-    int port_10 = pick_backend_port_10(ext_10);
-    const char *host_10 = pick_backend_host_10(ext_10);
-    if (port_10 < 0 || !host_10)
-        return -1;
-
-    //removes S1 from the path before sending it to backend
-    const char *rel_only_10 = rel_dir_10;
-    if (strncmp(rel_only_10, "~S1/", 4)==0)
-        rel_only_10 += 4;
+    char raw_10[LINE_MAX_10];
+    snprintf(raw_10, sizeof raw_10, "%s%s%s", dir_10, name_10 ? "/" : "", name_10 ? name_10 : "");
+    const char *r_10 = raw_10;
+    if (strncmp(r_10, "~S1/", 4) == 0)
+        r_10 += 4;
+    size_t o_10 = 0;
+    while (*r_10 && o_10 + 1 < cap_10)
+    {
+        if (*r_10 == '/' && (o_10 == 0 || out_10[o_10 - 1] == '/'))
+            ++r_10;
+        else if (r_10[0] == '.' && r_10[1] == '/' && (o_10 == 0 || out_10[o_10 - 1] == '/'))
+            r_10 += 2;
+        else
+            out_10[o_10++] = *r_10++;
+    }
+    out_10[o_10] = '\0';
+}
 
-    //if the path was only S1, send "."
-    const char *dir_field_10 = (rel_only_10 && *rel_only_10) ? rel_only_10 : "."; /* "." when "~S1/" */
+// REBALANCING: a "from" line gives the shards a class had before it was grown (or shrunk).
+// Merging the points of the old and the new ring cuts the ring into stretches that each have
+// one shard before and one after; only the stretches whose shard changes have files to move.
+// Each moving stretch steps through three states kept in shared memory, so every child sees a
+// switch the moment the migrator makes it:
+//   SEG_OLD_10       served by the old shard (the new one is still tried when a read misses)
+//   SEG_COPYING_10   being copied: reads use the old shard, writes and deletes go to both
+//   SEG_SWITCHED_10  served by the new shard; the old one is only a fallback until cleaned up
+enum { SEG_OLD_10, SEG_COPYING_10, SEG_SWITCHED_10 };
 
-    int fd_10 = connect_to_10(host_10, port_10);
-    if (fd_10 < 0)
+static int point_cmp_10(const void *a_10, const void *b_10)
+{
+    unsigned aa_10 = *(const unsigned*)a_10, bb_10 = *(const unsigned*)b_10;
+    return aa_10 < bb_10 ? -1 : aa_10 > bb_10;
+}
+static int plan_build_10(struct sclass_10 *cl_10)
+{
+    int nold_10 = ring_make_10(cl_10->from, cl_10->nfrom, &cl_10->old_ring);
+    int nnew_10 = cl_10->count * VNODES_10;
+    unsigned *pts_10 = (unsigned*)malloc(sizeof(unsigned) * (nold_10 + nnew_10));
+    if (nold_10 < 0 || !pts_10)
         return -1;
+    for (int i_10 = 0; i_10 < nold_10; ++i_10)
+        pts_10[i_10] = cl_10->old_ring[i_10].point;
+    for (int i_10 = 0; i_10 < nnew_10; ++i_10)
+        pts_10[nold_10 + i_10] = cl_10->ring[i_10].point;
+    qsort(pts_10, (size_t)(nold_10 + nnew_10), sizeof(unsigned), point_cmp_10);
 
-    //tells backend where to store the file
-    if (send_line_10(fd_10, "STORE|%s|%s|", dir_field_10, fname_10) != 0)
+    cl_10->segs = (struct seg_10*)malloc(sizeof(struct seg_10) * (nold_10 + nnew_10));
+    if (!cl_10->segs)
     {
-        close(fd_10);
+        free(pts_10);
         return -1;
     }
-
-    // send the file size after the previous step
-    struct stat st_10;
-    if (stat(tmp_path_10, &st_10) != 0)
+    cl_10->nsegs = 0;
+    for (int i_10 = 0; i_10 < nold_10 + nnew_10; ++i_10)
     {
-        close(fd_10);
-        return -1;
+        if (cl_10->nsegs && cl_10->segs[cl_10->nsegs - 1].hi == pts_10[i_10])
+            continue;
+        struct seg_10 *sg_10 = &cl_10->segs[cl_10->nsegs++];
+        sg_10->hi = pts_10[i_10];
+        sg_10->nf = ring_owners_10(cl_10->old_ring, nold_10, sg_10->hi, cl_10->replicas, sg_10->from);
+        sg_10->nt = ring_owners_10(cl_10->ring, nnew_10, sg_10->hi, cl_10->replicas, sg_10->to);
     }
+    free(pts_10);
 
-    //then the size of the bytes
-    if (send_line_10(fd_10, "%zu", (size_t)st_10.st_size) != 0)
-    {
-        close(fd_10);
+    // the saved state only applies to the same pair of layouts
+    char desc_10[LINE_MAX_10]; size_t d_10 = 0;
+    d_10 += (size_t)snprintf(desc_10, sizeof desc_10, "%d %d", VNODES_10, cl_10->replicas);
+    for (int i_10 = 0; i_10 < cl_10->nfrom && d_10 + 128 < sizeof desc_10; ++i_10)
+        d_10 += (size_t)snprintf(desc_10 + d_10, sizeof desc_10 - d_10, " %s", NODES_10[cl_10->from[i_10]].addr);
+    d_10 += (size_t)snprintf(desc_10 + d_10, sizeof desc_10 - d_10, " >");
+    for (int n_10 = cl_10->first; n_10 < cl_10->first + cl_10->count && d_10 + 128 < sizeof desc_10; ++n_10)
+        d_10 += (size_t)snprintf(desc_10 + d_10, sizeof desc_10 - d_10, " %s", NODES_10[n_10].addr);
+    cl_10->plan = ph_hash_10(desc_10, 0x504c414e);
+
+    // the states and progress live in a shared mapping made before any child is forked
+    size_t sz_10 = sizeof(struct rebal_10) + (size_t)cl_10->nsegs;
+    void *p_10 = mmap(NULL, sz_10, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    if (p_10 == MAP_FAILED)
         return -1;
+    cl_10->rb = (struct rebal_10*)p_10;
+    cl_10->seg_state = (unsigned char*)(cl_10->rb + 1);
+    snprintf(cl_10->rb->phase, sizeof cl_10->rb->phase, "idle");
+    return 0;
+}
+// stretch holding hash h
+static int seg_find_10(const struct sclass_10 *cl_10, unsigned h_10)
+{
+    int lo_10 = 0, hi_10 = cl_10->nsegs;
+    while (lo_10 < hi_10)
+    {
+        int mid_10 = (lo_10 + hi_10) / 2;
+        if (cl_10->segs[mid_10].hi < h_10)
+            lo_10 = mid_10 + 1;
+        else
+            hi_10 = mid_10;
     }
+    return lo_10 == cl_10->nsegs ? 0 : lo_10;
+}
+static int seg_moving_10(const struct sclass_10 *cl_10, int s_10)
+{
+    const struct seg_10 *sg_10 = &cl_10->segs[s_10];
+    if (sg_10->nf != sg_10->nt)
+        return 1;
+    for (int i_10 = 0; i_10 < sg_10->nf; ++i_10)
+        if (!set_has_10(sg_10->to, sg_10->nt, sg_10->from[i_10]))
+            return 1;
+    return 0;
+}
 
-    if (send_file_from_path_10(fd_10, tmp_path_10, NULL) != 0)
+// where a file of a remote class is kept right now: the replicas serving it, then (while its
+// stretch is rebalanced) the stretch's other replicas, which state tells how to use
+struct place_10
+{
+    int node[2 * MAX_REPLICAS_10];
+    int n, nserve, state;
+};
+static void place_add_10(struct place_10 *pl_10, const int *nodes_10, int n_10)
+{
+    for (int i_10 = 0; i_10 < n_10; ++i_10)
+        if (!set_has_10(pl_10->node, pl_10->n, nodes_10[i_10]))
+            pl_10->node[pl_10->n++] = nodes_10[i_10];
+}
+// dir may be the whole path when name is NULL
+static struct place_10 place_10(int cls_10, const char *dir_10, const char *name_10)
+{
+    const struct sclass_10 *cl_10 = &CLASSES_10[cls_10];
+    struct place_10 pl_10;
+    pl_10.n = pl_10.nserve = 1;
+    pl_10.node[0] = cl_10->first;
+    pl_10.state = SEG_OLD_10;
+    if (!cl_10->ring)
+        return pl_10;
+    char key_10[LINE_MAX_10];
+    shard_key_10(dir_10, name_10, key_10, sizeof key_10);
+    unsigned h_10 = ph_hash_10(key_10, 0);
+    if (!cl_10->segs)
     {
-        close(fd_10);
-        return -1;
+        pl_10.n = pl_10.nserve = ring_owners_10(cl_10->ring, cl_10->count * VNODES_10, h_10, cl_10->replicas, pl_10.node);
+        return pl_10;
     }
-
-    char line_10[LINE_MAX_10];
-    if (read_line_10(fd_10, line_10, sizeof line_10) <= 0)
+    int s_10 = seg_find_10(cl_10, h_10);
+    const struct seg_10 *sg_10 = &cl_10->segs[s_10];
+    pl_10.n = 0;
+    if (!seg_moving_10(cl_10, s_10))
     {
-        close(fd_10); return -1;
+        place_add_10(&pl_10, sg_10->to, sg_10->nt);
+        pl_10.nserve = pl_10.n;
+        return pl_10;
     }
-    close(fd_10);
-    return (strncmp(line_10, "OK", 2)==0) ? 0 : -1;
+    pl_10.state = __atomic_load_n(&cl_10->seg_state[s_10], __ATOMIC_ACQUIRE);
+    int sw_10 = pl_10.state == SEG_SWITCHED_10;
+    place_add_10(&pl_10, sw_10 ? sg_10->to : sg_10->from, sw_10 ? sg_10->nt : sg_10->nf);
+    pl_10.nserve = pl_10.n;
+    place_add_10(&pl_10, sw_10 ? sg_10->from : sg_10->to, sw_10 ? sg_10->nf : sg_10->nt);
+    return pl_10;
 }
-
-//this function fetches files from the backend
-static int backend_fetch_10(const char *ext_10, const char *rel_path_10, const char *tmp_path_10)
+// puts the serving replicas in the order to read them: quickest recent first reply first,
+// the ones that last failed to answer at the end
+static void place_rank_10(struct place_10 *pl_10)
 {
-    int port_10 = pick_backend_port_10(ext_10);
-    const char *host_10 = pick_backend_host_10(ext_10);
-
-    if (port_10 < 0 || !host_10)
-        return -1;
-
-    //removes S1 from the user input
-    const char *rel_only_10 = rel_path_10;
-    if (strncmp(rel_only_10, "~S1/", 4)==0)
-        rel_only_10 += 4;
-
-    int fd_10 = connect_to_10(host_10, port_10);
-    if (fd_10 < 0)
-        return -1;
-    if (send_line_10(fd_10, "FETCH|%s", rel_only_10) != 0)
+    if (!STATG_10)
+        return;
+    unsigned long long key_10[2 * MAX_REPLICAS_10];
+    for (int i_10 = 0; i_10 < pl_10->nserve; ++i_10)
     {
-        close(fd_10); return -1;
+        int n_10 = pl_10->node[i_10];
+        key_10[i_10] = __atomic_load_n(&STATG_10->backend[n_10].hdr_us, __ATOMIC_RELAXED);
+        if (__atomic_load_n(&STATG_10->backend[n_10].down, __ATOMIC_RELAXED))
+            key_10[i_10] += 1ULL << 40;
     }
+    for (int i_10 = 1; i_10 < pl_10->nserve; ++i_10)
+        for (int j_10 = i_10; j_10 > 0 && key_10[j_10] < key_10[j_10 - 1]; --j_10)
+        {
+            unsigned long long k_10 = key_10[j_10]; key_10[j_10] = key_10[j_10 - 1]; key_10[j_10 - 1] = k_10;
+            int t_10 = pl_10->node[j_10]; pl_10->node[j_10] = pl_10->node[j_10 - 1]; pl_10->node[j_10 - 1] = t_10;
+        }
+}
 
-    char line_10[LINE_MAX_10];
-    if (read_line_10(fd_10, line_10, sizeof line_10) <= 0)
+// the switched stretches survive a restart in ~/S1/.rebalance/<class>.state, one digit each
+// after a "plan" line; a stretch caught mid copy starts over
+static char *rebal_path_10(const struct sclass_10 *cl_10)
+{
+    char *dir_10 = build_s1_path_10("~S1/.rebalance", 1);
+    char *path_10 = NULL;
+    asprintf(&path_10, "%s/%s.state", dir_10, cl_10->name);
+    free(dir_10);
+    return path_10;
+}
+static void rebal_save_10(int cls_10)
+{
+    const struct sclass_10 *cl_10 = &CLASSES_10[cls_10];
+    char *path_10 = rebal_path_10(cl_10);
+    char *tmp_10 = NULL;
+    asprintf(&tmp_10, "%s.%d", path_10, (int)getpid());
+    FILE *f_10 = fopen(tmp_10, "w");
+    if (f_10)
     {
-        close(fd_10); return -1;
+        fprintf(f_10, "plan %08x %d\n", cl_10->plan, cl_10->nsegs);
+        for (int s_10 = 0; s_10 < cl_10->nsegs; ++s_10)
+            fputc(__atomic_load_n(&cl_10->seg_state[s_10], __ATOMIC_ACQUIRE) == SEG_SWITCHED_10 ? '2' : '0', f_10);
+        fputc('\n', f_10);
+        if (fclose(f_10) != 0 || rename(tmp_10, path_10) != 0)
+            unlink(tmp_10);
     }
-    if (strncmp(line_10, "OK|", 3) != 0)
+    free(tmp_10);
+    free(path_10);
+}
+static void rebal_load_10(int cls_10)
+{
+    struct sclass_10 *cl_10 = &CLASSES_10[cls_10];
+    char *path_10 = rebal_path_10(cl_10);
+    FILE *f_10 = fopen(path_10, "r");
+    free(path_10);
+    if (!f_10)
+        return;
+    unsigned plan_10 = 0; int n_10 = 0;
+    if (fscanf(f_10, "plan %x %d\n", &plan_10, &n_10) == 2 && plan_10 == cl_10->plan && n_10 == cl_10->nsegs)
     {
-        close(fd_10);
-        return -1;
+        int done_10 = 1;
+        for (int s_10 = 0; s_10 < n_10; ++s_10)
+        {
+            int ch_10 = fgetc(f_10);
+            cl_10->seg_state[s_10] = ch_10 == '2' ? SEG_SWITCHED_10 : SEG_OLD_10;
+            if (seg_moving_10(cl_10, s_10) && ch_10 != '2')
+                done_10 = 0;
+        }
+        snprintf(cl_10->rb->phase, sizeof cl_10->rb->phase, "%s", done_10 ? "switched" : "partial");
     }
-
-    char *tok_10=NULL, *save_10=NULL;
-    tok_10 = strtok_r(line_10+3, "|", &save_10); /* name (unused) */
-    tok_10 = strtok_r(NULL, "|", &save_10);      /* size */
-    size_t size_10 = (size_t)strtoull(tok_10 ? tok_10 : "0", NULL, 10);
-
-    int rc_10 = recv_file_to_path_10(fd_10, tmp_path_10, size_10);
-    close(fd_10);
-    return rc_10;
+    fclose(f_10);
 }
 
-//this function deletes a file from the backend
-static int backend_delete_10(const char *ext_10, const char *rel_path_10)
+static int class_find_10(const char *name_10)
+{
+    for (int i_10 = 0; i_10 < NCLASSES_10; ++i_10)
+        if (!strcmp(CLASSES_10[i_10].name, name_10))
+            return i_10;
+    return -1;
+}
+// fills host and port from an "ip:port" or "unix:<path>" string
+static int node_parse_10(struct node_10 *n_10, const char *addr_10)
 {
-    int port_10 = pick_backend_port_10(ext_10);
-    const char *host_10 = pick_backend_host_10(ext_10);
-    if (port_10 < 0 || !host_10)
+    const char *colon_10 = strrchr(addr_10, ':');
+    struct in_addr ia_10;
+    struct sockaddr_un u_10;
+    if (!strncmp(addr_10, "unix:", 5))
+    {
+        n_10->port = 0;
+        if (!addr_10[5] || strlen(addr_10 + 5) >= sizeof u_10.sun_path)
+            return -1;
+        snprintf(n_10->host, sizeof n_10->host, "%s", addr_10);
+        snprintf(n_10->addr, sizeof n_10->addr, "%s", addr_10);
+        return 0;
+    }
+    if (!colon_10 || (size_t)(colon_10 - addr_10) >= sizeof n_10->host)
         return -1;
-    const char *rel_only_10 = rel_path_10;
-    if (strncmp(rel_only_10, "~S1/", 4)==0)
-        rel_only_10 += 4;
-
-    int fd_10 = connect_to_10(host_10, port_10);
-    if (fd_10 < 0)
+    snprintf(n_10->host, sizeof n_10->host, "%.*s", (int)(colon_10 - addr_10), addr_10);
+    n_10->port = atoi(colon_10 + 1);
+    if (n_10->port <= 0 || n_10->port > 65535 || inet_pton(AF_INET, n_10->host, &ia_10) != 1)
         return -1;
-    if (send_line_10(fd_10, "DELETE|%s", rel_only_10) != 0)
+    snprintf(n_10->addr, sizeof n_10->addr, "%s:%d", n_10->host, n_10->port);
+    return 0;
+}
+// adds a class with its shards ("ip:port" strings, none for local); a name can be used once
+static int class_add_10(const char *name_10, char **addrs_10, int naddr_10)
+{
+    if (NCLASSES_10 == MAX_CLASSES_10 || NNODES_10 + naddr_10 > MAX_NODES_10 || class_find_10(name_10) >= 0
+        || strlen(name_10) >= sizeof CLASSES_10[0].name)
+        return -1;
+    struct sclass_10 *c_10 = &CLASSES_10[NCLASSES_10];
+    snprintf(c_10->name, sizeof c_10->name, "%s", name_10);
+    c_10->local = !strcmp(name_10, "local");
+    c_10->first = NNODES_10;
+    c_10->count = 0;
+    c_10->ring = NULL;
+    c_10->replicas = c_10->wquorum = 1;
+    for (int i_10 = 0; i_10 < naddr_10; ++i_10)
     {
-        close(fd_10); return -1;
+        struct node_10 *n_10 = &NODES_10[NNODES_10 + i_10];
+        if (node_parse_10(n_10, addrs_10[i_10]) != 0)
+            return -1;
+        if (naddr_10 == 1)
+            snprintf(n_10->name, sizeof n_10->name, "%s", name_10);
+        else
+            snprintf(n_10->name, sizeof n_10->name, "%s#%d", name_10, i_10);
+        n_10->cls = NCLASSES_10;
     }
-    char line_10[LINE_MAX_10];
-    if (read_line_10(fd_10, line_10, sizeof line_10) <= 0)
+    c_10->count = naddr_10;
+    NNODES_10 += naddr_10;
+    return NCLASSES_10++;
+}
+// records the previous shards of a class; one that is not among its current shards is added
+// as a retiring node, which keeps its stats and is drained by the rebalance
+static int class_from_10(int cls_10, char **addrs_10, int naddr_10)
+{
+    struct sclass_10 *cl_10 = &CLASSES_10[cls_10];
+    if (cl_10->local || cl_10->nfrom)
+        return -1;
+    for (int i_10 = 0; i_10 < naddr_10; ++i_10)
     {
-        close(fd_10); return -1;
+        struct node_10 nd_10;
+        if (node_parse_10(&nd_10, addrs_10[i_10]) != 0)
+            return -1;
+        int found_10 = -1;
+        for (int n_10 = 0; n_10 < NNODES_10 && found_10 < 0; ++n_10)
+            if (NODES_10[n_10].cls == cls_10 && NODES_10[n_10].port == nd_10.port && !strcmp(NODES_10[n_10].host, nd_10.host))
+                found_10 = n_10;
+        if (found_10 < 0)
+        {
+            if (NNODES_10 == MAX_NODES_10)
+                return -1;
+            snprintf(nd_10.name, sizeof nd_10.name, "%.25s#old%d", cl_10->name, i_10);
+            nd_10.cls = cls_10;
+            NODES_10[NNODES_10] = nd_10;
+            found_10 = NNODES_10++;
+        }
+        cl_10->from[cl_10->nfrom++] = found_10;
     }
-    close(fd_10);
-    return (strncmp(line_10, "OK", 2)==0) ? 0 : -1;
+    return 0;
 }
 
-//this function build the tar file for the required type (.c, .txt and .pdf)
-static int backend_tar_10(const char *ext_10, char **out_tmp_path_10, size_t *out_size_10)
+// a backend host from argv; one given as unix:<path> has no port
+static void default_addr_10(char *buf_10, size_t n_10, const char *host_10, int port_10)
 {
-    int port_10 = pick_backend_port_10(ext_10);
-    const char *host_10 = pick_backend_host_10(ext_10);
-    if (port_10 < 0 || !host_10)
-        return -1;
+    if (!strncmp(host_10, "unix:", 5))
+        snprintf(buf_10, n_10, "%s", host_10);
+    else
+        snprintf(buf_10, n_10, "%s:%d", host_10, port_10);
+}
 
-    int fd_10 = connect_to_10(host_10, port_10);
-    if (fd_10 < 0)
-        return -1;
-    if (send_line_10(fd_10, "TAR|%s", ext_10) != 0)
-    {
-        close(fd_10); return -1;
-    }
+// without DFS_CONF: .c stays on S1, .pdf/.txt/.zip go to S2/S3/S4 (argv may move those)
+// and anything else is kept locally
+static int route_defaults_10(void)
+{
+    char a2_10[128], a3_10[128], a4_10[128];
+    char *p2_10 = a2_10, *p3_10 = a3_10, *p4_10 = a4_10;
+    default_addr_10(a2_10, sizeof a2_10, S2_HOST_10, S2_PORT_10);
+    default_addr_10(a3_10, sizeof a3_10, S3_HOST_10, S3_PORT_10);
+    default_addr_10(a4_10, sizeof a4_10, S4_HOST_10, S4_PORT_10);
+    class_add_10("local", NULL, 0);
+    int s2_10 = class_add_10("S2", &p2_10, 1);
+    int s3_10 = class_add_10("S3", &p3_10, 1);
+    int s4_10 = class_add_10("S4", &p4_10, 1);
+    route_add_10(".c", 0);
+    route_add_10(".pdf", s2_10);
+    route_add_10(".txt", s3_10);
+    route_add_10(".zip", s4_10);
+    DEFAULT_CLASS_10 = 0;
+    return (s2_10 < 0 || s3_10 < 0 || s4_10 < 0) ? -1 : 0;
+}
 
-    char line_10[LINE_MAX_10];
-    if (read_line_10(fd_10, line_10, sizeof line_10) <= 0)
+static int route_load_10(const char *path_10)
+{
+    FILE *f_10 = fopen(path_10, "r");
+    if (!f_10)
     {
-        close(fd_10); return -1;
+        fprintf(stderr, "[S1] %s: %s\n", path_10, strerror(errno));
+        return -1;
     }
-    if (strncmp(line_10, "OK|", 3) != 0)
+    class_add_10("local", NULL, 0);
+    char buf_10[LINE_MAX_10];
+    int lno_10 = 0, bad_10 = 0;
+    while (!bad_10 && fgets(buf_10, sizeof buf_10, f_10))
     {
-        close(fd_10); return -1;
+        ++lno_10;
+        char *hash_10 = strchr(buf_10, '#');
+        if (hash_10)
+            *hash_10 = '\0';
+        char *save_10 = NULL;
+        char *kw_10 = strtok_r(buf_10, " \t\r\n", &save_10);
+        if (!kw_10)
+            continue;
+        char *name_10 = strtok_r(NULL, " \t\r\n", &save_10);
+        if (!name_10)
+            bad_10 = 1;
+        else if (!strcmp(kw_10, "class"))
+        {
+            char *addrs_10[MAX_NODES_10];
+            int naddr_10 = 0;
+            char *addr_10;
+            while (naddr_10 < MAX_NODES_10 && (addr_10 = strtok_r(NULL, " \t\r\n", &save_10)))
+                addrs_10[naddr_10++] = addr_10;
+            if (naddr_10 == 0 || class_add_10(name_10, addrs_10, naddr_10) < 0)
+                bad_10 = 1;
+        }
+        else if (!strcmp(kw_10, "from"))
+        {
+            int cls_10 = class_find_10(name_10);
+            char *addrs_10[MAX_NODES_10];
+            int naddr_10 = 0;
+            char *addr_10;
+            while (naddr_10 < MAX_NODES_10 && (addr_10 = strtok_r(NULL, " \t\r\n", &save_10)))
+                addrs_10[naddr_10++] = addr_10;
+            if (cls_10 < 0 || naddr_10 == 0 || class_from_10(cls_10, addrs_10, naddr_10) != 0)
+                bad_10 = 1;
+        }
+        else if (!strcmp(kw_10, "replicas"))
+        {
+            int cls_10 = class_find_10(name_10);
+            char *n_10 = strtok_r(NULL, " \t\r\n", &save_10);
+            char *w_10 = strtok_r(NULL, " \t\r\n", &save_10);
+            int r_10 = n_10 ? atoi(n_10) : 0;
+            if (cls_10 < 0 || CLASSES_10[cls_10].local || r_10 < 1 || r_10 > MAX_REPLICAS_10)
+                bad_10 = 1;
+            else
+            {
+                CLASSES_10[cls_10].replicas = r_10;
+                CLASSES_10[cls_10].wquorum = w_10 ? atoi(w_10) : r_10 / 2 + 1;
+                if (CLASSES_10[cls_10].wquorum < 1 || CLASSES_10[cls_10].wquorum > r_10)
+                    bad_10 = 1;
+            }
+        }
+        else if (!strcmp(kw_10, "hedge"))
+        {
+            HEDGE_PCT_10 = strcmp(name_10, "off") ? atoi(name_10) : 0;
+            if (HEDGE_PCT_10 < 0 || HEDGE_PCT_10 > 99 || (HEDGE_PCT_10 == 0 && strcmp(name_10, "off")))
+                bad_10 = 1;
+        }
+        else if (!strcmp(kw_10, "timeout"))
+        {
+            char *ms_s_10 = strtok_r(NULL, " \t\r\n", &save_10);
+            int ms_10 = ms_s_10 ? atoi(ms_s_10) : 0, op_10 = -1;
+            for (int o_10 = 0; o_10 < BOP_COUNT_10; ++o_10)
+                if (!strcmp(name_10, BOP_NAMES_10[o_10]))
+                    op_10 = o_10;
+            if (ms_10 < 1)
+                bad_10 = 1;
+            else if (!strcmp(name_10, "connect"))
+                CONNECT_MS_10 = ms_10;
+            else if (op_10 >= 0)
+                BOP_MS_10[op_10] = ms_10;
+            else
+                bad_10 = 1;
+        }
+        else if (!strcmp(kw_10, "breaker"))
+        {
+            char *ms_s_10 = strtok_r(NULL, " \t\r\n", &save_10);
+            BREAKER_FAILS_10 = strcmp(name_10, "off") ? atoi(name_10) : 0;
+            if (ms_s_10)
+                BREAKER_MS_10 = atoi(ms_s_10);
+            if ((BREAKER_FAILS_10 < 1 && strcmp(name_10, "off")) || BREAKER_MS_10 < 1)
+                bad_10 = 1;
+        }
+        else if (!strcmp(kw_10, "cache"))
+        {
+            char *disk_s_10 = strtok_r(NULL, " \t\r\n", &save_10);
+            char *ms_s_10 = disk_s_10 ? strtok_r(NULL, " \t\r\n", &save_10) : NULL;
+            CACHE_MEM_MB_10 = strcmp(name_10, "off") ? atoi(name_10) : 0;
+            CACHE_DISK_MB_10 = disk_s_10 ? atoi(disk_s_10) : 0;
+            if (ms_s_10)
+                CACHE_REVAL_MS_10 = atoi(ms_s_10);
+            if ((CACHE_MEM_MB_10 < 1 && strcmp(name_10, "off")) || CACHE_MEM_MB_10 > 65536 || CACHE_DISK_MB_10 < 0 || CACHE_REVAL_MS_10 < 0)
+                bad_10 = 1;
+        }
+        else if (!strcmp(kw_10, "writeback"))
+        {
+            char *legs_s_10 = strtok_r(NULL, " \t\r\n", &save_10);
+            char *batch_s_10 = legs_s_10 ? strtok_r(NULL, " \t\r\n", &save_10) : NULL;
+            WB_ON_10 = !strcmp(name_10, "on");
+            if (legs_s_10)
+                WB_LEGS_10 = atoi(legs_s_10);
+            if (batch_s_10)
+                WB_BATCH_10 = atoi(batch_s_10);
+            if ((!WB_ON_10 && strcmp(name_10, "off")) || WB_LEGS_10 < 1 || WB_LEGS_10 > 8 || WB_BATCH_10 < 1 || WB_BATCH_10 > 64)
+                bad_10 = 1;
+        }
+        else if (!strcmp(kw_10, "socket"))
+        {
+            if (sock_conf_10(name_10, &save_10) != 0)
+                bad_10 = 1;
+        }
+        else if (!strcmp(kw_10, "vnodes"))
+        {
+            VNODES_10 = atoi(name_10);
+            if (VNODES_10 < 1 || VNODES_10 > 1024)
+                bad_10 = 1;
+        }
+        else if (!strcmp(kw_10, "route"))
+        {
+            int cls_10 = class_find_10(name_10);
+            char *ext_10 = strtok_r(NULL, " \t\r\n", &save_10);
+            if (cls_10 < 0 || !ext_10)
+                bad_10 = 1;
+            for (; !bad_10 && ext_10; ext_10 = strtok_r(NULL, " \t\r\n", &save_10))
+                if (route_add_10(ext_10, cls_10) != 0)
+                    bad_10 = 1;
+        }
+        else if (!strcmp(kw_10, "default"))
+        {
+            DEFAULT_CLASS_10 = strcmp(name_10, "none") ? class_find_10(name_10) : -1;
+            if (DEFAULT_CLASS_10 < 0 && strcmp(name_10, "none"))
+                bad_10 = 1;
+        }
+        else
+            bad_10 = 1;
     }
-
-    char *tok_10, *save_10;
-    tok_10 = strtok_r(line_10+3, "|", &save_10);
-    tok_10 = strtok_r(NULL, "|", &save_10);
-    size_t size_10 = (size_t)strtoull(tok_10 ? tok_10 : "0", NULL, 10);
-
-    char *base_10 = build_s1_path_10("tmp", 1);
-    char *full_10 = NULL; asprintf(&full_10, "%s/tar_%d.tmp", base_10, getpid());
-    free(base_10);
-
-    if (recv_file_to_path_10(fd_10, full_10, size_10) != 0)
+    fclose(f_10);
+    if (bad_10)
     {
-        free(full_10); close(fd_10);
+        fprintf(stderr, "[S1] %s:%d: bad routing line\n", path_10, lno_10);
         return -1;
     }
-    close(fd_10);
-    *out_tmp_path_10 = full_10;
-
-    if (out_size_10) *out_size_10 = size_10;
     return 0;
 }
 
-//this functions lists all the files that the user uploaded onto the servers
-static int backend_list_10(const char *ext_10, const char *rel_dir_10, char ***out_arr_10, int *out_cnt_10)
+// loads the table and builds its hash; a config that does not load stops the server
+static int route_init_10(void)
 {
-    int port_10 = pick_backend_port_10(ext_10);
-    const char *host_10 = pick_backend_host_10(ext_10);
-    if (port_10 < 0 || !host_10)
-        return -1;
-
-    const char *rel_only_10 = rel_dir_10;
-    if (strncmp(rel_only_10, "~S1/", 4)==0)
-        rel_only_10 += 4;
-
-    int fd_10 = connect_to_10(host_10, port_10);
-    if (fd_10 < 0)
-        return -1;
-    if (send_line_10(fd_10, "LIST|%s", (rel_only_10 && *rel_only_10) ? rel_only_10 : ".") != 0)
+    const char *conf_10 = getenv("DFS_CONF");
+    if (conf_10 && *conf_10)
     {
-        close(fd_10); return -1;
+        if (route_load_10(conf_10) != 0)
+            return -1;
     }
-
-    char line_10[LINE_MAX_10];
-    if (read_line_10(fd_10, line_10, sizeof line_10) <= 0)
+    else if (route_defaults_10() != 0)
     {
-        close(fd_10); return -1;
+        fprintf(stderr, "[S1] bad backend address on the command line\n");
+        return -1;
     }
-    if (strcmp(line_10, "OK") != 0)
+    if (ph_build_10() != 0 || ring_build_10() != 0)
     {
-        close(fd_10); return -1;
+        fprintf(stderr, "[S1] could not build the routing hash\n");
+        return -1;
     }
+    return 0;
+}
 
-    int cap_10 = 8, cnt_10 = 0;
-    char **arr_10 = (char**)malloc(sizeof(char*)*cap_10);
-    if (!arr_10)
+// extensions that may be tarred: a dot and up to 15 of [a-z0-9_+-], safe inside a shell command
+static int ext_ok_10(const char *ext_10)
+{
+    size_t n_10 = strlen(ext_10);
+    if (ext_10[0] != '.' || n_10 < 2 || n_10 >= EXT_MAX_10)
+        return 0;
+    for (size_t i_10 = 1; i_10 < n_10; ++i_10)
     {
-        close(fd_10); return -1;
+        char ch_10 = ext_10[i_10];
+        if (!((ch_10 >= 'a' && ch_10 <= 'z') || (ch_10 >= '0' && ch_10 <= '9') || ch_10 == '_' || ch_10 == '+' || ch_10 == '-'))
+            return 0;
     }
+    return 1;
+}
+
+// METRICS: with S1_METRICS_PORT=<port> a separate process serves GET /metrics in the
+// Prometheus text format, read straight from the shared counters above; it never touches
+// the client listener or the workers, so a slow scrape cannot stall a request
+static pid_t metrics_pid_10 = -1;
 
+// histogram bounds exported to Prometheus (seconds); each internal bucket is counted
+// under the first bound at or above its upper edge
+static const double PROM_LE_10[] = { 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10 };
+#define PROM_NLE_10 (sizeof PROM_LE_10 / sizeof PROM_LE_10[0])
+
+// growing text buffer for one scrape
+struct mbuf_10 { char *p; size_t n, cap; };
+static void mprintf_10(struct mbuf_10 *b_10, const char *fmt_10, ...)
+{
     for (;;)
     {
-        int n_10 = read_line_10(fd_10, line_10, sizeof line_10);
-        if (n_10 <= 0)
-            break;
-        if (strcmp(line_10, "END")==0)
-            break;
-        if (strncmp(line_10, "NAME|", 5)==0)
+        va_list ap_10;
+        va_start(ap_10, fmt_10);
+        int k_10 = vsnprintf(b_10->p ? b_10->p + b_10->n : NULL, b_10->p ? b_10->cap - b_10->n : 0, fmt_10, ap_10);
+        va_end(ap_10);
+        if (k_10 < 0)
+            return;
+        if (b_10->p && b_10->n + (size_t)k_10 < b_10->cap)
         {
-            const char *nm_10 = line_10 + 5;
-            if (cnt_10 == cap_10)
-            {
-                cap_10 *= 2;
-                arr_10 = (char**)realloc(arr_10, sizeof(char*)*cap_10);
-            }
-            arr_10[cnt_10++] = strdup(nm_10);
+            b_10->n += (size_t)k_10;
+            return;
         }
+        size_t cap_10 = b_10->cap ? b_10->cap * 2 : 16384;
+        while (cap_10 < b_10->n + (size_t)k_10 + 1)
+            cap_10 *= 2;
+        char *np_10 = (char*)realloc(b_10->p, cap_10);
+        if (!np_10)
+            return;
+        b_10->p = np_10; b_10->cap = cap_10;
     }
-    close(fd_10);
-    *out_arr_10 = arr_10; *out_cnt_10 = cnt_10;
-    return 0;
 }
 
-// handlers for all the 5 commands (uploadf, downlf, removef, downltar, dispfnames)
-
-//this is the uploadf handler
-//handles the user uploads and send .c files to S1 directory
-// also checks if the max files does not exceed 3 for this command
-static void handle_uploadf_10(int cfd_10, char *line_10)
+// one counter family over a set of label values; field_10 picks the op_stats member
+static void prom_counter_10(struct mbuf_10 *b_10, const char *fam_10, const char *help_10, const char *key_10,
+    const char **names_10, const struct op_stats_10 *ops_10, int n_10, size_t field_10)
 {
-    char *save_10 = NULL;
-    strtok_r(line_10, "|", &save_10);          /* "UPLOADF" */
-    char *nstr_10  = strtok_r(NULL, "|", &save_10);
-    char *dest_10  = strtok_r(NULL, "|", &save_10);
-    int n_10 = nstr_10 ? atoi(nstr_10) : 0;
+    mprintf_10(b_10, "# HELP %s %s\n# TYPE %s counter\n", fam_10, help_10, fam_10);
+    for (int i_10 = 0; i_10 < n_10; ++i_10)
+        mprintf_10(b_10, "%s{%s=\"%s\"} %llu\n", fam_10, key_10, names_10[i_10],
+            *(const unsigned long long*)((const char*)&ops_10[i_10] + field_10));
+}
 
-    if (n_10 < 1 || n_10 > 3 || !dest_10 || !path_is_s1_10(dest_10))
+static void prom_histogram_10(struct mbuf_10 *b_10, const char *fam_10, const char *help_10, const char *key_10,
+    const char **names_10, const struct op_stats_10 *ops_10, int n_10)
+{
+    mprintf_10(b_10, "# HELP %s %s\n# TYPE %s histogram\n", fam_10, help_10, fam_10);
+    for (int i_10 = 0; i_10 < n_10; ++i_10)
     {
-        send_line_10(cfd_10, "ERR|bad upload header");
-        return;
+        const struct op_stats_10 *o_10 = &ops_10[i_10];
+        unsigned long long cum_10 = 0, total_10 = 0;
+        int k_10 = 0;
+        for (int j_10 = 0; j_10 < STAT_BUCKETS_10; ++j_10)
+            total_10 += o_10->hist[j_10];
+        for (size_t l_10 = 0; l_10 < PROM_NLE_10; ++l_10)
+        {
+            while (k_10 < STAT_BUCKETS_10 && (double)stat_bucket_upper_10(k_10) <= PROM_LE_10[l_10] * 1e6)
+                cum_10 += o_10->hist[k_10++];
+            mprintf_10(b_10, "%s_bucket{%s=\"%s\",le=\"%g\"} %llu\n", fam_10, key_10, names_10[i_10], PROM_LE_10[l_10], cum_10);
+        }
+        mprintf_10(b_10, "%s_bucket{%s=\"%s\",le=\"+Inf\"} %llu\n", fam_10, key_10, names_10[i_10], total_10);
+        mprintf_10(b_10, "%s_sum{%s=\"%s\"} %.6f\n", fam_10, key_10, names_10[i_10], (double)o_10->lat_sum_us / 1e6);
+        mprintf_10(b_10, "%s_count{%s=\"%s\"} %llu\n", fam_10, key_10, names_10[i_10], total_10);
     }
+}
 
-    char *tmpdir_10 = build_s1_path_10("tmp", 1);
+static void prom_gauge_10(struct mbuf_10 *b_10, const char *fam_10, const char *help_10, unsigned long long v_10)
+{
+    mprintf_10(b_10, "# HELP %s %s\n# TYPE %s gauge\n%s %llu\n", fam_10, help_10, fam_10, fam_10, v_10);
+}
 
-    for (int i_10 = 0; i_10 < n_10; ++i_10)
+// renders the whole exposition for one scrape
+static void cache_metrics_10(struct mbuf_10 *b_10);
+static void wb_metrics_10(struct mbuf_10 *b_10);
+
+static void metrics_render_10(struct mbuf_10 *b_10)
+{
+    static struct op_stats_10 cmds_10[CMD_COUNT_10], legs_10[MAX_NODES_10];
+    for (int i_10 = 0; i_10 < CMD_COUNT_10; ++i_10)
+        stat_sum_10(&cmds_10[i_10], 0, i_10);
+    // backend series are labelled by instance: the class name, or class#i for a sharded class
+    const char *names_10[MAX_NODES_10];
+    int nb_10 = NNODES_10;
+    for (int i_10 = 0; i_10 < nb_10; ++i_10)
     {
-        char meta_10[LINE_MAX_10];
-        if (read_line_10(cfd_10, meta_10, sizeof meta_10) <= 0)
-        {
-            free(tmpdir_10); return;
-        }
+        stat_sum_10(&legs_10[i_10], 1, i_10);
+        names_10[i_10] = NODES_10[i_10].name;
+    }
 
-        if (strncmp(meta_10, "FILEMETA|", 9)!=0)
-        {
-            free(tmpdir_10);
-            return;
-        }
+    mprintf_10(b_10, "# HELP dfs_start_time_seconds Unix time the server started.\n# TYPE dfs_start_time_seconds gauge\n"
+        "dfs_start_time_seconds %llu\n", STATG_10->start_s);
+    mprintf_10(b_10, "# HELP dfs_connections_accepted_total Client connections accepted.\n# TYPE dfs_connections_accepted_total counter\n"
+        "dfs_connections_accepted_total %llu\n", __atomic_load_n(&STATG_10->accepted, __ATOMIC_RELAXED));
+    prom_gauge_10(b_10, "dfs_connections_active", "Client connections currently open.", __atomic_load_n(&STATG_10->active, __ATOMIC_RELAXED));
+    prom_gauge_10(b_10, "dfs_requests_in_flight", "Client commands currently being served.", __atomic_load_n(&STATG_10->inflight, __ATOMIC_RELAXED));
 
-        char *sav2_10 = NULL;
-        char *fname_10 = strtok_r(meta_10+9, "|", &sav2_10);
-        char *szstr_10 = strtok_r(NULL, "|", &sav2_10);
-        size_t fsz_10 = (size_t)strtoull(szstr_10?szstr_10:"0", NULL, 10);
+    prom_counter_10(b_10, "dfs_requests_total", "Client commands served.", "cmd", CMD_NAMES_10, cmds_10, CMD_COUNT_10, offsetof(struct op_stats_10, requests));
+    prom_counter_10(b_10, "dfs_request_errors_total", "Client commands that sent an error reply.", "cmd", CMD_NAMES_10, cmds_10, CMD_COUNT_10, offsetof(struct op_stats_10, errors));
+    prom_counter_10(b_10, "dfs_received_bytes_total", "Bytes read from clients.", "cmd", CMD_NAMES_10, cmds_10, CMD_COUNT_10, offsetof(struct op_stats_10, bytes_in));
+    prom_counter_10(b_10, "dfs_sent_bytes_total", "Bytes written to clients.", "cmd", CMD_NAMES_10, cmds_10, CMD_COUNT_10, offsetof(struct op_stats_10, bytes_out));
+    prom_histogram_10(b_10, "dfs_request_duration_seconds", "Client command latency.", "cmd", CMD_NAMES_10, cmds_10, CMD_COUNT_10);
 
-        char *tmpfile_10 = NULL; asprintf(&tmpfile_10, "%s/%s", tmpdir_10, fname_10?fname_10:"file");
+    prom_counter_10(b_10, "dfs_backend_requests_total", "Calls made to each backend.", "backend", names_10, legs_10, nb_10, offsetof(struct op_stats_10, requests));
+    prom_counter_10(b_10, "dfs_backend_errors_total", "Backend calls that failed.", "backend", names_10, legs_10, nb_10, offsetof(struct op_stats_10, errors));
+    prom_counter_10(b_10, "dfs_backend_received_bytes_total", "Bytes read from each backend.", "backend", names_10, legs_10, nb_10, offsetof(struct op_stats_10, bytes_in));
+    prom_counter_10(b_10, "dfs_backend_sent_bytes_total", "Bytes written to each backend.", "backend", names_10, legs_10, nb_10, offsetof(struct op_stats_10, bytes_out));
+    prom_histogram_10(b_10, "dfs_backend_duration_seconds", "Backend call latency.", "backend", names_10, legs_10, nb_10);
 
-        if (recv_file_to_path_10(cfd_10, tmpfile_10, fsz_10) != 0)
-        {
-            free(tmpfile_10); free(tmpdir_10);
-            return;
-        }
+    mprintf_10(b_10, "# HELP dfs_backend_up Whether the last call to the backend got an answer (1 until the first call).\n# TYPE dfs_backend_up gauge\n");
+    for (int i_10 = 0; i_10 < nb_10; ++i_10)
+        mprintf_10(b_10, "dfs_backend_up{backend=\"%s\",addr=\"%s\"} %d\n", names_10[i_10], NODES_10[i_10].addr,
+            __atomic_load_n(&STATG_10->backend[i_10].down, __ATOMIC_RELAXED) ? 0 : 1);
+    mprintf_10(b_10, "# HELP dfs_backend_consecutive_failures Backend calls in a row that got no answer.\n# TYPE dfs_backend_consecutive_failures gauge\n");
+    for (int i_10 = 0; i_10 < nb_10; ++i_10)
+        mprintf_10(b_10, "dfs_backend_consecutive_failures{backend=\"%s\"} %llu\n", names_10[i_10],
+            __atomic_load_n(&STATG_10->backend[i_10].fails, __ATOMIC_RELAXED));
+    mprintf_10(b_10, "# HELP dfs_backend_breaker_open Whether calls to the backend fail at once until the prober reaches it.\n# TYPE dfs_backend_breaker_open gauge\n");
+    for (int i_10 = 0; i_10 < nb_10; ++i_10)
+        mprintf_10(b_10, "dfs_backend_breaker_open{backend=\"%s\"} %d\n", names_10[i_10],
+            __atomic_load_n(&STATG_10->backend[i_10].open, __ATOMIC_RELAXED) ? 1 : 0);
+    mprintf_10(b_10, "# HELP dfs_backend_reply_seconds Moving average of the time to a backend's first reply line (orders replica reads).\n# TYPE dfs_backend_reply_seconds gauge\n");
+    for (int i_10 = 0; i_10 < nb_10; ++i_10)
+        mprintf_10(b_10, "dfs_backend_reply_seconds{backend=\"%s\"} %.6f\n", names_10[i_10],
+            __atomic_load_n(&STATG_10->backend[i_10].hdr_us, __ATOMIC_RELAXED) / 1e6);
+    mprintf_10(b_10, "# HELP dfs_hedged_reads_total Downloads that asked a second replica because the first was slow.\n# TYPE dfs_hedged_reads_total counter\n"
+        "dfs_hedged_reads_total %llu\n", __atomic_load_n(&STATG_10->hedges, __ATOMIC_RELAXED));
+    mprintf_10(b_10, "# HELP dfs_hedged_read_wins_total Hedged downloads served by the second replica.\n# TYPE dfs_hedged_read_wins_total counter\n"
+        "dfs_hedged_read_wins_total %llu\n", __atomic_load_n(&STATG_10->hedge_wins, __ATOMIC_RELAXED));
+    mprintf_10(b_10, "# HELP dfs_listings_dropped_total Backend listings given up on once the other replicas had answered.\n# TYPE dfs_listings_dropped_total counter\n"
+        "dfs_listings_dropped_total %llu\n", __atomic_load_n(&STATG_10->lists_dropped, __ATOMIC_RELAXED));
+    cache_metrics_10(b_10);
+    wb_metrics_10(b_10);
 
-        const char *ext_10 = ext_lower_10(fname_10?fname_10:"");
+    char *root_10 = build_s1_path_10("", 0);
+    struct statvfs vfs_10;
+    if (root_10 && statvfs(root_10, &vfs_10) == 0)
+    {
+        mprintf_10(b_10, "# HELP dfs_disk_size_bytes Size of the filesystem holding the store.\n# TYPE dfs_disk_size_bytes gauge\n"
+            "dfs_disk_size_bytes{path=\"%s\"} %llu\n", root_10, (unsigned long long)vfs_10.f_blocks * vfs_10.f_frsize);
+        mprintf_10(b_10, "# HELP dfs_disk_free_bytes Free space available to the server on that filesystem.\n# TYPE dfs_disk_free_bytes gauge\n"
+            "dfs_disk_free_bytes{path=\"%s\"} %llu\n", root_10, (unsigned long long)vfs_10.f_bavail * vfs_10.f_frsize);
+    }
+    free(root_10);
+}
 
-        if (strcmp(ext_10, ".c")==0)
-        {
-            char *dst_dir_10  = build_s1_path_10(dest_10, 1);
-            char *dst_path_10 = NULL; asprintf(&dst_path_10, "%s/%s", dst_dir_10, fname_10);
-            rename(tmpfile_10, dst_path_10);
-            free(dst_path_10); free(dst_dir_10);
-        }
-        else if
-        (!strcmp(ext_10, ".pdf") || !strcmp(ext_10, ".txt") || !strcmp(ext_10, ".zip"))
-        {
-            if (forward_store_10(ext_10, dest_10, fname_10, tmpfile_10) == 0)
-            {
-                unlink(tmpfile_10);  // removes local temp after successful forward
-            }
+// one scrape per connection: GET /metrics, or GET /healthz for a plain liveness probe
+static void metrics_serve_one_10(int cfd_10)
+{
+    struct timeval tv_10 = { 2, 0 };
+    setsockopt(cfd_10, SOL_SOCKET, SO_RCVTIMEO, &tv_10, sizeof tv_10);
+    setsockopt(cfd_10, SOL_SOCKET, SO_SNDTIMEO, &tv_10, sizeof tv_10);
+
+    char req_10[2048]; size_t n_10 = 0;
+    while (n_10 + 1 < sizeof req_10)
+    {
+        ssize_t r_10 = read(cfd_10, req_10 + n_10, sizeof req_10 - 1 - n_10);
+        if (r_10 <= 0)
+            break;
+        n_10 += (size_t)r_10;
+        req_10[n_10] = '\0';
+        if (strstr(req_10, "\r\n\r\n") || strstr(req_10, "\n\n"))
+            break;
+    }
+    req_10[n_10] = '\0';
+
+    struct mbuf_10 body_10 = { NULL, 0, 0 };
+    const char *status_10 = "200 OK", *ctype_10 = "text/plain; version=0.0.4; charset=utf-8";
+    if (!strncmp(req_10, "GET /metrics", 12))
+        metrics_render_10(&body_10);
+    else if (!strncmp(req_10, "GET /healthz", 12))
+        mprintf_10(&body_10, "ok\n");
+    else
+    {
+        status_10 = "404 Not Found"; ctype_10 = "text/plain";
+        mprintf_10(&body_10, "try /metrics\n");
+    }
+    char head_10[256];
+    int h_10 = snprintf(head_10, sizeof head_10, "HTTP/1.0 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+        status_10, ctype_10, body_10.n);
+    write_fully_10(cfd_10, head_10, (size_t)h_10);
+    if (body_10.n)
+        write_fully_10(cfd_10, body_10.p, body_10.n);
+    free(body_10.p);
+}
+
+// binds in the parent so a bad port shows up at startup, then serves from a child
+// that dies with the server
+static void metrics_start_10(void)
+{
+    const char *port_s_10 = getenv("S1_METRICS_PORT");
+    if (!port_s_10 || !*port_s_10 || !STATS_10)
+        return;
+    int lfd_10 = socket(AF_INET, SOCK_STREAM, 0);
+    int opt_10 = 1;
+    setsockopt(lfd_10, SOL_SOCKET, SO_REUSEADDR, &opt_10, sizeof opt_10);
+    struct sockaddr_in a_10; memset(&a_10, 0, sizeof a_10);
+    a_10.sin_family = AF_INET;
+    a_10.sin_port = htons((uint16_t)atoi(port_s_10));
+    inet_pton(AF_INET, S1_LISTEN_HOST_10, &a_10.sin_addr);
+    if (bind(lfd_10, (struct sockaddr*)&a_10, sizeof a_10) != 0 || listen(lfd_10, 16) != 0)
+    {
+        perror("metrics bind");
+        close(lfd_10);
+        return;
+    }
+    pid_t pid_10 = fork();
+    if (pid_10 == 0)
+    {
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        signal(SIGCHLD, SIG_DFL);
+        signal(SIGPIPE, SIG_IGN);   /* a scraper that hangs up early must not take the endpoint down */
+        for (;;)
+        {
+            int cfd_10 = accept(lfd_10, NULL, NULL);
+            if (cfd_10 < 0)
+                continue;
+            metrics_serve_one_10(cfd_10);
+            close(cfd_10);
+        }
+    }
+    if (pid_10 < 0)
+        perror("metrics fork");
+    close(lfd_10);
+    metrics_pid_10 = pid_10;
+    fprintf(stderr, "[S1] metrics on %s:%s/metrics\n", S1_LISTEN_HOST_10, port_s_10);
+}
+
+// the prober: every BREAKER_MS_10 it asks each backend whose breaker is open for the size of a
+// file that is not there, and closes the breaker once any answer comes back. The first probe
+// waits a full period, so a backend that keeps failing is not hit right after it opened
+static pid_t prober_pid_10 = -1;
+
+static int breaker_probe_10(int node_10)
+{
+    int fd_10 = connect_to_10(NODES_10[node_10].host, NODES_10[node_10].port, CONNECT_MS_10);
+    if (fd_10 < 0)
+        return -1;
+    sock_timeout_10(fd_10, BOP_MS_10[BOP_STAT_10]);
+    char line_10[LINE_MAX_10];
+    int rc_10 = send_line_10(fd_10, "STAT|.dfs-probe") == 0 && read_line_10(fd_10, line_10, sizeof line_10) > 0 ? 0 : -1;
+    close(fd_10);
+    return rc_10;
+}
+static void prober_start_10(void)
+{
+    if (!STATG_10 || BREAKER_FAILS_10 <= 0 || NNODES_10 == 0)
+        return;
+    pid_t pid_10 = fork();
+    if (pid_10 == 0)
+    {
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        signal(SIGCHLD, SIG_DFL);
+        unsigned long long next_10[MAX_NODES_10];
+        memset(next_10, 0, sizeof next_10);
+        for (;;)
+        {
+            usleep(100000);
+            for (int b_10 = 0; b_10 < NNODES_10; ++b_10)
+            {
+                unsigned long long now_10 = now_us_10();
+                if (!__atomic_load_n(&STATG_10->backend[b_10].open, __ATOMIC_RELAXED))
+                {
+                    next_10[b_10] = 0;
+                    continue;
+                }
+                if (!next_10[b_10])
+                {
+                    fprintf(stderr, "[S1] %s: no answer, breaker open\n", NODES_10[b_10].name);
+                    next_10[b_10] = now_10 + (unsigned long long)BREAKER_MS_10 * 1000ULL;
+                    continue;
+                }
+                if (now_10 < next_10[b_10])
+                    continue;
+                if (breaker_probe_10(b_10) != 0)
+                {
+                    next_10[b_10] = now_us_10() + (unsigned long long)BREAKER_MS_10 * 1000ULL;
+                    continue;
+                }
+                __atomic_store_n(&STATG_10->backend[b_10].fails, 0, __ATOMIC_RELAXED);
+                __atomic_store_n(&STATG_10->backend[b_10].down, 0, __ATOMIC_RELAXED);
+                __atomic_store_n(&STATG_10->backend[b_10].open, 0, __ATOMIC_RELAXED);
+                fprintf(stderr, "[S1] %s: answering again, breaker closed\n", NODES_10[b_10].name);
+                next_10[b_10] = 0;
+            }
+        }
+    }
+    if (pid_10 < 0)
+        perror("prober fork");
+    prober_pid_10 = pid_10;
+}
+
+// tracing: with DFS_TRACE=<file> every request is recorded as timed spans tagged with its
+// request id (RID), in Chrome trace-event JSON (chrome://tracing, ui.perfetto.dev).
+// Spans go into a per-process ring and are appended to the file once the reply has been
+// sent, so the request path itself only reads the clock
+#define TRACE_RING_10 256
+
+struct span_10
+{
+    const char *name, *cat;
+    unsigned long long ts_us, dur_us;
+    char rid[33];
+};
+static struct span_10 spans_10[TRACE_RING_10];
+static unsigned span_head_10, span_flushed_10;
+static int trace_named_10;
+
+static unsigned long long wall_us_10(void)
+{
+    struct timespec ts_10;
+    clock_gettime(CLOCK_REALTIME, &ts_10);
+    return (unsigned long long)ts_10.tv_sec * 1000000ULL + (unsigned long long)ts_10.tv_nsec / 1000ULL;
+}
+
+// the first process to create the file writes the opening '['; the viewers accept
+// an array that is never closed, so every process just appends ",\n"-terminated events
+static void trace_init_10(void)
+{
+    const char *path_10 = getenv("DFS_TRACE");
+    if (!path_10 || !*path_10)
+        return;
+    int fd_10 = open(path_10, O_WRONLY|O_CREAT|O_EXCL|O_APPEND, 0644);
+    if (fd_10 >= 0)
+        write_fully_10(fd_10, "[\n", 2);
+    else
+        fd_10 = open(path_10, O_WRONLY|O_APPEND);
+    if (fd_10 < 0)
+        perror("DFS_TRACE");
+    trace_fd_10 = fd_10;
+}
+
+static unsigned long long trace_begin_10(void)
+{
+    return trace_fd_10 >= 0 ? wall_us_10() : 0;
+}
+
+static void trace_span_10(const char *name_10, const char *cat_10, unsigned long long t0_10)
+{
+    if (trace_fd_10 < 0 || !t0_10)
+        return;
+    struct span_10 *sp_10 = &spans_10[span_head_10++ % TRACE_RING_10];
+    sp_10->name = name_10;
+    sp_10->cat = cat_10;
+    sp_10->ts_us = t0_10;
+    sp_10->dur_us = wall_us_10() - t0_10;
+    memcpy(sp_10->rid, trace_rid_10, sizeof sp_10->rid);
+}
+
+// appends every span recorded since the last flush; one write() per batch of whole lines
+static void trace_flush_10(void)
+{
+    if (trace_fd_10 < 0)
+        return;
+    if (span_head_10 - span_flushed_10 > TRACE_RING_10)
+        span_flushed_10 = span_head_10 - TRACE_RING_10;   /* the ring overwrote the oldest */
+    char buf_10[8192]; size_t n_10 = 0;
+    int pid_10 = (int)getpid();
+    if (!trace_named_10)
+    {
+        trace_named_10 = 1;
+        n_10 += (size_t)snprintf(buf_10, sizeof buf_10,
+            "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"S1 worker %d\"}},\n", pid_10, pid_10);
+    }
+    while (span_flushed_10 != span_head_10)
+    {
+        const struct span_10 *sp_10 = &spans_10[span_flushed_10++ % TRACE_RING_10];
+        if (n_10 + 256 > sizeof buf_10)
+        {
+            write_fully_10(trace_fd_10, buf_10, n_10);
+            n_10 = 0;
+        }
+        n_10 += (size_t)snprintf(buf_10 + n_10, sizeof buf_10 - n_10,
+            "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":%d,\"tid\":%d,\"args\":{\"rid\":\"%s\"}},\n",
+            sp_10->name, sp_10->cat, sp_10->ts_us, sp_10->dur_us, pid_10, pid_10, sp_10->rid);
+    }
+    if (n_10)
+        write_fully_10(trace_fd_10, buf_10, n_10);
+}
+
+// S1 makes up an id for requests that arrive without one
+static void trace_new_rid_10(void)
+{
+    static unsigned seq_10;
+    snprintf(trace_rid_10, sizeof trace_rid_10, "%08llx%04x%04x",
+        wall_us_10() & 0xffffffffULL, (unsigned)getpid() & 0xffff, ++seq_10 & 0xffff);
+}
+
+// These are the File helpers
+// gets n bytes from a socket and writes them to an already open file
+static int recv_file_to_fd_10(int fd_10, int out_10, size_t size_10)
+{
+    char *buf_10 = (char*)malloc(CHUNK_10);
+    if (!buf_10)
+        return -1;
+    size_t left_10 = size_10;
+    while (left_10 > 0)
+    {
+        size_t want_10 = left_10 > CHUNK_10 ? CHUNK_10 : left_10;
+        ssize_t r_10 = read_fully_10(fd_10, buf_10, want_10);
+        if (r_10 <= 0)
+        {
+            free(buf_10);
+            return -1;
+        }
+        if (write_fully_10(out_10, buf_10, (size_t)r_10) != r_10)
+        {
+            free(buf_10);
+            return -1;
+        }
+        left_10 -= (size_t)r_10;
+    }
+    free(buf_10);
+    return 0;
+}
+// reads n bytes from a socket and throws them away, so the next request still lines up
+static int drain_10(int fd_10, size_t size_10)
+{
+    char buf_10[CHUNK_10];
+    while (size_10 > 0)
+    {
+        size_t want_10 = size_10 > CHUNK_10 ? CHUNK_10 : size_10;
+        ssize_t r_10 = read_fully_10(fd_10, buf_10, want_10);
+        if (r_10 <= 0)
+            return -1;
+        size_10 -= (size_t)r_10;
+    }
+    return 0;
+}
+// gets n bytes from a socket and writes to a file
+static int recv_file_to_path_10(int fd_10, const char *dst_path_10, size_t size_10)
+{
+    int out_10 = open(dst_path_10, O_CREAT|O_TRUNC|O_WRONLY, 0600);
+    if (out_10 < 0)
+        return -1;
+    int rc_10 = recv_file_to_fd_10(fd_10, out_10, size_10);
+    close(out_10);
+    return rc_10;
+}
+// creates a new unique file under ~/S1/tmp (prefix_XXXXXX) and returns its open fd
+// every upload/fetch gets its own temp file so concurrent requests never share one
+static int make_temp_10(const char *prefix_10, char **out_path_10)
+{
+    char *tmpdir_10 = build_s1_path_10("tmp", 1);
+    char *path_10 = NULL; asprintf(&path_10, "%s/%s_XXXXXX", tmpdir_10, prefix_10);
+    free(tmpdir_10);
+    int fd_10 = mkstemp(path_10);
+    if (fd_10 < 0)
+    {
+        free(path_10);
+        return -1;
+    }
+    *out_path_10 = path_10;
+    return fd_10;
+}
+
+// Backend operations for the storage classes in the routing table
+// connects to a backend and marks the socket as the current leg for byte accounting; the reads
+// and writes of the leg get the timeout of its operation, and a backend whose breaker is open
+// is not tried at all
+static int leg_connect_10(int node_10, int op_10)
+{
+    unsigned long long t0_10 = trace_begin_10();
+    leg_t0_10 = now_us_10();
+    int fd_10 = -1;
+    int open_10 = STATG_10 && __atomic_load_n(&STATG_10->backend[node_10].open, __ATOMIC_RELAXED);
+    if (open_10)
+        errno = ECONNREFUSED;
+    else if ((fd_10 = connect_to_10(NODES_10[node_10].host, NODES_10[node_10].port, CONNECT_MS_10)) >= 0)
+        sock_timeout_10(fd_10, BOP_MS_10[op_10]);
+    trace_span_10(open_10 ? "breaker_open" : "connect", "S1", t0_10);
+    stat_leg_fd_10 = fd_10;
+    leg_rid_pending_10 = 1;
+    leg_wait_t0_10 = 0;
+    return fd_10;
+}
+
+static int store_send_10(int fd_10, const char *rel_dir_10, const char *fname_10, const char *tmp_path_10, int nx_10);
+
+// send a file to the backend instance that holds it; with nx (STORENX) a file already there is
+// kept and -2 returned
+static int forward_store_leg_10(int node_10, const char *rel_dir_10, const char *fname_10, const char *tmp_path_10, int nx_10)
+{
+    if (node_10 < 0)
+        return -1;
+    int fd_10 = leg_connect_10(node_10, BOP_STORE_10);
+    if (fd_10 < 0)
+        return -1;
+    int rc_10 = store_send_10(fd_10, rel_dir_10, fname_10, tmp_path_10, nx_10);
+    close(fd_10);
+    return rc_10;
+}
+// one STORE (or STORENX) on a connected leg; a leg can carry several in a row
+static int store_send_10(int fd_10, const char *rel_dir_10, const char *fname_10, const char *tmp_path_10, int nx_10)
+{
+    //removes S1 from the path before sending it to backend
+    const char *rel_only_10 = rel_dir_10;
+    if (strncmp(rel_only_10, "~S1/", 4)==0)
+        rel_only_10 += 4;
+
+    //if the path was only S1, send "."; the backend only creates folders followed by a '/',
+    //so "~S1/dir" is sent as "dir/"
+    char dir_field_10[LINE_MAX_10];
+    size_t dl_10 = strlen(rel_only_10);
+    snprintf(dir_field_10, sizeof dir_field_10, "%s%s", dl_10 ? rel_only_10 : ".", (dl_10 && rel_only_10[dl_10 - 1] == '/') ? "" : "/");
+
+    //tells backend where to store the file
+    if (send_line_10(fd_10, "%s|%s|%s|", nx_10 ? "STORENX" : "STORE", dir_field_10, fname_10) != 0)
+        return -1;
+
+    // send the file size after the previous step
+    struct stat st_10;
+    if (stat(tmp_path_10, &st_10) != 0)
+        return -1;
+
+    //then the size of the bytes
+    if (send_line_10(fd_10, "%zu", (size_t)st_10.st_size) != 0)
+        return -1;
+
+    if (send_file_from_path_10(fd_10, tmp_path_10, NULL, write_fully_10) != 0)
+        return -1;
+
+    char line_10[LINE_MAX_10];
+    if (read_line_10(fd_10, line_10, sizeof line_10) <= 0)
+        return -1;
+    if (nx_10 && !strcmp(line_10, "ERR|exists"))
+        return -2;
+    return (strncmp(line_10, "OK", 2)==0) ? 0 : -1;
+}
+
+//this function fetches files from the backend
+static int backend_fetch_leg_10(int node_10, const char *rel_path_10, const char *tmp_path_10)
+{
+    if (node_10 < 0)
+        return -1;
+
+    //removes S1 from the user input
+    const char *rel_only_10 = rel_path_10;
+    if (strncmp(rel_only_10, "~S1/", 4)==0)
+        rel_only_10 += 4;
+
+    int fd_10 = leg_connect_10(node_10, BOP_FETCH_10);
+    if (fd_10 < 0)
+        return -1;
+    if (send_line_10(fd_10, "FETCH|%s", rel_only_10) != 0)
+    {
+        close(fd_10); return -1;
+    }
+
+    char line_10[LINE_MAX_10];
+    if (read_line_10(fd_10, line_10, sizeof line_10) <= 0)
+    {
+        close(fd_10); return -1;
+    }
+    if (strncmp(line_10, "OK|", 3) != 0)
+    {
+        close(fd_10);
+        return -1;
+    }
+
+    char *tok_10=NULL, *save_10=NULL;
+    tok_10 = strtok_r(line_10+3, "|", &save_10); /* name (unused) */
+    tok_10 = strtok_r(NULL, "|", &save_10);      /* size */
+    size_t size_10 = (size_t)strtoull(tok_10 ? tok_10 : "0", NULL, 10);
+
+    int rc_10 = recv_file_to_path_10(fd_10, tmp_path_10, size_10);
+    close(fd_10);
+    return rc_10;
+}
+
+//this function deletes a file from the backend
+static int backend_delete_leg_10(int node_10, const char *rel_path_10)
+{
+    if (node_10 < 0)
+        return -1;
+    const char *rel_only_10 = rel_path_10;
+    if (strncmp(rel_only_10, "~S1/", 4)==0)
+        rel_only_10 += 4;
+
+    int fd_10 = leg_connect_10(node_10, BOP_DELETE_10);
+    if (fd_10 < 0)
+        return -1;
+    if (send_line_10(fd_10, "DELETE|%s", rel_only_10) != 0)
+    {
+        close(fd_10); return -1;
+    }
+    char line_10[LINE_MAX_10];
+    if (read_line_10(fd_10, line_10, sizeof line_10) <= 0)
+    {
+        close(fd_10); return -1;
+    }
+    close(fd_10);
+    return (strncmp(line_10, "OK", 2)==0) ? 0 : -1;
+}
+
+//this function asks a backend for the tar of every file of one extension
+static int backend_tar_leg_10(int node_10, const char *ext_10, char **out_tmp_path_10, size_t *out_size_10)
+{
+    if (node_10 < 0)
+        return -1;
+
+    int fd_10 = leg_connect_10(node_10, BOP_TAR_10);
+    if (fd_10 < 0)
+        return -1;
+    if (send_line_10(fd_10, "TAR|%s", ext_10) != 0)
+    {
+        close(fd_10); return -1;
+    }
+
+    char line_10[LINE_MAX_10];
+    if (read_line_10(fd_10, line_10, sizeof line_10) <= 0)
+    {
+        close(fd_10); return -1;
+    }
+    if (strncmp(line_10, "OK|", 3) != 0)
+    {
+        close(fd_10);
+        return strcmp(line_10, "ERR|empty") ? -1 : -2;   /* -2: nothing of that type there */
+    }
+
+    char *tok_10, *save_10;
+    tok_10 = strtok_r(line_10+3, "|", &save_10);
+    tok_10 = strtok_r(NULL, "|", &save_10);
+    size_t size_10 = (size_t)strtoull(tok_10 ? tok_10 : "0", NULL, 10);
+
+    char *full_10 = NULL;
+    int tfd_10 = make_temp_10("tar", &full_10);
+    if (tfd_10 < 0)
+    {
+        close(fd_10);
+        return -1;
+    }
+    int rc_10 = recv_file_to_fd_10(fd_10, tfd_10, size_10);
+    close(tfd_10);
+    close(fd_10);
+    if (rc_10 != 0)
+    {
+        unlink(full_10); free(full_10);
+        return -1;
+    }
+    *out_tmp_path_10 = full_10;
+
+    if (out_size_10) *out_size_10 = size_10;
+    return 0;
+}
+
+// reads a LIST reply: OK, then NAME|file lines up to END
+static int list_read_10(int fd_10, char ***out_arr_10, int *out_cnt_10)
+{
+    char line_10[LINE_MAX_10];
+    if (read_line_10(fd_10, line_10, sizeof line_10) <= 0 || strcmp(line_10, "OK") != 0)
+        return -1;
+
+    int cap_10 = 8, cnt_10 = 0;
+    char **arr_10 = (char**)malloc(sizeof(char*)*cap_10);
+    if (!arr_10)
+        return -1;
+
+    for (;;)
+    {
+        int n_10 = read_line_10(fd_10, line_10, sizeof line_10);
+        if (n_10 <= 0)
+            break;
+        if (strcmp(line_10, "END")==0)
+            break;
+        if (strncmp(line_10, "NAME|", 5)==0)
+        {
+            const char *nm_10 = line_10 + 5;
+            if (cnt_10 == cap_10)
+            {
+                cap_10 *= 2;
+                arr_10 = (char**)realloc(arr_10, sizeof(char*)*cap_10);
+            }
+            arr_10[cnt_10++] = strdup(nm_10);
+        }
+    }
+    *out_arr_10 = arr_10; *out_cnt_10 = cnt_10;
+    return 0;
+}
+
+// the version of a file as a backend has it (FETCH and STAT replies), checked by the READ CACHE
+struct fver_10
+{
+    unsigned long long size, mtime;
+};
+static void fver_parse_10(const char *s_10, struct fver_10 *v_10)
+{
+    char *end_10 = NULL;
+    v_10->size = strtoull(s_10, &end_10, 10);
+    v_10->mtime = *end_10 == '|' ? strtoull(end_10 + 1, NULL, 10) : 0;
+}
+
+//asks a backend whether it has a file: 1 yes, 0 no, -1 when it could not be asked; ver (may be
+//NULL) gets its size and mtime
+static int backend_stat_leg_10(int node_10, const char *rel_path_10, struct fver_10 *ver_10)
+{
+    if (node_10 < 0)
+        return -1;
+    const char *rel_only_10 = rel_path_10;
+    if (strncmp(rel_only_10, "~S1/", 4)==0)
+        rel_only_10 += 4;
+
+    int fd_10 = leg_connect_10(node_10, BOP_STAT_10);
+    if (fd_10 < 0)
+        return -1;
+    if (send_line_10(fd_10, "STAT|%s", rel_only_10) != 0)
+    {
+        close(fd_10); return -1;
+    }
+    char line_10[LINE_MAX_10];
+    if (read_line_10(fd_10, line_10, sizeof line_10) <= 0)
+    {
+        close(fd_10); return -1;
+    }
+    close(fd_10);
+    if (!strncmp(line_10, "OK|", 3))
+    {
+        if (ver_10)
+            fver_parse_10(line_10 + 3, ver_10);   /* OK|size|mtime */
+        return 1;
+    }
+    return strcmp(line_10, "ERR|nofile") ? -1 : 0;
+}
+
+//lists every file a backend holds, in all folders (paths relative to its root)
+static int backend_walk_leg_10(int node_10, char ***out_arr_10, int *out_cnt_10)
+{
+    if (node_10 < 0)
+        return -1;
+    int fd_10 = leg_connect_10(node_10, BOP_WALK_10);
+    if (fd_10 < 0)
+        return -1;
+    char line_10[LINE_MAX_10];
+    if (send_line_10(fd_10, "WALK") != 0 || read_line_10(fd_10, line_10, sizeof line_10) <= 0 || strcmp(line_10, "OK") != 0)
+    {
+        close(fd_10); return -1;
+    }
+
+    int cap_10 = 64, cnt_10 = 0, ended_10 = 0;
+    char **arr_10 = (char**)malloc(sizeof(char*)*cap_10);
+    while (arr_10)
+    {
+        if (read_line_10(fd_10, line_10, sizeof line_10) <= 0)
+            break;
+        if (!strcmp(line_10, "END"))
+        {
+            ended_10 = 1;
+            break;
+        }
+        char *bar_10 = strrchr(line_10, '|');
+        if (strncmp(line_10, "FILE|", 5) != 0 || !bar_10 || bar_10 < line_10 + 5)
+            continue;
+        *bar_10 = '\0';   /* drops the size */
+        if (cnt_10 == cap_10)
+        {
+            cap_10 *= 2;
+            arr_10 = (char**)realloc(arr_10, sizeof(char*)*cap_10);
+            if (!arr_10)
+                break;
+        }
+        arr_10[cnt_10++] = strdup(line_10 + 5);
+    }
+    close(fd_10);
+    // a walk cut short would make files look absent, so it counts as a failure
+    if (!ended_10)
+    {
+        for (int i_10 = 0; arr_10 && i_10 < cnt_10; ++i_10)
+            free(arr_10[i_10]);
+        free(arr_10);
+        return -1;
+    }
+    *out_arr_10 = arr_10; *out_cnt_10 = cnt_10;
+    return 0;
+}
+
+// every backend call is timed and counted per backend instance for STATS
+static int forward_store_10(int node_10, const char *rel_dir_10, const char *fname_10, const char *tmp_path_10)
+{
+    if (node_10 < 0)
+        return -1;
+    unsigned long long t0_10 = stat_leg_begin_10();
+    unsigned long long tw_10 = trace_begin_10();
+    int rc_10 = forward_store_leg_10(node_10, rel_dir_10, fname_10, tmp_path_10, 0);
+    trace_span_10("backend.store", NODES_10[node_10].name, tw_10);
+    stat_leg_end_10(node_10, t0_10, rc_10 == 0);
+    return rc_10;
+}
+static int backend_storenx_10(int node_10, const char *rel_dir_10, const char *fname_10, const char *tmp_path_10)
+{
+    if (node_10 < 0)
+        return -1;
+    unsigned long long t0_10 = stat_leg_begin_10();
+    unsigned long long tw_10 = trace_begin_10();
+    int rc_10 = forward_store_leg_10(node_10, rel_dir_10, fname_10, tmp_path_10, 1);
+    trace_span_10("backend.storenx", NODES_10[node_10].name, tw_10);
+    stat_leg_end_10(node_10, t0_10, rc_10 != -1);
+    return rc_10;
+}
+static int backend_fetch_10(int node_10, const char *rel_path_10, const char *tmp_path_10)
+{
+    if (node_10 < 0)
+        return -1;
+    unsigned long long t0_10 = stat_leg_begin_10();
+    unsigned long long tw_10 = trace_begin_10();
+    int rc_10 = backend_fetch_leg_10(node_10, rel_path_10, tmp_path_10);
+    trace_span_10("backend.fetch", NODES_10[node_10].name, tw_10);
+    stat_leg_end_10(node_10, t0_10, rc_10 == 0);
+    return rc_10;
+}
+static int backend_delete_10(int node_10, const char *rel_path_10)
+{
+    unsigned long long t0_10 = stat_leg_begin_10();
+    unsigned long long tw_10 = trace_begin_10();
+    int rc_10 = backend_delete_leg_10(node_10, rel_path_10);
+    trace_span_10("backend.delete", NODES_10[node_10].name, tw_10);
+    stat_leg_end_10(node_10, t0_10, rc_10 == 0);
+    return rc_10;
+}
+static int backend_tar_10(int node_10, const char *ext_10, char **out_tmp_path_10, size_t *out_size_10)
+{
+    unsigned long long t0_10 = stat_leg_begin_10();
+    unsigned long long tw_10 = trace_begin_10();
+    int rc_10 = backend_tar_leg_10(node_10, ext_10, out_tmp_path_10, out_size_10);
+    trace_span_10("backend.tar", NODES_10[node_10].name, tw_10);
+    stat_leg_end_10(node_10, t0_10, rc_10 == 0);
+    return rc_10;
+}
+static int backend_stat_10(int node_10, const char *rel_path_10, struct fver_10 *ver_10)
+{
+    unsigned long long t0_10 = stat_leg_begin_10();
+    unsigned long long tw_10 = trace_begin_10();
+    int rc_10 = backend_stat_leg_10(node_10, rel_path_10, ver_10);
+    trace_span_10("backend.stat", NODES_10[node_10].name, tw_10);
+    stat_leg_end_10(node_10, t0_10, rc_10 >= 0);
+    return rc_10;
+}
+static int backend_walk_10(int node_10, char ***out_arr_10, int *out_cnt_10)
+{
+    unsigned long long t0_10 = stat_leg_begin_10();
+    unsigned long long tw_10 = trace_begin_10();
+    int rc_10 = backend_walk_leg_10(node_10, out_arr_10, out_cnt_10);
+    trace_span_10("backend.walk", NODES_10[node_10].name, tw_10);
+    stat_leg_end_10(node_10, t0_10, rc_10 == 0);
+    return rc_10;
+}
+
+// HEDGED READS: a download asks the quickest replica first; when its reply line has not come
+// within the hedge delay (the configured percentile of that replica's recent first-reply times),
+// the next replica is asked too, whichever answers first is read and the other is hung up on.
+// A listing asks every backend at once and, with replicas, stops waiting for the slow ones once
+// the ones that answered hold a copy of every file and the hedge delay has passed
+#define HEDGE_MIN_US_10 1000      /* never hedge sooner than this */
+#define HEDGE_COLD_US_10 50000    /* delay for a backend with too few recent replies to tell */
+
+static unsigned long long hedge_delay_10(int node_10)
+{
+    if (!STATG_10)
+        return HEDGE_COLD_US_10;
+    unsigned long long h_10[STAT_BUCKETS_10], total_10 = 0;
+    for (int b_10 = 0; b_10 < STAT_BUCKETS_10; ++b_10)
+        total_10 += h_10[b_10] = __atomic_load_n(&STATG_10->backend[node_10].hdr_hist[b_10], __ATOMIC_RELAXED);
+    if (total_10 < 16)
+        return HEDGE_COLD_US_10;
+    unsigned long long want_10 = (total_10 * (unsigned long long)HEDGE_PCT_10 + 99) / 100, seen_10 = 0;
+    for (int b_10 = 0; b_10 < STAT_BUCKETS_10; ++b_10)
+        if ((seen_10 += h_10[b_10]) >= want_10)
+        {
+            unsigned long long us_10 = stat_bucket_upper_10(b_10);
+            return us_10 < HEDGE_MIN_US_10 ? HEDGE_MIN_US_10 : us_10;
+        }
+    return HEDGE_COLD_US_10;
+}
+
+// a backend leg run alongside others; the stat_leg_* globals follow one leg at a time, so each
+// one keeps its own copy and swaps it in around its I/O
+struct pleg_10
+{
+    int node, fd, replied;
+    unsigned long long t0, tw, hdr_us, in, out;
+};
+static void pleg_enter_10(struct pleg_10 *p_10)
+{
+    stat_leg_fd_10 = p_10->fd;
+    stat_leg_in_10 = p_10->in;
+    stat_leg_out_10 = p_10->out;
+    leg_replied_10 = p_10->replied;
+    leg_t0_10 = p_10->t0;
+    leg_hdr_us_10 = p_10->hdr_us;
+}
+static void pleg_leave_10(struct pleg_10 *p_10)
+{
+    p_10->in = stat_leg_in_10;
+    p_10->out = stat_leg_out_10;
+    p_10->replied = leg_replied_10;
+    p_10->hdr_us = leg_hdr_us_10;
+    stat_leg_fd_10 = -1;
+}
+// connects and sends the request; a backend that cannot be reached is counted and -1 returned
+static int pleg_start_10(struct pleg_10 *p_10, int node_10, int op_10, const char *req_10)
+{
+    memset(p_10, 0, sizeof *p_10);
+    p_10->node = node_10;
+    p_10->tw = trace_begin_10();
+    p_10->t0 = stat_leg_begin_10();
+    p_10->fd = leg_connect_10(node_10, op_10);
+    p_10->t0 = leg_t0_10;
+    if (p_10->fd >= 0 && send_line_10(p_10->fd, "%s", req_10) != 0)
+    {
+        close(p_10->fd);
+        p_10->fd = -1;
+    }
+    pleg_leave_10(p_10);
+    if (p_10->fd < 0)
+    {
+        stat_leg_add_10(node_10, p_10->t0, 0, 0, 0, p_10->in, p_10->out);
+        return -1;
+    }
+    return 0;
+}
+static void pleg_end_10(struct pleg_10 *p_10, const char *span_10, int ok_10)
+{
+    close(p_10->fd);
+    trace_span_10(span_10, NODES_10[p_10->node].name, p_10->tw);
+    stat_leg_add_10(p_10->node, p_10->t0, ok_10, p_10->replied, p_10->hdr_us, p_10->in, p_10->out);
+}
+// the loser of a hedge is hung up on and left out of the backend's latency and health; the time
+// it went without answering still counts in its moving average, so a stalled replica stops being
+// asked first
+static void pleg_cancel_10(struct pleg_10 *p_10)
+{
+    close(p_10->fd);
+    trace_span_10("backend.cancelled", NODES_10[p_10->node].name, p_10->tw);
+    if (STATG_10 && !p_10->replied)
+    {
+        unsigned long long waited_10 = now_us_10() - p_10->t0;
+        unsigned long long avg_10 = __atomic_load_n(&STATG_10->backend[p_10->node].hdr_us, __ATOMIC_RELAXED);
+        __atomic_store_n(&STATG_10->backend[p_10->node].hdr_us, (avg_10 * 7 + waited_10) / 8 + 1, __ATOMIC_RELAXED);
+    }
+}
+// waits until one of the legs has something to read (or the timeout, -1 for none, passes);
+// returns its index or -1
+static int pleg_wait_10(struct pleg_10 **legs_10, int n_10, int timeout_ms_10)
+{
+    struct pollfd pf_10[MAX_NODES_10];
+    for (int i_10 = 0; i_10 < n_10; ++i_10)
+    {
+        pf_10[i_10].fd = legs_10[i_10]->fd;
+        pf_10[i_10].events = POLLIN;
+        pf_10[i_10].revents = 0;
+    }
+    int r_10;
+    while ((r_10 = poll(pf_10, (nfds_t)n_10, timeout_ms_10)) < 0 && errno == EINTR)
+        ;
+    for (int i_10 = 0; r_10 > 0 && i_10 < n_10; ++i_10)
+        if (pf_10[i_10].revents)
+            return i_10;
+    return -1;
+}
+
+// reads a FETCH reply (OK|name|size|mtime, then the bytes) into tmp_path
+static int fetch_reply_10(struct pleg_10 *p_10, const char *tmp_path_10, struct fver_10 *ver_10)
+{
+    pleg_enter_10(p_10);
+    char line_10[LINE_MAX_10];
+    int rc_10 = -1;
+    char *bar_10;
+    if (read_line_10(p_10->fd, line_10, sizeof line_10) > 0 && !strncmp(line_10, "OK|", 3) && (bar_10 = strchr(line_10 + 3, '|')))
+    {
+        fver_parse_10(bar_10 + 1, ver_10);
+        rc_10 = recv_file_to_path_10(p_10->fd, tmp_path_10, (size_t)ver_10->size);
+    }
+    pleg_leave_10(p_10);
+    return rc_10;
+}
+// fetches a file from the first replica of pl that has it, hedging between the serving ones;
+// ver gets the version that replica had
+static int hedged_fetch_10(const struct place_10 *pl_10, const char *rel_path_10, const char *tmp_path_10, struct fver_10 *ver_10)
+{
+    const char *rel_only_10 = rel_path_10;
+    if (strncmp(rel_only_10, "~S1/", 4)==0)
+        rel_only_10 += 4;
+    char req_10[LINE_MAX_10];
+    snprintf(req_10, sizeof req_10, "FETCH|%s", rel_only_10);
+
+    int next_10 = 0;
+    while (next_10 < pl_10->n)
+    {
+        struct pleg_10 a_10, b_10;
+        if (pleg_start_10(&a_10, pl_10->node[next_10++], BOP_FETCH_10, req_10) != 0)
+            continue;
+        struct pleg_10 *legs_10[2] = { &a_10, &b_10 };
+        int nlegs_10 = 1;
+        if (HEDGE_PCT_10 > 0 && next_10 < pl_10->nserve)
+        {
+            int ms_10 = (int)((hedge_delay_10(a_10.node) + 999) / 1000);
+            if (pleg_wait_10(legs_10, 1, ms_10) < 0)
+            {
+                // the first replica is slower than usual: ask the next one too
+                if (pleg_start_10(&b_10, pl_10->node[next_10], BOP_FETCH_10, req_10) == 0)
+                {
+                    nlegs_10 = 2;
+                    if (STATG_10)
+                        __atomic_fetch_add(&STATG_10->hedges, 1, __ATOMIC_RELAXED);
+                }
+                ++next_10;
+            }
+        }
+        int w_10 = nlegs_10 == 1 ? 0 : pleg_wait_10(legs_10, 2, BOP_MS_10[BOP_FETCH_10]);
+        if (w_10 < 0)
+        {
+            // neither replica said anything within the fetch timeout
+            pleg_end_10(&a_10, "backend.fetch", 0);
+            pleg_end_10(&b_10, "backend.fetch", 0);
+            continue;
+        }
+        struct pleg_10 *win_10 = legs_10[w_10], *lose_10 = legs_10[1 - w_10];
+        int rc_10 = fetch_reply_10(win_10, tmp_path_10, ver_10);
+        pleg_end_10(win_10, "backend.fetch", rc_10 == 0);
+        if (rc_10 == 0)
+        {
+            if (nlegs_10 == 2)
+            {
+                pleg_cancel_10(lose_10);
+                if (win_10 == &b_10 && STATG_10)
+                    __atomic_fetch_add(&STATG_10->hedge_wins, 1, __ATOMIC_RELAXED);
+            }
+            return 0;
+        }
+        // the first answer was not the file (or broke off): the other leg may still have it
+        if (nlegs_10 == 2)
+        {
+            rc_10 = fetch_reply_10(lose_10, tmp_path_10, ver_10);
+            pleg_end_10(lose_10, "backend.fetch", rc_10 == 0);
+            if (rc_10 == 0)
+                return 0;
+        }
+    }
+    return -1;
+}
+
+// READ CACHE: downloads of remote classes are cached in S1, in a memory tier shared by every
+// child (mapped once at startup) and optionally a disk tier under ~/S1/.cache. The memory tier
+// is a segmented LRU: a file enters the probation segment and moves to the protected one on its
+// second hit, so a pass over many files once (a scan) only cycles probation and leaves the hot
+// set alone. Files pushed out of protected go down to the disk tier when there is one, as do
+// files too big for memory; probation victims are dropped. A cached file is served as is for
+// CACHE_REVAL_MS_10 after it was fetched or checked, after that its size and mtime are checked
+// with a STAT first. S1's own uploads and removes drop the entry once the backends have the
+// change, and a fetch that started before a drop is not cached
+#define CACHE_BLOCK_10 4096
+#define CACHE_SLOTS_10 4096
+#define CACHE_INDEX_10 8192   /* power of two, twice the slots */
+#define CACHE_KEY_10 256
+#define CACHE_DEMOTE_10 16    /* protected files moved to disk per fill, at most */
+enum { CL_PROB_10, CL_PROT_10, CL_DISK_10, CL_COUNT_10 };
+static const char *CL_NAMES_10[CL_COUNT_10] = { "probation", "protected", "disk" };
+
+struct centry_10
+{
+    char key[CACHE_KEY_10];      /* path under ~S1, see cache_key_10 */
+    struct fver_10 ver;
+    unsigned long long checked_us, disk_id;
+    unsigned hash;
+    int list, prev, next;        /* list: CL_*_10, or -1 while it is filled or moved to disk */
+    int block, pins, dead;       /* block: first of its chain in the memory tier, -1 for none */
+};
+struct cache_10
+{
+    int lock;
+    int head[CL_COUNT_10], tail[CL_COUNT_10];
+    unsigned long long bytes[CL_COUNT_10];
+    int free_slot, free_block, nfree_blocks, tombs;
+    unsigned long long seq, disk_seq;
+    unsigned long long hits[CL_COUNT_10], misses, revalidated, stale, evicted;
+    int index[CACHE_INDEX_10];   /* slot, -1 empty, -2 deleted */
+    struct centry_10 e[CACHE_SLOTS_10];
+};
+static struct cache_10 *CACHE_10 = NULL;
+static int *CBLOCK_NEXT_10 = NULL;   /* chain of each memory block, then the free list */
+static char *CDATA_10 = NULL;
+static int CACHE_NBLOCKS_10 = 0;
+static char *CACHE_DIR_10 = NULL;
+
+// the lock only covers bookkeeping; file data is copied with the entry pinned instead
+static void cache_lock_10(void)
+{
+    while (__atomic_exchange_n(&CACHE_10->lock, 1, __ATOMIC_ACQUIRE))
+        sched_yield();
+}
+static void cache_unlock_10(void)
+{
+    __atomic_store_n(&CACHE_10->lock, 0, __ATOMIC_RELEASE);
+}
+
+// the cache key of a file is its path under ~S1 without the prefix, so a download of
+// "~S1/a/b.pdf" and an upload of b.pdf to "~S1/a/" meet; -1 when it is too long to cache
+static int cache_key_10(char *out_10, const char *dir_10, const char *name_10)
+{
+    if (!strncmp(dir_10, "~S1/", 4))
+        dir_10 += 4;
+    else if (!strcmp(dir_10, "~S1"))
+        dir_10 = "";
+    size_t dl_10 = strlen(dir_10);
+    while (dl_10 && dir_10[dl_10 - 1] == '/')
+        --dl_10;
+    size_t nl_10 = name_10 ? strlen(name_10) : 0;
+    if (dl_10 + nl_10 + 2 > CACHE_KEY_10)
+        return -1;
+    memcpy(out_10, dir_10, dl_10);
+    if (name_10)
+    {
+        if (dl_10)
+            out_10[dl_10++] = '/';
+        memcpy(out_10 + dl_10, name_10, nl_10);
+        dl_10 += nl_10;
+    }
+    out_10[dl_10] = '\0';
+    return 0;
+}
+// whether a key is in the folder whose key is dir, at any depth
+static int key_under_10(const char *key_10, const char *dir_10)
+{
+    size_t dl_10 = strlen(dir_10);
+    return !dl_10 || (!strncmp(key_10, dir_10, dl_10) && key_10[dl_10] == '/');
+}
+static unsigned cache_hash_10(const char *key_10)
+{
+    unsigned h_10 = 2166136261u;   /* FNV-1a */
+    for (; *key_10; ++key_10)
+        h_10 = (h_10 ^ (unsigned char)*key_10) * 16777619u;
+    return h_10;
+}
+static void cache_disk_path_10(char *out_10, size_t n_10, unsigned long long id_10)
+{
+    snprintf(out_10, n_10, "%s/%016llx", CACHE_DIR_10, id_10);
+}
+
+// the index is open addressing over slot numbers; deleted marks are swept by a rebuild
+static int cache_find_10(const char *key_10, unsigned h_10)
+{
+    for (unsigned i_10 = h_10 & (CACHE_INDEX_10 - 1);; i_10 = (i_10 + 1) & (CACHE_INDEX_10 - 1))
+    {
+        int s_10 = CACHE_10->index[i_10];
+        if (s_10 == -1)
+            return -1;
+        if (s_10 >= 0 && CACHE_10->e[s_10].hash == h_10 && !strcmp(CACHE_10->e[s_10].key, key_10))
+            return s_10;
+    }
+}
+static void cache_index_add_10(int s_10)
+{
+    unsigned i_10 = CACHE_10->e[s_10].hash & (CACHE_INDEX_10 - 1);
+    while (CACHE_10->index[i_10] >= 0)
+        i_10 = (i_10 + 1) & (CACHE_INDEX_10 - 1);
+    if (CACHE_10->index[i_10] == -2)
+        --CACHE_10->tombs;
+    CACHE_10->index[i_10] = s_10;
+}
+static void cache_index_del_10(int s_10)
+{
+    unsigned i_10 = CACHE_10->e[s_10].hash & (CACHE_INDEX_10 - 1);
+    while (CACHE_10->index[i_10] != s_10)
+        i_10 = (i_10 + 1) & (CACHE_INDEX_10 - 1);
+    CACHE_10->index[i_10] = -2;
+    if (++CACHE_10->tombs > CACHE_INDEX_10 / 4)
+    {
+        for (int j_10 = 0; j_10 < CACHE_INDEX_10; ++j_10)
+            CACHE_10->index[j_10] = -1;
+        CACHE_10->tombs = 0;
+        for (int j_10 = 0; j_10 < CACHE_SLOTS_10; ++j_10)
+            if (CACHE_10->e[j_10].list != -2 && !CACHE_10->e[j_10].dead)
+                cache_index_add_10(j_10);
+    }
+}
+
+static unsigned long long cache_cost_10(const struct centry_10 *e_10, int list_10)
+{
+    if (list_10 == CL_DISK_10)
+        return e_10->ver.size;
+    return (e_10->ver.size + CACHE_BLOCK_10 - 1) / CACHE_BLOCK_10 * CACHE_BLOCK_10;
+}
+static void cache_unlink_10(int s_10)
+{
+    struct centry_10 *e_10 = &CACHE_10->e[s_10];
+    int l_10 = e_10->list;
+    if (l_10 < 0)
+        return;
+    if (e_10->prev >= 0) CACHE_10->e[e_10->prev].next = e_10->next; else CACHE_10->head[l_10] = e_10->next;
+    if (e_10->next >= 0) CACHE_10->e[e_10->next].prev = e_10->prev; else CACHE_10->tail[l_10] = e_10->prev;
+    CACHE_10->bytes[l_10] -= cache_cost_10(e_10, l_10);
+    e_10->list = -1;
+}
+static void cache_push_10(int s_10, int l_10)
+{
+    struct centry_10 *e_10 = &CACHE_10->e[s_10];
+    e_10->list = l_10;
+    e_10->prev = -1;
+    e_10->next = CACHE_10->head[l_10];
+    if (e_10->next >= 0) CACHE_10->e[e_10->next].prev = s_10; else CACHE_10->tail[l_10] = s_10;
+    CACHE_10->head[l_10] = s_10;
+    CACHE_10->bytes[l_10] += cache_cost_10(e_10, l_10);
+}
+
+static int cache_blocks_alloc_10(int n_10)
+{
+    if (n_10 > CACHE_10->nfree_blocks)
+        return -2;
+    int first_10 = -1, *link_10 = &first_10;
+    for (int i_10 = 0; i_10 < n_10; ++i_10)
+    {
+        int b_10 = CACHE_10->free_block;
+        CACHE_10->free_block = CBLOCK_NEXT_10[b_10];
+        *link_10 = b_10;
+        link_10 = &CBLOCK_NEXT_10[b_10];
+    }
+    *link_10 = -1;
+    CACHE_10->nfree_blocks -= n_10;
+    return first_10;
+}
+static void cache_blocks_free_10(int b_10)
+{
+    while (b_10 >= 0)
+    {
+        int next_10 = CBLOCK_NEXT_10[b_10];
+        CBLOCK_NEXT_10[b_10] = CACHE_10->free_block;
+        CACHE_10->free_block = b_10;
+        ++CACHE_10->nfree_blocks;
+        b_10 = next_10;
+    }
+}
+// gives the slot back once nobody has it pinned
+static void cache_release_10(int s_10)
+{
+    struct centry_10 *e_10 = &CACHE_10->e[s_10];
+    cache_blocks_free_10(e_10->block);
+    if (e_10->disk_id)
+    {
+        char p_10[PATH_MAX];
+        cache_disk_path_10(p_10, sizeof p_10, e_10->disk_id);
+        unlink(p_10);
+    }
+    memset(e_10, 0, sizeof *e_10);
+    e_10->list = -2;   /* free */
+    e_10->block = -1;
+    e_10->next = CACHE_10->free_slot;
+    CACHE_10->free_slot = s_10;
+}
+static void cache_drop_slot_10(int s_10)
+{
+    struct centry_10 *e_10 = &CACHE_10->e[s_10];
+    if (e_10->dead)
+        return;
+    cache_unlink_10(s_10);
+    e_10->dead = 1;
+    cache_index_del_10(s_10);
+    if (!e_10->pins)
+        cache_release_10(s_10);
+}
+static void cache_unpin_10(int s_10)
+{
+    if (--CACHE_10->e[s_10].pins == 0 && CACHE_10->e[s_10].dead)
+        cache_release_10(s_10);
+}
+// least recently used entry of a list that nobody has pinned
+static int cache_victim_10(int l_10)
+{
+    int s_10 = CACHE_10->tail[l_10];
+    while (s_10 >= 0 && CACHE_10->e[s_10].pins)
+        s_10 = CACHE_10->e[s_10].prev;
+    return s_10;
+}
+static void cache_trim_disk_10(void)
+{
+    unsigned long long cap_10 = (unsigned long long)CACHE_DISK_MB_10 << 20;
+    int s_10;
+    while (CACHE_10->bytes[CL_DISK_10] > cap_10 && (s_10 = cache_victim_10(CL_DISK_10)) >= 0)
+    {
+        cache_drop_slot_10(s_10);
+        ++CACHE_10->evicted;
+    }
+}
+
+// copies n bytes between a file and a block chain, a run of adjacent blocks per call
+static int cache_blocks_io_10(int fd_10, int b_10, unsigned long long n_10, int out_10)
+{
+    while (n_10 > 0 && b_10 >= 0)
+    {
+        int run_10 = 1;
+        while ((unsigned long long)run_10 * CACHE_BLOCK_10 < n_10 && CBLOCK_NEXT_10[b_10 + run_10 - 1] == b_10 + run_10)
+            ++run_10;
+        size_t len_10 = (size_t)run_10 * CACHE_BLOCK_10;
+        if (len_10 > n_10)
+            len_10 = (size_t)n_10;
+        char *p_10 = CDATA_10 + (size_t)b_10 * CACHE_BLOCK_10;
+        if (out_10)
+        {
+            if (write_fully_10(fd_10, p_10, len_10) != (ssize_t)len_10)
+                return -1;
+        }
+        else
+        {
+            for (size_t got_10 = 0; got_10 < len_10;)
+            {
+                ssize_t r_10 = read(fd_10, p_10 + got_10, len_10 - got_10);
+                if (r_10 < 0 && errno == EINTR)
+                    continue;
+                if (r_10 <= 0)
+                    return -1;
+                got_10 += (size_t)r_10;
+            }
+        }
+        n_10 -= len_10;
+        b_10 = CBLOCK_NEXT_10[b_10 + run_10 - 1];
+    }
+    return n_10 ? -1 : 0;
+}
+
+// the generation a fetch starts from; a fetch whose generation has passed is not cached
+static unsigned long long cache_seq_10(void)
+{
+    return CACHE_10 ? __atomic_load_n(&CACHE_10->seq, __ATOMIC_ACQUIRE) : 0;
+}
+// drops a file S1 has just written or removed on the backends
+static void cache_drop_10(const char *dir_10, const char *name_10)
+{
+    char key_10[CACHE_KEY_10];
+    if (!CACHE_10 || cache_key_10(key_10, dir_10, name_10) != 0)
+        return;
+    cache_lock_10();
+    ++CACHE_10->seq;
+    int s_10 = cache_find_10(key_10, cache_hash_10(key_10));
+    if (s_10 >= 0)
+        cache_drop_slot_10(s_10);
+    cache_unlock_10();
+}
+
+// drops every file under a folder, for a recursive remove
+static void cache_drop_tree_10(const char *dir_10)
+{
+    char key_10[CACHE_KEY_10];
+    if (!CACHE_10 || cache_key_10(key_10, dir_10, NULL) != 0)
+        return;
+    cache_lock_10();
+    ++CACHE_10->seq;
+    for (int s_10 = 0; s_10 < CACHE_SLOTS_10; ++s_10)
+        if (CACHE_10->e[s_10].list != -2 && !CACHE_10->e[s_10].dead && key_under_10(CACHE_10->e[s_10].key, key_10))
+            cache_drop_slot_10(s_10);
+    cache_unlock_10();
+}
+
+// serves rel_path from the cache into tmp_path: 1 when it did, 0 when the caller must fetch it.
+// An entry due for a check is checked against the serving replicas of pl, quickest first
+static int cache_get_10(const struct place_10 *pl_10, const char *rel_path_10, const char *tmp_path_10)
+{
+    char key_10[CACHE_KEY_10];
+    if (!CACHE_10 || cache_key_10(key_10, rel_path_10, NULL) != 0)
+        return 0;
+    cache_lock_10();
+    int s_10 = cache_find_10(key_10, cache_hash_10(key_10));
+    if (s_10 < 0 || CACHE_10->e[s_10].list < 0)
+    {
+        ++CACHE_10->misses;
+        cache_unlock_10();
+        return 0;
+    }
+    struct centry_10 *e_10 = &CACHE_10->e[s_10];
+    ++e_10->pins;
+    struct fver_10 ver_10 = e_10->ver;
+    unsigned long long checked_10 = e_10->checked_us;
+    cache_unlock_10();
+
+    if (now_us_10() - checked_10 >= (unsigned long long)CACHE_REVAL_MS_10 * 1000ULL)
+    {
+        struct fver_10 cur_10 = { 0, 0 };
+        int there_10 = -1;
+        for (int r_10 = 0; r_10 < pl_10->nserve && there_10 < 0; ++r_10)
+            there_10 = backend_stat_10(pl_10->node[r_10], rel_path_10, &cur_10);
+        int fresh_10 = there_10 == 1 && cur_10.size == ver_10.size && cur_10.mtime == ver_10.mtime;
+        cache_lock_10();
+        if (fresh_10)
+        {
+            e_10->checked_us = now_us_10();
+            ++CACHE_10->revalidated;
+        }
+        else
+        {
+            // changed or gone; a backend that could not be asked leaves the entry for next time
+            ++CACHE_10->misses;
+            if (there_10 >= 0)
+            {
+                ++CACHE_10->stale;
+                cache_drop_slot_10(s_10);
+            }
+            cache_unpin_10(s_10);
+            cache_unlock_10();
+            return 0;
+        }
+        cache_unlock_10();
+    }
+
+    // pinned, the entry stays in its tier and keeps its blocks or file while it is copied out
+    int rc_10 = -1, l_10 = e_10->list;
+    if (l_10 == CL_DISK_10)
+    {
+        char p_10[PATH_MAX];
+        cache_disk_path_10(p_10, sizeof p_10, e_10->disk_id);
+        unlink(tmp_path_10);
+        rc_10 = link(p_10, tmp_path_10);   /* ~/S1/tmp is on the same filesystem */
+    }
+    else
+    {
+        int fd_10 = open(tmp_path_10, O_WRONLY|O_TRUNC);
+        if (fd_10 >= 0)
+        {
+            rc_10 = cache_blocks_io_10(fd_10, e_10->block, ver_10.size, 1);
+            close(fd_10);
+        }
+    }
+
+    cache_lock_10();
+    if (rc_10 == 0)
+    {
+        ++CACHE_10->hits[l_10];
+        if (!e_10->dead && e_10->list >= 0)
+        {
+            // a second hit makes a probation entry protected; protected keeps 80% of memory and
+            // hands its least recent entries back to probation beyond that
+            cache_unlink_10(s_10);
+            cache_push_10(s_10, l_10 == CL_PROB_10 ? CL_PROT_10 : l_10);
+            unsigned long long cap_10 = (unsigned long long)CACHE_NBLOCKS_10 * CACHE_BLOCK_10 / 5 * 4;
+            int v_10;
+            while (CACHE_10->bytes[CL_PROT_10] > cap_10 && (v_10 = CACHE_10->tail[CL_PROT_10]) != s_10 && v_10 >= 0)
+            {
+                cache_unlink_10(v_10);
+                cache_push_10(v_10, CL_PROB_10);
+            }
+        }
+    }
+    else
+        ++CACHE_10->misses;
+    cache_unpin_10(s_10);
+    cache_unlock_10();
+    return rc_10 == 0;
+}
+
+// moves protected entries pushed out of memory to the disk tier; they are pinned and off their
+// lists (their blocks still held) until this is done
+static void cache_demote_10(const int *slots_10, int n_10)
+{
+    int ok_10[CACHE_DEMOTE_10];
+    for (int i_10 = 0; i_10 < n_10; ++i_10)
+    {
+        const struct centry_10 *e_10 = &CACHE_10->e[slots_10[i_10]];
+        char p_10[PATH_MAX];
+        cache_disk_path_10(p_10, sizeof p_10, e_10->disk_id);
+        int fd_10 = open(p_10, O_CREAT|O_TRUNC|O_WRONLY, 0600);
+        ok_10[i_10] = fd_10 >= 0 && cache_blocks_io_10(fd_10, e_10->block, e_10->ver.size, 1) == 0;
+        if (fd_10 >= 0)
+            close(fd_10);
+    }
+    cache_lock_10();
+    for (int i_10 = 0; i_10 < n_10; ++i_10)
+    {
+        int s_10 = slots_10[i_10];
+        struct centry_10 *e_10 = &CACHE_10->e[s_10];
+        cache_blocks_free_10(e_10->block);
+        e_10->block = -1;
+        if (ok_10[i_10] && !e_10->dead)
+            cache_push_10(s_10, CL_DISK_10);
+        else if (!e_10->dead)
+            cache_drop_slot_10(s_10);
+        cache_unpin_10(s_10);
+    }
+    cache_trim_disk_10();
+    cache_unlock_10();
+}
+
+// caches a file just fetched into tmp_path, unless the cache was invalidated since seq
+static void cache_put_10(const char *rel_path_10, const char *tmp_path_10, const struct fver_10 *ver_10, unsigned long long seq_10)
+{
+    char key_10[CACHE_KEY_10];
+    if (!CACHE_10 || cache_key_10(key_10, rel_path_10, NULL) != 0)
+        return;
+    int need_10 = (int)((ver_10->size + CACHE_BLOCK_10 - 1) / CACHE_BLOCK_10);
+    int to_disk_10 = ver_10->size > (unsigned long long)CACHE_NBLOCKS_10 / 8 * CACHE_BLOCK_10;
+    if (to_disk_10 && (!CACHE_DISK_MB_10 || ver_10->size > ((unsigned long long)CACHE_DISK_MB_10 << 20) / 4))
+        return;
+
+    unsigned h_10 = cache_hash_10(key_10);
+    cache_lock_10();
+    if (CACHE_10->seq != seq_10 || CACHE_10->free_slot < 0 || cache_find_10(key_10, h_10) >= 0)
+    {
+        cache_unlock_10();
+        return;
+    }
+    int s_10 = CACHE_10->free_slot;
+    struct centry_10 *e_10 = &CACHE_10->e[s_10];
+    CACHE_10->free_slot = e_10->next;
+    memset(e_10, 0, sizeof *e_10);
+    memcpy(e_10->key, key_10, strlen(key_10) + 1);
+    e_10->hash = h_10;
+    e_10->ver = *ver_10;
+    e_10->list = -1;   /* in the index, so a second fill of it backs off, but not served yet */
+    e_10->block = -1;
+    e_10->pins = 1;
+    cache_index_add_10(s_10);
+
+    // room in memory: probation goes first, then protected, which moves down to disk if any
+    int demote_10[CACHE_DEMOTE_10], nd_10 = 0, pending_10 = 0;
+    while (!to_disk_10 && CACHE_10->nfree_blocks + pending_10 < need_10)
+    {
+        int v_10 = cache_victim_10(CL_PROB_10);
+        if (v_10 < 0)
+            v_10 = cache_victim_10(CL_PROT_10);
+        if (v_10 < 0)
+            break;
+        struct centry_10 *ve_10 = &CACHE_10->e[v_10];
+        ++CACHE_10->evicted;
+        if (ve_10->list == CL_PROT_10 && CACHE_DISK_MB_10 && nd_10 < CACHE_DEMOTE_10)
+        {
+            cache_unlink_10(v_10);
+            ++ve_10->pins;
+            ve_10->disk_id = ++CACHE_10->disk_seq;
+            pending_10 += (int)((ve_10->ver.size + CACHE_BLOCK_10 - 1) / CACHE_BLOCK_10);
+            demote_10[nd_10++] = v_10;
+        }
+        else
+            cache_drop_slot_10(v_10);
+    }
+    if (to_disk_10)
+        e_10->disk_id = ++CACHE_10->disk_seq;
+    cache_unlock_10();
+
+    if (nd_10)
+        cache_demote_10(demote_10, nd_10);
+
+    int ok_10 = 0;
+    if (to_disk_10)
+    {
+        char p_10[PATH_MAX];
+        cache_disk_path_10(p_10, sizeof p_10, e_10->disk_id);
+        ok_10 = link(tmp_path_10, p_10) == 0;
+    }
+    else
+    {
+        cache_lock_10();
+        int b_10 = need_10 ? cache_blocks_alloc_10(need_10) : -1;
+        if (b_10 != -2)
+            e_10->block = b_10;
+        cache_unlock_10();
+        int fd_10 = b_10 == -2 ? -1 : open(tmp_path_10, O_RDONLY);
+        if (fd_10 >= 0)
+        {
+            ok_10 = cache_blocks_io_10(fd_10, b_10, ver_10->size, 0) == 0;
+            close(fd_10);
+        }
+    }
+
+    cache_lock_10();
+    if (ok_10 && !e_10->dead)
+    {
+        e_10->checked_us = now_us_10();
+        cache_push_10(s_10, to_disk_10 ? CL_DISK_10 : CL_PROB_10);
+        if (to_disk_10)
+            cache_trim_disk_10();
+    }
+    else if (!e_10->dead)
+        cache_drop_slot_10(s_10);
+    cache_unpin_10(s_10);
+    cache_unlock_10();
+}
+
+static void cache_metrics_10(struct mbuf_10 *b_10)
+{
+    if (!CACHE_10)
+        return;
+    unsigned long long hits_10[CL_COUNT_10], bytes_10[CL_COUNT_10], misses_10, reval_10, stale_10, evicted_10;
+    cache_lock_10();   /* the counters as of one moment */
+    memcpy(hits_10, CACHE_10->hits, sizeof hits_10);
+    memcpy(bytes_10, CACHE_10->bytes, sizeof bytes_10);
+    misses_10 = CACHE_10->misses;
+    reval_10 = CACHE_10->revalidated;
+    stale_10 = CACHE_10->stale;
+    evicted_10 = CACHE_10->evicted;
+    cache_unlock_10();
+    mprintf_10(b_10, "# HELP dfs_cache_hits_total Downloads served from the read cache, by segment.\n# TYPE dfs_cache_hits_total counter\n");
+    for (int l_10 = 0; l_10 < CL_COUNT_10; ++l_10)
+        mprintf_10(b_10, "dfs_cache_hits_total{segment=\"%s\"} %llu\n", CL_NAMES_10[l_10], hits_10[l_10]);
+    mprintf_10(b_10, "# HELP dfs_cache_misses_total Downloads the read cache could not serve.\n# TYPE dfs_cache_misses_total counter\n"
+        "dfs_cache_misses_total %llu\n", misses_10);
+    mprintf_10(b_10, "# HELP dfs_cache_revalidations_total Cached files checked against the backend and still current.\n# TYPE dfs_cache_revalidations_total counter\n"
+        "dfs_cache_revalidations_total %llu\n", reval_10);
+    mprintf_10(b_10, "# HELP dfs_cache_stale_total Cached files found changed or gone on the backend.\n# TYPE dfs_cache_stale_total counter\n"
+        "dfs_cache_stale_total %llu\n", stale_10);
+    mprintf_10(b_10, "# HELP dfs_cache_evictions_total Files pushed out of memory or off the disk tier to make room.\n# TYPE dfs_cache_evictions_total counter\n"
+        "dfs_cache_evictions_total %llu\n", evicted_10);
+    mprintf_10(b_10, "# HELP dfs_cache_bytes Bytes held by each segment of the read cache.\n# TYPE dfs_cache_bytes gauge\n");
+    for (int l_10 = 0; l_10 < CL_COUNT_10; ++l_10)
+        mprintf_10(b_10, "dfs_cache_bytes{segment=\"%s\"} %llu\n", CL_NAMES_10[l_10], bytes_10[l_10]);
+}
+
+// maps the memory tier, shared by every child, and empties the disk tier left by a previous run
+static void cache_init_10(void)
+{
+    if (CACHE_MEM_MB_10 == 0 && CACHE_DISK_MB_10 == 0)
+        return;
+    CACHE_NBLOCKS_10 = (int)(((unsigned long long)CACHE_MEM_MB_10 << 20) / CACHE_BLOCK_10);
+    size_t sz_10 = sizeof(struct cache_10) + sizeof(int) * (size_t)CACHE_NBLOCKS_10;
+    void *p_10 = mmap(NULL, sz_10, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    void *d_10 = CACHE_NBLOCKS_10 ? mmap(NULL, (size_t)CACHE_NBLOCKS_10 * CACHE_BLOCK_10, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0) : NULL;
+    if (p_10 == MAP_FAILED || d_10 == MAP_FAILED)
+    {
+        perror("cache mmap");
+        return;
+    }
+    CACHE_10 = (struct cache_10*)p_10;
+    CBLOCK_NEXT_10 = (int*)(CACHE_10 + 1);
+    CDATA_10 = (char*)d_10;
+    for (int c_10 = 0; c_10 < CL_COUNT_10; ++c_10)
+        CACHE_10->head[c_10] = CACHE_10->tail[c_10] = -1;
+    for (int i_10 = 0; i_10 < CACHE_INDEX_10; ++i_10)
+        CACHE_10->index[i_10] = -1;
+    for (int s_10 = 0; s_10 < CACHE_SLOTS_10; ++s_10)
+    {
+        CACHE_10->e[s_10].list = -2;
+        CACHE_10->e[s_10].next = s_10 + 1 < CACHE_SLOTS_10 ? s_10 + 1 : -1;
+    }
+    for (int b_10 = 0; b_10 < CACHE_NBLOCKS_10; ++b_10)
+        CBLOCK_NEXT_10[b_10] = b_10 + 1 < CACHE_NBLOCKS_10 ? b_10 + 1 : -1;
+    CACHE_10->free_block = CACHE_NBLOCKS_10 ? 0 : -1;
+    CACHE_10->nfree_blocks = CACHE_NBLOCKS_10;
+
+    CACHE_DIR_10 = build_s1_path_10("~S1/.cache", 1);
+    DIR *dir_10 = opendir(CACHE_DIR_10);
+    struct dirent *de_10;
+    while (dir_10 && (de_10 = readdir(dir_10)))
+        if (de_10->d_name[0] != '.')
+        {
+            char p_10[PATH_MAX];
+            snprintf(p_10, sizeof p_10, "%s/%s", CACHE_DIR_10, de_10->d_name);
+            unlink(p_10);
+        }
+    if (dir_10)
+        closedir(dir_10);
+}
+
+// REPLICATION: an upload goes to every replica at once, one child process per backend leg, and
+// is acknowledged as soon as the class's write quorum has stored it; the slower legs finish in
+// the background. Each leg sends its own hard link of the staged file, so the staged name can
+// be removed before they are all done
+static int store_replicas_10(const struct place_10 *pl_10, int nw_10, int quorum_10,
+    const char *rel_dir_10, const char *fname_10, const char *tmp_path_10)
+{
+    if (nw_10 == 1)
+        return forward_store_10(pl_10->node[0], rel_dir_10, fname_10, tmp_path_10);
+    pid_t pid_10[2 * MAX_REPLICAS_10];
+    int acks_10 = 0, fails_10 = 0, pending_10 = 0;
+    for (int i_10 = 0; i_10 < nw_10; ++i_10)
+    {
+        char *leg_10 = NULL;
+        asprintf(&leg_10, "%s.%d", tmp_path_10, i_10);
+        pid_10[i_10] = -1;
+        if (link(tmp_path_10, leg_10) == 0)
+            pid_10[i_10] = fork();
+        if (pid_10[i_10] == 0)
+        {
+            int rc_10 = forward_store_10(pl_10->node[i_10], rel_dir_10, fname_10, leg_10);
+            unlink(leg_10);
+            trace_flush_10();
+            _exit(rc_10 == 0 ? 0 : 1);
+        }
+        if (pid_10[i_10] > 0)
+            ++pending_10;
+        else
+        {
+            // no child: this leg runs here instead
+            unlink(leg_10);
+            int ok_10 = forward_store_10(pl_10->node[i_10], rel_dir_10, fname_10, tmp_path_10) == 0;
+            if (i_10 < pl_10->nserve)
+                ok_10 ? ++acks_10 : ++fails_10;
+        }
+        free(leg_10);
+    }
+    // only the serving replicas count toward the quorum; stop once it is met or out of reach
+    while (pending_10 > 0 && acks_10 < quorum_10 && pl_10->nserve - fails_10 >= quorum_10)
+    {
+        int st_10;
+        pid_t w_10 = waitpid(-1, &st_10, 0);
+        if (w_10 < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        for (int i_10 = 0; i_10 < nw_10; ++i_10)
+            if (pid_10[i_10] == w_10)
+            {
+                --pending_10;
+                if (i_10 < pl_10->nserve)
+                    (WIFEXITED(st_10) && WEXITSTATUS(st_10) == 0) ? ++acks_10 : ++fails_10;
+            }
+    }
+    return acks_10 >= quorum_10 ? 0 : -1;
+}
+
+// WRITE-BACK: with "writeback on" an upload to a remote class is acknowledged once it is in
+// S1's journal (~/S1/.journal: the bytes and the file's path, both fsynced), and a forwarder
+// process stores it on its replicas afterwards. The forwarder sends up to WB_BATCH_10 files
+// over one connection, keeps at most WB_LEGS_10 connections per backend, and retries a file
+// whose legs failed with a growing delay until every replica has it; only then does the file
+// leave the journal. Until then downloads and listings see it in the journal, a newer upload of
+// the same file supersedes it and a remove cancels it. The journal of a crashed S1 is forwarded
+// after the restart. With the journal index full, an upload is stored at once as before
+#define WB_SLOTS_10 1024
+#define WB_RETRY_MS_10 100        /* first retry, doubled up to WB_RETRY_MAX_MS_10 */
+#define WB_RETRY_MAX_MS_10 10000
+
+enum { WB_FREE_10, WB_PENDING_10, WB_SENDING_10 };
+
+struct wbent_10
+{
+    char key[CACHE_KEY_10];      /* path under ~S1, as in the READ CACHE */
+    char id[48];                 /* journal name, sorts in upload order */
+    unsigned hash;
+    int state, legs, failed, cancelled, superseded;
+    unsigned long long done;     /* a bit per node that has stored it */
+    unsigned long long sent;     /* and per node a leg went to, which may store it after timing out */
+    unsigned long long size, tries, next_us;
+};
+// a forwarder worker and its batch; the worker marks each file it settles, so the files of a
+// worker that died on the way can be failed and retried
+struct wbworker_10
+{
+    pid_t pid;
+    int node, n;
+    int slot[64];
+    char settled[64];
+};
+struct wb_10
+{
+    int lock;
+    unsigned long long forwarded, retries;
+    struct wbent_10 e[WB_SLOTS_10];
+    struct wbworker_10 w[MAX_NODES_10 * 8];
+};
+static struct wb_10 *WB_10 = NULL;
+static char *WB_DIR_10 = NULL;
+static int wb_wake_fd_10[2] = { -1, -1 };   /* an upload pokes the forwarder through this pipe */
+static pid_t forwarder_pid_10 = -1;
+
+static void wb_lock_10(void)
+{
+    while (__atomic_exchange_n(&WB_10->lock, 1, __ATOMIC_ACQUIRE))
+        sched_yield();
+}
+static void wb_unlock_10(void)
+{
+    __atomic_store_n(&WB_10->lock, 0, __ATOMIC_RELEASE);
+}
+static void wb_path_10(char *out_10, size_t n_10, const char *id_10, const char *ext_10)
+{
+    snprintf(out_10, n_10, "%s/%s.%s", WB_DIR_10, id_10, ext_10);
+}
+// the newest live journal entry of a key, or -1
+static int wb_find_10(const char *key_10, unsigned h_10)
+{
+    int best_10 = -1;
+    for (int s_10 = 0; s_10 < WB_SLOTS_10; ++s_10)
+    {
+        const struct wbent_10 *e_10 = &WB_10->e[s_10];
+        if (e_10->state != WB_FREE_10 && e_10->hash == h_10 && !e_10->cancelled && !e_10->superseded
+            && !strcmp(e_10->key, key_10) && (best_10 < 0 || strcmp(e_10->id, WB_10->e[best_10].id) > 0))
+            best_10 = s_10;
+    }
+    return best_10;
+}
+static int wb_add_10(const char *key_10, const char *id_10, unsigned long long size_10)
+{
+    unsigned h_10 = cache_hash_10(key_10);
+    wb_lock_10();
+    int s_10 = -1;
+    for (int i_10 = 0; i_10 < WB_SLOTS_10; ++i_10)
+    {
+        struct wbent_10 *e_10 = &WB_10->e[i_10];
+        if (e_10->state == WB_FREE_10)
+        {
+            if (s_10 < 0)
+                s_10 = i_10;
+        }
+        else if (e_10->hash == h_10 && !strcmp(e_10->key, key_10))
+            e_10->superseded = 1;
+    }
+    if (s_10 >= 0)
+    {
+        struct wbent_10 *e_10 = &WB_10->e[s_10];
+        memset(e_10, 0, sizeof *e_10);
+        memcpy(e_10->key, key_10, strlen(key_10) + 1);
+        snprintf(e_10->id, sizeof e_10->id, "%s", id_10);
+        e_10->hash = h_10;
+        e_10->size = size_10;
+        e_10->state = WB_PENDING_10;
+    }
+    wb_unlock_10();
+    return s_10;
+}
+
+// journals an upload that has been received into tmp_path: 0 once it is on disk (tmp_path is
+// gone then), -1 when it should be stored at once instead
+static int wb_journal_10(const char *dest_10, const char *fname_10, const char *tmp_path_10)
+{
+    char key_10[CACHE_KEY_10];
+    if (!WB_10 || cache_key_10(key_10, dest_10, fname_10) != 0)
+        return -1;
+    static unsigned seq_10;
+    struct timespec ts_10;
+    clock_gettime(CLOCK_REALTIME, &ts_10);
+    char id_10[48], data_10[PATH_MAX], meta_10[PATH_MAX], tmp_10[PATH_MAX];
+    snprintf(id_10, sizeof id_10, "%016llx-%d-%u",
+        (unsigned long long)ts_10.tv_sec * 1000000000ULL + (unsigned long long)ts_10.tv_nsec, (int)getpid(), seq_10++);
+    wb_path_10(data_10, sizeof data_10, id_10, "data");
+    wb_path_10(meta_10, sizeof meta_10, id_10, "meta");
+    wb_path_10(tmp_10, sizeof tmp_10, id_10, "tmp");
+
+    // the bytes first, then the record naming them; the record's rename is the commit
+    struct stat st_10;
+    int fd_10 = open(tmp_path_10, O_RDONLY);
+    int ok_10 = fd_10 >= 0 && fsync(fd_10) == 0 && fstat(fd_10, &st_10) == 0;
+    if (fd_10 >= 0)
+        close(fd_10);
+    if (!ok_10 || rename(tmp_path_10, data_10) != 0)
+        return -1;
+    FILE *m_10 = fopen(tmp_10, "w");
+    ok_10 = m_10 && fprintf(m_10, "%s\n", key_10) > 0 && fflush(m_10) == 0 && fsync(fileno(m_10)) == 0;
+    if (m_10)
+        ok_10 = fclose(m_10) == 0 && ok_10;
+    int dfd_10 = open(WB_DIR_10, O_RDONLY | O_DIRECTORY);
+    ok_10 = ok_10 && rename(tmp_10, meta_10) == 0 && dfd_10 >= 0 && fsync(dfd_10) == 0;
+    if (dfd_10 >= 0)
+        close(dfd_10);
+    if (!ok_10 || wb_add_10(key_10, id_10, (unsigned long long)st_10.st_size) < 0)
+    {
+        // hand the bytes back to the caller
+        unlink(tmp_10);
+        unlink(meta_10);
+        if (rename(data_10, tmp_path_10) != 0)
+            unlink(data_10);
+        return -1;
+    }
+    if (write(wb_wake_fd_10[1], "", 1) < 0)
+    {
+        /* the pipe is full: the forwarder is awake anyway */
+    }
+    return 0;
+}
+
+// serves a file that is still only in the journal: 1 when tmp_path now has it
+static int wb_read_10(const char *rel_path_10, const char *tmp_path_10)
+{
+    char key_10[CACHE_KEY_10], id_10[48];
+    if (!WB_10 || cache_key_10(key_10, rel_path_10, NULL) != 0)
+        return 0;
+    wb_lock_10();
+    int s_10 = wb_find_10(key_10, cache_hash_10(key_10));
+    if (s_10 >= 0)
+        memcpy(id_10, WB_10->e[s_10].id, sizeof id_10);
+    wb_unlock_10();
+    if (s_10 < 0)
+        return 0;
+    // the forwarder may be done with it meanwhile, and then the backend has it
+    char data_10[PATH_MAX];
+    wb_path_10(data_10, sizeof data_10, id_10, "data");
+    unlink(tmp_path_10);
+    return link(data_10, tmp_path_10) == 0;
+}
+
+// cancels the journal entries of a file being removed, or with tree of every file under a
+// folder; returns how many files had one, and with keys their paths under ~S1 (to be freed)
+static int wb_cancel_10(const char *rel_path_10, int tree_10, char ***keys_10)
+{
+    char key_10[CACHE_KEY_10];
+    if (keys_10)
+        *keys_10 = NULL;
+    if (!WB_10 || cache_key_10(key_10, rel_path_10, NULL) != 0)
+        return 0;
+    unsigned h_10 = cache_hash_10(key_10);
+    int n_10 = 0;
+    wb_lock_10();
+    for (int s_10 = 0; s_10 < WB_SLOTS_10; ++s_10)
+    {
+        struct wbent_10 *e_10 = &WB_10->e[s_10];
+        if (e_10->state == WB_FREE_10 || e_10->cancelled
+            || (tree_10 ? !key_under_10(e_10->key, key_10) : e_10->hash != h_10 || strcmp(e_10->key, key_10)))
+            continue;
+        if (!e_10->superseded)
+        {
+            if (keys_10)
+            {
+                *keys_10 = (char**)realloc(*keys_10, sizeof(char*) * (size_t)(n_10 + 1));
+                (*keys_10)[n_10] = strdup(e_10->key);
+            }
+            ++n_10;
+        }
+        e_10->cancelled = 1;
+    }
+    wb_unlock_10();
+    if (n_10 && write(wb_wake_fd_10[1], "", 1) < 0)
+    {
+        /* the forwarder is awake anyway */
+    }
+    return n_10;
+}
+
+// the replicas a journaled file goes to, as an upload would pick them
+static int wb_targets_10(const struct wbent_10 *e_10, int *nodes_10)
+{
+    const char *slash_10 = strrchr(e_10->key, '/');
+    int cls_10 = route_10(slash_10 ? slash_10 + 1 : e_10->key);
+    if (cls_10 < 0 || CLASSES_10[cls_10].local)
+        return 0;
+    char path_10[CACHE_KEY_10 + 8];
+    snprintf(path_10, sizeof path_10, "~S1/%s", e_10->key);
+    struct place_10 pl_10 = place_10(cls_10, path_10, NULL);
+    int nw_10 = pl_10.state == SEG_COPYING_10 ? pl_10.n : pl_10.nserve;
+    memcpy(nodes_10, pl_10.node, sizeof(int) * (size_t)nw_10);
+    return nw_10;
+}
+
+// a forwarder worker: one connection to a backend, a STORE per journaled file
+static void wb_send_batch_10(struct wbworker_10 *w_10)
+{
+    int node_10 = w_10->node, n_10 = w_10->n;
+    const int *slots_10 = w_10->slot;
+    unsigned long long t0_10 = stat_leg_begin_10();
+    unsigned long long tw_10 = trace_begin_10();
+    int fd_10 = leg_connect_10(node_10, BOP_STORE_10);
+    int sent_10 = 0;
+    for (int i_10 = 0; i_10 < n_10; ++i_10)
+    {
+        struct wbent_10 *e_10 = &WB_10->e[slots_10[i_10]];   /* kept while its legs are out */
+        char data_10[PATH_MAX], dir_10[CACHE_KEY_10 + 8];
+        wb_path_10(data_10, sizeof data_10, e_10->id, "data");
+        const char *slash_10 = strrchr(e_10->key, '/');
+        snprintf(dir_10, sizeof dir_10, "~S1/%.*s", slash_10 ? (int)(slash_10 - e_10->key) : 0, e_10->key);
+        int ok_10 = fd_10 >= 0 && store_send_10(fd_10, dir_10, slash_10 ? slash_10 + 1 : e_10->key, data_10, 0) == 0;
+        if (!ok_10 && fd_10 >= 0)
+        {
+            close(fd_10);   /* the rest of the batch is not sent on a broken leg */
+            fd_10 = -1;
+        }
+        sent_10 += ok_10;
+        // dropped again now this backend has it, in case a fetch since the upload cached the old file
+        if (ok_10)
+            cache_drop_10(e_10->key, NULL);
+        wb_lock_10();
+        if (ok_10)
+            e_10->done |= 1ULL << node_10;
+        else
+            e_10->failed = 1;
+        w_10->settled[i_10] = 1;
+        --e_10->legs;
+        wb_unlock_10();
+    }
+    if (fd_10 >= 0)
+        close(fd_10);
+    trace_span_10("backend.store", NODES_10[node_10].name, tw_10);
+    stat_leg_end_10(node_10, t0_10, sent_10 == n_10);
+}
+
+// a worker has exited: whatever of its batch it did not settle (it died on the way, killed or
+// crashed) counts as a failed leg, so the entry is retried instead of staying in flight for good
+static void wb_reap_10(struct wbworker_10 *w_10, int died_10)
+{
+    wb_lock_10();
+    for (int i_10 = 0; died_10 && i_10 < w_10->n; ++i_10)
+        if (!w_10->settled[i_10])
+        {
+            WB_10->e[w_10->slot[i_10]].failed = 1;
+            --WB_10->e[w_10->slot[i_10]].legs;
+        }
+    w_10->n = 0;
+    w_10->pid = 0;
+    wb_unlock_10();
+}
+
+// one pass of the forwarder: settles entries whose legs are all back, then sends what is due
+static void wb_pass_10(int *legs_10)
+{
+    struct { int node; char key[CACHE_KEY_10]; } undo_10[64];
+    char gone_10[64][48];
+    int nundo_10 = 0, ngone_10 = 0;
+    unsigned long long now_10 = now_us_10();
+
+    wb_lock_10();
+    for (int s_10 = 0; s_10 < WB_SLOTS_10; ++s_10)
+    {
+        struct wbent_10 *e_10 = &WB_10->e[s_10];
+        if (e_10->state == WB_FREE_10 || e_10->legs > 0)
+            continue;
+        int nodes_10[2 * MAX_REPLICAS_10], nt_10 = wb_targets_10(e_10, nodes_10), all_10 = 1;
+        for (int t_10 = 0; t_10 < nt_10; ++t_10)
+            all_10 &= (int)((e_10->done >> nodes_10[t_10]) & 1);
+        int finish_10 = e_10->cancelled || e_10->superseded || (nt_10 > 0 && all_10);
+        if (finish_10 && ngone_10 < 64 && (!e_10->cancelled || nundo_10 + __builtin_popcountll(e_10->sent) <= 64))
+        {
+            // a cancelled file that reached a backend after the remove is removed again there
+            for (int n_10 = 0; e_10->cancelled && n_10 < NNODES_10; ++n_10)
+                if ((e_10->sent >> n_10) & 1)
+                {
+                    undo_10[nundo_10].node = n_10;
+                    memcpy(undo_10[nundo_10++].key, e_10->key, sizeof e_10->key);
+                }
+            if (!e_10->cancelled && !e_10->superseded)
+                ++WB_10->forwarded;
+            memcpy(gone_10[ngone_10++], e_10->id, sizeof e_10->id);
+            e_10->state = WB_FREE_10;
+        }
+        else if (e_10->state == WB_SENDING_10)
+        {
+            e_10->state = WB_PENDING_10;
+            if (e_10->failed)
+            {
+                unsigned long long ms_10 = (unsigned long long)WB_RETRY_MS_10 << (e_10->tries < 7 ? e_10->tries : 7);
+                e_10->next_us = now_10 + (ms_10 < WB_RETRY_MAX_MS_10 ? ms_10 : WB_RETRY_MAX_MS_10) * 1000ULL;
+                ++e_10->tries;
+                ++WB_10->retries;
+                e_10->failed = 0;
+            }
+        }
+    }
+    wb_unlock_10();
+
+    for (int i_10 = 0; i_10 < nundo_10; ++i_10)
+    {
+        char path_10[CACHE_KEY_10 + 8];
+        snprintf(path_10, sizeof path_10, "~S1/%s", undo_10[i_10].key);
+        backend_delete_10(undo_10[i_10].node, path_10);
+    }
+    for (int i_10 = 0; i_10 < ngone_10; ++i_10)
+    {
+        char p_10[PATH_MAX];
+        wb_path_10(p_10, sizeof p_10, gone_10[i_10], "meta");
+        unlink(p_10);
+        wb_path_10(p_10, sizeof p_10, gone_10[i_10], "data");
+        unlink(p_10);
+    }
+
+    // due files, oldest first per backend, while the backend has a free leg and the batch room;
+    // a file waits while an older upload of the same path is still being sent
+    int batch_10[MAX_NODES_10][64], nb_10[MAX_NODES_10];
+    memset(nb_10, 0, sizeof nb_10);
+    wb_lock_10();
+    for (int s_10 = 0; s_10 < WB_SLOTS_10; ++s_10)
+    {
+        struct wbent_10 *e_10 = &WB_10->e[s_10];
+        if (e_10->state != WB_PENDING_10 || e_10->cancelled || e_10->superseded || e_10->next_us > now_10)
+            continue;
+        int busy_10 = 0;
+        for (int o_10 = 0; o_10 < WB_SLOTS_10 && !busy_10; ++o_10)
+            busy_10 = WB_10->e[o_10].state == WB_SENDING_10 && WB_10->e[o_10].hash == e_10->hash && !strcmp(WB_10->e[o_10].key, e_10->key);
+        if (busy_10)
+            continue;
+        int nodes_10[2 * MAX_REPLICAS_10], nt_10 = wb_targets_10(e_10, nodes_10);
+        if (!nt_10)
+        {
+            fprintf(stderr, "[S1] journal: %s no longer goes to a backend, dropped\n", e_10->key);
+            e_10->cancelled = 1;
+            continue;
+        }
+        for (int t_10 = 0; t_10 < nt_10; ++t_10)
+        {
+            int n_10 = nodes_10[t_10];
+            if ((e_10->done >> n_10) & 1 || legs_10[n_10] >= WB_LEGS_10 || nb_10[n_10] >= WB_BATCH_10)
+                continue;
+            batch_10[n_10][nb_10[n_10]++] = s_10;
+            e_10->sent |= 1ULL << n_10;
+            ++e_10->legs;
+            e_10->state = WB_SENDING_10;
+        }
+    }
+    wb_unlock_10();
+
+    for (int n_10 = 0; n_10 < NNODES_10; ++n_10)
+    {
+        if (!nb_10[n_10])
+            continue;
+        // at most WB_LEGS_10 (<= 8) workers per node are out, so a record is always free
+        struct wbworker_10 *w_10 = WB_10->w;
+        while (w_10->pid)
+            ++w_10;
+        w_10->node = n_10;
+        w_10->n = nb_10[n_10];
+        memcpy(w_10->slot, batch_10[n_10], sizeof(int) * (size_t)nb_10[n_10]);
+        memset(w_10->settled, 0, sizeof w_10->settled);
+        pid_t pid_10 = fork();
+        if (pid_10 == 0)
+        {
+            wb_send_batch_10(w_10);
+            trace_flush_10();
+            _exit(0);
+        }
+        if (pid_10 < 0)
+        {
+            wb_send_batch_10(w_10);
+            continue;
+        }
+        w_10->pid = pid_10;
+        ++legs_10[n_10];
+    }
+}
+
+static void wb_metrics_10(struct mbuf_10 *b_10)
+{
+    if (!WB_10)
+        return;
+    unsigned long long n_10 = 0, bytes_10 = 0;
+    wb_lock_10();
+    for (int s_10 = 0; s_10 < WB_SLOTS_10; ++s_10)
+        if (WB_10->e[s_10].state != WB_FREE_10 && !WB_10->e[s_10].cancelled && !WB_10->e[s_10].superseded)
+        {
+            ++n_10;
+            bytes_10 += WB_10->e[s_10].size;
+        }
+    unsigned long long fwd_10 = WB_10->forwarded, retries_10 = WB_10->retries;
+    wb_unlock_10();
+    prom_gauge_10(b_10, "dfs_writeback_pending", "Uploads journaled but not yet on all their replicas", n_10);
+    prom_gauge_10(b_10, "dfs_writeback_pending_bytes", "Bytes of the journaled uploads", bytes_10);
+    mprintf_10(b_10, "# HELP dfs_writeback_forwarded_total Journaled uploads stored on all their replicas\n# TYPE dfs_writeback_forwarded_total counter\ndfs_writeback_forwarded_total %llu\n", fwd_10);
+    mprintf_10(b_10, "# HELP dfs_writeback_retries_total Forwarding attempts retried after a failed leg\n# TYPE dfs_writeback_retries_total counter\ndfs_writeback_retries_total %llu\n", retries_10);
+}
+
+// picks up the journal of a previous run, then forks the forwarder
+static void wb_start_10(void)
+{
+    if (!WB_ON_10)
+        return;
+    void *p_10 = mmap(NULL, sizeof(struct wb_10), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    if (p_10 == MAP_FAILED || pipe(wb_wake_fd_10) != 0)
+    {
+        perror("writeback");
+        return;
+    }
+    WB_10 = (struct wb_10*)p_10;
+    WB_DIR_10 = build_s1_path_10("~S1/.journal", 1);
+    fcntl(wb_wake_fd_10[1], F_SETFL, O_NONBLOCK);
+
+    DIR *dir_10 = opendir(WB_DIR_10);
+    struct dirent *de_10;
+    int n_10 = 0;
+    while (dir_10 && (de_10 = readdir(dir_10)))
+    {
+        char id_10[48], p_10[PATH_MAX], key_10[CACHE_KEY_10 + 2];
+        size_t nl_10 = strlen(de_10->d_name);
+        if (nl_10 < 6 || nl_10 - 5 >= sizeof id_10 || strcmp(de_10->d_name + nl_10 - 5, ".meta"))
+            continue;
+        snprintf(id_10, sizeof id_10, "%.*s", (int)(nl_10 - 5), de_10->d_name);
+        wb_path_10(p_10, sizeof p_10, id_10, "meta");
+        FILE *m_10 = fopen(p_10, "r");
+        struct stat st_10;
+        if (m_10 && fgets(key_10, sizeof key_10, m_10))
+        {
+            key_10[strcspn(key_10, "\n")] = '\0';
+            wb_path_10(p_10, sizeof p_10, id_10, "data");
+            if (stat(p_10, &st_10) == 0 && strlen(key_10) < CACHE_KEY_10 && wb_add_10(key_10, id_10, (unsigned long long)st_10.st_size) >= 0)
+                ++n_10;
+        }
+        if (m_10)
+            fclose(m_10);
+    }
+    if (dir_10)
+        closedir(dir_10);
+    if (n_10)
+        fprintf(stderr, "[S1] journal: %d uploads left to forward\n", n_10);
+
+    pid_t pid_10 = fork();
+    if (pid_10 == 0)
+    {
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        signal(SIGCHLD, SIG_DFL);
+        signal(SIGPIPE, SIG_IGN);   /* a backend gone mid-store fails the leg, not the worker */
+        close(wb_wake_fd_10[1]);
+        int legs_10[MAX_NODES_10];
+        memset(legs_10, 0, sizeof legs_10);
+        for (;;)
+        {
+            pid_t w_10;
+            int st_10;
+            while ((w_10 = waitpid(-1, &st_10, WNOHANG)) > 0)
+                for (int i_10 = 0; i_10 < MAX_NODES_10 * 8; ++i_10)
+                    if (WB_10->w[i_10].pid == w_10)
+                    {
+                        --legs_10[WB_10->w[i_10].node];
+                        wb_reap_10(&WB_10->w[i_10], !(WIFEXITED(st_10) && WEXITSTATUS(st_10) == 0));
+                    }
+            wb_pass_10(legs_10);
+            // woken by an upload, otherwise every 50 ms for retries and finished legs
+            struct pollfd pf_10 = { wb_wake_fd_10[0], POLLIN, 0 };
+            if (poll(&pf_10, 1, 50) > 0)
+            {
+                char buf_10[64];
+                if (read(wb_wake_fd_10[0], buf_10, sizeof buf_10) < 0)
+                    continue;
+            }
+        }
+    }
+    if (pid_10 < 0)
+        perror("forwarder fork");
+    // the read end stays open here too: with the forwarder gone an upload's wake-up finds the
+    // pipe full instead of raising SIGPIPE, and the journal keeps taking uploads for the restart
+    forwarder_pid_10 = pid_10;
+}
+
+// handlers for all the 5 commands (uploadf, downlf, removef, downltar, dispfnames)
+
+//this is the uploadf handler
+//handles the user uploads, keeps locally routed files in the S1 directory and forwards the rest
+// also checks if the max files does not exceed 3 for this command
+static void handle_uploadf_10(int cfd_10, char *line_10)
+{
+    char *save_10 = NULL;
+    strtok_r(line_10, "|", &save_10);          /* "UPLOADF" */
+    char *nstr_10  = strtok_r(NULL, "|", &save_10);
+    char *dest_10  = strtok_r(NULL, "|", &save_10);
+    int n_10 = nstr_10 ? atoi(nstr_10) : 0;
+
+    if (n_10 < 1 || n_10 > 3 || !dest_10 || !path_is_s1_10(dest_10))
+    {
+        send_line_10(cfd_10, "ERR|bad upload header");
+        return;
+    }
+
+    char lost_10[LINE_MAX_10 - 32] = "";   /* files that missed their write quorum */
+    size_t nlost_10 = 0;
+    for (int i_10 = 0; i_10 < n_10; ++i_10)
+    {
+        char meta_10[LINE_MAX_10];
+        if (read_line_10(cfd_10, meta_10, sizeof meta_10) <= 0)
+            return;
+
+        if (strncmp(meta_10, "FILEMETA|", 9)!=0)
+            return;
+
+        char *sav2_10 = NULL;
+        char *fname_10 = strtok_r(meta_10+9, "|", &sav2_10);
+        char *szstr_10 = strtok_r(NULL, "|", &sav2_10);
+        size_t fsz_10 = (size_t)strtoull(szstr_10?szstr_10:"0", NULL, 10);
+
+        // stage into a unique temp file so two uploads of the same name never clobber each other
+        char *tmpfile_10 = NULL;
+        int tfd_10 = make_temp_10("up", &tmpfile_10);
+        if (tfd_10 < 0)
+        {
+            // the file's bytes are still on the way: skip them and report it with the other lost ones
+            if (drain_10(cfd_10, fsz_10) != 0)
+                return;
+            if (nlost_10 + strlen(fname_10 ? fname_10 : "") + 2 < sizeof lost_10)
+                nlost_10 += (size_t)snprintf(lost_10 + nlost_10, sizeof lost_10 - nlost_10, "%s%s", nlost_10 ? "," : "", fname_10 ? fname_10 : "");
+            continue;
+        }
+        unsigned long long tr_10 = trace_begin_10();
+        int rc_10 = recv_file_to_fd_10(cfd_10, tfd_10, fsz_10);
+        trace_span_10("stage", "S1", tr_10);
+        close(tfd_10);
+        if (rc_10 != 0)
+        {
+            unlink(tmpfile_10); free(tmpfile_10);
+            return;
+        }
+
+        int cls_10 = route_10(fname_10?fname_10:"");
+
+        if (cls_10 >= 0 && CLASSES_10[cls_10].local)
+        {
+            // ~/S1/tmp is on the same filesystem, so rename publishes the whole file at once
+            char *dst_dir_10  = build_s1_path_10(dest_10, 1);
+            char *dst_path_10 = NULL; asprintf(&dst_path_10, "%s/%s", dst_dir_10, fname_10);
+            if (rename(tmpfile_10, dst_path_10) != 0)
+                unlink(tmpfile_10);
+            free(dst_path_10); free(dst_dir_10);
+        }
+        else if (cls_10 >= 0 && WB_ON_10 && wb_journal_10(dest_10, fname_10, tmpfile_10) == 0)
+        {
+            cache_drop_10(dest_10, fname_10);   /* the journal serves it until it is forwarded; the forwarder drops it again */
+        }
+        else if (cls_10 >= 0)
+        {
+            // a stretch being copied also sends the write to the replicas it is copied to
+            struct place_10 pl_10 = place_10(cls_10, dest_10, fname_10);
+            int nw_10 = pl_10.state == SEG_COPYING_10 ? pl_10.n : pl_10.nserve;
+            int quorum_10 = CLASSES_10[cls_10].wquorum < pl_10.nserve ? CLASSES_10[cls_10].wquorum : pl_10.nserve;
+            if (store_replicas_10(&pl_10, nw_10, quorum_10, dest_10, fname_10, tmpfile_10) != 0 && nlost_10 + strlen(fname_10) + 2 < sizeof lost_10)
+                nlost_10 += (size_t)snprintf(lost_10 + nlost_10, sizeof lost_10 - nlost_10, "%s%s", nlost_10 ? "," : "", fname_10);
+            cache_drop_10(dest_10, fname_10);   /* after the store, so no fetch of the old file is cached */
+            unlink(tmpfile_10);  // the backends have their own copies (or the forward failed)
+        }
+        else
+        {
+            unlink(tmpfile_10);
+        }
+        free(tmpfile_10);
+    }
+    if (nlost_10)
+        send_line_10(cfd_10, "ERR|not_stored|%s", lost_10);
+    else
+        send_line_10(cfd_10, "OK");
+}
+
+//this is the downlf handler
+//downloads the required files for the client under ~/S1/downloaded_files/
+static void handle_downlf_10(int cfd_10, char *line_10)
+{
+    strtok_r(line_10, "|", &line_10); /* "DOWNLF" */
+    char *nstr_10 = strtok_r(NULL, "|", &line_10);
+    int n_10 = nstr_10 ? atoi(nstr_10) : 0;
+
+    if (n_10 < 1 || n_10 > 2)
+    {
+        send_line_10(cfd_10, "ERR|bad downlf header");
+        return;
+    }
+
+    for (int i_10 = 0; i_10 < n_10; ++i_10)
+    {
+        char *pp_10 = strtok_r(NULL, "|", &line_10);
+        if (!pp_10 || !path_is_s1_10(pp_10))
+        {
+            send_line_10(cfd_10, "FILENOTFOUND|%s", pp_10?pp_10:"");
+            continue;
+        }
+
+        int cls_10 = route_10(pp_10);
+
+        if (cls_10 >= 0 && CLASSES_10[cls_10].local)
+        {
+            char *full_10 = build_s1_path_10(pp_10, 0);
+            struct stat st_10;
+            if (stat(full_10, &st_10) != 0 || !S_ISREG(st_10.st_mode))
+            {
+                send_line_10(cfd_10, "FILENOTFOUND|%s", pp_10);
+                free(full_10);
+                continue;
+            }
+            size_t sz_10 = (size_t)st_10.st_size;
+            const char *basename_10 = strrchr(full_10, '/');
+            basename_10 = basename_10 ? basename_10+1 : full_10;
+
+            unsigned long long ta_10 = trace_begin_10();
+            archive_copy_10("downloaded_files", basename_10, full_10);
+            trace_span_10("archive", "S1", ta_10);
+
+            send_line_10(cfd_10, "FILERESP|%s|%zu", basename_10, sz_10);
+            unsigned long long tx_10 = trace_begin_10();
+            send_file_from_path_10(cfd_10, full_10, NULL, write_fully_10);
+            trace_span_10("send", "S1", tx_10);
+            free(full_10);
+
+        }
+        else if (cls_10 >= 0)
+        {
+            // fetch into a temp file from the backend, then send & archive
+            char *tmpout_10 = NULL;
+            int tfd_10 = make_temp_10("fetch", &tmpout_10);
+            if (tfd_10 < 0)
+            {
+                send_line_10(cfd_10, "FILENOTFOUND|%s", pp_10);
+                continue;
+            }
+            close(tfd_10);
+
+            // from the read cache if it is there; otherwise the quickest replica first, hedged onto
+            // the next one when it is slow to answer (a stretch being rebalanced may still, or
+            // already, have the file on its other replicas), and cached. The generation is taken
+            // before any lookup, so an upload that lands meanwhile keeps this fetch out of the cache
+            struct place_10 pl_10 = place_10(cls_10, pp_10, NULL);
+            place_rank_10(&pl_10);
+            unsigned long long seq_10 = cache_seq_10();
+            int hit_10 = wb_read_10(pp_10, tmpout_10);   /* not forwarded yet: the journal has it */
+            if (!hit_10)
+            {
+                unsigned long long tc_10 = trace_begin_10();
+                hit_10 = cache_get_10(&pl_10, pp_10, tmpout_10);
+                trace_span_10(hit_10 ? "cache.hit" : "cache.miss", "S1", tc_10);
+            }
+            struct fver_10 ver_10;
+            if (!hit_10 && hedged_fetch_10(&pl_10, pp_10, tmpout_10, &ver_10) == 0)
+                cache_put_10(pp_10, tmpout_10, &ver_10, seq_10);
+            else if (!hit_10)
+            {
+                send_line_10(cfd_10, "FILENOTFOUND|%s", pp_10);
+                unlink(tmpout_10); free(tmpout_10);
+                continue;
+            }
+            struct stat st_10; stat(tmpout_10, &st_10);
+            size_t size_10 = (size_t)st_10.st_size;
+            const char *base_10 = strrchr(pp_10, '/');
+            base_10 = base_10? base_10+1 : pp_10;
+
+            unsigned long long ta_10 = trace_begin_10();
+            archive_copy_10("downloaded_files", base_10, tmpout_10);
+            trace_span_10("archive", "S1", ta_10);
+
+            send_line_10(cfd_10, "FILERESP|%s|%zu", base_10, size_10);
+            unsigned long long tx_10 = trace_begin_10();
+            send_file_from_path_10(cfd_10, tmpout_10, NULL, write_fully_10);
+            trace_span_10("send", "S1", tx_10);
+            unlink(tmpout_10); free(tmpout_10);
+
+        }
+        else
+        {
+            send_line_10(cfd_10, "FILENOTFOUND|%s", pp_10);
+        }
+    }
+    send_line_10(cfd_10, "DONE");
+}
+
+// this is the handler for removef
+//deletes locally routed files here and the others on their backend
+static void handle_removef_10(int cfd_10, char *line_10)
+{
+    strtok_r(line_10, "|", &line_10);
+    char *nstr_10 = strtok_r(NULL, "|", &line_10);
+    int n_10 = nstr_10 ? atoi(nstr_10) : 0;
+    if (n_10 < 1 || n_10 > 2)
+    {
+        send_line_10(cfd_10, "ERR|bad removef header");
+        return;
+    }
+
+    for (int i_10 = 0; i_10 < n_10; ++i_10)
+    {
+        char *pp_10 = strtok_r(NULL, "|", &line_10);
+        if (!pp_10 || !path_is_s1_10(pp_10))
+        {
+            send_line_10(cfd_10, "REMERR|%s|bad_path", pp_10?pp_10:"");
+            continue;
+        }
+        int cls_10 = route_10(pp_10);
+
+        if (cls_10 >= 0 && CLASSES_10[cls_10].local)
+        {
+            char *full_10 = build_s1_path_10(pp_10, 0);
+            if (unlink(full_10) == 0)
+                send_line_10(cfd_10, "REMOK|%s", pp_10);
+            else
+                send_line_10(cfd_10, "REMERR|%s|%s", pp_10, strerror(errno));
+            free(full_10);
+
+        }
+        else if (cls_10 >= 0)
+        {
+            // every replica; while a stretch is copied or not yet cleaned up, its old and new replicas
+            struct place_10 pl_10 = place_10(cls_10, pp_10, NULL);
+            int nd_10 = pl_10.state == SEG_OLD_10 ? pl_10.nserve : pl_10.n, ok_10 = wb_cancel_10(pp_10, 0, NULL) > 0;
+            for (int r_10 = 0; r_10 < nd_10; ++r_10)
+                if (backend_delete_10(pl_10.node[r_10], pp_10) == 0)
+                    ok_10 = 1;
+            cache_drop_10(pp_10, NULL);
+            if (ok_10)
+                send_line_10(cfd_10, "REMOK|%s", pp_10);
+            else
+                send_line_10(cfd_10, "REMERR|%s|NOT FOUND", pp_10);
+        }
+        else
+        {
+            send_line_10(cfd_10, "REMERR|%s|unsupported", pp_10);
+        }
+    }
+}
+
+// batched and recursive removes, for cleanups of many files at once:
+//   REMOVEM|<n>, then n paths one per line: the files are taken RM_BATCH_10 at a time, and each
+//     backend gets the files of a batch it holds as one DELETEM on one connection, all backends
+//     at once; a REMOK or REMERR line per file follows each batch
+//   REMOVER|<folder>: every file under the folder, on S1 and on every backend at once (DELTREE),
+//     with a REMOK line per file as the backends report them
+// both end with REMDONE|<removed>|<failed>
+#define RM_BATCH_10 512
+#define RM_MAX_10 100000
+
+// a set of names, to report a file removed from several replicas once
+struct nameset_10 { char **slot; unsigned cap, n; };
+static int nameset_add_10(struct nameset_10 *set_10, const char *name_10)
+{
+    if ((set_10->n + 1) * 2 > set_10->cap)
+    {
+        struct nameset_10 big_10 = { NULL, set_10->cap ? set_10->cap * 2 : 256, 0 };
+        big_10.slot = (char**)calloc(big_10.cap, sizeof(char*));
+        for (unsigned i_10 = 0; i_10 < set_10->cap; ++i_10)
+            if (set_10->slot[i_10])
+            {
+                unsigned j_10 = cache_hash_10(set_10->slot[i_10]) & (big_10.cap - 1);
+                while (big_10.slot[j_10])
+                    j_10 = (j_10 + 1) & (big_10.cap - 1);
+                big_10.slot[j_10] = set_10->slot[i_10];
+                ++big_10.n;
+            }
+        free(set_10->slot);
+        *set_10 = big_10;
+    }
+    unsigned j_10 = cache_hash_10(name_10) & (set_10->cap - 1);
+    for (; set_10->slot[j_10]; j_10 = (j_10 + 1) & (set_10->cap - 1))
+        if (!strcmp(set_10->slot[j_10], name_10))
+            return 0;
+    set_10->slot[j_10] = strdup(name_10);
+    ++set_10->n;
+    return 1;
+}
+static void nameset_free_10(struct nameset_10 *set_10)
+{
+    for (unsigned i_10 = 0; i_10 < set_10->cap; ++i_10)
+        free(set_10->slot[i_10]);
+    free(set_10->slot);
+}
+
+// removes a batch of files; ok gets whether each is gone, why the reason when it is not
+static void rm_batch_10(char **paths_10, int n_10, int *ok_10, const char **why_10)
+{
+    static int items_10[MAX_NODES_10][RM_BATCH_10];
+    int nitems_10[MAX_NODES_10];
+    memset(nitems_10, 0, sizeof nitems_10);
+    for (int i_10 = 0; i_10 < n_10; ++i_10)
+    {
+        const char *pp_10 = paths_10[i_10];
+        ok_10[i_10] = 0;
+        why_10[i_10] = "NOT FOUND";
+        int cls_10 = path_is_s1_10(pp_10) ? route_10(pp_10) : -1;
+        if (!path_is_s1_10(pp_10))
+            why_10[i_10] = "bad_path";
+        else if (cls_10 >= 0 && CLASSES_10[cls_10].local)
+        {
+            char *full_10 = build_s1_path_10(pp_10, 0);
+            ok_10[i_10] = unlink(full_10) == 0;
+            if (!ok_10[i_10])
+                why_10[i_10] = strerror(errno);
+            free(full_10);
+        }
+        else if (cls_10 >= 0)
+        {
+            // every replica, as for REMOVEF
+            struct place_10 pl_10 = place_10(cls_10, pp_10, NULL);
+            int nd_10 = pl_10.state == SEG_OLD_10 ? pl_10.nserve : pl_10.n;
+            for (int r_10 = 0; r_10 < nd_10; ++r_10)
+                items_10[pl_10.node[r_10]][nitems_10[pl_10.node[r_10]]++] = i_10;
+            ok_10[i_10] = wb_cancel_10(pp_10, 0, NULL) > 0;
+        }
+        else
+            why_10[i_10] = "unsupported";
+    }
+
+    struct pleg_10 legs_10[MAX_NODES_10];
+    struct pleg_10 *wait_10[MAX_NODES_10];
+    int idx_10[MAX_NODES_10], nw_10 = 0;
+    for (int b_10 = 0; b_10 < NNODES_10; ++b_10)
+    {
+        if (!nitems_10[b_10])
+            continue;
+        char req_10[32];
+        snprintf(req_10, sizeof req_10, "DELETEM|%d", nitems_10[b_10]);
+        if (pleg_start_10(&legs_10[b_10], b_10, BOP_DELETE_10, req_10) != 0)
+            continue;
+        pleg_enter_10(&legs_10[b_10]);
+        int sent_10 = 1;
+        for (int k_10 = 0; k_10 < nitems_10[b_10] && sent_10; ++k_10)
+            sent_10 = send_line_10(legs_10[b_10].fd, "%s", paths_10[items_10[b_10][k_10]] + 4) == 0;
+        pleg_leave_10(&legs_10[b_10]);
+        if (!sent_10)
+        {
+            pleg_end_10(&legs_10[b_10], "backend.delete", 0);
+            continue;
+        }
+        idx_10[nw_10] = b_10;
+        wait_10[nw_10++] = &legs_10[b_10];
+    }
+    // the replies of whichever backend answers first, until all have
+    while (nw_10)
+    {
+        int w_10 = pleg_wait_10(wait_10, nw_10, BOP_MS_10[BOP_DELETE_10]);
+        if (w_10 < 0)
+        {
+            for (int i_10 = 0; i_10 < nw_10; ++i_10)
+                pleg_end_10(wait_10[i_10], "backend.delete", 0);
+            break;
+        }
+        int b_10 = idx_10[w_10], k_10 = 0;
+        pleg_enter_10(wait_10[w_10]);
+        for (; k_10 < nitems_10[b_10]; ++k_10)
+        {
+            char line_10[LINE_MAX_10];
+            if (read_line_10(wait_10[w_10]->fd, line_10, sizeof line_10) <= 0)
+                break;
+            if (!strcmp(line_10, "OK"))
+                ok_10[items_10[b_10][k_10]] = 1;
+        }
+        pleg_leave_10(wait_10[w_10]);
+        pleg_end_10(wait_10[w_10], "backend.delete", k_10 == nitems_10[b_10]);
+        wait_10[w_10] = wait_10[--nw_10];
+        idx_10[w_10] = idx_10[nw_10];
+    }
+    for (int i_10 = 0; i_10 < n_10; ++i_10)
+        if (path_is_s1_10(paths_10[i_10]))
+            cache_drop_10(paths_10[i_10], NULL);
+}
+
+static void handle_removem_10(int cfd_10, char *line_10)
+{
+    int n_10 = atoi(line_10 + 8);
+    if (n_10 < 1 || n_10 > RM_MAX_10)
+    {
+        send_line_10(cfd_10, "ERR|bad removem header");
+        return;
+    }
+    // the whole list is read first, so a client still sending it never blocks on unread replies
+    char **paths_10 = (char**)malloc(sizeof(char*) * (size_t)n_10);
+    for (int i_10 = 0; i_10 < n_10; ++i_10)
+    {
+        char p_10[LINE_MAX_10];
+        if (read_line_10(cfd_10, p_10, sizeof p_10) <= 0)
+        {
+            while (i_10--)
+                free(paths_10[i_10]);
+            free(paths_10);
+            return;
+        }
+        paths_10[i_10] = strdup(p_10);
+    }
+    int ok_10[RM_BATCH_10];
+    const char *why_10[RM_BATCH_10];
+    unsigned long long removed_10 = 0, failed_10 = 0;
+    for (int base_10 = 0; base_10 < n_10; base_10 += RM_BATCH_10)
+    {
+        int k_10 = n_10 - base_10 < RM_BATCH_10 ? n_10 - base_10 : RM_BATCH_10;
+        rm_batch_10(paths_10 + base_10, k_10, ok_10, why_10);
+        for (int i_10 = 0; i_10 < k_10; ++i_10)
+        {
+            if (ok_10[i_10])
+                send_line_10(cfd_10, "REMOK|%s", paths_10[base_10 + i_10]);
+            else
+                send_line_10(cfd_10, "REMERR|%s|%s", paths_10[base_10 + i_10], why_10[i_10]);
+            removed_10 += ok_10[i_10] != 0;
+            failed_10 += ok_10[i_10] == 0;
+            free(paths_10[base_10 + i_10]);
+        }
+    }
+    free(paths_10);
+    send_line_10(cfd_10, "REMDONE|%llu|%llu", removed_10, failed_10);
+}
+
+// removes the files kept on S1 itself under a folder, and the folders left empty
+static void rm_local_tree_10(int cfd_10, int dfd_10, const char *rel_10, unsigned long long *removed_10, unsigned long long *failed_10)
+{
+    DIR *d_10 = fdopendir(dfd_10);
+    if (!d_10)
+    {
+        close(dfd_10);
+        return;
+    }
+    struct dirent *e_10;
+    while ((e_10 = readdir(d_10)))
+    {
+        if (e_10->d_name[0] == '.')
+            continue;
+        char *r_10 = NULL;
+        asprintf(&r_10, "%s/%s", rel_10, e_10->d_name);
+        struct stat st_10;
+        if (fstatat(dirfd(d_10), e_10->d_name, &st_10, AT_SYMLINK_NOFOLLOW) == 0)
+        {
+            int cls_10 = route_10(e_10->d_name);
+            if (S_ISDIR(st_10.st_mode))
+            {
+                int sub_10 = openat(dirfd(d_10), e_10->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+                if (sub_10 >= 0)
+                {
+                    rm_local_tree_10(cfd_10, sub_10, r_10, removed_10, failed_10);
+                    unlinkat(dirfd(d_10), e_10->d_name, AT_REMOVEDIR);   /* fails while anything is left */
+                }
+            }
+            else if (S_ISREG(st_10.st_mode) && cls_10 >= 0 && CLASSES_10[cls_10].local)
+            {
+                if (unlinkat(dirfd(d_10), e_10->d_name, 0) == 0)
+                {
+                    send_line_10(cfd_10, "REMOK|~S1/%s", r_10);
+                    ++*removed_10;
+                }
+                else
+                {
+                    send_line_10(cfd_10, "REMERR|~S1/%s|%s", r_10, strerror(errno));
+                    ++*failed_10;
+                }
+            }
+        }
+        free(r_10);
+    }
+    closedir(d_10);
+}
+
+// DELTREE on every backend at once (one leg per address); a file is reported the first time a
+// replica removed it, and as failed only if none did
+static void rm_tree_backends_10(int cfd_10, const char *rel_10, struct nameset_10 *seen_10,
+    unsigned long long *removed_10, unsigned long long *failed_10)
+{
+    char req_10[LINE_MAX_10];
+    snprintf(req_10, sizeof req_10, "DELTREE|%s", rel_10);
+    struct pleg_10 legs_10[MAX_NODES_10];
+    struct pleg_10 *wait_10[MAX_NODES_10];
+    int idx_10[MAX_NODES_10], nw_10 = 0;
+    for (int b_10 = 0; b_10 < NNODES_10; ++b_10)
+    {
+        int dup_10 = 0;
+        for (int o_10 = 0; o_10 < b_10 && !dup_10; ++o_10)
+            dup_10 = NODES_10[o_10].port == NODES_10[b_10].port && !strcmp(NODES_10[o_10].host, NODES_10[b_10].host);
+        if (dup_10 || NODES_10[b_10].cls < 0 || CLASSES_10[NODES_10[b_10].cls].local)
+            continue;
+        if (pleg_start_10(&legs_10[b_10], b_10, BOP_DELETE_10, req_10) != 0)
+        {
+            send_line_10(cfd_10, "REMERR|~S1/%s|%s unreachable", rel_10, NODES_10[b_10].name);
+            ++*failed_10;
+            continue;
+        }
+        idx_10[nw_10] = b_10;
+        wait_10[nw_10++] = &legs_10[b_10];
+    }
+
+    char **fails_10 = NULL;   /* "path|reason", reported at the end unless another replica removed it */
+    int nfails_10 = 0;
+    while (nw_10)
+    {
+        int w_10 = pleg_wait_10(wait_10, nw_10, 0);
+        if (w_10 < 0)
+        {
+            obuf_flush_10();   /* the REMOK lines so far, while the backends go on */
+            w_10 = pleg_wait_10(wait_10, nw_10, BOP_MS_10[BOP_DELETE_10]);
+        }
+        int done_10 = 0, ok_10 = 0;
+        char line_10[LINE_MAX_10];
+        if (w_10 >= 0)
+        {
+            pleg_enter_10(wait_10[w_10]);
+            int r_10 = read_line_10(wait_10[w_10]->fd, line_10, sizeof line_10);
+            pleg_leave_10(wait_10[w_10]);
+            if (r_10 > 0 && !strncmp(line_10, "DEL|", 4))
+            {
+                char path_10[LINE_MAX_10 + 8];
+                snprintf(path_10, sizeof path_10, "~S1/%s", line_10 + 4);
+                if (nameset_add_10(seen_10, path_10))
+                {
+                    send_line_10(cfd_10, "REMOK|%s", path_10);
+                    ++*removed_10;
+                }
+            }
+            else if (r_10 > 0 && !strncmp(line_10, "FAIL|", 5))
+            {
+                fails_10 = (char**)realloc(fails_10, sizeof(char*) * (size_t)(nfails_10 + 1));
+                fails_10[nfails_10++] = strdup(line_10 + 5);
+            }
+            else if (r_10 <= 0 || strcmp(line_10, "OK"))
+            {
+                done_10 = 1;   /* END, or the leg broke off */
+                ok_10 = r_10 > 0 && !strcmp(line_10, "END");
+            }
+        }
+        for (int i_10 = 0; i_10 < nw_10; ++i_10)
+        {
+            if (w_10 >= 0 && (i_10 != w_10 || !done_10))
+                continue;
+            pleg_end_10(wait_10[i_10], "backend.delete", ok_10);
+            if (!ok_10)
+            {
+                send_line_10(cfd_10, "REMERR|~S1/%s|%s did not finish", rel_10, NODES_10[idx_10[i_10]].name);
+                ++*failed_10;
+            }
+        }
+        if (w_10 < 0)
+            break;
+        if (done_10)
+        {
+            wait_10[w_10] = wait_10[--nw_10];
+            idx_10[w_10] = idx_10[nw_10];
+        }
+    }
+    for (int i_10 = 0; i_10 < nfails_10; ++i_10)
+    {
+        char *bar_10 = strchr(fails_10[i_10], '|');
+        if (bar_10)
+            *bar_10++ = '\0';
+        char path_10[LINE_MAX_10 + 8];
+        snprintf(path_10, sizeof path_10, "~S1/%s", fails_10[i_10]);
+        if (nameset_add_10(seen_10, path_10))
+        {
+            send_line_10(cfd_10, "REMERR|%s|%s", path_10, bar_10 ? bar_10 : "error");
+            ++*failed_10;
+        }
+        free(fails_10[i_10]);
+    }
+    free(fails_10);
+}
+
+static void handle_remover_10(int cfd_10, char *line_10)
+{
+    // a folder under ~S1, but not S1's own ones (tmp, downloaded_files, tar_files, hidden)
+    char rel_10[LINE_MAX_10];
+    const char *pp_10 = line_10 + 8;
+    snprintf(rel_10, sizeof rel_10, "%s", path_is_s1_10(pp_10) ? pp_10 + 4 : "");
+    size_t n_10 = strlen(rel_10);
+    while (n_10 && rel_10[n_10 - 1] == '/')
+        rel_10[--n_10] = '\0';
+    size_t top_10 = strcspn(rel_10, "/");
+    int bad_10 = !n_10 || strstr(rel_10, "/.") || rel_10[0] == '.'
+        || (top_10 == 3 && !strncmp(rel_10, "tmp", 3)) || (top_10 == 16 && !strncmp(rel_10, "downloaded_files", 16))
+        || (top_10 == 9 && !strncmp(rel_10, "tar_files", 9));
+    if (bad_10)
+    {
+        send_line_10(cfd_10, "ERR|bad_path");
+        return;
+    }
+
+    unsigned long long removed_10 = 0, failed_10 = 0;
+    struct nameset_10 seen_10 = { NULL, 0, 0 };
+    char *full_10 = build_s1_path_10(rel_10, 0);
+    int dfd_10 = open(full_10, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+    if (dfd_10 >= 0)
+    {
+        rm_local_tree_10(cfd_10, dfd_10, rel_10, &removed_10, &failed_10);
+        rmdir(full_10);
+    }
+    free(full_10);
+
+    // uploads still in the write-back journal are cancelled (and removed if they land meanwhile)
+    char **keys_10 = NULL;
+    int nk_10 = wb_cancel_10(pp_10, 1, &keys_10);
+    for (int i_10 = 0; i_10 < nk_10; ++i_10)
+    {
+        char path_10[CACHE_KEY_10 + 8];
+        snprintf(path_10, sizeof path_10, "~S1/%s", keys_10[i_10]);
+        if (nameset_add_10(&seen_10, path_10))
+        {
+            send_line_10(cfd_10, "REMOK|%s", path_10);
+            ++removed_10;
+        }
+        free(keys_10[i_10]);
+    }
+    free(keys_10);
+
+    rm_tree_backends_10(cfd_10, rel_10, &seen_10, &removed_10, &failed_10);
+    cache_drop_tree_10(pp_10);
+    nameset_free_10(&seen_10);
+    send_line_10(cfd_10, "REMDONE|%llu|%llu", removed_10, failed_10);
+}
+
+// this is the handler for downltar
+// send the required tar files to ~/S1/tar_files/ with fixed names:
+/*          .c   -> cfiles.tar
+          .pdf -> pdfs.tar
+          .txt -> textiles.tar
+          any other .ext -> extfiles.tar
+*/
+static const char *tar_name_10(const char *ext_10)
+{
+    static char out_10[EXT_MAX_10 + 16];
+    if (!strcmp(ext_10, ".c"))
+        return "cfiles.tar";
+    if (!strcmp(ext_10, ".pdf"))
+        return "pdfs.tar";
+    if (!strcmp(ext_10, ".txt"))
+        return "textiles.tar";
+    snprintf(out_10, sizeof out_10, "%sfiles.tar", ext_10 + 1);
+    return out_10;
+}
+// a remote class's tar of one type, built with the streaming archive's member filter below
+static int class_tar_10(int cls_10, const char *ext_10, char **out_tmp_path_10, size_t *out_size_10);
+static void handle_downtar_10(int cfd_10, char *line_10)
+{
+    strtok_r(line_10, "|", &line_10);
+    char *type_10 = strtok_r(NULL, "|", &line_10);
+    if (!type_10)
+    {
+        send_line_10(cfd_10, "ERR|missing_type");
+        return;
+    }
+    for (char *p_10 = type_10; *p_10; ++p_10)
+        *p_10 = (char)tolower((unsigned char)*p_10);
+    int cls_10 = ext_ok_10(type_10) ? route_ext_10(type_10) : -1;
+    if (cls_10 < 0)
+    {
+        send_line_10(cfd_10, "ERR|unsupported_type");
+        return;
+    }
+    const char *fname_10 = tar_name_10(type_10);
+
+    char *tar_10 = NULL; size_t sz_10 = 0;
+    int rc_10;
+    if (CLASSES_10[cls_10].local)
+    {
+        // Build tar of every file of that type under ~/S1, leaving out S1's own work folders
+        char *root_10   = build_s1_path_10("", 1);
+        int tfd_10 = make_temp_10("cfiles", &tar_10);
+        if (tfd_10 < 0)
+        {
+            send_line_10(cfd_10, "ERR|no_files");
+            free(root_10); return;
+        }
+        close(tfd_10);
+
+        char *cmd_10 = NULL;
+        asprintf(&cmd_10, "cd '%s' && tar -cf '%s' $(find . -type f -iname '*%s' ! -path './tmp/*' ! -path './downloaded_files/*' ! -path './tar_files/*' ! -path './.rebalance/*' ! -path './.cache/*' ! -path './.journal/*' | sed 's|^\\./||') 2>/dev/null",
+            root_10, tar_10, type_10);
+        rc_10 = system(cmd_10);
+        (void)rc_10;
+        free(cmd_10);
+        free(root_10);
+
+        struct stat st_10;
+        if (stat(tar_10, &st_10)!=0 || st_10.st_size == 0)
+        {
+            send_line_10(cfd_10, "ERR|no_files");
+            unlink(tar_10); free(tar_10); return;
+        }
+        sz_10 = (size_t)st_10.st_size;
+    }
+    else if ((rc_10 = class_tar_10(cls_10, type_10, &tar_10, &sz_10)) != 0)
+    {
+        send_line_10(cfd_10, rc_10 == -2 ? "ERR|no_files" : "ERR|tar_backend");
+        return;
+    }
+
+    //copy with the fixed name for the type
+    unsigned long long ta_10 = trace_begin_10();
+    archive_copy_10("tar_files", fname_10, tar_10);
+    trace_span_10("archive", "S1", ta_10);
+
+    send_line_10(cfd_10, "FILERESP|%s|%zu", fname_10, sz_10);
+    unsigned long long tx_10 = trace_begin_10();
+    send_file_from_path_10(cfd_10, tar_10, NULL, write_fully_10);
+    trace_span_10("send", "S1", tx_10);
+    unlink(tar_10); free(tar_10);
+}
+
+//this is the handler for dispfnames
+// lists all the files uploaded by the user (names compared by compare_str_10, see dfscore.c)
+
+// one listed file: grouped by extension in routing table order (unrouted extensions last,
+// alphabetically), then sorted by name inside the group
+struct disp_ent_10
+{
+    char *name;
+    char ext[EXT_MAX_10];
+    int rank;
+};
+static int compare_ent_10(const void *a_10, const void *b_10)
+{
+    const struct disp_ent_10 *aa_10 = (const struct disp_ent_10*)a_10;
+    const struct disp_ent_10 *bb_10 = (const struct disp_ent_10*)b_10;
+    if (aa_10->rank != bb_10->rank)
+        return aa_10->rank < bb_10->rank ? -1 : 1;
+    int c_10 = strcmp(aa_10->ext, bb_10->ext);
+    return c_10 ? c_10 : compare_str_10(&aa_10->name, &bb_10->name);
+}
+static void disp_push_10(struct disp_ent_10 **vec_10, int *cnt_10, int *cap_10, const char *name_10)
+{
+    if (*cnt_10 == *cap_10)
+    {
+        *cap_10 *= 2;
+        *vec_10 = (struct disp_ent_10*)realloc(*vec_10, sizeof(struct disp_ent_10) * *cap_10);
+    }
+    struct disp_ent_10 *e_10 = &(*vec_10)[(*cnt_10)++];
+    e_10->name = strdup(name_10);
+    snprintf(e_10->ext, sizeof e_10->ext, "%s", ext_lower_10(name_10));
+    e_10->rank = NROUTES_10;
+    for (int r_10 = 0; r_10 < NROUTES_10; ++r_10)
+        if (!strcmp(ROUTES_10[r_10].ext, e_10->ext))
+        {
+            e_10->rank = r_10;
+            break;
+        }
+}
+
+// asks every shard of every class at once for the files it keeps under rel_dir (classes may share
+// a backend, which is asked once). A shard that is slow to answer is waited for only while its
+// class still needs it: once the shards that answered hold a replica of every file of each class,
+// the stragglers get until their hedge delay and are then dropped. A class being rebalanced is
+// always waited for in full, since a stretch may be on one shard only
+static void disp_backends_10(const char *rel_dir_10, struct disp_ent_10 **vec_10, int *cnt_10, int *cap_10)
+{
+    const char *rel_only_10 = rel_dir_10;
+    if (strncmp(rel_only_10, "~S1/", 4)==0)
+        rel_only_10 += 4;
+    char req_10[LINE_MAX_10];
+    snprintf(req_10, sizeof req_10, "LIST|%s", *rel_only_10 ? rel_only_10 : ".");
+
+    struct pleg_10 legs_10[MAX_NODES_10];
+    int rep_10[MAX_NODES_10];      /* the node whose leg answers for this one's address */
+    int state_10[MAX_NODES_10];    /* per leg: 0 waiting, 1 answered, -1 failed or dropped */
+    for (int b_10 = 0; b_10 < NNODES_10; ++b_10)
+    {
+        rep_10[b_10] = b_10;
+        for (int o_10 = 0; o_10 < b_10 && rep_10[b_10] == b_10; ++o_10)
+            if (NODES_10[o_10].port == NODES_10[b_10].port && !strcmp(NODES_10[o_10].host, NODES_10[b_10].host))
+                rep_10[b_10] = o_10;
+        state_10[b_10] = -1;
+        if (rep_10[b_10] == b_10 && NODES_10[b_10].cls >= 0 && !CLASSES_10[NODES_10[b_10].cls].local)
+            state_10[b_10] = pleg_start_10(&legs_10[b_10], b_10, BOP_LIST_10, req_10) == 0 ? 0 : -1;
+    }
+
+    unsigned long long t0_10 = now_us_10(), deadline_10 = 0;
+    for (;;)
+    {
+        struct pleg_10 *wait_10[MAX_NODES_10];
+        int idx_10[MAX_NODES_10], nw_10 = 0;
+        for (int b_10 = 0; b_10 < NNODES_10; ++b_10)
+            if (rep_10[b_10] == b_10 && state_10[b_10] == 0)
+            {
+                idx_10[nw_10] = b_10;
+                wait_10[nw_10++] = &legs_10[b_10];
+            }
+        if (!nw_10)
+            break;
+
+        // can the rest be done without? every class needs all but replicas-1 of its shards
+        if (!deadline_10 && HEDGE_PCT_10 > 0)
+        {
+            int spare_10 = 1;
+            for (int c_10 = 0; c_10 < NCLASSES_10 && spare_10; ++c_10)
+            {
+                const struct sclass_10 *cl_10 = &CLASSES_10[c_10];
+                if (cl_10->local)
+                    continue;
+                int missing_10 = 0, waiting_10 = 0;
+                for (int b_10 = 0; b_10 < NNODES_10; ++b_10)
+                    if (NODES_10[b_10].cls == c_10)
+                    {
+                        missing_10 += state_10[rep_10[b_10]] != 1;
+                        waiting_10 += state_10[rep_10[b_10]] == 0;
+                    }
+                if (waiting_10 && (cl_10->nfrom || missing_10 > cl_10->replicas - 1))
+                    spare_10 = 0;
+            }
+            if (spare_10)
+            {
+                unsigned long long d_10 = 0;
+                for (int w_10 = 0; w_10 < nw_10; ++w_10)
+                    if (hedge_delay_10(idx_10[w_10]) > d_10)
+                        d_10 = hedge_delay_10(idx_10[w_10]);
+                deadline_10 = t0_10 + d_10;
+            }
+        }
+        int ms_10 = BOP_MS_10[BOP_LIST_10];
+        if (deadline_10)
+        {
+            unsigned long long now_10 = now_us_10();
+            ms_10 = now_10 >= deadline_10 ? 0 : (int)((deadline_10 - now_10 + 999) / 1000);
+        }
+        int w_10 = ms_10 == 0 ? -1 : pleg_wait_10(wait_10, nw_10, ms_10);
+        if (w_10 < 0 && !deadline_10)
+        {
+            // none of them answered within the list timeout: they count as failed calls
+            for (int i_10 = 0; i_10 < nw_10; ++i_10)
+            {
+                pleg_end_10(wait_10[i_10], "backend.list", 0);
+                state_10[idx_10[i_10]] = -1;
+            }
+            break;
+        }
+        if (w_10 < 0)
+        {
+            for (int i_10 = 0; i_10 < nw_10; ++i_10)
+            {
+                pleg_cancel_10(wait_10[i_10]);
+                state_10[idx_10[i_10]] = -1;
+                if (STATG_10)
+                    __atomic_fetch_add(&STATG_10->lists_dropped, 1, __ATOMIC_RELAXED);
+            }
+            break;
+        }
+
+        struct pleg_10 *p_10 = wait_10[w_10];
+        char **arr_10 = NULL; int n_10 = 0;
+        pleg_enter_10(p_10);
+        int rc_10 = list_read_10(p_10->fd, &arr_10, &n_10);
+        pleg_leave_10(p_10);
+        pleg_end_10(p_10, "backend.list", rc_10 == 0);
+        state_10[idx_10[w_10]] = rc_10 == 0 ? 1 : -1;
+        for (int i_10 = 0; i_10 < n_10; ++i_10)
+        {
+            disp_push_10(vec_10, cnt_10, cap_10, arr_10[i_10]);
+            free(arr_10[i_10]);
+        }
+        free(arr_10);
+    }
+}
+// adds the names of files journaled in dir to a listing
+static void wb_list_10(const char *dir_10, struct disp_ent_10 **vec_10, int *cnt_10, int *cap_10)
+{
+    char want_10[CACHE_KEY_10];
+    if (!WB_10 || cache_key_10(want_10, dir_10, NULL) != 0)
+        return;
+    size_t wl_10 = strlen(want_10);
+    wb_lock_10();
+    for (int s_10 = 0; s_10 < WB_SLOTS_10; ++s_10)
+    {
+        const struct wbent_10 *e_10 = &WB_10->e[s_10];
+        if (e_10->state == WB_FREE_10 || e_10->cancelled || e_10->superseded)
+            continue;
+        const char *name_10 = e_10->key + wl_10 + (wl_10 ? 1 : 0);
+        if (!strncmp(e_10->key, want_10, wl_10) && (!wl_10 || e_10->key[wl_10] == '/') && !strchr(name_10, '/'))
+            disp_push_10(vec_10, cnt_10, cap_10, name_10);
+    }
+    wb_unlock_10();
+}
+
+static void handle_disp_10(int cfd_10, char *line_10)
+{
+    strtok_r(line_10, "|", &line_10);
+    char *pp_10 = strtok_r(NULL, "|", &line_10);
+    if (!pp_10 || !path_is_s1_10(pp_10))
+    {
+        send_line_10(cfd_10, "ERR|bad_path");
+        return;
+    }
+
+    int cnt_10 = 0, cap_10 = 16;
+    struct disp_ent_10 *vec_10 = (struct disp_ent_10*)malloc(sizeof(struct disp_ent_10) * cap_10);
+
+    //lists the local files in that folder whose type is kept on S1
+    char *dir_10 = build_s1_path_10(pp_10, 0);
+    DIR *d_10 = opendir(dir_10);
+    if (d_10)
+    {
+        struct dirent *e_10;
+        while ((e_10 = readdir(d_10)))
+        {
+            if (e_10->d_type != DT_REG)
+                continue;
+            int cls_10 = route_10(e_10->d_name);
+            if (cls_10 >= 0 && CLASSES_10[cls_10].local)
+                disp_push_10(&vec_10, &cnt_10, &cap_10, e_10->d_name);
+        }
+        closedir(d_10);
+    }
+
+    disp_backends_10(pp_10, &vec_10, &cnt_10, &cap_10);
+    wb_list_10(pp_10, &vec_10, &cnt_10, &cap_10);   /* uploads the backends may not have yet */
+
+    if (cnt_10 > 1)
+        qsort(vec_10, cnt_10, sizeof(struct disp_ent_10), compare_ent_10);
+
+    //lists all the files to the client; a file on two shards of a stretch being rebalanced is listed once
+    send_line_10(cfd_10, "LISTBEGIN");
+    for (int i_10 = 0; i_10 < cnt_10; ++i_10)
+        if (i_10 == 0 || strcmp(vec_10[i_10].name, vec_10[i_10 - 1].name))
+            send_line_10(cfd_10, "NAME|%s|%s", vec_10[i_10].ext, vec_10[i_10].name);
+    send_line_10(cfd_10, "LISTEND");
+
+    // frees memory
+    for (int i_10 = 0; i_10 < cnt_10; ++i_10)
+        free(vec_10[i_10].name);
+    free(vec_10);
+    free(dir_10);
+}
+
+// PAGED LISTINGS: DISPP|<limit>|<dir>|<after> lists a folder like DISP, but in byte order of the
+// names, starting after the cursor <after>, at most <limit> of them (0: all), and streams them
+// while they are merged: every source (S1's own files, the write-back journal, each backend with
+// LISTS) gives a sorted run, and S1 merges the runs k ways, holding one name per run. The page
+// ends with LISTEND|<cursor>, the <after> of the next page (empty after the last one). A run is
+// kept in one buffer; for a page, only its <limit> smallest names, in fixed slots, so memory
+// follows the page size and not the folder size
+#define LIST_PAGE_MAX_10 10000
+#define NAME_SLOT_10 256
+
+struct namerun_10
+{
+    char *buf;          /* names back to back, or with a limit one per NAME_SLOT_10 slot */
+    size_t used, cap;
+    size_t *off;        /* with a limit a max-heap while names are added */
+    char **sorted;      /* after namerun_sort_10 */
+    int n, cap_n, limit, more;
+};
+static void namerun_init_10(struct namerun_10 *r_10, int limit_10)
+{
+    memset(r_10, 0, sizeof *r_10);
+    r_10->limit = limit_10;
+    if (limit_10 > 0)
+    {
+        r_10->cap = (size_t)limit_10 * NAME_SLOT_10;
+        r_10->buf = (char*)malloc(r_10->cap);
+        r_10->cap_n = limit_10;
+        r_10->off = (size_t*)malloc(sizeof(size_t) * (size_t)limit_10);
+    }
+}
+static int namerun_less_10(const struct namerun_10 *r_10, int a_10, int b_10)
+{
+    return strcmp(r_10->buf + r_10->off[a_10], r_10->buf + r_10->off[b_10]) < 0;
+}
+static void namerun_swap_10(struct namerun_10 *r_10, int a_10, int b_10)
+{
+    size_t t_10 = r_10->off[a_10]; r_10->off[a_10] = r_10->off[b_10]; r_10->off[b_10] = t_10;
+}
+// adds a name if it comes after the cursor; with a limit, a name past the limit replaces the
+// largest one kept when it is smaller
+static void namerun_add_10(struct namerun_10 *r_10, const char *name_10, const char *after_10)
+{
+    size_t len_10 = strlen(name_10) + 1;
+    if (*after_10 && strcmp(name_10, after_10) <= 0)
+        return;
+    if (r_10->limit <= 0)
+    {
+        if (r_10->used + len_10 > r_10->cap)
+        {
+            r_10->cap = (r_10->cap ? r_10->cap * 2 : 65536) + len_10;
+            r_10->buf = (char*)realloc(r_10->buf, r_10->cap);
+        }
+        if (r_10->n == r_10->cap_n)
+        {
+            r_10->cap_n = r_10->cap_n ? r_10->cap_n * 2 : 1024;
+            r_10->off = (size_t*)realloc(r_10->off, sizeof(size_t) * (size_t)r_10->cap_n);
+        }
+        memcpy(r_10->buf + r_10->used, name_10, len_10);
+        r_10->off[r_10->n++] = r_10->used;
+        r_10->used += len_10;
+        return;
+    }
+    if (len_10 > NAME_SLOT_10)
+        return;
+    int i_10;
+    if (r_10->n < r_10->limit)
+    {
+        i_10 = r_10->n;
+        r_10->off[i_10] = (size_t)i_10 * NAME_SLOT_10;
+        memcpy(r_10->buf + r_10->off[i_10], name_10, len_10);
+        ++r_10->n;
+        for (; i_10 > 0 && namerun_less_10(r_10, (i_10 - 1) / 2, i_10); i_10 = (i_10 - 1) / 2)
+            namerun_swap_10(r_10, i_10, (i_10 - 1) / 2);
+        return;
+    }
+    r_10->more = 1;
+    if (strcmp(name_10, r_10->buf + r_10->off[0]) >= 0)
+        return;
+    memcpy(r_10->buf + r_10->off[0], name_10, len_10);
+    for (i_10 = 0;;)
+    {
+        int c_10 = 2 * i_10 + 1;
+        if (c_10 >= r_10->n)
+            break;
+        if (c_10 + 1 < r_10->n && namerun_less_10(r_10, c_10, c_10 + 1))
+            ++c_10;
+        if (!namerun_less_10(r_10, i_10, c_10))
+            break;
+        namerun_swap_10(r_10, i_10, c_10);
+        i_10 = c_10;
+    }
+}
+// runs are ordered by the part of an entry before its first '|': a name, or a path with its size
+// and mtime after it (TREE)
+static int key_cmp_10(const char *a_10, const char *b_10)
+{
+    const unsigned char *x_10 = (const unsigned char*)a_10, *y_10 = (const unsigned char*)b_10;
+    for (;; ++x_10, ++y_10)
+    {
+        int cx_10 = *x_10 == '|' ? 0 : *x_10, cy_10 = *y_10 == '|' ? 0 : *y_10;
+        if (cx_10 != cy_10 || !cx_10)
+            return cx_10 - cy_10;
+    }
+}
+static int namerun_cmp_10(const void *a_10, const void *b_10)
+{
+    return key_cmp_10(*(char* const*)a_10, *(char* const*)b_10);
+}
+static void namerun_sort_10(struct namerun_10 *r_10)
+{
+    r_10->sorted = (char**)malloc(sizeof(char*) * (size_t)(r_10->n ? r_10->n : 1));
+    for (int i_10 = 0; i_10 < r_10->n; ++i_10)
+        r_10->sorted[i_10] = r_10->buf + r_10->off[i_10];
+    qsort(r_10->sorted, (size_t)r_10->n, sizeof(char*), namerun_cmp_10);
+}
+static void namerun_free_10(struct namerun_10 *r_10)
+{
+    free(r_10->buf);
+    free(r_10->off);
+    free(r_10->sorted);
+}
+
+// one run of the merge: a sorted run held here, or a backend's LISTS reply read a name at a time.
+// A leg's reply is read LSRC_BUF_10 bytes per read() into its own buffer and split into lines there
+#define LSRC_BUF_10 (4 * LINE_MAX_10)
+struct lsrc_10
+{
+    struct namerun_10 run;
+    int pos, leg, live, more;
+    struct pleg_10 p;
+    char head[LINE_MAX_10];
+    size_t boff, blen;
+    char buf[LSRC_BUF_10];
+};
+// the next line of a leg's reply, as read_line_10 returns it: its length, 0 at the end of the
+// reply, -1 on an error or a line longer than LINE_MAX_10
+static int lsrc_line_10(struct lsrc_10 *s_10, char *line_10)
+{
+    char *nl_10;
+    while (!(nl_10 = (char*)memchr(s_10->buf + s_10->boff, '\n', s_10->blen - s_10->boff)))
+    {
+        if (s_10->blen - s_10->boff >= LINE_MAX_10)
+            return -1;
+        memmove(s_10->buf, s_10->buf + s_10->boff, s_10->blen - s_10->boff);
+        s_10->blen -= s_10->boff;
+        s_10->boff = 0;
+        obuf_idle_10(s_10->p.fd);
+        pleg_enter_10(&s_10->p);
+        ssize_t r_10;
+        while ((r_10 = read(s_10->p.fd, s_10->buf + s_10->blen, sizeof s_10->buf - s_10->blen)) < 0 && errno == EINTR)
+            ;
+        if (r_10 > 0)
+            count_io_10(s_10->p.fd, r_10, 0);
+        leg_seen_10(s_10->p.fd, r_10 > 0);
+        pleg_leave_10(&s_10->p);
+        if (r_10 < 0)
+            return -1;
+        if (r_10 == 0)
+        {
+            // the rest of the reply without its newline, as read_line_10 would give it
+            int n_10 = (int)(s_10->blen - s_10->boff);
+            memcpy(line_10, s_10->buf + s_10->boff, (size_t)n_10);
+            line_10[n_10] = '\0';
+            s_10->boff = s_10->blen;
+            return n_10;
+        }
+        s_10->blen += (size_t)r_10;
+    }
+    size_t n_10 = (size_t)(nl_10 - (s_10->buf + s_10->boff));
+    if (n_10 >= LINE_MAX_10)
+        return -1;
+    memcpy(line_10, s_10->buf + s_10->boff, n_10);
+    line_10[n_10] = '\0';
+    s_10->boff += n_10 + 1;
+    return (int)n_10;
+}
+static void lsrc_next_10(struct lsrc_10 *s_10)
+{
+    if (!s_10->leg)
+    {
+        s_10->live = s_10->pos < s_10->run.n;
+        if (s_10->live)
+            snprintf(s_10->head, sizeof s_10->head, "%s", s_10->run.sorted[s_10->pos++]);
+        else
+            s_10->more = s_10->run.more;
+        return;
+    }
+    char line_10[LINE_MAX_10];
+    int r_10 = lsrc_line_10(s_10, line_10);
+    if (r_10 > 0 && (!strncmp(line_10, "NAME|", 5) || !strncmp(line_10, "ENT|", 4)))
+    {
+        snprintf(s_10->head, sizeof s_10->head, "%s", line_10 + (line_10[0] == 'N' ? 5 : 4));
+        return;
+    }
+    // END, END|more when the backend stopped at the limit, or the leg broke off
+    s_10->live = 0;
+    s_10->more = r_10 > 0 && !strcmp(line_10, "END|more");
+    pleg_end_10(&s_10->p, "backend.list", r_10 > 0 && !strncmp(line_10, "END", 3));
+}
+
+// one leg per backend address, all asked req at once
+static void lsrc_legs_10(struct lsrc_10 *src_10, int *ns_10, const char *req_10)
+{
+    for (int b_10 = 0; b_10 < NNODES_10; ++b_10)
+    {
+        int dup_10 = 0;
+        for (int o_10 = 0; o_10 < b_10 && !dup_10; ++o_10)
+            dup_10 = NODES_10[o_10].port == NODES_10[b_10].port && !strcmp(NODES_10[o_10].host, NODES_10[b_10].host);
+        if (dup_10 || NODES_10[b_10].cls < 0 || CLASSES_10[NODES_10[b_10].cls].local)
+            continue;
+        if (pleg_start_10(&src_10[*ns_10].p, b_10, BOP_LIST_10, req_10) != 0)
+            continue;
+        src_10[(*ns_10)++].leg = 1;
+    }
+}
+// gets the first entry of every run; the backends sort theirs at the same time, so the first
+// entries go out once each has one
+static void lsrc_start_10(struct lsrc_10 *src_10, int ns_10)
+{
+    for (int s_10 = 0; s_10 < ns_10; ++s_10)
+    {
+        src_10[s_10].live = 1;
+        if (!src_10[s_10].leg)
+            namerun_sort_10(&src_10[s_10].run);
+        else
+        {
+            char line_10[LINE_MAX_10];
+            int r_10 = lsrc_line_10(&src_10[s_10], line_10);
+            if (r_10 <= 0 || strcmp(line_10, "OK"))
+            {
+                pleg_end_10(&src_10[s_10].p, "backend.list", 0);
+                src_10[s_10].live = 0;
+                continue;
+            }
+        }
+        lsrc_next_10(&src_10[s_10]);
+    }
+}
+// merges the runs out to the client, an entry per key: NAME|<ext>|<name>, or for TREE
+// ENT|<ext>|<path>|<size>|<mtime> of the newest copy among the replicas. last gets the last key
+static int lsrc_merge_10(int cfd_10, struct lsrc_10 *src_10, int ns_10, int limit_10, int tree_10, char *last_10, size_t n_10)
+{
+    int sent_10 = 0;
+    while (limit_10 == 0 || sent_10 < limit_10)
+    {
+        int m_10 = -1;
+        for (int s_10 = 0; s_10 < ns_10; ++s_10)
+            if (src_10[s_10].live && (m_10 < 0 || key_cmp_10(src_10[s_10].head, src_10[m_10].head) < 0))
+                m_10 = s_10;
+        if (m_10 < 0)
+            break;
+        char ent_10[LINE_MAX_10];
+        snprintf(ent_10, sizeof ent_10, "%s", src_10[m_10].head);
+        for (int s_10 = 0; s_10 < ns_10; ++s_10)
+        {
+            if (!src_10[s_10].live || key_cmp_10(src_10[s_10].head, ent_10))
+                continue;
+            const char *mt_10 = strrchr(src_10[s_10].head, '|'), *best_10 = strrchr(ent_10, '|');
+            if (tree_10 && mt_10 && best_10 && strtoull(mt_10 + 1, NULL, 10) > strtoull(best_10 + 1, NULL, 10))
+                snprintf(ent_10, sizeof ent_10, "%s", src_10[s_10].head);
+            lsrc_next_10(&src_10[s_10]);
+        }
+        size_t k_10 = strcspn(ent_10, "|");
+        snprintf(last_10, n_10, "%.*s", (int)k_10, ent_10);
+        send_line_10(cfd_10, "%s|%s|%s", tree_10 ? "ENT" : "NAME", ext_lower_10(last_10), ent_10);
+        ++sent_10;
+    }
+    return sent_10;
+}
+// reads the legs to their end and frees the runs; whether any run had more than was sent
+static int lsrc_finish_10(struct lsrc_10 *src_10, int ns_10)
+{
+    int more_10 = 0;
+    for (int s_10 = 0; s_10 < ns_10; ++s_10)
+    {
+        more_10 |= src_10[s_10].live || src_10[s_10].more;
+        while (src_10[s_10].leg && src_10[s_10].live)
+            lsrc_next_10(&src_10[s_10]);   /* the rest of a page, so the backend finishes it */
+        namerun_free_10(&src_10[s_10].run);
+    }
+    free(src_10);
+    return more_10;
+}
+
+static void handle_dispp_10(int cfd_10, char *line_10)
+{
+    strtok_r(line_10, "|", &line_10);
+    char *lim_s_10 = strtok_r(NULL, "|", &line_10);
+    char *pp_10 = strtok_r(NULL, "|", &line_10);
+    const char *after_10 = line_10 ? line_10 : "";
+    int limit_10 = lim_s_10 ? atoi(lim_s_10) : -1;
+    if (!pp_10 || !path_is_s1_10(pp_10) || limit_10 < 0 || limit_10 > LIST_PAGE_MAX_10)
+    {
+        send_line_10(cfd_10, "ERR|bad_path");
+        return;
+    }
+
+    // the runs: S1's own files and the journal, then the backends
+    struct lsrc_10 *src_10 = (struct lsrc_10*)calloc((size_t)NNODES_10 + 2, sizeof(struct lsrc_10));
+    int ns_10 = 0;
+    namerun_init_10(&src_10[ns_10].run, limit_10);
+    char *dir_10 = build_s1_path_10(pp_10, 0);
+    DIR *d_10 = opendir(dir_10);
+    struct dirent *e_10;
+    while (d_10 && (e_10 = readdir(d_10)))
+    {
+        int cls_10 = e_10->d_type == DT_REG ? route_10(e_10->d_name) : -1;
+        if (cls_10 >= 0 && CLASSES_10[cls_10].local)
+            namerun_add_10(&src_10[ns_10].run, e_10->d_name, after_10);
+    }
+    if (d_10)
+        closedir(d_10);
+    free(dir_10);
+    ++ns_10;
+
+    namerun_init_10(&src_10[ns_10].run, limit_10);
+    {
+        int cnt_10 = 0, cap_10 = 16;
+        struct disp_ent_10 *vec_10 = (struct disp_ent_10*)malloc(sizeof(struct disp_ent_10) * cap_10);
+        wb_list_10(pp_10, &vec_10, &cnt_10, &cap_10);
+        for (int i_10 = 0; i_10 < cnt_10; ++i_10)
+        {
+            namerun_add_10(&src_10[ns_10].run, vec_10[i_10].name, after_10);
+            free(vec_10[i_10].name);
         }
-        free(tmpfile_10);
+        free(vec_10);
     }
-    free(tmpdir_10);
-    send_line_10(cfd_10, "OK");
+    ++ns_10;
+
+    char req_10[LINE_MAX_10];
+    snprintf(req_10, sizeof req_10, "LISTS|%d|%s|%s", limit_10, pp_10[4] ? pp_10 + 4 : ".", after_10);
+    lsrc_legs_10(src_10, &ns_10, req_10);
+    lsrc_start_10(src_10, ns_10);
+
+    send_line_10(cfd_10, "LISTBEGIN");
+    char last_10[LINE_MAX_10] = "";
+    lsrc_merge_10(cfd_10, src_10, ns_10, limit_10, 0, last_10, sizeof last_10);
+    int more_10 = lsrc_finish_10(src_10, ns_10);
+    send_line_10(cfd_10, "LISTEND|%s", more_10 ? last_10 : "");
 }
 
-//this is the downlf handler
-//downloads the required files for the client under ~/S1/downloaded_files/
-static void handle_downlf_10(int cfd_10, char *line_10)
+// TREE|<depth>|<prefix>|<glob>|<dir> lists every file under a folder, recursively, between
+// LISTBEGIN and LISTEND as ENT|<ext>|<path>|<size>|<mtime_ns>, paths relative to the folder and
+// in byte order. Only depth levels are read (0: all), and only paths starting with the prefix
+// and names matching the glob are listed (either may be empty). Each backend walks its part
+// with TREE at the same time as S1 walks its own files; the runs are merged as for DISPP
+struct tree_10
 {
-    strtok_r(line_10, "|", &line_10); /* "DOWNLF" */
-    char *nstr_10 = strtok_r(NULL, "|", &line_10);
-    int n_10 = nstr_10 ? atoi(nstr_10) : 0;
+    int maxdepth;
+    const char *prefix, *glob;
+    int fnflags;
+};
+static unsigned long long mtime_ns_10(const struct stat *st_10)
+{
+    return (unsigned long long)st_10->st_mtim.tv_sec * 1000000000ULL + (unsigned long long)st_10->st_mtim.tv_nsec;
+}
+// whether a file's path (and name) passes the filters
+static int tree_want_10(const struct tree_10 *t_10, const char *path_10)
+{
+    const char *base_10 = strrchr(path_10, '/');
+    int depth_10 = 0;
+    for (const char *c_10 = path_10; *c_10; ++c_10)
+        depth_10 += *c_10 == '/';
+    return (!t_10->maxdepth || depth_10 < t_10->maxdepth) && !strncmp(path_10, t_10->prefix, strlen(t_10->prefix))
+        && (!*t_10->glob || fnmatch(t_10->glob, base_10 ? base_10 + 1 : path_10, t_10->fnflags) == 0);
+}
+// whether anything under a folder can match the prefix
+static int tree_may_match_10(const char *rel_10, const char *prefix_10)
+{
+    size_t r_10 = strlen(rel_10), p_10 = strlen(prefix_10);
+    if (r_10 < p_10)
+        return !strncmp(prefix_10, rel_10, r_10) && prefix_10[r_10] == '/';
+    return !strncmp(rel_10, prefix_10, p_10);
+}
+// S1's own files under a folder; rel is the path from the listed folder, top whether dfd is
+// ~S1 itself, where S1's working folders are left out
+static void tree_local_10(const struct tree_10 *t_10, int dfd_10, const char *rel_10, int top_10, struct namerun_10 *run_10)
+{
+    DIR *d_10 = fdopendir(dfd_10);
+    if (!d_10)
+    {
+        close(dfd_10);
+        return;
+    }
+    struct dirent *e_10;
+    while ((e_10 = readdir(d_10)))
+    {
+        if (e_10->d_name[0] == '.' || (top_10 && (!strcmp(e_10->d_name, "tmp")
+            || !strcmp(e_10->d_name, "downloaded_files") || !strcmp(e_10->d_name, "tar_files"))))
+            continue;
+        struct stat st_10;
+        if (fstatat(dirfd(d_10), e_10->d_name, &st_10, AT_SYMLINK_NOFOLLOW) != 0)
+            continue;
+        char *p_10 = NULL;
+        asprintf(&p_10, "%s%s%s", rel_10, *rel_10 ? "/" : "", e_10->d_name);
+        int cls_10 = route_10(e_10->d_name);
+        if (S_ISDIR(st_10.st_mode) && tree_may_match_10(p_10, t_10->prefix))
+        {
+            int sub_10 = openat(dirfd(d_10), e_10->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+            if (sub_10 >= 0)
+                tree_local_10(t_10, sub_10, p_10, 0, run_10);
+        }
+        else if (S_ISREG(st_10.st_mode) && cls_10 >= 0 && CLASSES_10[cls_10].local && tree_want_10(t_10, p_10))
+        {
+            char ent_10[LINE_MAX_10];
+            int k_10 = snprintf(ent_10, sizeof ent_10, "%s|%lld|%llu", p_10, (long long)st_10.st_size, mtime_ns_10(&st_10));
+            if (k_10 > 0 && (size_t)k_10 < sizeof ent_10)
+                namerun_add_10(run_10, ent_10, "");
+        }
+        free(p_10);
+    }
+    closedir(d_10);
+}
+// uploads still in the journal, dated by when they were taken in (the journal name starts
+// with that time in nanoseconds)
+static void tree_journal_10(const struct tree_10 *t_10, const char *dir_10, struct namerun_10 *run_10)
+{
+    char want_10[CACHE_KEY_10];
+    if (!WB_10 || cache_key_10(want_10, dir_10, NULL) != 0)
+        return;
+    size_t wl_10 = strlen(want_10);
+    wb_lock_10();
+    for (int s_10 = 0; s_10 < WB_SLOTS_10; ++s_10)
+    {
+        const struct wbent_10 *e_10 = &WB_10->e[s_10];
+        if (e_10->state == WB_FREE_10 || e_10->cancelled || e_10->superseded || !key_under_10(e_10->key, want_10))
+            continue;
+        const char *p_10 = e_10->key + wl_10 + (wl_10 ? 1 : 0);
+        char ent_10[LINE_MAX_10];
+        if (tree_want_10(t_10, p_10))
+        {
+            snprintf(ent_10, sizeof ent_10, "%s|%llu|%llu", p_10, e_10->size, strtoull(e_10->id, NULL, 16));
+            namerun_add_10(run_10, ent_10, "");
+        }
+    }
+    wb_unlock_10();
+}
+static void handle_tree_10(int cfd_10, char *line_10)
+{
+    // fields split by hand, as the prefix and glob may be empty
+    char *f_10[4];
+    f_10[0] = line_10 + 5;
+    for (int i_10 = 1; i_10 < 4; ++i_10)
+    {
+        char *bar_10 = f_10[i_10 - 1] ? strchr(f_10[i_10 - 1], '|') : NULL;
+        if (bar_10)
+            *bar_10++ = '\0';
+        f_10[i_10] = bar_10;
+    }
+    struct tree_10 t_10 = { f_10[0] ? atoi(f_10[0]) : -1, f_10[1], f_10[2], 0 };
+    char *pp_10 = f_10[3];
+    if (!pp_10 || !path_is_s1_10(pp_10) || t_10.maxdepth < 0 || strstr(pp_10, "/."))
+    {
+        send_line_10(cfd_10, "ERR|bad_path");
+        return;
+    }
+    size_t n_10 = strlen(pp_10);
+    while (n_10 > 4 && pp_10[n_10 - 1] == '/')
+        pp_10[--n_10] = '\0';
 
-    if (n_10 < 1 || n_10 > 2)
+    struct lsrc_10 *src_10 = (struct lsrc_10*)calloc((size_t)NNODES_10 + 2, sizeof(struct lsrc_10));
+    int ns_10 = 0;
+    namerun_init_10(&src_10[ns_10].run, 0);
+    char *dir_10 = build_s1_path_10(pp_10, 0);
+    int dfd_10 = open(dir_10, O_RDONLY | O_DIRECTORY);
+    free(dir_10);
+    if (dfd_10 >= 0)
+        tree_local_10(&t_10, dfd_10, "", !pp_10[4], &src_10[ns_10].run);
+    ++ns_10;
+    namerun_init_10(&src_10[ns_10].run, 0);
+    tree_journal_10(&t_10, pp_10, &src_10[ns_10].run);
+    ++ns_10;
+
+    char req_10[LINE_MAX_10];
+    snprintf(req_10, sizeof req_10, "TREE|%d|%s|%s|%s", t_10.maxdepth, t_10.prefix, t_10.glob, pp_10[4] ? pp_10 + 4 : ".");
+    lsrc_legs_10(src_10, &ns_10, req_10);
+    lsrc_start_10(src_10, ns_10);
+
+    send_line_10(cfd_10, "LISTBEGIN");
+    char last_10[LINE_MAX_10] = "";
+    lsrc_merge_10(cfd_10, src_10, ns_10, 0, 1, last_10, sizeof last_10);
+    lsrc_finish_10(src_10, ns_10);
+    send_line_10(cfd_10, "LISTEND|");
+}
+
+// DOWNTAR|all, or a set of types (DOWNTAR|.c,.pdf), is sent as one archive built while it goes
+// out: TARSTREAM|<name>, the tar in DATA|<n> pieces, then TAREND|<members>|<failed>. Every
+// backend is asked for its tar of every type at once, so the archives are built side by side;
+// their members are then passed on as each backend's stream has one ready, between S1's own
+// files. A file held on several replicas goes in once. failed counts the backends that broke
+// off after the stream had started (the archive then lacks some of their files)
+#define TAR_RECORD_10 10240
+#define TAR_OUT_10    65536
+
+// COMPRESSION: DOWNTAR|<types>|gz or |lz4 compresses the archive on the way out. It is cut into
+// ZBLOCK_10 blocks that a pool of threads (one per core) compresses independently; the blocks
+// go out in order as each finishes. With gz every block is a gzip member of its own (gunzip
+// reads a file of them back to back), with lz4 an independent block of one LZ4 frame
+enum { ZC_NONE_10, ZC_GZIP_10, ZC_LZ4_10 };
+#define ZBLOCK_10       (256 * 1024)
+#define ZTHREADS_MAX_10 16
+struct zjob_10
+{
+    unsigned char *in, *out;
+    size_t n, on;
+    int done;
+};
+struct zpool_10
+{
+    pthread_mutex_t mu;
+    pthread_cond_t work, done;
+    pthread_t th[ZTHREADS_MAX_10];
+    int nth, codec, quit, cap;
+    struct zjob_10 *ring;
+    unsigned long long head, next, tail;   /* oldest not sent yet, next to compress, next free */
+};
+// LZ4 block format: sequences of literals and a match back into the last 64KiB, found through a
+// hash of the next four bytes. Greedy, like lz4's fast mode; the last five bytes are literals
+#define LZ4_HASH_LOG_10 12
+static unsigned read32_10(const unsigned char *p_10)
+{
+    unsigned v_10;
+    memcpy(&v_10, p_10, 4);
+    return v_10;
+}
+static unsigned char *lz4_len_10(unsigned char *op_10, size_t len_10)
+{
+    for (; len_10 >= 255; len_10 -= 255)
+        *op_10++ = 255;
+    *op_10++ = (unsigned char)len_10;
+    return op_10;
+}
+static size_t lz4_block_10(const unsigned char *src_10, size_t n_10, unsigned char *dst_10)
+{
+    unsigned *table_10 = (unsigned*)calloc((size_t)1 << LZ4_HASH_LOG_10, sizeof(unsigned));
+    unsigned char *op_10 = dst_10;
+    size_t ip_10 = 0, anchor_10 = 0;
+    while (n_10 > 12 && ip_10 < n_10 - 12)
     {
-        send_line_10(cfd_10, "ERR|bad downlf header");
+        unsigned seq_10 = read32_10(src_10 + ip_10);
+        unsigned h_10 = (seq_10 * 2654435761u) >> (32 - LZ4_HASH_LOG_10);
+        size_t ref_10 = table_10[h_10];
+        table_10[h_10] = (unsigned)ip_10 + 1;
+        if (!ref_10 || ip_10 - (ref_10 - 1) > 65535 || read32_10(src_10 + ref_10 - 1) != seq_10)
+        {
+            ++ip_10;
+            continue;
+        }
+        size_t m_10 = ref_10 - 1, len_10 = 4;
+        while (ip_10 > anchor_10 && m_10 > 0 && src_10[ip_10 - 1] == src_10[m_10 - 1])
+        {
+            --ip_10;
+            --m_10;
+            ++len_10;
+        }
+        while (ip_10 + len_10 < n_10 - 5 && src_10[ip_10 + len_10] == src_10[m_10 + len_10])
+            ++len_10;
+        size_t lit_10 = ip_10 - anchor_10, ml_10 = len_10 - 4;
+        unsigned char *token_10 = op_10++;
+        *token_10 = (unsigned char)(((lit_10 < 15 ? lit_10 : 15) << 4) | (ml_10 < 15 ? ml_10 : 15));
+        if (lit_10 >= 15)
+            op_10 = lz4_len_10(op_10, lit_10 - 15);
+        memcpy(op_10, src_10 + anchor_10, lit_10);
+        op_10 += lit_10;
+        *op_10++ = (unsigned char)((ip_10 - m_10) & 255);
+        *op_10++ = (unsigned char)((ip_10 - m_10) >> 8);
+        if (ml_10 >= 15)
+            op_10 = lz4_len_10(op_10, ml_10 - 15);
+        ip_10 += len_10;
+        anchor_10 = ip_10;
+    }
+    size_t lit_10 = n_10 - anchor_10;
+    *op_10++ = (unsigned char)((lit_10 < 15 ? lit_10 : 15) << 4);
+    if (lit_10 >= 15)
+        op_10 = lz4_len_10(op_10, lit_10 - 15);
+    memcpy(op_10, src_10 + anchor_10, lit_10);
+    op_10 += lit_10;
+    free(table_10);
+    return (size_t)(op_10 - dst_10);
+}
+// xxHash32 (seed 0) of fewer than four bytes, for the LZ4 frame descriptor's checksum
+static unsigned xxh32_small_10(const unsigned char *p_10, size_t n_10)
+{
+    unsigned h_10 = 374761393u + (unsigned)n_10;
+    for (size_t i_10 = 0; i_10 < n_10; ++i_10)
+    {
+        h_10 += p_10[i_10] * 374761393u;
+        h_10 = ((h_10 << 11) | (h_10 >> 21)) * 2654435761u;
+    }
+    h_10 ^= h_10 >> 15;
+    h_10 *= 2246822519u;
+    h_10 ^= h_10 >> 13;
+    h_10 *= 3266489917u;
+    h_10 ^= h_10 >> 16;
+    return h_10;
+}
+static size_t zbound_10(size_t n_10)
+{
+    return (size_t)compressBound((uLong)n_10) + n_10 / 255 + 64;
+}
+// one block: a whole gzip member, or an LZ4 block with its size word (kept as it was when
+// compressing does not make it smaller)
+static size_t zblock_10(int codec_10, const unsigned char *in_10, size_t n_10, unsigned char *out_10)
+{
+    if (codec_10 == ZC_LZ4_10)
+    {
+        size_t on_10 = lz4_block_10(in_10, n_10, out_10 + 4);
+        unsigned word_10 = (unsigned)on_10;
+        if (on_10 >= n_10)
+        {
+            memcpy(out_10 + 4, in_10, n_10);
+            on_10 = n_10;
+            word_10 = (unsigned)n_10 | 0x80000000u;
+        }
+        for (int i_10 = 0; i_10 < 4; ++i_10)
+            out_10[i_10] = (unsigned char)(word_10 >> (8 * i_10));
+        return on_10 + 4;
+    }
+    z_stream z_10;
+    memset(&z_10, 0, sizeof z_10);
+    if (deflateInit2(&z_10, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return 0;
+    z_10.next_in = (Bytef*)in_10;
+    z_10.avail_in = (uInt)n_10;
+    z_10.next_out = out_10;
+    z_10.avail_out = (uInt)zbound_10(n_10);
+    int rc_10 = deflate(&z_10, Z_FINISH);
+    size_t on_10 = z_10.total_out;
+    deflateEnd(&z_10);
+    return rc_10 == Z_STREAM_END ? on_10 : 0;
+}
+static void *zworker_10(void *arg_10)
+{
+    struct zpool_10 *z_10 = (struct zpool_10*)arg_10;
+    pthread_mutex_lock(&z_10->mu);
+    for (;;)
+    {
+        while (z_10->next == z_10->tail && !z_10->quit)
+            pthread_cond_wait(&z_10->work, &z_10->mu);
+        if (z_10->next == z_10->tail)
+            break;
+        struct zjob_10 *j_10 = &z_10->ring[z_10->next++ % (unsigned long long)z_10->cap];
+        pthread_mutex_unlock(&z_10->mu);
+        j_10->on = zblock_10(z_10->codec, j_10->in, j_10->n, j_10->out);
+        pthread_mutex_lock(&z_10->mu);
+        j_10->done = 1;
+        pthread_cond_broadcast(&z_10->done);
+    }
+    pthread_mutex_unlock(&z_10->mu);
+    return NULL;
+}
+static struct zpool_10 *zpool_new_10(int codec_10)
+{
+    struct zpool_10 *z_10 = (struct zpool_10*)calloc(1, sizeof(struct zpool_10));
+    pthread_mutex_init(&z_10->mu, NULL);
+    pthread_cond_init(&z_10->work, NULL);
+    pthread_cond_init(&z_10->done, NULL);
+    z_10->codec = codec_10;
+    long cores_10 = sysconf(_SC_NPROCESSORS_ONLN);
+    int want_10 = cores_10 < 1 ? 1 : cores_10 > ZTHREADS_MAX_10 ? ZTHREADS_MAX_10 : (int)cores_10;
+    z_10->cap = 2 * want_10 + 2;   /* blocks held at once: enough to keep every thread busy */
+    z_10->ring = (struct zjob_10*)calloc((size_t)z_10->cap, sizeof(struct zjob_10));
+    while (z_10->nth < want_10 && pthread_create(&z_10->th[z_10->nth], NULL, zworker_10, z_10) == 0)
+        ++z_10->nth;
+    return z_10;
+}
+
+// the archive's output: DATA|<n> pieces to the client, the same bytes to the copy kept in tar_files
+struct tout_10
+{
+    int cfd, keep, err;
+    size_t n, cap;
+    unsigned long long bytes;   /* of the tar, before any compression */
+    char *buf;
+    struct zpool_10 *z;
+};
+static int tout_emit_10(struct tout_10 *o_10, const void *p_10, size_t n_10)
+{
+    if (o_10->err || !n_10)
+        return o_10->err;
+    // without a client (cfd < 0) the archive only goes to keep, and a failed write there fails it
+    int rc_10 = o_10->cfd < 0 || (send_line_10(o_10->cfd, "DATA|%zu", n_10) == 0 && write_fully_10(o_10->cfd, p_10, n_10) == (ssize_t)n_10) ? 0 : -1;
+    if (o_10->keep >= 0 && write_fully_10(o_10->keep, p_10, n_10) != (ssize_t)n_10)
+    {
+        close(o_10->keep);
+        o_10->keep = -1;
+        if (o_10->cfd < 0)
+            rc_10 = -1;
+    }
+    o_10->err = rc_10;   /* the client went away: nothing more goes out */
+    return rc_10;
+}
+// sends the compressed blocks in order, waiting for them up to block upto; the ones after it
+// go too if they are done already
+static void zpool_drain_10(struct tout_10 *o_10, unsigned long long upto_10)
+{
+    struct zpool_10 *z_10 = o_10->z;
+    for (;;)
+    {
+        pthread_mutex_lock(&z_10->mu);
+        struct zjob_10 *j_10 = &z_10->ring[z_10->head % (unsigned long long)z_10->cap];
+        while (z_10->head < upto_10 && !j_10->done)
+            pthread_cond_wait(&z_10->done, &z_10->mu);
+        int ready_10 = z_10->head < z_10->tail && j_10->done;
+        pthread_mutex_unlock(&z_10->mu);
+        if (!ready_10)
+            return;
+        if (!j_10->on)
+            o_10->err = -1;
+        tout_emit_10(o_10, j_10->out, j_10->on);
+        free(j_10->in);
+        free(j_10->out);
+        pthread_mutex_lock(&z_10->mu);
+        j_10->done = 0;
+        ++z_10->head;
+        pthread_mutex_unlock(&z_10->mu);
+    }
+}
+// a full buffer goes out as it is, or to the pool as one block; when the ring is full this
+// waits for its oldest block and sends it first
+static int tout_flush_10(struct tout_10 *o_10)
+{
+    if (!o_10->n || o_10->err)
+        return o_10->err;
+    o_10->bytes += o_10->n;
+    struct zpool_10 *z_10 = o_10->z;
+    if (!z_10)
+    {
+        int rc_10 = tout_emit_10(o_10, o_10->buf, o_10->n);
+        o_10->n = 0;
+        return rc_10;
+    }
+    if (z_10->tail - z_10->head == (unsigned long long)z_10->cap)
+        zpool_drain_10(o_10, z_10->head + 1);
+    struct zjob_10 *j_10 = &z_10->ring[z_10->tail % (unsigned long long)z_10->cap];
+    j_10->in = (unsigned char*)o_10->buf;
+    j_10->n = o_10->n;
+    j_10->out = (unsigned char*)malloc(zbound_10(o_10->n) + 4);
+    o_10->buf = (char*)malloc(o_10->cap);
+    o_10->n = 0;
+    if (!z_10->nth)
+    {
+        j_10->on = zblock_10(z_10->codec, j_10->in, j_10->n, j_10->out);   /* no threads: inline */
+        j_10->done = 1;
+    }
+    pthread_mutex_lock(&z_10->mu);
+    ++z_10->tail;
+    pthread_cond_signal(&z_10->work);
+    pthread_mutex_unlock(&z_10->mu);
+    zpool_drain_10(o_10, z_10->head);   /* whatever finished already */
+    return o_10->err;
+}
+static int tout_put_10(struct tout_10 *o_10, const void *p_10, size_t n_10)
+{
+    while (n_10)
+    {
+        size_t k_10 = o_10->cap - o_10->n < n_10 ? o_10->cap - o_10->n : n_10;
+        memcpy(o_10->buf + o_10->n, p_10, k_10);
+        o_10->n += k_10;
+        p_10 = (const char*)p_10 + k_10;
+        n_10 -= k_10;
+        if (o_10->n == o_10->cap && tout_flush_10(o_10) != 0)
+            return -1;
+    }
+    return 0;
+}
+static struct tout_10 *tout_new_10(int cfd_10, int keep_10, int codec_10)
+{
+    struct tout_10 *o_10 = (struct tout_10*)calloc(1, sizeof(struct tout_10));
+    o_10->cfd = cfd_10;
+    o_10->keep = keep_10;
+    o_10->cap = codec_10 == ZC_NONE_10 ? TAR_OUT_10 : ZBLOCK_10;
+    o_10->buf = (char*)malloc(o_10->cap);
+    if (codec_10 != ZC_NONE_10)
+        o_10->z = zpool_new_10(codec_10);
+    if (codec_10 == ZC_LZ4_10)
+    {
+        // frame: magic, independent blocks, no checksums, blocks of at most 256KiB (ZBLOCK_10)
+        unsigned char head_10[7] = { 0x04, 0x22, 0x4d, 0x18, 0x60, 0x50, 0 };
+        head_10[6] = (unsigned char)((xxh32_small_10(head_10 + 4, 2) >> 8) & 0xff);
+        tout_emit_10(o_10, head_10, sizeof head_10);
+    }
+    return o_10;
+}
+// the rest of the buffer, every block still in the pool and the LZ4 end mark; stops the threads
+static int tout_finish_10(struct tout_10 *o_10)
+{
+    tout_flush_10(o_10);
+    struct zpool_10 *z_10 = o_10->z;
+    if (z_10)
+    {
+        zpool_drain_10(o_10, z_10->tail);
+        pthread_mutex_lock(&z_10->mu);
+        z_10->quit = 1;
+        pthread_cond_broadcast(&z_10->work);
+        pthread_mutex_unlock(&z_10->mu);
+        for (int i_10 = 0; i_10 < z_10->nth; ++i_10)
+            pthread_join(z_10->th[i_10], NULL);
+        static const unsigned char end_10[4] = { 0, 0, 0, 0 };
+        if (z_10->codec == ZC_LZ4_10)
+            tout_emit_10(o_10, end_10, sizeof end_10);
+    }
+    return o_10->err;
+}
+static void tout_free_10(struct tout_10 *o_10)
+{
+    struct zpool_10 *z_10 = o_10->z;
+    if (z_10)
+    {
+        for (; z_10->head < z_10->tail; ++z_10->head)
+        {
+            free(z_10->ring[z_10->head % (unsigned long long)z_10->cap].in);
+            free(z_10->ring[z_10->head % (unsigned long long)z_10->cap].out);
+        }
+        pthread_mutex_destroy(&z_10->mu);
+        pthread_cond_destroy(&z_10->work);
+        pthread_cond_destroy(&z_10->done);
+        free(z_10->ring);
+        free(z_10);
+    }
+    if (o_10->keep >= 0)
+        close(o_10->keep);
+    free(o_10->buf);
+    free(o_10);
+}
+// tar headers for S1's own files, in the format the backends write (GNU, as tar -c does)
+static void tar_num_10(char *f_10, size_t w_10, unsigned long long v_10)
+{
+    if (v_10 < (1ULL << (3 * (w_10 - 1))))
+    {
+        snprintf(f_10, w_10, "%0*llo", (int)(w_10 - 1), v_10);
+        return;
+    }
+    memset(f_10, 0, w_10);
+    f_10[0] = (char)0x80;   /* base-256, for sizes of 8GiB and more */
+    for (size_t i_10 = w_10 - 1; i_10 > 0 && v_10; --i_10, v_10 >>= 8)
+        f_10[i_10] = (char)(v_10 & 0xff);
+}
+static unsigned long long tar_getnum_10(const char *f_10, size_t w_10)
+{
+    unsigned long long v_10 = 0;
+    if ((unsigned char)f_10[0] & 0x80)
+    {
+        for (size_t i_10 = 1; i_10 < w_10; ++i_10)
+            v_10 = (v_10 << 8) | (unsigned char)f_10[i_10];
+        return v_10;
+    }
+    for (size_t i_10 = 0; i_10 < w_10 && f_10[i_10]; ++i_10)
+        if (f_10[i_10] >= '0' && f_10[i_10] <= '7')
+            v_10 = v_10 * 8 + (unsigned long long)(f_10[i_10] - '0');
+    return v_10;
+}
+static void tar_block_10(char *h_10, const char *name_10, char type_10, unsigned long long size_10, const struct stat *st_10)
+{
+    memset(h_10, 0, 512);
+    memcpy(h_10, name_10, strnlen(name_10, 100));
+    tar_num_10(h_10 + 100, 8, st_10->st_mode & 07777);
+    tar_num_10(h_10 + 108, 8, st_10->st_uid);
+    tar_num_10(h_10 + 116, 8, st_10->st_gid);
+    tar_num_10(h_10 + 124, 12, size_10);
+    tar_num_10(h_10 + 136, 12, (unsigned long long)st_10->st_mtime);
+    h_10[156] = type_10;
+    memcpy(h_10 + 257, "ustar  ", 8);
+    memset(h_10 + 148, ' ', 8);
+    unsigned sum_10 = 0;
+    for (int i_10 = 0; i_10 < 512; ++i_10)
+        sum_10 += (unsigned char)h_10[i_10];
+    snprintf(h_10 + 148, 7, "%06o", sum_10);
+}
+// a long path goes ahead of its header in a GNU long-name entry
+static size_t tar_head_10(char *out_10, const char *path_10, const struct stat *st_10)
+{
+    size_t n_10 = strlen(path_10), at_10 = 0;
+    if (n_10 >= 100)
+    {
+        tar_block_10(out_10, "././@LongLink", 'L', n_10 + 1, st_10);
+        at_10 = 512 + (n_10 + 1 + 511) / 512 * 512;
+        memset(out_10 + 512, 0, at_10 - 512);
+        memcpy(out_10 + 512, path_10, n_10);
+    }
+    tar_block_10(out_10 + at_10, path_10, '0', (unsigned long long)st_10->st_size, st_10);
+    return at_10 + 512;
+}
+
+// paths already in the archive, so a file on several replicas goes in once
+struct pathset_10
+{
+    char **slot;
+    size_t cap, n;
+};
+static int pathset_add_10(struct pathset_10 *ps_10, const char *path_10)
+{
+    if (2 * (ps_10->n + 1) > ps_10->cap)
+    {
+        struct pathset_10 big_10 = { NULL, ps_10->cap ? ps_10->cap * 2 : 1024, 0 };
+        big_10.slot = (char**)calloc(big_10.cap, sizeof(char*));
+        for (size_t i_10 = 0; i_10 < ps_10->cap; ++i_10)
+        {
+            if (!ps_10->slot[i_10])
+                continue;
+            size_t h_10 = cache_hash_10(ps_10->slot[i_10]) & (big_10.cap - 1);
+            while (big_10.slot[h_10])
+                h_10 = (h_10 + 1) & (big_10.cap - 1);
+            big_10.slot[h_10] = ps_10->slot[i_10];
+            ++big_10.n;
+        }
+        free(ps_10->slot);
+        *ps_10 = big_10;
+    }
+    size_t h_10 = cache_hash_10(path_10) & (ps_10->cap - 1);
+    for (; ps_10->slot[h_10]; h_10 = (h_10 + 1) & (ps_10->cap - 1))
+        if (!strcmp(ps_10->slot[h_10], path_10))
+            return 0;
+    ps_10->slot[h_10] = strdup(path_10);
+    ++ps_10->n;
+    return 1;
+}
+static void pathset_free_10(struct pathset_10 *ps_10)
+{
+    for (size_t i_10 = 0; i_10 < ps_10->cap; ++i_10)
+        free(ps_10->slot[i_10]);
+    free(ps_10->slot);
+}
+
+// one backend's tar of one type, read member by member
+struct tsrc_10
+{
+    struct pleg_10 p;
+    unsigned long long left;   /* bytes of its archive not read yet */
+    int live, file;            /* file: p.fd is a fetched archive on disk, not the leg */
+};
+static int tsrc_read_10(struct tsrc_10 *t_10, void *buf_10, size_t n_10)
+{
+    if (n_10 > t_10->left)
+        return -1;
+    if (!t_10->file)
+        pleg_enter_10(&t_10->p);
+    ssize_t r_10 = read_fully_10(t_10->p.fd, buf_10, n_10);
+    if (!t_10->file)
+        pleg_leave_10(&t_10->p);
+    if (r_10 != (ssize_t)n_10)
+        return -1;
+    t_10->left -= n_10;
+    return 0;
+}
+// whether a member of a backend's archive goes in: the backend must serve the file (a retiring
+// shard only until its stretch has switched, after which its copy is stale) and no other
+// replica's copy of it may have gone in already
+static int tar_member_take_10(int node_10, const char *path_10, struct pathset_10 *ps_10)
+{
+    struct place_10 pl_10 = place_10(NODES_10[node_10].cls, path_10, NULL);
+    return set_has_10(pl_10.node, pl_10.nserve, node_10) && pathset_add_10(ps_10, path_10);
+}
+// passes one member of a backend's archive on (or skips it, see tar_member_take_10);
+// 1 when one was passed, 0 at the end of the archive, -1 when the backend broke off
+static int tsrc_member_10(struct tsrc_10 *t_10, struct tout_10 *o_10, struct pathset_10 *ps_10, unsigned long long *members_10, char *buf_10)
+{
+    char path_10[PATH_MAX] = "";
+    size_t hn_10 = 0;
+    for (;;)
+    {
+        if (hn_10 + 512 > CHUNK_10 || tsrc_read_10(t_10, buf_10 + hn_10, 512) != 0)
+            return -1;
+        char *h_10 = buf_10 + hn_10;
+        hn_10 += 512;
+        int zero_10 = 1;
+        for (int i_10 = 0; i_10 < 512 && zero_10; ++i_10)
+            zero_10 = !h_10[i_10];
+        if (zero_10)
+        {
+            // the end: the rest is the second zero block and record padding
+            while (t_10->left)
+            {
+                size_t k_10 = t_10->left < CHUNK_10 ? (size_t)t_10->left : CHUNK_10;
+                if (tsrc_read_10(t_10, buf_10, k_10) != 0)
+                    return -1;
+            }
+            return 0;
+        }
+        unsigned long long size_10 = tar_getnum_10(h_10 + 124, 12);
+        size_t body_10 = (size_t)((size_10 + 511) / 512 * 512);
+        if (h_10[156] == 'L')
+        {
+            // a GNU long name: the path is the entry's data, the member's own header follows
+            if (size_10 >= sizeof path_10 || hn_10 + body_10 + 512 > CHUNK_10 || tsrc_read_10(t_10, buf_10 + hn_10, body_10) != 0)
+                return -1;
+            memcpy(path_10, buf_10 + hn_10, (size_t)size_10);
+            path_10[size_10] = '\0';
+            hn_10 += body_10;
+            continue;
+        }
+        if (!*path_10)
+        {
+            if (!memcmp(h_10 + 257, "ustar\0", 6) && h_10[345])
+                snprintf(path_10, sizeof path_10, "%.155s/%.100s", h_10 + 345, h_10);
+            else
+                snprintf(path_10, sizeof path_10, "%.100s", h_10);
+        }
+        int keep_10 = tar_member_take_10(t_10->p.node, path_10, ps_10);
+        if (keep_10 && tout_put_10(o_10, buf_10, hn_10) != 0)
+            return -1;
+        unsigned long long more_10 = (size_10 + 511) / 512 * 512;
+        while (more_10)
+        {
+            size_t k_10 = more_10 < CHUNK_10 ? (size_t)more_10 : CHUNK_10;
+            if (tsrc_read_10(t_10, buf_10, k_10) != 0 || (keep_10 && tout_put_10(o_10, buf_10, k_10) != 0))
+                return -1;
+            more_10 -= k_10;
+        }
+        *members_10 += (unsigned long long)keep_10;
+        return 1;
+    }
+}
+// one of S1's own files as a member; entries are "path|size|mtime" from tree_local_10
+static void tar_local_member_10(const char *root_10, const char *ent_10, struct tout_10 *o_10, struct pathset_10 *ps_10, unsigned long long *members_10, char *buf_10)
+{
+    char path_10[PATH_MAX];
+    snprintf(path_10, sizeof path_10, "%.*s", (int)strcspn(ent_10, "|"), ent_10);
+    char *full_10 = NULL;
+    asprintf(&full_10, "%s/%s", root_10, path_10);
+    int in_10 = open(full_10, O_RDONLY);
+    free(full_10);
+    struct stat st_10;
+    if (in_10 < 0 || fstat(in_10, &st_10) != 0 || !S_ISREG(st_10.st_mode) || !pathset_add_10(ps_10, path_10))
+    {
+        if (in_10 >= 0)
+            close(in_10);
+        return;
+    }
+    char *head_10 = (char*)malloc(512 * 2 + PATH_MAX + 512);
+    tout_put_10(o_10, head_10, tar_head_10(head_10, path_10, &st_10));
+    free(head_10);
+    // a file that shrank since it was stat'ed is padded out to the size in its header
+    unsigned long long left_10 = (unsigned long long)st_10.st_size;
+    while (left_10)
+    {
+        size_t k_10 = left_10 < CHUNK_10 ? (size_t)left_10 : CHUNK_10;
+        ssize_t r_10 = read(in_10, buf_10, k_10);
+        if (r_10 <= 0)
+        {
+            memset(buf_10, 0, k_10);
+            r_10 = (ssize_t)k_10;
+        }
+        tout_put_10(o_10, buf_10, (size_t)r_10);
+        left_10 -= (unsigned long long)r_10;
+    }
+    close(in_10);
+    memset(buf_10, 0, 512);
+    tout_put_10(o_10, buf_10, (size_t)((512 - st_10.st_size % 512) % 512));
+    ++*members_10;
+}
+// the end of an archive: two zero blocks, padded to whole records as tar does
+static void tar_end_10(struct tout_10 *o_10, char *buf_10)
+{
+    unsigned long long at_10 = o_10->bytes + o_10->n;
+    size_t tail_10 = 1024 + (size_t)((TAR_RECORD_10 - (at_10 + 1024) % TAR_RECORD_10) % TAR_RECORD_10);
+    memset(buf_10, 0, CHUNK_10);
+    while (tail_10)
+    {
+        size_t k_10 = tail_10 < CHUNK_10 ? tail_10 : CHUNK_10;
+        tout_put_10(o_10, buf_10, k_10);
+        tail_10 -= k_10;
+    }
+}
+
+// DOWNTAR|<type> of a remote class: every shard's tar of the type (retiring ones included) is
+// fetched and its members are copied into one archive through tar_member_take_10, so a file
+// held on several replicas, or still on a shard a rebalance moved it from, goes in once. A shard
+// with nothing of that type is skipped, one that fails fails the whole tar (-2 when nothing
+// went in)
+static int class_tar_10(int cls_10, const char *ext_10, char **out_tmp_path_10, size_t *out_size_10)
+{
+    char *merged_10 = NULL;
+    int mfd_10 = make_temp_10("tar", &merged_10);
+    if (mfd_10 < 0)
+        return -1;
+    struct tout_10 *o_10 = tout_new_10(-1, mfd_10, ZC_NONE_10);
+    struct pathset_10 ps_10 = { NULL, 0, 0 };
+    unsigned long long members_10 = 0;
+    char *buf_10 = (char*)malloc(CHUNK_10);
+    int failed_10 = 0;
+    for (int n_10 = 0; n_10 < NNODES_10 && !failed_10; ++n_10)
+    {
+        if (NODES_10[n_10].cls != cls_10)
+            continue;
+        char *part_10 = NULL; size_t psz_10 = 0;
+        int rc_10 = backend_tar_10(n_10, ext_10, &part_10, &psz_10);
+        if (rc_10 == -2)
+            continue;
+        if (rc_10 != 0)
+        {
+            failed_10 = 1;
+            continue;
+        }
+        struct tsrc_10 t_10;
+        memset(&t_10, 0, sizeof t_10);
+        t_10.p.node = n_10;
+        t_10.p.fd = open(part_10, O_RDONLY);
+        t_10.left = psz_10;
+        t_10.file = 1;
+        int r_10;
+        while (t_10.p.fd >= 0 && (r_10 = tsrc_member_10(&t_10, o_10, &ps_10, &members_10, buf_10)) == 1)
+            ;
+        failed_10 = t_10.p.fd < 0 || r_10 < 0 || o_10->err;
+        if (t_10.p.fd >= 0)
+            close(t_10.p.fd);
+        unlink(part_10); free(part_10);
+    }
+    tar_end_10(o_10, buf_10);
+    failed_10 |= tout_finish_10(o_10) != 0;
+    tout_free_10(o_10);
+    free(buf_10);
+    pathset_free_10(&ps_10);
+    struct stat st_10;
+    if (failed_10 || !members_10 || stat(merged_10, &st_10) != 0)
+    {
+        unlink(merged_10); free(merged_10);
+        return failed_10 ? -1 : -2;
+    }
+    *out_tmp_path_10 = merged_10;
+    *out_size_10 = (size_t)st_10.st_size;
+    return 0;
+}
+
+static void handle_downtar_all_10(int cfd_10, char *line_10)
+{
+    // the types: every routed one for all, else the listed ones
+    char types_10[MAX_ROUTES_10][EXT_MAX_10];
+    int nt_10 = 0;
+    char *set_10 = line_10 + 8;
+    for (char *p_10 = set_10; *p_10; ++p_10)
+        *p_10 = (char)tolower((unsigned char)*p_10);
+    int codec_10 = ZC_NONE_10;
+    char *zarg_10 = strchr(set_10, '|');
+    if (zarg_10)
+    {
+        *zarg_10++ = '\0';
+        if (!strcmp(zarg_10, "gz"))
+            codec_10 = ZC_GZIP_10;
+        else if (!strcmp(zarg_10, "lz4"))
+            codec_10 = ZC_LZ4_10;
+        else if (*zarg_10)
+        {
+            send_line_10(cfd_10, "ERR|bad_codec");
+            return;
+        }
+    }
+    int all_10 = !strcmp(set_10, "all");
+    char *save_10 = NULL;
+    for (int r_10 = 0; all_10 ? r_10 < NROUTES_10 : r_10 == 0 || save_10; ++r_10)
+    {
+        const char *ext_10 = all_10 ? ROUTES_10[r_10].ext : strtok_r(r_10 ? NULL : set_10, ",", &save_10);
+        if (!ext_10)
+            break;
+        if (!ext_ok_10(ext_10) || route_ext_10(ext_10) < 0)
+        {
+            if (all_10)
+                continue;
+            send_line_10(cfd_10, "ERR|unsupported_type");
+            return;
+        }
+        int dup_10 = 0;
+        for (int i_10 = 0; i_10 < nt_10 && !dup_10; ++i_10)
+            dup_10 = !strcmp(types_10[i_10], ext_10);
+        if (!dup_10 && nt_10 < MAX_ROUTES_10)
+            snprintf(types_10[nt_10++], EXT_MAX_10, "%.*s", EXT_MAX_10 - 1, ext_10);
+    }
+    if (!nt_10)
+    {
+        send_line_10(cfd_10, "ERR|unsupported_type");
         return;
     }
 
-    for (int i_10 = 0; i_10 < n_10; ++i_10)
+    // every backend of every type's class starts building its tar now
+    struct tsrc_10 *src_10 = (struct tsrc_10*)calloc((size_t)(NNODES_10 * nt_10) + 1, sizeof(struct tsrc_10));
+    int ns_10 = 0, failed_10 = 0;
+    struct namerun_10 local_10;
+    namerun_init_10(&local_10, 0);
+    char *root_10 = build_s1_path_10("", 1);
+    for (int t_10 = 0; t_10 < nt_10; ++t_10)
+    {
+        int cls_10 = route_ext_10(types_10[t_10]);
+        if (CLASSES_10[cls_10].local)
+            continue;
+        char req_10[LINE_MAX_10];
+        snprintf(req_10, sizeof req_10, "TAR|%.*s", EXT_MAX_10 - 1, types_10[t_10]);
+        for (int n_10 = 0; n_10 < NNODES_10; ++n_10)
+        {
+            if (NODES_10[n_10].cls != cls_10)
+                continue;
+            if (pleg_start_10(&src_10[ns_10].p, n_10, BOP_TAR_10, req_10) != 0)
+            {
+                failed_10 = 1;
+                continue;
+            }
+            src_10[ns_10++].live = 1;
+        }
+    }
+    // S1's own files meanwhile
+    for (int t_10 = 0; t_10 < nt_10; ++t_10)
+    {
+        if (!CLASSES_10[route_ext_10(types_10[t_10])].local)
+            continue;
+        char glob_10[EXT_MAX_10 + 2];
+        snprintf(glob_10, sizeof glob_10, "*%.*s", EXT_MAX_10 - 1, types_10[t_10]);
+        struct tree_10 tr_10 = { 0, "", glob_10, FNM_CASEFOLD };
+        int dfd_10 = open(root_10, O_RDONLY | O_DIRECTORY);
+        if (dfd_10 >= 0)
+            tree_local_10(&tr_10, dfd_10, "", 1, &local_10);
+    }
+    namerun_sort_10(&local_10);
+
+    // the first line of every reply comes once that backend's archive is built
+    for (int s_10 = 0; s_10 < ns_10; ++s_10)
     {
-        char *pp_10 = strtok_r(NULL, "|", &line_10);
-        if (!pp_10 || !path_is_s1_10(pp_10))
+        char reply_10[LINE_MAX_10];
+        pleg_enter_10(&src_10[s_10].p);
+        int r_10 = read_line_10(src_10[s_10].p.fd, reply_10, sizeof reply_10);
+        pleg_leave_10(&src_10[s_10].p);
+        const char *sz_10 = r_10 > 0 && !strncmp(reply_10, "OK|", 3) ? strchr(reply_10 + 3, '|') : NULL;
+        if (sz_10)
         {
-            send_line_10(cfd_10, "FILENOTFOUND|%s", pp_10?pp_10:"");
+            src_10[s_10].left = strtoull(sz_10 + 1, NULL, 10);
             continue;
         }
+        src_10[s_10].live = 0;
+        int empty_10 = r_10 > 0 && !strcmp(reply_10, "ERR|empty");
+        failed_10 |= !empty_10;
+        pleg_end_10(&src_10[s_10].p, "backend.tar", empty_10);
+    }
+    int any_10 = local_10.n > 0;
+    for (int s_10 = 0; s_10 < ns_10; ++s_10)
+        any_10 |= src_10[s_10].live;
+    if (failed_10 || !any_10)
+    {
+        for (int s_10 = 0; s_10 < ns_10; ++s_10)
+            if (src_10[s_10].live)
+                pleg_cancel_10(&src_10[s_10].p);
+        send_line_10(cfd_10, failed_10 ? "ERR|tar_backend" : "ERR|no_files");
+        namerun_free_10(&local_10);
+        free(src_10);
+        free(root_10);
+        return;
+    }
 
-        const char *ext_10 = ext_lower_10(pp_10);
+    // the archive's name: all.tar, the types (c_pdf.tar) or the one type's (cfiles.tar), with
+    // .gz or .lz4 after it when compressed; a copy is kept in tar_files
+    char name_10[LINE_MAX_10] = "";
+    size_t nn_10 = 0;
+    if (nt_10 == 1 && !all_10)
+        nn_10 = (size_t)snprintf(name_10, sizeof name_10, "%s", tar_name_10(types_10[0]));
+    else
+    {
+        for (int t_10 = 0; t_10 < nt_10 && !all_10 && nn_10 + EXT_MAX_10 + 8 < sizeof name_10; ++t_10)
+            nn_10 += (size_t)snprintf(name_10 + nn_10, sizeof name_10 - nn_10, "%s%s", t_10 ? "_" : "", types_10[t_10] + 1);
+        nn_10 += (size_t)snprintf(name_10 + nn_10, sizeof name_10 - nn_10, "%s.tar", all_10 ? "all" : "");
+    }
+    snprintf(name_10 + nn_10, sizeof name_10 - nn_10, "%s", codec_10 == ZC_GZIP_10 ? ".gz" : codec_10 == ZC_LZ4_10 ? ".lz4" : "");
+    char *adir_10 = build_s1_path_10("~S1/tar_files", 1);
+    char *keep_10 = unique_dest_path_10(adir_10, name_10);
+    send_line_10(cfd_10, "TARSTREAM|%s", name_10);
+    struct tout_10 *o_10 = tout_new_10(cfd_10, keep_10 ? open(keep_10, O_CREAT | O_TRUNC | O_WRONLY, 0600) : -1, codec_10);
 
-        if (!strcmp(ext_10, ".c"))
+    // a member from whichever backend has one ready, and one of S1's own in between
+    struct pathset_10 ps_10 = { NULL, 0, 0 };
+    unsigned long long members_10 = 0;
+    int broke_10 = 0, lpos_10 = 0;
+    char *buf_10 = (char*)malloc(CHUNK_10);
+    struct pollfd *pfd_10 = (struct pollfd*)malloc(sizeof(struct pollfd) * (size_t)(ns_10 + 1));
+    int *who_10 = (int*)malloc(sizeof(int) * (size_t)(ns_10 + 1));
+    unsigned long long ta_10 = trace_begin_10();
+    for (;;)
+    {
+        int np_10 = 0;
+        for (int s_10 = 0; s_10 < ns_10; ++s_10)
+            if (src_10[s_10].live)
+            {
+                pfd_10[np_10].fd = src_10[s_10].p.fd;
+                pfd_10[np_10].events = POLLIN;
+                who_10[np_10++] = s_10;
+            }
+        int local_left_10 = lpos_10 < local_10.n;
+        if (o_10->err)
         {
-            char *full_10 = build_s1_path_10(pp_10, 0);
-            struct stat st_10;
-            if (stat(full_10, &st_10) != 0 || !S_ISREG(st_10.st_mode))
+            for (int k_10 = 0; k_10 < np_10; ++k_10)
             {
-                send_line_10(cfd_10, "FILENOTFOUND|%s", pp_10);
-                free(full_10);
-                continue;
+                src_10[who_10[k_10]].live = 0;
+                pleg_cancel_10(&src_10[who_10[k_10]].p);
             }
-            size_t sz_10 = (size_t)st_10.st_size;
-            const char *basename_10 = strrchr(full_10, '/');
-            basename_10 = basename_10 ? basename_10+1 : full_10;
-
-            archive_copy_10("downloaded_files", basename_10, full_10);
-
-            send_line_10(cfd_10, "FILERESP|%s|%zu", basename_10, sz_10);
-            send_file_from_path_10(cfd_10, full_10, NULL);
-            free(full_10);
-
+            break;
         }
-        else if (!strcmp(ext_10, ".pdf") || !strcmp(ext_10, ".txt") || !strcmp(ext_10, ".zip"))
+        if (!np_10 && !local_left_10)
+            break;
+        int pr_10 = np_10 ? poll(pfd_10, (nfds_t)np_10, local_left_10 ? 0 : BOP_MS_10[BOP_TAR_10]) : 0;
+        if (pr_10 < 0 && errno == EINTR)
+            continue;
+        if (pr_10 <= 0 && !local_left_10)
         {
-            // fetch into a temp file from the backend, then send & archive
-            char *tmpdir_10 = build_s1_path_10("tmp", 1);
-            char *tmpout_10 = NULL; asprintf(&tmpout_10, "%s/fetch_%d.tmp", tmpdir_10, getpid());
-            free(tmpdir_10);
-
-            if (backend_fetch_10(ext_10, pp_10, tmpout_10) != 0)
+            // every backend left went quiet for a whole TAR timeout
+            for (int k_10 = 0; k_10 < np_10; ++k_10)
             {
-                send_line_10(cfd_10, "FILENOTFOUND|%s", pp_10);
-                free(tmpout_10);
+                src_10[who_10[k_10]].live = 0;
+                pleg_end_10(&src_10[who_10[k_10]].p, "backend.tar", 0);
+                ++broke_10;
+            }
+            continue;
+        }
+        for (int k_10 = 0; k_10 < np_10 && pr_10 > 0; ++k_10)
+        {
+            if (!pfd_10[k_10].revents)
                 continue;
+            struct tsrc_10 *t_10 = &src_10[who_10[k_10]];
+            int r_10 = tsrc_member_10(t_10, o_10, &ps_10, &members_10, buf_10);
+            if (r_10 <= 0)
+            {
+                t_10->live = 0;
+                pleg_end_10(&t_10->p, "backend.tar", r_10 == 0);
+                broke_10 += r_10 < 0;
             }
-            struct stat st_10; stat(tmpout_10, &st_10);
-            size_t size_10 = (size_t)st_10.st_size;
-            const char *base_10 = strrchr(pp_10, '/');
-            base_10 = base_10? base_10+1 : pp_10;
+        }
+        if (local_left_10)
+            tar_local_member_10(root_10, local_10.sorted[lpos_10++], o_10, &ps_10, &members_10, buf_10);
+    }
+    trace_span_10("tar.stream", "S1", ta_10);
 
-            archive_copy_10("downloaded_files", base_10, tmpout_10);
+    tar_end_10(o_10, buf_10);
+    if (tout_finish_10(o_10) == 0)
+        send_line_10(cfd_10, "TAREND|%llu|%d", members_10, broke_10);
+    tout_free_10(o_10);
+    free(keep_10);
+    free(adir_10);
+    free(buf_10);
+    free(pfd_10);
+    free(who_10);
+    pathset_free_10(&ps_10);
+    namerun_free_10(&local_10);
+    free(src_10);
+    free(root_10);
+}
 
-            send_line_10(cfd_10, "FILERESP|%s|%zu", base_10, size_10);
-            send_file_from_path_10(cfd_10, tmpout_10, NULL);
-            unlink(tmpout_10); free(tmpout_10);
 
-        }
-        else
+//this is the routes handler
+// replies with the routing table: CLASS|name|addr,addr.. (or "local"), REPLICAS|name|n|w for a
+// replicated class, FROM|name|addr,addr.. for a class being rebalanced, ROUTE|ext|class, DEFAULT|class
+static void handle_routes_10(int cfd_10)
+{
+    send_line_10(cfd_10, "ROUTESBEGIN");
+    for (int i_10 = 0; i_10 < NCLASSES_10; ++i_10)
+    {
+        const struct sclass_10 *cl_10 = &CLASSES_10[i_10];
+        if (cl_10->local)
         {
-            send_line_10(cfd_10, "FILENOTFOUND|%s", pp_10);
+            send_line_10(cfd_10, "CLASS|%s|local", cl_10->name);
+            continue;
         }
+        char addrs_10[LINE_MAX_10 - 64]; size_t a_10 = 0;
+        addrs_10[0] = '\0';
+        for (int n_10 = cl_10->first; n_10 < cl_10->first + cl_10->count && a_10 + 130 < sizeof addrs_10; ++n_10)
+            a_10 += (size_t)snprintf(addrs_10 + a_10, sizeof addrs_10 - a_10, "%s%s", a_10 ? "," : "", NODES_10[n_10].addr);
+        send_line_10(cfd_10, "CLASS|%s|%s", cl_10->name, addrs_10);
+        if (cl_10->replicas > 1)
+            send_line_10(cfd_10, "REPLICAS|%s|%d|%d", cl_10->name, cl_10->replicas, cl_10->wquorum);
+        if (!cl_10->nfrom)
+            continue;
+        a_10 = 0;
+        for (int i_10 = 0; i_10 < cl_10->nfrom && a_10 + 130 < sizeof addrs_10; ++i_10)
+            a_10 += (size_t)snprintf(addrs_10 + a_10, sizeof addrs_10 - a_10, "%s%s", a_10 ? "," : "", NODES_10[cl_10->from[i_10]].addr);
+        send_line_10(cfd_10, "FROM|%s|%s", cl_10->name, addrs_10);
     }
-    send_line_10(cfd_10, "DONE");
+    for (int r_10 = 0; r_10 < NROUTES_10; ++r_10)
+        send_line_10(cfd_10, "ROUTE|%s|%s", ROUTES_10[r_10].ext, CLASSES_10[ROUTES_10[r_10].cls].name);
+    send_line_10(cfd_10, "DEFAULT|%s", DEFAULT_CLASS_10 >= 0 ? CLASSES_10[DEFAULT_CLASS_10].name : "none");
+    send_line_10(cfd_10, "ROUTESEND");
 }
 
-// this is the handler for removef
-//deletes the .c locally or .pdf/.txt/.zip files from backend
-static void handle_removef_10(int cfd_10, char *line_10)
+// REBALANCE: a migrator process moves the files of every moving stretch of a class from its old
+// shard to its new one, one stretch at a time with FETCH and STORENX, and switches the stretch
+// once all its files are copied. It keeps under the KB/s asked for and pauses while clients have
+// commands in flight, so the move does not show up in their latency
+#define REBAL_KBPS_10 4096   /* when the client does not give a rate */
+#define REBAL_GRACE_S_10 2   /* lets commands that looked up a stretch before it changed finish */
+
+struct move_10
 {
-    strtok_r(line_10, "|", &line_10);
-    char *nstr_10 = strtok_r(NULL, "|", &line_10);
-    int n_10 = nstr_10 ? atoi(nstr_10) : 0;
-    if (n_10 < 1 || n_10 > 2)
+    char *rel;
+    int seg, node;
+};
+static int move_cmp_10(const void *a_10, const void *b_10)
+{
+    const struct move_10 *aa_10 = (const struct move_10*)a_10;
+    const struct move_10 *bb_10 = (const struct move_10*)b_10;
+    if (aa_10->seg != bb_10->seg)
+        return aa_10->seg - bb_10->seg;
+    return strcmp(aa_10->rel, bb_10->rel);
+}
+
+// sleeps until the bytes moved so far fit the rate, then while client commands are in flight
+// (a fifth of a second at most, so a busy server still makes progress)
+static void rebal_throttle_10(unsigned long long t0_10, unsigned long long moved_10, int kbps_10)
+{
+    if (kbps_10 > 0)
     {
-        send_line_10(cfd_10, "ERR|bad removef header");
-        return;
+        unsigned long long due_10 = t0_10 + moved_10 * 1000000ULL / ((unsigned long long)kbps_10 * 1024ULL);
+        for (unsigned long long now_10 = now_us_10(); now_10 < due_10; now_10 = now_us_10())
+            usleep((useconds_t)(due_10 - now_10 > 500000 ? 500000 : due_10 - now_10));
+    }
+    for (int i_10 = 0; i_10 < 10 && STATG_10 && __atomic_load_n(&STATG_10->inflight, __ATOMIC_RELAXED) > 0; ++i_10)
+        usleep(20000);
+}
+
+// copies one file of a moving stretch from an old replica to each new replica that was not an
+// old one; a copy already there came from a write sent to both sets and is kept, and a file
+// deleted while it was copied is deleted again
+static int rebal_copy_10(const struct seg_10 *sg_10, const char *rel_10, unsigned long long *bytes_10)
+{
+    char *tmp_10 = NULL;
+    int tfd_10 = make_temp_10("move", &tmp_10);
+    if (tfd_10 < 0)
+        return -1;
+    close(tfd_10);
+    int src_10 = -1;
+    for (int i_10 = 0; i_10 < sg_10->nf && src_10 < 0; ++i_10)
+        if (backend_fetch_10(sg_10->from[i_10], rel_10, tmp_10) == 0)
+            src_10 = sg_10->from[i_10];
+    if (src_10 < 0)
+    {
+        unlink(tmp_10); free(tmp_10);
+        for (int i_10 = 0; i_10 < sg_10->nf; ++i_10)
+            if (backend_stat_10(sg_10->from[i_10], rel_10, NULL) != 0)
+                return -1;
+        return 0;   /* removed meanwhile */
+    }
+    struct stat st_10;
+    *bytes_10 = stat(tmp_10, &st_10) == 0 ? (unsigned long long)st_10.st_size : 0;
+
+    char dir_10[LINE_MAX_10];
+    const char *slash_10 = strrchr(rel_10, '/');
+    snprintf(dir_10, sizeof dir_10, "%.*s", slash_10 ? (int)(slash_10 - rel_10) : 0, rel_10);
+    int stored_10[MAX_REPLICAS_10], ns_10 = 0, rc_10 = 0;
+    for (int i_10 = 0; i_10 < sg_10->nt; ++i_10)
+    {
+        if (set_has_10(sg_10->from, sg_10->nf, sg_10->to[i_10]))
+            continue;
+        int r_10 = backend_storenx_10(sg_10->to[i_10], dir_10, slash_10 ? slash_10 + 1 : rel_10, tmp_10);
+        if (r_10 == 0)
+            stored_10[ns_10++] = sg_10->to[i_10];
+        else if (r_10 != -2)
+            rc_10 = -1;
     }
+    unlink(tmp_10); free(tmp_10);
+    if (ns_10 && backend_stat_10(src_10, rel_10, NULL) == 0)
+        for (int i_10 = 0; i_10 < ns_10; ++i_10)
+            backend_delete_10(stored_10[i_10], rel_10);
+    return rc_10;
+}
 
+// the files an old replica holds in stretches moving in the given state; with leaving, only
+// those of stretches it is not a new replica of
+static void rebal_collect_10(const struct sclass_10 *cl_10, int node_10, int state_10, int leaving_10,
+    struct move_10 **vec_10, int *cnt_10, int *cap_10, int *failed_10)
+{
+    char **arr_10 = NULL; int n_10 = 0;
+    if (backend_walk_10(node_10, &arr_10, &n_10) != 0)
+    {
+        *failed_10 = 1;
+        return;
+    }
     for (int i_10 = 0; i_10 < n_10; ++i_10)
     {
-        char *pp_10 = strtok_r(NULL, "|", &line_10);
-        if (!pp_10 || !path_is_s1_10(pp_10))
+        char key_10[LINE_MAX_10];
+        shard_key_10(arr_10[i_10], NULL, key_10, sizeof key_10);
+        int s_10 = seg_find_10(cl_10, ph_hash_10(key_10, 0));
+        const struct seg_10 *sg_10 = &cl_10->segs[s_10];
+        if (!seg_moving_10(cl_10, s_10) || !set_has_10(sg_10->from, sg_10->nf, node_10)
+            || (leaving_10 && set_has_10(sg_10->to, sg_10->nt, node_10))
+            || __atomic_load_n(&cl_10->seg_state[s_10], __ATOMIC_ACQUIRE) != state_10)
         {
-            send_line_10(cfd_10, "REMERR|%s|bad_path", pp_10?pp_10:"");
+            free(arr_10[i_10]);
             continue;
         }
-        const char *ext_10 = ext_lower_10(pp_10);
+        if (*cnt_10 == *cap_10)
+        {
+            *cap_10 *= 2;
+            *vec_10 = (struct move_10*)realloc(*vec_10, sizeof(struct move_10) * *cap_10);
+        }
+        (*vec_10)[*cnt_10].rel = arr_10[i_10];
+        (*vec_10)[*cnt_10].node = node_10;
+        (*vec_10)[(*cnt_10)++].seg = s_10;
+    }
+    free(arr_10);
+}
 
-        if (!strcmp(ext_10, ".c"))
+static void rebal_phase_10(struct rebal_10 *rb_10, const char *phase_10)
+{
+    snprintf(rb_10->phase, sizeof rb_10->phase, "%s", phase_10);
+}
+
+static void rebal_run_10(int cls_10, int kbps_10)
+{
+    struct sclass_10 *cl_10 = &CLASSES_10[cls_10];
+    struct rebal_10 *rb_10 = cl_10->rb;
+    snprintf(trace_rid_10, sizeof trace_rid_10, "rebalance-%.20s", cl_10->name);
+    rb_10->files = rb_10->bytes = rb_10->failed = 0;
+
+    // 1: every moving stretch not switched yet starts taking writes on both replica sets
+    rebal_phase_10(rb_10, "copying");
+    for (int s_10 = 0; s_10 < cl_10->nsegs; ++s_10)
+        if (seg_moving_10(cl_10, s_10) && cl_10->seg_state[s_10] == SEG_OLD_10)
+            __atomic_store_n(&cl_10->seg_state[s_10], SEG_COPYING_10, __ATOMIC_RELEASE);
+    sleep(REBAL_GRACE_S_10);
+
+    // 2: copy stretch by stretch (each file once, whichever old replicas list it), switching each
+    // one once all its files are on the new replicas
+    int cnt_10 = 0, cap_10 = 64;
+    struct move_10 *vec_10 = (struct move_10*)malloc(sizeof(struct move_10) * cap_10);
+    int walk_failed_10[MAX_NODES_10] = { 0 };
+    for (int i_10 = 0; i_10 < cl_10->nfrom; ++i_10)
+        rebal_collect_10(cl_10, cl_10->from[i_10], SEG_COPYING_10, 0, &vec_10, &cnt_10, &cap_10, &walk_failed_10[cl_10->from[i_10]]);
+    qsort(vec_10, (size_t)cnt_10, sizeof(struct move_10), move_cmp_10);
+
+    unsigned long long t0_10 = now_us_10(), moved_10 = 0;
+    int next_10 = 0;
+    for (int s_10 = 0; s_10 < cl_10->nsegs; ++s_10)
+    {
+        const struct seg_10 *sg_10 = &cl_10->segs[s_10];
+        if (!seg_moving_10(cl_10, s_10) || cl_10->seg_state[s_10] != SEG_COPYING_10)
+            continue;
+        int ok_10 = 1;
+        for (int i_10 = 0; i_10 < sg_10->nf; ++i_10)
+            if (walk_failed_10[sg_10->from[i_10]])
+                ok_10 = 0;
+        for (; next_10 < cnt_10 && vec_10[next_10].seg == s_10; ++next_10)
         {
-            char *full_10 = build_s1_path_10(pp_10, 0);
-            if (unlink(full_10) == 0)
-                send_line_10(cfd_10, "REMOK|%s", pp_10);
+            if (next_10 > 0 && vec_10[next_10 - 1].seg == s_10 && !strcmp(vec_10[next_10 - 1].rel, vec_10[next_10].rel))
+                continue;
+            unsigned long long b_10 = 0;
+            if (rebal_copy_10(sg_10, vec_10[next_10].rel, &b_10) != 0)
+            {
+                ok_10 = 0;
+                __atomic_fetch_add(&rb_10->failed, 1, __ATOMIC_RELAXED);
+            }
             else
-                send_line_10(cfd_10, "REMERR|%s|%s", pp_10, strerror(errno));
-            free(full_10);
-
+            {
+                __atomic_fetch_add(&rb_10->files, 1, __ATOMIC_RELAXED);
+                __atomic_fetch_add(&rb_10->bytes, b_10, __ATOMIC_RELAXED);
+            }
+            trace_flush_10();
+            moved_10 += b_10;
+            rebal_throttle_10(t0_10, moved_10, kbps_10);
         }
-        else if (!strcmp(ext_10, ".pdf") || !strcmp(ext_10, ".txt") || !strcmp(ext_10, ".zip"))
+        if (ok_10)
         {
-            if (backend_delete_10(ext_10, pp_10)==0)
-                send_line_10(cfd_10, "REMOK|%s", pp_10);
-            else
-                send_line_10(cfd_10, "REMERR|%s|NOT FOUND", pp_10);
+            __atomic_store_n(&cl_10->seg_state[s_10], SEG_SWITCHED_10, __ATOMIC_RELEASE);
+            rebal_save_10(cls_10);
         }
-        else
+    }
+    for (int i_10 = 0; i_10 < cnt_10; ++i_10)
+        free(vec_10[i_10].rel);
+
+    // 3: clean the replicas that left a stretch; a file the copy missed (a write that began
+    // before its stretch started copying) is copied first, then deleted from the leaving replica
+    rebal_phase_10(rb_10, "cleanup");
+    sleep(REBAL_GRACE_S_10);
+    cnt_10 = 0;
+    int sweep_failed_10 = 0;
+    for (int i_10 = 0; i_10 < cl_10->nfrom; ++i_10)
+        rebal_collect_10(cl_10, cl_10->from[i_10], SEG_SWITCHED_10, 1, &vec_10, &cnt_10, &cap_10, &sweep_failed_10);
+    for (int i_10 = 0; i_10 < cnt_10; ++i_10)
+    {
+        const struct seg_10 *sg_10 = &cl_10->segs[vec_10[i_10].seg];
+        unsigned long long b_10 = 0;
+        int missing_10 = 0, err_10 = 0;
+        for (int t_10 = 0; t_10 < sg_10->nt; ++t_10)
         {
-            send_line_10(cfd_10, "REMERR|%s|unsupported", pp_10);
+            if (set_has_10(sg_10->from, sg_10->nf, sg_10->to[t_10]))
+                continue;
+            int there_10 = backend_stat_10(sg_10->to[t_10], vec_10[i_10].rel, NULL);
+            if (there_10 < 0)
+                err_10 = 1;
+            else if (there_10 == 0)
+                missing_10 = 1;
         }
+        if (err_10 || (missing_10 && rebal_copy_10(sg_10, vec_10[i_10].rel, &b_10) != 0))
+            __atomic_fetch_add(&rb_10->failed, 1, __ATOMIC_RELAXED);
+        else
+            backend_delete_10(vec_10[i_10].node, vec_10[i_10].rel);
+        trace_flush_10();
+        moved_10 += b_10;
+        rebal_throttle_10(t0_10, moved_10, kbps_10);
+        free(vec_10[i_10].rel);
     }
+    free(vec_10);
+
+    int done_10 = !sweep_failed_10 && !rb_10->failed;
+    for (int s_10 = 0; s_10 < cl_10->nsegs && done_10; ++s_10)
+        if (seg_moving_10(cl_10, s_10) && cl_10->seg_state[s_10] != SEG_SWITCHED_10)
+            done_10 = 0;
+    rebal_phase_10(rb_10, done_10 ? "done" : "partial");
+    trace_flush_10();
+    __atomic_store_n(&rb_10->pid, 0, __ATOMIC_RELEASE);
 }
 
-// this is the handler for downltar
-// send the required tar files to ~/S1/tar_files/ with fixed names:
-/*          .c   -> cfiles.tar
-          .pdf -> pdfs.tar
-          .txt -> textiles.tar
-*/
-static void handle_downtar_10(int cfd_10, char *line_10)
+//this is the rebalance handler
+// REBALANCE|<class>|start[|KB/s] starts moving the class to its current shards in the background
+// REBALANCE|<class>|status replies OK|phase=..|moving=..|switched=..|files=..|bytes=..|failed=..
+static void handle_rebalance_10(int cfd_10, char *line_10)
 {
-    strtok_r(line_10, "|", &line_10);
-    char *type_10 = strtok_r(NULL, "|", &line_10);
-    if (!type_10)
+    char *save_10 = NULL;
+    strtok_r(line_10, "|", &save_10);
+    char *name_10 = strtok_r(NULL, "|", &save_10);
+    char *what_10 = strtok_r(NULL, "|", &save_10);
+    char *rate_10 = strtok_r(NULL, "|", &save_10);
+    int cls_10 = name_10 ? class_find_10(name_10) : -1;
+    if (cls_10 < 0 || !what_10)
     {
-        send_line_10(cfd_10, "ERR|missing_type");
+        send_line_10(cfd_10, "ERR|no_class");
         return;
     }
-
-    if (!strcmp(type_10, ".c"))
+    struct sclass_10 *cl_10 = &CLASSES_10[cls_10];
+    if (!cl_10->rb)
     {
-        // Build tar of all .c under ~/S1
-        char *root_10   = build_s1_path_10("", 1);
-        char *tmpdir_10 = build_s1_path_10("tmp", 1);
-        char *tar_10    = NULL; asprintf(&tar_10, "%s/cfiles.tar", tmpdir_10);
-        free(tmpdir_10);
-
-        char *cmd_10 = NULL;
-        asprintf(&cmd_10, "cd '%s' && tar -cf '%s' $(find . -type f -name '*.c' | sed 's|^\\./||') 2>/dev/null", root_10, tar_10);
-        int rc_10 = system(cmd_10);
-        (void)rc_10;
-        free(cmd_10);
-        free(root_10);
-
-        struct stat st_10;
-        if (stat(tar_10, &st_10)!=0)
-        {
-            send_line_10(cfd_10, "ERR|no_c_files");
-            free(tar_10); return;
-        }
-        size_t sz_10 = (size_t)st_10.st_size;
-
-        //copy with fixed name cfiles.tar
-        archive_copy_10("tar_files", "cfiles.tar", tar_10);
-
-        send_line_10(cfd_10, "FILERESP|cfiles.tar|%zu", sz_10);
-        send_file_from_path_10(cfd_10, tar_10, NULL);
-        unlink(tar_10); free(tar_10);
-
+        send_line_10(cfd_10, "ERR|no_plan");   /* the config has no "from" line for it */
+        return;
     }
-    else if (!strcmp(type_10, ".pdf") || !strcmp(type_10, ".txt"))
-    {
-        char *tmp_10 = NULL; size_t sz_10 = 0;
-        if (backend_tar_10(type_10, &tmp_10, &sz_10) != 0)
+    unsigned moving_10 = 0, switched_10 = 0;
+    for (int s_10 = 0; s_10 < cl_10->nsegs; ++s_10)
+        if (seg_moving_10(cl_10, s_10))
         {
-            send_line_10(cfd_10, "ERR|tar_backend");
-            return;
+            ++moving_10;
+            if (__atomic_load_n(&cl_10->seg_state[s_10], __ATOMIC_ACQUIRE) == SEG_SWITCHED_10)
+                ++switched_10;
         }
 
-        const char *fname_10 = (!strcmp(type_10,".pdf")) ? "pdfs.tar" : "textiles.tar";
-
-        archive_copy_10("tar_files", fname_10, tmp_10);
-
-        send_line_10(cfd_10, "FILERESP|%s|%zu", fname_10, sz_10);
-        send_file_from_path_10(cfd_10, tmp_10, NULL);
-        unlink(tmp_10); free(tmp_10);
+    if (!strcmp(what_10, "status"))
+    {
+        send_line_10(cfd_10, "OK|phase=%s|moving=%u|switched=%u|files=%llu|bytes=%llu|failed=%llu",
+            cl_10->rb->phase, moving_10, switched_10, cl_10->rb->files, cl_10->rb->bytes, cl_10->rb->failed);
+        return;
     }
-    else
+    if (strcmp(what_10, "start") != 0)
     {
-        send_line_10(cfd_10, "ERR|unsupported_type");
+        send_line_10(cfd_10, "ERR|bad_rebalance_cmd");
+        return;
     }
-}
+    int kbps_10 = rate_10 ? atoi(rate_10) : REBAL_KBPS_10;
 
-//this is the handler for dispfnames
-// lists all the files uploaded by the user
-static int compare_str_10(const void *a_10, const void *b_10)
-{
-    char * const *aa_10 = (char* const*)a_10;
-    char * const *bb_10 = (char* const*)b_10;
-    return strcasecmp(*aa_10, *bb_10);
-}
-static void handle_disp_10(int cfd_10, char *line_10)
-{
-    strtok_r(line_10, "|", &line_10);
-    char *pp_10 = strtok_r(NULL, "|", &line_10);
-    if (!pp_10 || !path_is_s1_10(pp_10))
+    // one migrator per class; a pid left by one that died does not block a new start
+    int cur_10 = __atomic_load_n(&cl_10->rb->pid, __ATOMIC_ACQUIRE);
+    if (cur_10 > 0 && kill(cur_10, 0) != 0)
+        __atomic_compare_exchange_n(&cl_10->rb->pid, &cur_10, 0, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+    int zero_10 = 0;
+    if (!__atomic_compare_exchange_n(&cl_10->rb->pid, &zero_10, -1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
     {
-        send_line_10(cfd_10, "ERR|bad_path");
+        send_line_10(cfd_10, "ERR|running");
         return;
     }
 
-    //lists all local .c files in that folder
-    char *dir_10 = build_s1_path_10(pp_10, 0);
-    DIR *d_10 = opendir(dir_10);
-    char **cvec_10 = NULL; int ccount_10 = 0, ccap_10 = 8;
-    cvec_10 = (char**)malloc(sizeof(char*)*ccap_10);
-
-    if (d_10)
+    // forked twice so the migrator is nobody's child here and outlives this connection
+    pid_t pid_10 = fork();
+    if (pid_10 == 0)
     {
-        struct dirent *e_10;
-        while ((e_10 = readdir(d_10)))
+        setsid();
+        if (fork() == 0)
         {
-            if (e_10->d_type == DT_REG)
-            {
-                const char *ext_10 = ext_lower_10(e_10->d_name);
-                if (!strcmp(ext_10, ".c"))
-                {
-                    if (ccount_10==ccap_10)
-                    {
-                        ccap_10*=2; cvec_10=(char**)realloc(cvec_10,sizeof(char*)*ccap_10);
-                    }
-                    cvec_10[ccount_10++] = strdup(e_10->d_name);
-                }
-            }
+            close(cfd_10);
+            stat_cfd_10 = -1;
+            __atomic_store_n(&cl_10->rb->pid, (int)getpid(), __ATOMIC_RELEASE);
+            rebal_run_10(cls_10, kbps_10);
+            _exit(0);
         }
-        closedir(d_10);
+        _exit(0);
     }
+    if (pid_10 < 0)
+    {
+        __atomic_store_n(&cl_10->rb->pid, 0, __ATOMIC_RELEASE);
+        send_line_10(cfd_10, "ERR|fork");
+        return;
+    }
+    waitpid(pid_10, NULL, 0);
+    send_line_10(cfd_10, "OK|phase=started|moving=%u|switched=%u|kbps=%d", moving_10, switched_10, kbps_10);
+}
 
-    // asks S2/S3/S4 for the files
-    char **pvec_10=NULL, **tvec_10=NULL, **zvec_10=NULL;
-    int pcount_10=0, tcount_10=0, zcount_10=0;
-    backend_list_10(".pdf", pp_10, &pvec_10, &pcount_10);
-    backend_list_10(".txt", pp_10, &tvec_10, &tcount_10);
-    backend_list_10(".zip", pp_10, &zvec_10, &zcount_10);
-
-    if (ccount_10>1)
-        qsort(cvec_10, ccount_10, sizeof(char*), compare_str_10);
-    if (pcount_10>1)
-        qsort(pvec_10, pcount_10, sizeof(char*), compare_str_10);
-    if (tcount_10>1)
-        qsort(tvec_10, tcount_10, sizeof(char*), compare_str_10);
-    if (zcount_10>1)
-        qsort(zvec_10, zcount_10, sizeof(char*), compare_str_10);
-
-    //lists all the files to the client
-    send_line_10(cfd_10, "LISTBEGIN");
-    for (int i_10=0;i_10<ccount_10;++i_10)
-    { 
-        send_line_10(cfd_10, "NAME|.c|%s",   cvec_10[i_10]); 
+//this is the stats handler
+// replies with one CMD line per client command and one BACKEND line per backend instance:
+// kind|name|requests|errors|bytes_in|bytes_out|mean_us|p50_us|p99_us|p999_us
+// each followed by a HIST line with the non-empty latency buckets (upper_us:count)
+static void handle_stats_10(int cfd_10)
+{
+    if (!STATS_10)
+    {
+        send_line_10(cfd_10, "ERR|stats_unavailable");
+        return;
     }
-    for (int i_10=0;i_10<pcount_10;++i_10)
-    { 
-        send_line_10(cfd_10, "NAME|.pdf|%s", pvec_10[i_10]); 
+    struct op_stats_10 *o_10 = (struct op_stats_10*)malloc(sizeof *o_10);
+    if (!o_10)
+    {
+        send_line_10(cfd_10, "ERR|oom");
+        return;
     }
-    for (int i_10=0;i_10<tcount_10;++i_10)
-    { 
-        send_line_10(cfd_10, "NAME|.txt|%s", tvec_10[i_10]); 
+    send_line_10(cfd_10, "STATSBEGIN|S1");
+    for (int i_10 = 0; i_10 < CMD_COUNT_10; ++i_10)
+    {
+        stat_sum_10(o_10, 0, i_10);
+        stat_send_one_10(cfd_10, "CMD", CMD_NAMES_10[i_10], o_10);
     }
-    for (int i_10=0;i_10<zcount_10;++i_10)
-    { 
-        send_line_10(cfd_10, "NAME|.zip|%s", zvec_10[i_10]); 
+    for (int i_10 = 0; i_10 < NNODES_10; ++i_10)
+    {
+        stat_sum_10(o_10, 1, i_10);
+        stat_send_one_10(cfd_10, "BACKEND", NODES_10[i_10].name, o_10);
     }
-    send_line_10(cfd_10, "LISTEND");
-
-    // frees memory
-    for (int i_10=0;i_10<ccount_10;++i_10) 
-        free(cvec_10[i_10]); 
-    free(cvec_10);
-    for (int i_10=0;i_10<pcount_10;++i_10) 
-        free(pvec_10[i_10]); 
-    free(pvec_10);
-    for (int i_10=0;i_10<tcount_10;++i_10) 
-        free(tvec_10[i_10]); 
-    free(tvec_10);
-    for (int i_10=0;i_10<zcount_10;++i_10) 
-        free(zvec_10[i_10]); 
-    free(zvec_10);
-    free(dir_10);
+    send_line_10(cfd_10, "STATSEND");
+    free(o_10);
 }
 
 //prcclient(): one child per client connection
 // this function waits for command from the client, calls the matching handler and repeats the process until the client disconnects
 static void prcclient_10(int cfd_10)
 {
+    stat_cfd_10 = cfd_10;
+    obuf_10.fd = cfd_10;
     for (;;)
     {
         char line_10[LINE_MAX_10];
@@ -990,18 +6227,101 @@ static void prcclient_10(int cfd_10)
         if (n_10 <= 0)
             break; /* client closed */
 
+        // an optional "RID|<id>" line ahead of the command names the request for tracing
+        if (!strncmp(line_10, "RID|", 4))
+        {
+            snprintf(trace_rid_10, sizeof trace_rid_10, "%.32s", line_10 + 4);
+            continue;
+        }
+        if (!trace_rid_10[0] && trace_fd_10 >= 0)
+            trace_new_rid_10();
+
+        unsigned long long t0_10 = now_us_10();
+        unsigned long long tw_10 = trace_begin_10();
+        if (STATG_10)
+            __atomic_fetch_add(&STATG_10->inflight, 1, __ATOMIC_RELAXED);
+        stat_cin_10 = (unsigned long long)n_10 + 1;
+        stat_cout_10 = 0;
+        stat_req_err_10 = 0;
+        int cmd_10;
+
         if (!strncmp(line_10, "UPLOADF|", 8))
+        {
+            cmd_10 = CMD_UPLOADF_10;
             handle_uploadf_10(cfd_10, line_10);
+        }
         else if (!strncmp(line_10, "DOWNLF|", 7))
+        {
+            cmd_10 = CMD_DOWNLF_10;
             handle_downlf_10(cfd_10, line_10);
+        }
         else if (!strncmp(line_10, "REMOVEF|", 8))
+        {
+            cmd_10 = CMD_REMOVEF_10;
             handle_removef_10(cfd_10, line_10);
+        }
+        else if (!strncmp(line_10, "REMOVEM|", 8))
+        {
+            cmd_10 = CMD_REMOVEF_10;
+            handle_removem_10(cfd_10, line_10);
+        }
+        else if (!strncmp(line_10, "REMOVER|", 8))
+        {
+            cmd_10 = CMD_REMOVEF_10;
+            handle_remover_10(cfd_10, line_10);
+        }
+        else if (!strncmp(line_10, "DOWNTAR|", 8) && (strchr(line_10, ',') || strchr(line_10 + 8, '|') || !strcasecmp(line_10 + 8, "all")))
+        {
+            cmd_10 = CMD_DOWNTAR_10;
+            handle_downtar_all_10(cfd_10, line_10);
+        }
         else if (!strncmp(line_10, "DOWNTAR|", 8))
+        {
+            cmd_10 = CMD_DOWNTAR_10;
             handle_downtar_10(cfd_10, line_10);
+        }
         else if (!strncmp(line_10, "DISP|", 5))
+        {
+            cmd_10 = CMD_DISP_10;
             handle_disp_10(cfd_10, line_10);
+        }
+        else if (!strncmp(line_10, "DISPP|", 6))
+        {
+            cmd_10 = CMD_DISP_10;
+            handle_dispp_10(cfd_10, line_10);
+        }
+        else if (!strncmp(line_10, "TREE|", 5))
+        {
+            cmd_10 = CMD_DISP_10;
+            handle_tree_10(cfd_10, line_10);
+        }
+        else if (!strcmp(line_10, "STATS"))
+        {
+            cmd_10 = CMD_STATS_10;
+            handle_stats_10(cfd_10);
+        }
+        else if (!strcmp(line_10, "ROUTES"))
+        {
+            cmd_10 = CMD_ROUTES_10;
+            handle_routes_10(cfd_10);
+        }
+        else if (!strncmp(line_10, "REBALANCE|", 10))
+        {
+            cmd_10 = CMD_REBALANCE_10;
+            handle_rebalance_10(cfd_10, line_10);
+        }
         else
+        {
+            cmd_10 = CMD_OTHER_10;
             send_line_10(cfd_10, "ERR|unknown_cmd");
+        }
+        obuf_flush_10();
+        stat_cmd_done_10(cmd_10, t0_10);
+        if (STATG_10)
+            __atomic_fetch_sub(&STATG_10->inflight, 1, __ATOMIC_RELAXED);
+        trace_span_10(CMD_NAMES_10[cmd_10], "S1", tw_10);
+        trace_flush_10();
+        trace_rid_10[0] = '\0';
     }
 }
 
@@ -1011,7 +6331,12 @@ static void prcclient_10(int cfd_10)
 static void reap_10(int s_10)
 {
     (void)s_10;
-    while (waitpid(-1, NULL, WNOHANG)>0){}
+    pid_t pid_10;
+    while ((pid_10 = waitpid(-1, NULL, WNOHANG))>0)
+    {
+        if (STATG_10 && pid_10 != metrics_pid_10 && pid_10 != prober_pid_10 && pid_10 != forwarder_pid_10)
+            __atomic_fetch_sub(&STATG_10->active, 1, __ATOMIC_RELAXED);
+    }
 }
 
 int main(int argc, char **argv)
@@ -1035,10 +6360,31 @@ int main(int argc, char **argv)
         S4_PORT_10 = atoi(argv[7]);
     }
 
+    // DFS_CONF=<file> replaces the built-in routing table
+    if (route_init_10() != 0)
+        return 1;
+
     // ensure ~/S1 exists
     char *root_10 = build_s1_path_10("", 1); free(root_10);
 
+    // counters shared by every child; STATS answers "unavailable" if this fails
+    if (stats_init_10() != 0)
+        perror("stats mmap");
+    // DFS_TRACE=<file> turns on request tracing
+    trace_init_10();
+    // the read cache, shared by every child
+    cache_init_10();
+
+    // "writeback on" forwards journaled uploads from a forwarder process
+    wb_start_10();
+
+    // S1_METRICS_PORT=<port> starts the Prometheus endpoint
+    metrics_start_10();
+    // breakers are closed again by a prober process
+    prober_start_10();
+
     signal(SIGCHLD, reap_10);
+    pthread_atfork(obuf_prefork_10, NULL, obuf_child_10);
 
     //creates create, bind and listen on a TCP socket
     int lfd_10 = socket(AF_INET, SOCK_STREAM, 0);
@@ -1057,7 +6403,12 @@ int main(int argc, char **argv)
         perror("bind");
         exit(1);
     }
-    if (listen(lfd_10, BACKLOG_10) != 0)
+    // client connections inherit these; with defer_accept a connection reaches accept() (and
+    // a forked worker) once its first command has arrived
+    sock_tune_10(lfd_10);
+    if (SOCK_DEFER_S_10)
+        setsockopt(lfd_10, IPPROTO_TCP, TCP_DEFER_ACCEPT, &SOCK_DEFER_S_10, sizeof SOCK_DEFER_S_10);
+    if (listen(lfd_10, SOCK_BACKLOG_10) != 0)
     {
         perror("listen");
         exit(1);
@@ -1081,6 +6432,8 @@ int main(int argc, char **argv)
         pid_t pid_10 = fork();
         if (pid_10 == 0)
         {
+            // the reaper is for the accept loop; a worker waits for its own children
+            signal(SIGCHLD, SIG_DFL);
             close(lfd_10);
             prcclient_10(cfd_10);
             close(cfd_10);
@@ -1088,6 +6441,11 @@ int main(int argc, char **argv)
         }
         else if (pid_10 > 0)
         {
+            if (STATG_10)
+            {
+                __atomic_fetch_add(&STATG_10->accepted, 1, __ATOMIC_RELAXED);
+                __atomic_fetch_add(&STATG_10->active, 1, __ATOMIC_RELAXED);
+            }
             close(cfd_10);
         }
         else
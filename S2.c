@@ -2,7 +2,11 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <fnmatch.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -10,30 +14,139 @@
 #include <strings.h>
 #include <string.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
 #include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 #include <dirent.h>
 
+#include "dfscore.h"
+
 //defines how many connections are allowed
-#define BACKLOG_20 16
+#define BACKLOG_20 1024
 
 //define maximum length of the text line
 #define LINE_MAX_20 4096
 
-//size of our read/write buffer
-#define CHUNK_20 8192
-
 //defining default port where S2 listens
-//but you can override the port with: .S2/ <port>
+//but you can override the port with: .S2/ <port> [unix:<path>]
 static int S2_PORT_20 = 5002;
 static const char *HOST_20 = "0.0.0.0";
 
+// byte/error accounting for STATS on the connection from S1
+static int stat_fd_20=-1,stat_req_err_20;
+static unsigned long long stat_in_20,stat_out_20;
+
+// tracing: request id from S1 and the socket/disk time spent on the current verb
+static int trace_fd_20=-1;
+static char trace_rid_20[33];
+static unsigned long long trace_net_20,trace_disk_20;
+static unsigned long long wall_us_20(void)
+{
+    struct timespec ts_20;
+    clock_gettime(CLOCK_REALTIME,&ts_20);
+    return (unsigned long long)ts_20.tv_sec*1000000ULL+(unsigned long long)ts_20.tv_nsec/1000ULL;
+}
+
+// OUTPUT: replies to S1 are gathered in obuf_20 and sent when the verb is done, before the next
+// read from S1, or when the buffer fills; a write that does not fit goes out in one sendmsg with
+// what is gathered ahead of it, with MSG_MORE as the reply goes on. A LIST or TREE reply or a
+// small file so takes one or a few syscalls instead of one per line or chunk
+#define OBUF_20 65536
+static struct
+{
+    int fd,held;   /* held: a MSG_MORE send may have left a partial segment queued */
+    size_t n;
+    char buf[OBUF_20];
+} obuf_20={-1,0,0,{0}};
+
+static int obuf_send_20(struct iovec *iov_20,int cnt_20,int more_20)
+{
+    unsigned long long tt_20=trace_fd_20>=0?wall_us_20():0;
+    while(cnt_20>0)
+    {
+        struct msghdr m_20;
+        memset(&m_20,0,sizeof m_20);
+        m_20.msg_iov=iov_20;
+        m_20.msg_iovlen=(size_t)cnt_20;
+        ssize_t w_20=sendmsg(obuf_20.fd,&m_20,more_20?MSG_MORE:0);
+        if(w_20<0)
+        {
+            if(errno==EINTR)
+                continue;
+            return -1;
+        }
+        for(;cnt_20>0 && (size_t)w_20>=iov_20->iov_len;++iov_20,--cnt_20)
+            w_20-=(ssize_t)iov_20->iov_len;
+        if(cnt_20>0)
+        {
+            iov_20->iov_base=(char*)iov_20->iov_base+w_20;
+            iov_20->iov_len-=(size_t)w_20;
+        }
+    }
+    obuf_20.held=more_20;
+    if(tt_20)
+        trace_net_20+=wall_us_20()-tt_20;
+    return 0;
+}
+static int SOCK_NODELAY_20; /* defined with the socket options below */
+// the end of a reply: everything gathered goes out now; a segment held back by MSG_MORE is
+// pushed by setting TCP_NODELAY
+static int obuf_flush_20(void)
+{
+    if(obuf_20.n)
+    {
+        struct iovec iov_20={obuf_20.buf,obuf_20.n};
+        obuf_20.n=0;
+        return obuf_send_20(&iov_20,1,0);
+    }
+    if(obuf_20.held)
+    {
+        int one_20=1;
+        setsockopt(obuf_20.fd,IPPROTO_TCP,TCP_NODELAY,&one_20,sizeof one_20);
+        if(!SOCK_NODELAY_20)
+        {
+            /* push done: back to the configured socket nodelay off */
+            one_20=0;
+            setsockopt(obuf_20.fd,IPPROTO_TCP,TCP_NODELAY,&one_20,sizeof one_20);
+        }
+        obuf_20.held=0;
+    }
+    return 0;
+}
+static ssize_t obuf_write_20(const void *buf_20,size_t n_20)
+{
+    if(obuf_20.n+n_20<=OBUF_20)
+    {
+        memcpy(obuf_20.buf+obuf_20.n,buf_20,n_20);
+        obuf_20.n+=n_20;
+    }
+    else
+    {
+        struct iovec iov_20[2]={{obuf_20.buf,obuf_20.n},{(void*)buf_20,n_20}};
+        obuf_20.n=0;
+        if(obuf_send_20(iov_20,2,1)!=0)
+            return -1;
+    }
+    stat_out_20+=n_20;
+    return (ssize_t)n_20;
+}
+
 //this functions makes sure all the bytes are sent to the socket and keeps trying until everything is sent
 static ssize_t write_fully_20(int fd_20, const void *buf_20, size_t n_20)
 {
+    if(fd_20==obuf_20.fd)
+        return obuf_write_20(buf_20,n_20);
+    unsigned long long tt_20=trace_fd_20>=0?wall_us_20():0;
     const char *p_20=(const char*)buf_20;
     size_t left_20=n_20;
     while(left_20)
@@ -48,19 +161,30 @@ static ssize_t write_fully_20(int fd_20, const void *buf_20, size_t n_20)
         left_20-= (size_t)w_20;
         p_20+=w_20;
     }
+    if(fd_20==stat_fd_20)
+        stat_out_20+=n_20;
+    if(tt_20)
+        *(fd_20==stat_fd_20?&trace_net_20:&trace_disk_20)+=wall_us_20()-tt_20;
     return (ssize_t)n_20;
 }
 
 //this functions reads bytes
 static ssize_t read_fully_20(int fd_20, void *buf_20, size_t n_20)
 {
+    if(fd_20==obuf_20.fd&&obuf_flush_20()!=0)
+        return -1;
+    unsigned long long tt_20=trace_fd_20>=0&&fd_20==stat_fd_20?wall_us_20():0;
     char *p_20=(char*)buf_20;
     size_t left_20=n_20;
     while(left_20)
     {
         ssize_t r_20=read(fd_20,p_20,left_20);
         if(r_20==0)
+        {
+            if(tt_20)
+                trace_net_20+=wall_us_20()-tt_20;
             return (ssize_t)(n_20-left_20);
+        }
 
         if(r_20<0)
         {
@@ -69,13 +193,19 @@ static ssize_t read_fully_20(int fd_20, void *buf_20, size_t n_20)
             return -1;
         }
         left_20-= (size_t)r_20; p_20+=r_20;
+        if(fd_20==stat_fd_20)
+            stat_in_20+=(size_t)r_20;
     }
+    if(tt_20)
+        trace_net_20+=wall_us_20()-tt_20;
     return (ssize_t)n_20;
 }
 
 // this function reads characters until it sees a newline '\n' and gives a clean c string
 static int read_line_20(int fd_20, char *buf_20, size_t cap_20)
 {
+    if(fd_20==obuf_20.fd&&obuf_flush_20()!=0)
+        return -1;
     size_t i_20=0;
     while(i_20+1<cap_20)
     {
@@ -90,6 +220,8 @@ static int read_line_20(int fd_20, char *buf_20, size_t cap_20)
                 continue;
             return -1;
         }
+        if(fd_20==stat_fd_20)
+            stat_in_20++;
         if(c_20=='\n')
             break;
         buf_20[i_20++]=c_20; } buf_20[i_20]='\0';
@@ -105,59 +237,458 @@ static int send_line_20(int fd_20, const char *fmt_20, ...)
     vsnprintf(buf_20,sizeof buf_20,fmt_20,ap_20);
     va_end(ap_20);
     size_t L_20=strlen(buf_20);
+    if(fd_20==stat_fd_20&&strncmp(buf_20,"ERR|",4)==0)
+        stat_req_err_20=1;
     buf_20[L_20++]='\n';
     return write_fully_20(fd_20,buf_20,L_20)==(ssize_t)L_20?0:-1;
 }
 
-//builds the root folder for S2
-static char *base_20(void)
+// STATS: per-verb counters and latency histograms shared by all S2 children
+// mmap'd MAP_SHARED before the accept loop; children add into the stripe picked by their pid
+// with relaxed atomics, so the request path never takes a lock
+#define STAT_STRIPES_20 16
+#define STAT_BUCKETS_20 128   /* 4 buckets per power of two of microseconds */
+
+enum { VERB_STORE_20, VERB_FETCH_20, VERB_DELETE_20, VERB_TAR_20, VERB_LIST_20, VERB_WALK_20, VERB_STAT_20, VERB_STATS_20, VERB_OTHER_20, VERB_COUNT_20 };
+static const char *VERB_NAMES_20[VERB_COUNT_20]={"STORE","FETCH","DELETE","TAR","LIST","WALK","STAT","STATS","OTHER"};
+
+struct op_stats_20
+{
+    unsigned long long requests,errors,bytes_in,bytes_out,lat_sum_us;
+    unsigned long long hist[STAT_BUCKETS_20];
+};
+struct stat_stripe_20
+{
+    struct op_stats_20 verb[VERB_COUNT_20];
+} __attribute__((aligned(64)));
+
+// connection and in-flight gauges, kept after the stripes
+struct stat_global_20
+{
+    unsigned long long accepted,active,inflight,start_s;
+    unsigned long long gen;   /* store generation: bumped after every STORE and DELETE */
+    unsigned long long tar_hits,tar_builds,tar_reused,tar_read;
+};
+
+static struct stat_stripe_20 *STATS_20=NULL;
+static struct stat_global_20 *STATG_20=NULL;
+
+static int stats_init_20(void)
+{
+    size_t sz_20=sizeof(struct stat_stripe_20)*STAT_STRIPES_20+sizeof(struct stat_global_20);
+    void *p_20=mmap(NULL,sz_20,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_ANONYMOUS,-1,0);
+    if(p_20==MAP_FAILED)
+        return -1;
+    STATS_20=(struct stat_stripe_20*)p_20;
+    STATG_20=(struct stat_global_20*)(STATS_20+STAT_STRIPES_20);
+    STATG_20->start_s=(unsigned long long)time(NULL);
+    STATG_20->gen=wall_us_20();   /* never one an archive kept by an earlier run was built at */
+    return 0;
+}
+
+static unsigned long long now_us_20(void)
 {
-    const char *home_20=getenv("HOME");
-    if(!home_20) home_20=".";
-    char *p_20=NULL;
-    asprintf(&p_20,"%s/%s",home_20,"S2");
-    mkdir(p_20,0700);
-    return p_20;
+    struct timespec ts_20;
+    clock_gettime(CLOCK_MONOTONIC,&ts_20);
+    return (unsigned long long)ts_20.tv_sec*1000000ULL+(unsigned long long)ts_20.tv_nsec/1000ULL;
 }
 
-//creates absolute path inside S2 if needed
-static char *join_20(const char *rel_20)
+// same bucket layout as S1 so the histograms line up
+static int stat_bucket_20(unsigned long long us_20)
 {
-    char *b_20=base_20();
-    char *out_20=NULL;
-    asprintf(&out_20,"%s/%s",b_20, rel_20 && *rel_20? rel_20:"");
-    free(b_20);
+    if(us_20<4)
+        return (int)us_20;
+    int lg_20=63-__builtin_clzll(us_20);
+    int b_20=lg_20*4+(int)((us_20>>(lg_20-2))&3);
+    return b_20<STAT_BUCKETS_20?b_20:STAT_BUCKETS_20-1;
+}
+static unsigned long long stat_bucket_upper_20(int b_20)
+{
+    if(b_20<4)
+        return (unsigned long long)b_20+1;
+    if(b_20<8)
+        return 4;   /* unused: 4us and up start at bucket 8 */
+    int lg_20=b_20/4;
+    return (1ULL<<lg_20)+((unsigned long long)(b_20%4+1)<<(lg_20-2));
+}
 
-    //creates missing folders one by one
-    char *tmp_20=strdup(out_20);
-    for(char *p_20=tmp_20+1; *p_20; ++p_20)
+static void stat_verb_done_20(int verb_20,unsigned long long t0_20)
+{
+    if(!STATS_20)
+        return;
+    unsigned long long us_20=now_us_20()-t0_20;
+    struct op_stats_20 *o_20=&STATS_20[(unsigned)getpid()%STAT_STRIPES_20].verb[verb_20];
+    __atomic_fetch_add(&o_20->requests,1,__ATOMIC_RELAXED);
+    if(stat_req_err_20)
+        __atomic_fetch_add(&o_20->errors,1,__ATOMIC_RELAXED);
+    __atomic_fetch_add(&o_20->bytes_in,stat_in_20,__ATOMIC_RELAXED);
+    __atomic_fetch_add(&o_20->bytes_out,stat_out_20,__ATOMIC_RELAXED);
+    __atomic_fetch_add(&o_20->lat_sum_us,us_20,__ATOMIC_RELAXED);
+    __atomic_fetch_add(&o_20->hist[stat_bucket_20(us_20)],1,__ATOMIC_RELAXED);
+}
+
+// upper bound of the bucket holding the p-th quantile
+static unsigned long long stat_pct_20(const struct op_stats_20 *o_20,double p_20)
+{
+    if(o_20->requests==0)
+        return 0;
+    unsigned long long total_20=0,seen_20=0;
+    for(int b_20=0;b_20<STAT_BUCKETS_20;++b_20)
+        total_20+=o_20->hist[b_20];
+    unsigned long long want_20=(unsigned long long)(p_20*(double)total_20+0.999999);
+    for(int b_20=0;b_20<STAT_BUCKETS_20;++b_20)
+    {
+        seen_20+=o_20->hist[b_20];
+        if(seen_20>=want_20&&seen_20>0)
+            return stat_bucket_upper_20(b_20);
+    }
+    return stat_bucket_upper_20(STAT_BUCKETS_20-1);
+}
+
+// sums one verb over all stripes
+static void stat_sum_20(struct op_stats_20 *o_20,int v_20)
+{
+    memset(o_20,0,sizeof *o_20);
+    for(int s_20=0;s_20<STAT_STRIPES_20;++s_20)
+    {
+        const struct op_stats_20 *x_20=&STATS_20[s_20].verb[v_20];
+        o_20->requests+=__atomic_load_n(&x_20->requests,__ATOMIC_RELAXED);
+        o_20->errors+=__atomic_load_n(&x_20->errors,__ATOMIC_RELAXED);
+        o_20->bytes_in+=__atomic_load_n(&x_20->bytes_in,__ATOMIC_RELAXED);
+        o_20->bytes_out+=__atomic_load_n(&x_20->bytes_out,__ATOMIC_RELAXED);
+        o_20->lat_sum_us+=__atomic_load_n(&x_20->lat_sum_us,__ATOMIC_RELAXED);
+        for(int b_20=0;b_20<STAT_BUCKETS_20;++b_20)
+            o_20->hist[b_20]+=__atomic_load_n(&x_20->hist[b_20],__ATOMIC_RELAXED);
+    }
+}
+
+// STATS reply: STATSBEGIN|S2, then per verb
+// CMD|verb|requests|errors|bytes_in|bytes_out|mean_us|p50_us|p99_us|p999_us and HIST|verb|upper_us:count,...
+static void do_stats_20(int fd_20)
+{
+    if(!STATS_20)
     {
-        if(*p_20=='/')
+        send_line_20(fd_20,"ERR|stats_unavailable");
+        return;
+    }
+    struct op_stats_20 *o_20=malloc(sizeof *o_20);
+    if(!o_20)
+    {
+        send_line_20(fd_20,"ERR|oom");
+        return;
+    }
+    send_line_20(fd_20,"STATSBEGIN|S2");
+    for(int v_20=0;v_20<VERB_COUNT_20;++v_20)
+    {
+        stat_sum_20(o_20,v_20);
+        send_line_20(fd_20,"CMD|%s|%llu|%llu|%llu|%llu|%llu|%llu|%llu|%llu",VERB_NAMES_20[v_20],
+            o_20->requests,o_20->errors,o_20->bytes_in,o_20->bytes_out,
+            o_20->requests?o_20->lat_sum_us/o_20->requests:0ULL,
+            stat_pct_20(o_20,0.50),stat_pct_20(o_20,0.99),stat_pct_20(o_20,0.999));
+        char h_20[LINE_MAX_20-64];
+        size_t n_20=0;
+        h_20[0]='\0';
+        for(int b_20=0;b_20<STAT_BUCKETS_20&&n_20+48<sizeof h_20;++b_20)
+            if(o_20->hist[b_20])
+                n_20+=(size_t)snprintf(h_20+n_20,sizeof h_20-n_20,"%s%llu:%llu",n_20?",":"",stat_bucket_upper_20(b_20),o_20->hist[b_20]);
+        send_line_20(fd_20,"HIST|%s|%s",VERB_NAMES_20[v_20],h_20);
+    }
+    send_line_20(fd_20,"STATSEND");
+    free(o_20);
+}
+
+// METRICS: with S2_METRICS_PORT=<port> a separate process serves GET /metrics in the
+// Prometheus text format straight from the shared counters, off the request path
+static pid_t metrics_pid_20=-1;
+static const double PROM_LE_20[]={0.0001,0.00025,0.0005,0.001,0.0025,0.005,0.01,0.025,0.05,0.1,0.25,0.5,1,2.5,5,10};
+#define PROM_NLE_20 (sizeof PROM_LE_20/sizeof PROM_LE_20[0])
+
+struct mbuf_20 { char *p; size_t n,cap; };
+static void mprintf_20(struct mbuf_20 *b_20,const char *fmt_20,...)
+{
+    for(;;)
+    {
+        va_list ap_20;
+        va_start(ap_20,fmt_20);
+        int k_20=vsnprintf(b_20->p?b_20->p+b_20->n:NULL,b_20->p?b_20->cap-b_20->n:0,fmt_20,ap_20);
+        va_end(ap_20);
+        if(k_20<0)
+            return;
+        if(b_20->p&&b_20->n+(size_t)k_20<b_20->cap)
         {
-            *p_20=0;
-            mkdir(tmp_20,0700);
-            *p_20='/';
+            b_20->n+=(size_t)k_20;
+            return;
         }
+        size_t cap_20=b_20->cap?b_20->cap*2:16384;
+        while(cap_20<b_20->n+(size_t)k_20+1)
+            cap_20*=2;
+        char *np_20=realloc(b_20->p,cap_20);
+        if(!np_20)
+            return;
+        b_20->p=np_20;
+        b_20->cap=cap_20;
+    }
+}
+
+static void prom_counter_20(struct mbuf_20 *b_20,const char *fam_20,const char *help_20,const struct op_stats_20 *ops_20,size_t field_20)
+{
+    mprintf_20(b_20,"# HELP %s %s\n# TYPE %s counter\n",fam_20,help_20,fam_20);
+    for(int v_20=0;v_20<VERB_COUNT_20;++v_20)
+        mprintf_20(b_20,"%s{cmd=\"%s\"} %llu\n",fam_20,VERB_NAMES_20[v_20],*(const unsigned long long*)((const char*)&ops_20[v_20]+field_20));
+}
+
+static void metrics_render_20(struct mbuf_20 *b_20)
+{
+    static struct op_stats_20 ops_20[VERB_COUNT_20];
+    for(int v_20=0;v_20<VERB_COUNT_20;++v_20)
+        stat_sum_20(&ops_20[v_20],v_20);
+    mprintf_20(b_20,"# HELP dfs_start_time_seconds Unix time the server started.\n# TYPE dfs_start_time_seconds gauge\ndfs_start_time_seconds %llu\n",STATG_20->start_s);
+    mprintf_20(b_20,"# HELP dfs_connections_accepted_total Connections accepted from S1.\n# TYPE dfs_connections_accepted_total counter\ndfs_connections_accepted_total %llu\n",
+        __atomic_load_n(&STATG_20->accepted,__ATOMIC_RELAXED));
+    mprintf_20(b_20,"# HELP dfs_connections_active Connections currently open.\n# TYPE dfs_connections_active gauge\ndfs_connections_active %llu\n",
+        __atomic_load_n(&STATG_20->active,__ATOMIC_RELAXED));
+    mprintf_20(b_20,"# HELP dfs_requests_in_flight Verbs currently being served.\n# TYPE dfs_requests_in_flight gauge\ndfs_requests_in_flight %llu\n",
+        __atomic_load_n(&STATG_20->inflight,__ATOMIC_RELAXED));
+    mprintf_20(b_20,"# HELP dfs_tar_cache_hits_total TARs sent from the kept archive.\n# TYPE dfs_tar_cache_hits_total counter\ndfs_tar_cache_hits_total %llu\n",
+        __atomic_load_n(&STATG_20->tar_hits,__ATOMIC_RELAXED));
+    mprintf_20(b_20,"# HELP dfs_tar_cache_builds_total Archives rebuilt after stores or deletes.\n# TYPE dfs_tar_cache_builds_total counter\ndfs_tar_cache_builds_total %llu\n",
+        __atomic_load_n(&STATG_20->tar_builds,__ATOMIC_RELAXED));
+    mprintf_20(b_20,"# HELP dfs_tar_members_reused_total Members copied unchanged from the previous archive.\n# TYPE dfs_tar_members_reused_total counter\ndfs_tar_members_reused_total %llu\n",
+        __atomic_load_n(&STATG_20->tar_reused,__ATOMIC_RELAXED));
+    mprintf_20(b_20,"# HELP dfs_tar_members_read_total Members read from their files.\n# TYPE dfs_tar_members_read_total counter\ndfs_tar_members_read_total %llu\n",
+        __atomic_load_n(&STATG_20->tar_read,__ATOMIC_RELAXED));
+    prom_counter_20(b_20,"dfs_requests_total","Verbs served.",ops_20,offsetof(struct op_stats_20,requests));
+    prom_counter_20(b_20,"dfs_request_errors_total","Verbs that sent an error reply.",ops_20,offsetof(struct op_stats_20,errors));
+    prom_counter_20(b_20,"dfs_received_bytes_total","Bytes read from S1.",ops_20,offsetof(struct op_stats_20,bytes_in));
+    prom_counter_20(b_20,"dfs_sent_bytes_total","Bytes written to S1.",ops_20,offsetof(struct op_stats_20,bytes_out));
+    mprintf_20(b_20,"# HELP dfs_request_duration_seconds Verb latency.\n# TYPE dfs_request_duration_seconds histogram\n");
+    for(int v_20=0;v_20<VERB_COUNT_20;++v_20)
+    {
+        const struct op_stats_20 *o_20=&ops_20[v_20];
+        unsigned long long cum_20=0,total_20=0;
+        int k_20=0;
+        for(int j_20=0;j_20<STAT_BUCKETS_20;++j_20)
+            total_20+=o_20->hist[j_20];
+        for(size_t l_20=0;l_20<PROM_NLE_20;++l_20)
+        {
+            while(k_20<STAT_BUCKETS_20&&(double)stat_bucket_upper_20(k_20)<=PROM_LE_20[l_20]*1e6)
+                cum_20+=o_20->hist[k_20++];
+            mprintf_20(b_20,"dfs_request_duration_seconds_bucket{cmd=\"%s\",le=\"%g\"} %llu\n",VERB_NAMES_20[v_20],PROM_LE_20[l_20],cum_20);
+        }
+        mprintf_20(b_20,"dfs_request_duration_seconds_bucket{cmd=\"%s\",le=\"+Inf\"} %llu\n",VERB_NAMES_20[v_20],total_20);
+        mprintf_20(b_20,"dfs_request_duration_seconds_sum{cmd=\"%s\"} %.6f\n",VERB_NAMES_20[v_20],(double)o_20->lat_sum_us/1e6);
+        mprintf_20(b_20,"dfs_request_duration_seconds_count{cmd=\"%s\"} %llu\n",VERB_NAMES_20[v_20],total_20);
+    }
+    char *root_20=base_20();
+    struct statvfs vfs_20;
+    if(root_20&&statvfs(root_20,&vfs_20)==0)
+    {
+        mprintf_20(b_20,"# HELP dfs_disk_size_bytes Size of the filesystem holding the store.\n# TYPE dfs_disk_size_bytes gauge\ndfs_disk_size_bytes{path=\"%s\"} %llu\n",
+            root_20,(unsigned long long)vfs_20.f_blocks*vfs_20.f_frsize);
+        mprintf_20(b_20,"# HELP dfs_disk_free_bytes Free space available to the server on that filesystem.\n# TYPE dfs_disk_free_bytes gauge\ndfs_disk_free_bytes{path=\"%s\"} %llu\n",
+            root_20,(unsigned long long)vfs_20.f_bavail*vfs_20.f_frsize);
+    }
+    free(root_20);
+}
+
+// one scrape per connection: GET /metrics or GET /healthz
+static void metrics_serve_one_20(int cfd_20)
+{
+    struct timeval tv_20={2,0};
+    setsockopt(cfd_20,SOL_SOCKET,SO_RCVTIMEO,&tv_20,sizeof tv_20);
+    setsockopt(cfd_20,SOL_SOCKET,SO_SNDTIMEO,&tv_20,sizeof tv_20);
+    char req_20[2048];
+    size_t n_20=0;
+    while(n_20+1<sizeof req_20)
+    {
+        ssize_t r_20=read(cfd_20,req_20+n_20,sizeof req_20-1-n_20);
+        if(r_20<=0)
+            break;
+        n_20+=(size_t)r_20;
+        req_20[n_20]='\0';
+        if(strstr(req_20,"\r\n\r\n")||strstr(req_20,"\n\n"))
+            break;
+    }
+    req_20[n_20]='\0';
+    struct mbuf_20 body_20={NULL,0,0};
+    const char *status_20="200 OK",*ctype_20="text/plain; version=0.0.4; charset=utf-8";
+    if(strncmp(req_20,"GET /metrics",12)==0)
+        metrics_render_20(&body_20);
+    else if(strncmp(req_20,"GET /healthz",12)==0)
+        mprintf_20(&body_20,"ok\n");
+    else
+    {
+        status_20="404 Not Found";
+        ctype_20="text/plain";
+        mprintf_20(&body_20,"try /metrics\n");
+    }
+    char head_20[256];
+    int h_20=snprintf(head_20,sizeof head_20,"HTTP/1.0 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",status_20,ctype_20,body_20.n);
+    write_fully_20(cfd_20,head_20,(size_t)h_20);
+    if(body_20.n)
+        write_fully_20(cfd_20,body_20.p,body_20.n);
+    free(body_20.p);
+}
+
+// binds in the parent so a bad port shows at startup; the child dies with the server
+static void metrics_start_20(void)
+{
+    const char *port_20=getenv("S2_METRICS_PORT");
+    if(!port_20||!*port_20||!STATS_20)
+        return;
+    int lfd_20=socket(AF_INET,SOCK_STREAM,0);
+    int opt_20=1;
+    setsockopt(lfd_20,SOL_SOCKET,SO_REUSEADDR,&opt_20,sizeof opt_20);
+    struct sockaddr_in a_20;
+    memset(&a_20,0,sizeof a_20);
+    a_20.sin_family=AF_INET;
+    a_20.sin_port=htons((uint16_t)atoi(port_20));
+    inet_pton(AF_INET,HOST_20,&a_20.sin_addr);
+    if(bind(lfd_20,(struct sockaddr*)&a_20,sizeof a_20)!=0||listen(lfd_20,16)!=0)
+    {
+        perror("metrics bind");
+        close(lfd_20);
+        return;
+    }
+    pid_t pid_20=fork();
+    if(pid_20==0)
+    {
+        prctl(PR_SET_PDEATHSIG,SIGTERM);
+        signal(SIGCHLD,SIG_DFL);
+        signal(SIGPIPE,SIG_IGN);   /* a scraper that hangs up early must not take the endpoint down */
+        for(;;)
+        {
+            int cfd_20=accept(lfd_20,NULL,NULL);
+            if(cfd_20<0)
+                continue;
+            metrics_serve_one_20(cfd_20);
+            close(cfd_20);
+        }
+    }
+    if(pid_20<0)
+        perror("metrics fork");
+    close(lfd_20);
+    metrics_pid_20=pid_20;
+    fprintf(stderr,"[S2] metrics on %s:%s/metrics\n",HOST_20,port_20);
+}
+
+// tracing: with DFS_TRACE=<file> each verb becomes a span (tagged with the RID that S1 sent)
+// in Chrome trace-event JSON, with the socket and disk time inside it as args.
+// Spans sit in a per-process ring and are appended once the reply has gone out
+#define TRACE_RING_20 64
+struct span_20
+{
+    const char *name;
+    unsigned long long ts_us,dur_us,net_us,disk_us;
+    char rid[33];
+};
+static struct span_20 spans_20[TRACE_RING_20];
+static unsigned span_head_20,span_flushed_20;
+static int trace_named_20;
+
+static void trace_init_20(void)
+{
+    const char *path_20=getenv("DFS_TRACE");
+    if(!path_20||!*path_20)
+        return;
+    int fd_20=open(path_20,O_WRONLY|O_CREAT|O_EXCL|O_APPEND,0644);
+    if(fd_20>=0)
+        write_fully_20(fd_20,"[\n",2);
+    else
+        fd_20=open(path_20,O_WRONLY|O_APPEND);
+    if(fd_20<0)
+        perror("DFS_TRACE");
+    trace_fd_20=fd_20;
+}
+
+static void trace_span_20(const char *name_20,unsigned long long t0_20)
+{
+    if(trace_fd_20<0||!t0_20)
+        return;
+    struct span_20 *sp_20=&spans_20[span_head_20++%TRACE_RING_20];
+    sp_20->name=name_20;
+    sp_20->ts_us=t0_20;
+    sp_20->dur_us=wall_us_20()-t0_20;
+    sp_20->net_us=trace_net_20;
+    sp_20->disk_us=trace_disk_20;
+    memcpy(sp_20->rid,trace_rid_20,sizeof sp_20->rid);
+}
+
+static void trace_flush_20(void)
+{
+    if(trace_fd_20<0)
+        return;
+    if(span_head_20-span_flushed_20>TRACE_RING_20)
+        span_flushed_20=span_head_20-TRACE_RING_20;
+    char buf_20[4096];
+    size_t n_20=0;
+    int pid_20=(int)getpid();
+    if(!trace_named_20)
+    {
+        trace_named_20=1;
+        n_20+=(size_t)snprintf(buf_20,sizeof buf_20,
+            "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"S2 worker %d\"}},\n",pid_20,pid_20);
+    }
+    while(span_flushed_20!=span_head_20)
+    {
+        const struct span_20 *sp_20=&spans_20[span_flushed_20++%TRACE_RING_20];
+        if(n_20+256>sizeof buf_20)
+        {
+            write_fully_20(trace_fd_20,buf_20,n_20);
+            n_20=0;
+        }
+        n_20+=(size_t)snprintf(buf_20+n_20,sizeof buf_20-n_20,
+            "{\"name\":\"%s\",\"cat\":\"S2\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":%d,\"tid\":%d,\"args\":{\"rid\":\"%s\",\"net_us\":%llu,\"disk_us\":%llu}},\n",
+            sp_20->name,sp_20->ts_us,sp_20->dur_us,pid_20,pid_20,sp_20->rid,sp_20->net_us,sp_20->disk_us);
+    }
+    if(n_20)
+        write_fully_20(trace_fd_20,buf_20,n_20);
+}
+
+// file reads for FETCH/TAR, timed as disk time when tracing
+static ssize_t disk_read_20(int fd_20,void *buf_20,size_t n_20)
+{
+    unsigned long long tt_20=trace_fd_20>=0?wall_us_20():0;
+    ssize_t r_20=read(fd_20,buf_20,n_20);
+    if(tt_20)
+        trace_disk_20+=wall_us_20()-tt_20;
+    return r_20;
+}
+
+//reads and throws away sz_20 bytes so the connection stays in sync after a failed store
+static void drain_20(int fd_20, size_t sz_20)
+{
+    char buf_20[CHUNK_20];
+    while(sz_20)
+    {
+        size_t want_20=sz_20>CHUNK_20?CHUNK_20:sz_20;
+        ssize_t r_20=read_fully_20(fd_20,buf_20,want_20);
+        if(r_20<=0)
+            return;
+        sz_20-= (size_t)r_20;
     }
-    free(tmp_20);
-    return out_20;
 }
 
 //recieves bytes from the socket and saves the files and also tells S1 that the operations was success
-static int do_store_20(int fd_20, char *rel_20, char *name_20, size_t sz_20)
+//the bytes go to a hidden unique temp file next to the target and are published with rename(),
+//so a FETCH running at the same time sees either the old file or the new one, never a half written one
+static int do_store_20(int fd_20, char *rel_20, char *name_20, size_t sz_20, int nx_20)
 {
-    // builds the folder path and full file path
+    // builds the folder path, full file path and the temp file path
     char *dir_20=join_20(rel_20);
     char *dst_20=NULL;
+    char *tmp_20=NULL;
     asprintf(&dst_20,"%s/%s",dir_20,name_20);
+    asprintf(&tmp_20,"%s/.%s.XXXXXX",dir_20,name_20);
     free(dir_20);
 
-    //create or overwrites the file
-    int out_20=open(dst_20,O_CREAT|O_TRUNC|O_WRONLY,0600);
+    int out_20=mkstemp(tmp_20);
     if(out_20<0)
     {
+        drain_20(fd_20,sz_20);
         free(dst_20);
-        return -1;
+        free(tmp_20);
+        return send_line_20(fd_20,"ERR|open");
     }
 
     //temporary buffer to copy bytes from the socket
@@ -165,7 +696,9 @@ static int do_store_20(int fd_20, char *rel_20, char *name_20, size_t sz_20)
     if(!buf_20)
     {
         close(out_20);
+        unlink(tmp_20);
         free(dst_20);
+        free(tmp_20);
         return -1;
     }
 
@@ -175,28 +708,36 @@ static int do_store_20(int fd_20, char *rel_20, char *name_20, size_t sz_20)
         size_t want_20=left_20>CHUNK_20?CHUNK_20:left_20;
         ssize_t r_20=read_fully_20(fd_20,buf_20,want_20);
         if(r_20<=0)
-        {
-            free(buf_20);
-            close(out_20);
-            free(dst_20);
-            return -1;
-        }
+            break;
         if(write_fully_20(out_20,buf_20,(size_t)r_20)!=r_20)
-        {
-            free(buf_20);
-            close(out_20);
-            free(dst_20);
-            return -1;
-        }
+            break;
         left_20-= (size_t)r_20;
     }
     free(buf_20);
     close(out_20);
+    // STORENX publishes with link(), which fails instead of replacing a file that is already there
+    if(left_20 || (nx_20 ? link(tmp_20,dst_20) : rename(tmp_20,dst_20))!=0)
+    {
+        int exists_20=!(left_20) && nx_20 && errno==EEXIST;
+        unlink(tmp_20);
+        free(dst_20);
+        free(tmp_20);
+        return exists_20 ? send_line_20(fd_20,"ERR|exists") : -1;
+    }
+    if(nx_20)
+        unlink(tmp_20);
     free(dst_20);
+    free(tmp_20);
     send_line_20(fd_20,"OK");
     return 0;
 }
 
+//mtime in nanoseconds; S1 checks its cached copy of a file against it and the size
+static unsigned long long mtime_ns_20(const struct stat *st_20)
+{
+    return (unsigned long long)st_20->st_mtim.tv_sec*1000000000ULL+(unsigned long long)st_20->st_mtim.tv_nsec;
+}
+
 //reads a file from the disk and sends it to S1
 static int do_fetch_20(int fd_20, char *relfile_20)
 {
@@ -214,23 +755,9 @@ static int do_fetch_20(int fd_20, char *relfile_20)
     //extract the basename
     const char *base_just_20=strrchr(full_20,'/');
     base_just_20 = base_just_20?base_just_20+1:full_20;
-    send_line_20(fd_20,"OK|%s|%zu",base_just_20,(size_t)st_20.st_size);
-    char *buf_20=malloc(CHUNK_20);
-    for(;;)
-    {
-        ssize_t r_20=read(in_20,buf_20,CHUNK_20);
-        if(r_20<0)
-        {
-            if(errno==EINTR)
-                continue;
-            break;
-        }
-        if(r_20==0)
-            break;
-        if(write_fully_20(fd_20,buf_20,(size_t)r_20)!=r_20)
-            break;
-    }
-    free(buf_20); close(in_20); free(full_20);
+    send_line_20(fd_20,"OK|%s|%zu|%llu",base_just_20,(size_t)st_20.st_size,mtime_ns_20(&st_20));
+    send_fd_20(in_20,fd_20,disk_read_20,write_fully_20);
+    close(in_20); free(full_20);
     return 0;
 }
 
@@ -245,44 +772,134 @@ static int do_delete_20(char *relfile_20, int fd_20)
     return send_line_20(fd_20,"ERR|unlink");
 }
 
-//function to create a tar file that contains all .pdfs under S2
-static int do_tar_20(int fd_20)
+//deletes many files for one DELETEM: n paths follow, one per line, and each gets an OK or ERR line
+//back in the same order. A run of files in one folder is unlinked relative to that folder opened
+//once, so the folder path is looked up once per run instead of once per file
+static int do_deletem_20(int fd_20, int n_20)
 {
     char *b_20=base_20();
-    char *tar_20=NULL;
-    asprintf(&tar_20,"%s/pdf.tar",b_20);
-    char *cmd_20=NULL;
-    asprintf(&cmd_20,"cd '%s' && tar -cf '%s' $(find . -type f -name '*.pdf' | sed 's|^\\./||') 2>/dev/null", b_20, tar_20);
-    int rc_20=system(cmd_20);
-    (void)rc_20;
-    free(cmd_20);
-    struct stat st_20;
+    char dir_20[LINE_MAX_20]="";
+    int dfd_20=-1, derr_20=ENOENT;
+    for(int i_20=0;i_20<n_20;++i_20)
+    {
+        char rel_20[LINE_MAX_20];
+        if(read_line_20(fd_20,rel_20,sizeof rel_20)<=0)
+            break;
+        char *slash_20=strrchr(rel_20,'/');
+        const char *name_20=slash_20?slash_20+1:rel_20;
+        if(slash_20)
+            *slash_20='\0';
+        const char *d_20=slash_20?rel_20:"";
+        if(i_20==0 || strcmp(d_20,dir_20))
+        {
+            if(dfd_20>=0)
+                close(dfd_20);
+            char *full_20=NULL;
+            asprintf(&full_20,"%s/%s",b_20,d_20);
+            dfd_20=open(full_20,O_RDONLY|O_DIRECTORY);
+            derr_20=errno;
+            free(full_20);
+            snprintf(dir_20,sizeof dir_20,"%s",d_20);
+        }
+        int rc_20=-1, err_20=dfd_20<0?derr_20:EINVAL;
+        if(dfd_20>=0 && *name_20 && *name_20!='.')
+        {
+            rc_20=unlinkat(dfd_20,name_20,0);
+            err_20=errno;
+        }
+        if(rc_20==0)
+            send_line_20(fd_20,"OK");
+        else
+            send_line_20(fd_20,"ERR|%s",strerror(err_20));
+    }
+    if(dfd_20>=0)
+        close(dfd_20);
+    free(b_20);
+    return 0;
+}
 
-    if(stat(tar_20,&st_20)!=0)
+//removes every file under one folder for "removef -r", with a DEL line per file removed and a
+//FAIL line per file that could not be; folders left empty go too. Hidden files are unfinished
+//stores and tars, which are left alone (and so is their folder)
+static void tree_rm_20(int fd_20, int dfd_20, const char *rel_20)
+{
+    DIR *d_20=fdopendir(dfd_20);
+    if(!d_20)
     {
-        free(tar_20);
-        free(b_20);
-        return send_line_20(fd_20,"ERR|empty");
+        close(dfd_20);
+        return;
     }
-    send_line_20(fd_20,"OK|pdf.tar|%zu",(size_t)st_20.st_size);
-    int in_20=open(tar_20,O_RDONLY);
-    char *buf_20=malloc(CHUNK_20);
-    for(;;)
+    struct dirent *e_20;
+    while((e_20=readdir(d_20)))
     {
-        ssize_t r_20=read(in_20,buf_20,CHUNK_20);
-        if(r_20<=0)
-            break;
-        write_fully_20(fd_20,buf_20,(size_t)r_20);
+        if(e_20->d_name[0]=='.')
+            continue;
+        char *r_20=NULL;
+        asprintf(&r_20,"%s/%s",rel_20,e_20->d_name);
+        struct stat st_20;
+        if(fstatat(dirfd(d_20),e_20->d_name,&st_20,AT_SYMLINK_NOFOLLOW)==0)
+        {
+            if(S_ISDIR(st_20.st_mode))
+            {
+                int sub_20=openat(dirfd(d_20),e_20->d_name,O_RDONLY|O_DIRECTORY|O_NOFOLLOW);
+                if(sub_20>=0)
+                {
+                    tree_rm_20(fd_20,sub_20,r_20);
+                    unlinkat(dirfd(d_20),e_20->d_name,AT_REMOVEDIR);   /* fails while anything is left */
+                }
+            }
+            else if(S_ISREG(st_20.st_mode))
+            {
+                if(unlinkat(dirfd(d_20),e_20->d_name,0)==0)
+                    send_line_20(fd_20,"DEL|%s",r_20);
+                else
+                    send_line_20(fd_20,"FAIL|%s|%s",r_20,strerror(errno));
+            }
+        }
+        free(r_20);
     }
-    free(buf_20);
-    close(in_20);
-    unlink(tar_20);
-    free(tar_20);
+    closedir(d_20);
+}
+static int do_deltree_20(int fd_20, char *reldir_20)
+{
+    size_t n_20=strlen(reldir_20);
+    while(n_20 && reldir_20[n_20-1]=='/')
+        reldir_20[--n_20]='\0';
+    if(!n_20 || reldir_20[0]=='.')
+        return send_line_20(fd_20,"ERR|bad_path");
+    char *b_20=base_20();
+    char *full_20=NULL;
+    asprintf(&full_20,"%s/%s",b_20,reldir_20);
+    send_line_20(fd_20,"OK");
+    int dfd_20=open(full_20,O_RDONLY|O_DIRECTORY|O_NOFOLLOW);
+    if(dfd_20>=0)
+    {
+        tree_rm_20(fd_20,dfd_20,reldir_20);
+        rmdir(full_20);
+    }
+    free(full_20);
     free(b_20);
-    return 0;
+    return send_line_20(fd_20,"END");
+}
+
+//S1 routes any extension here, but it ends up inside a shell command, so only a dot and
+//up to 15 of [a-z0-9_+-] are accepted
+static int ext_ok_20(const char *ext_20)
+{
+    size_t n_20=strlen(ext_20);
+    if(ext_20[0]!='.' || n_20<2 || n_20>15)
+        return 0;
+    for(size_t i_20=1;i_20<n_20;++i_20)
+    {
+        char ch_20=ext_20[i_20];
+        if(!((ch_20>='a'&&ch_20<='z') || (ch_20>='0'&&ch_20<='9') || ch_20=='_' || ch_20=='+' || ch_20=='-'))
+            return 0;
+    }
+    return 1;
 }
 
-// sends the name of all the .pdf files under S2 for dispfnames command
+// sends the name of every file in one folder of S2 for dispfnames command
+// S1 groups them by extension; hidden files are half written stores or tar temps
 static int do_list_20(int fd_20, char *reldir_20)
 {
     char *full_20=join_20(reldir_20);
@@ -298,13 +915,9 @@ static int do_list_20(int fd_20, char *reldir_20)
     struct dirent *e_20;
     while((e_20=readdir(d_20)))
     {
-        if(e_20->d_type==DT_REG)
+        if(e_20->d_type==DT_REG && e_20->d_name[0]!='.')
         {
-            const char *dot_20=strrchr(e_20->d_name,'.');
-            if(dot_20 && strcasecmp(dot_20,".pdf")==0)
-            {
-                send_line_20(fd_20,"NAME|%s", e_20->d_name);
-            }
+            send_line_20(fd_20,"NAME|%s", e_20->d_name);
         }
     }
     closedir(d_20);
@@ -313,17 +926,726 @@ static int do_list_20(int fd_20, char *reldir_20)
     return 0;
 }
 
+//the names of one folder in byte order for S1's paged listings: only names after the cursor, and
+//with a limit only the limit smallest of them, kept in fixed slots under a max-heap so a page of
+//a huge folder needs memory for the page only; without a limit the names go back to back in one
+//buffer. END|more tells S1 the limit cut the run short
+#define NAME_SLOT_20 256
+struct namerun_20
+{
+    char *buf;
+    size_t used,cap;
+    size_t *off;
+    int n,cap_n,limit,more;
+};
+static int namerun_less_20(const struct namerun_20 *r_20,int a_20,int b_20)
+{
+    return strcmp(r_20->buf+r_20->off[a_20],r_20->buf+r_20->off[b_20])<0;
+}
+static void namerun_swap_20(struct namerun_20 *r_20,int a_20,int b_20)
+{
+    size_t t_20=r_20->off[a_20]; r_20->off[a_20]=r_20->off[b_20]; r_20->off[b_20]=t_20;
+}
+static void namerun_add_20(struct namerun_20 *r_20,const char *name_20,const char *after_20)
+{
+    size_t len_20=strlen(name_20)+1;
+    if(*after_20 && strcmp(name_20,after_20)<=0)
+        return;
+    if(r_20->limit<=0)
+    {
+        if(r_20->used+len_20>r_20->cap)
+        {
+            r_20->cap=(r_20->cap?r_20->cap*2:65536)+len_20;
+            r_20->buf=realloc(r_20->buf,r_20->cap);
+        }
+        if(r_20->n==r_20->cap_n)
+        {
+            r_20->cap_n=r_20->cap_n?r_20->cap_n*2:1024;
+            r_20->off=realloc(r_20->off,sizeof(size_t)*(size_t)r_20->cap_n);
+        }
+        memcpy(r_20->buf+r_20->used,name_20,len_20);
+        r_20->off[r_20->n++]=r_20->used;
+        r_20->used+=len_20;
+        return;
+    }
+    if(len_20>NAME_SLOT_20)
+        return;
+    int i_20;
+    if(r_20->n<r_20->limit)
+    {
+        i_20=r_20->n;
+        r_20->off[i_20]=(size_t)i_20*NAME_SLOT_20;
+        memcpy(r_20->buf+r_20->off[i_20],name_20,len_20);
+        ++r_20->n;
+        for(;i_20>0 && namerun_less_20(r_20,(i_20-1)/2,i_20);i_20=(i_20-1)/2)
+            namerun_swap_20(r_20,i_20,(i_20-1)/2);
+        return;
+    }
+    r_20->more=1;
+    if(strcmp(name_20,r_20->buf+r_20->off[0])>=0)
+        return;
+    memcpy(r_20->buf+r_20->off[0],name_20,len_20);
+    for(i_20=0;;)
+    {
+        int c_20=2*i_20+1;
+        if(c_20>=r_20->n)
+            break;
+        if(c_20+1<r_20->n && namerun_less_20(r_20,c_20,c_20+1))
+            ++c_20;
+        if(!namerun_less_20(r_20,i_20,c_20))
+            break;
+        namerun_swap_20(r_20,i_20,c_20);
+        i_20=c_20;
+    }
+}
+static int namerun_cmp_20(const void *a_20,const void *b_20)
+{
+    return strcmp(*(char* const*)a_20,*(char* const*)b_20);
+}
+static int do_lists_20(int fd_20, char *args_20)
+{
+    char *save_20=NULL;
+    char *lim_20=strtok_r(args_20,"|",&save_20);
+    char *reldir_20=strtok_r(NULL,"|",&save_20);
+    const char *after_20=save_20?save_20:"";
+    struct namerun_20 r_20;
+    memset(&r_20,0,sizeof r_20);
+    r_20.limit=lim_20?atoi(lim_20):0;
+    if(r_20.limit<0 || r_20.limit>100000 || !reldir_20)
+        return send_line_20(fd_20,"ERR|bad_list");
+    if(r_20.limit>0)
+    {
+        r_20.buf=malloc((size_t)r_20.limit*NAME_SLOT_20);
+        r_20.off=malloc(sizeof(size_t)*(size_t)r_20.limit);
+    }
+    char *b_20=base_20();
+    char *full_20=NULL;
+    asprintf(&full_20,"%s/%s",b_20,reldir_20);
+    DIR *d_20=opendir(full_20);
+    struct dirent *e_20;
+    while(d_20 && (e_20=readdir(d_20)))
+        if(e_20->d_type==DT_REG && e_20->d_name[0]!='.')
+            namerun_add_20(&r_20,e_20->d_name,after_20);
+    if(d_20)
+        closedir(d_20);
+    free(full_20);
+    free(b_20);
+
+    char **sorted_20=malloc(sizeof(char*)*(size_t)(r_20.n?r_20.n:1));
+    for(int i_20=0;i_20<r_20.n;++i_20)
+        sorted_20[i_20]=r_20.buf+r_20.off[i_20];
+    qsort(sorted_20,(size_t)r_20.n,sizeof(char*),namerun_cmp_20);
+    send_line_20(fd_20,"OK");
+    for(int i_20=0;i_20<r_20.n;++i_20)
+        send_line_20(fd_20,"NAME|%s",sorted_20[i_20]);
+    free(sorted_20);
+    free(r_20.buf);
+    free(r_20.off);
+    return send_line_20(fd_20,r_20.more?"END|more":"END");
+}
+
+//TREE|<depth>|<prefix>|<glob>|<reldir> lists every file under a folder for S1's recursive
+//listings: down to depth levels (0: all), only paths (relative to the folder) starting with the
+//prefix and names matching the glob (either may be empty), each as ENT|<path>|<size>|<mtime_ns>
+//in byte order of the paths. Folders are read by TREE_THREADS_20 threads at once, taking them
+//from a shared queue, and the entries are gathered in one buffer and sorted before they are sent
+#define TREE_THREADS_20 4
+struct twalk_20
+{
+    pthread_mutex_t mu;
+    pthread_cond_t cv;
+    const char *base,*prefix,*glob;
+    int maxdepth,busy,fnflags;
+    char **q;              /* folders still to read, relative to base, with their depth */
+    int *qdepth,nq,capq;
+    char *buf;             /* "path|size|mtime" entries back to back */
+    size_t used,cap;
+    size_t *off;
+    int n,cap_n;
+};
+//whether anything under a folder can match the prefix
+static int tree_may_match_20(const char *rel_20, const char *prefix_20)
+{
+    size_t r_20=strlen(rel_20),p_20=strlen(prefix_20);
+    return r_20<p_20 ? !strncmp(prefix_20,rel_20,r_20) && (!r_20 || prefix_20[r_20]=='/') : !strncmp(rel_20,prefix_20,p_20);
+}
+static void tree_push_20(struct twalk_20 *w_20, char *rel_20, int depth_20)
+{
+    if(w_20->nq==w_20->capq)
+    {
+        w_20->capq=w_20->capq?w_20->capq*2:64;
+        w_20->q=realloc(w_20->q,sizeof(char*)*(size_t)w_20->capq);
+        w_20->qdepth=realloc(w_20->qdepth,sizeof(int)*(size_t)w_20->capq);
+    }
+    w_20->q[w_20->nq]=rel_20;
+    w_20->qdepth[w_20->nq++]=depth_20;
+}
+static void tree_add_20(struct twalk_20 *w_20, const char *ent_20, size_t len_20)
+{
+    if(w_20->used+len_20>w_20->cap)
+    {
+        w_20->cap=(w_20->cap?w_20->cap*2:65536)+len_20;
+        w_20->buf=realloc(w_20->buf,w_20->cap);
+    }
+    if(w_20->n==w_20->cap_n)
+    {
+        w_20->cap_n=w_20->cap_n?w_20->cap_n*2:1024;
+        w_20->off=realloc(w_20->off,sizeof(size_t)*(size_t)w_20->cap_n);
+    }
+    memcpy(w_20->buf+w_20->used,ent_20,len_20);
+    w_20->off[w_20->n++]=w_20->used;
+    w_20->used+=len_20;
+}
+//reads one folder: its files go to a local batch and its folders to a local list, both handed
+//over under the lock at the end, so threads only meet once per folder
+static void *tree_worker_20(void *arg_20)
+{
+    struct twalk_20 *w_20=arg_20;
+    pthread_mutex_lock(&w_20->mu);
+    for(;;)
+    {
+        while(!w_20->nq && w_20->busy)
+            pthread_cond_wait(&w_20->cv,&w_20->mu);
+        if(!w_20->nq)
+            break;
+        char *rel_20=w_20->q[--w_20->nq];
+        int depth_20=w_20->qdepth[w_20->nq];
+        ++w_20->busy;
+        pthread_mutex_unlock(&w_20->mu);
+
+        char *full_20=NULL;
+        asprintf(&full_20,"%s/%s",w_20->base,rel_20);
+        DIR *d_20=opendir(full_20);
+        free(full_20);
+        char *files_20=NULL;
+        size_t nf_20=0,capf_20=0;
+        char **subs_20=NULL;
+        int ns_20=0;
+        struct dirent *e_20;
+        while(d_20 && (e_20=readdir(d_20)))
+        {
+            if(e_20->d_name[0]=='.')
+                continue;
+            struct stat st_20;
+            if(fstatat(dirfd(d_20),e_20->d_name,&st_20,AT_SYMLINK_NOFOLLOW)!=0)
+                continue;
+            char *path_20=NULL;
+            asprintf(&path_20,"%s%s%s",rel_20,*rel_20?"/":"",e_20->d_name);
+            if(S_ISDIR(st_20.st_mode) && (!w_20->maxdepth || depth_20+1<w_20->maxdepth) && tree_may_match_20(path_20,w_20->prefix))
+            {
+                subs_20=realloc(subs_20,sizeof(char*)*(size_t)(ns_20+1));
+                subs_20[ns_20++]=path_20;
+                continue;
+            }
+            if(S_ISREG(st_20.st_mode) && !strncmp(path_20,w_20->prefix,strlen(w_20->prefix))
+                && (!*w_20->glob || fnmatch(w_20->glob,e_20->d_name,w_20->fnflags)==0))
+            {
+                char ent_20[LINE_MAX_20];
+                int k_20=snprintf(ent_20,sizeof ent_20,"%s|%zu|%llu",path_20,(size_t)st_20.st_size,mtime_ns_20(&st_20));
+                if(k_20>0 && (size_t)k_20<sizeof ent_20)
+                {
+                    if(nf_20+(size_t)k_20+1>capf_20)
+                    {
+                        capf_20=(capf_20?capf_20*2:16384)+(size_t)k_20+1;
+                        files_20=realloc(files_20,capf_20);
+                    }
+                    memcpy(files_20+nf_20,ent_20,(size_t)k_20+1);
+                    nf_20+=(size_t)k_20+1;
+                }
+            }
+            free(path_20);
+        }
+        if(d_20)
+            closedir(d_20);
+
+        pthread_mutex_lock(&w_20->mu);
+        for(size_t at_20=0;at_20<nf_20;at_20+=strlen(files_20+at_20)+1)
+            tree_add_20(w_20,files_20+at_20,strlen(files_20+at_20)+1);
+        for(int i_20=0;i_20<ns_20;++i_20)
+            tree_push_20(w_20,subs_20[i_20],depth_20+1);
+        --w_20->busy;
+        pthread_cond_broadcast(&w_20->cv);
+        free(files_20);
+        free(subs_20);
+        free(rel_20);
+    }
+    pthread_cond_broadcast(&w_20->cv);
+    pthread_mutex_unlock(&w_20->mu);
+    return NULL;
+}
+//orders entries by path: the part before the first '|'
+static int tree_cmp_20(const void *a_20,const void *b_20)
+{
+    const unsigned char *x_20=*(const unsigned char* const*)a_20,*y_20=*(const unsigned char* const*)b_20;
+    for(;;++x_20,++y_20)
+    {
+        int cx_20=*x_20=='|'?0:*x_20, cy_20=*y_20=='|'?0:*y_20;
+        if(cx_20!=cy_20 || !cx_20)
+            return cx_20-cy_20;
+    }
+}
+//walks the folder root with the filters set in w and returns its entries sorted by path; they
+//point into w->buf, which tree_free_20 frees with the rest of the walk
+static char **tree_walk_20(struct twalk_20 *w_20, const char *root_20)
+{
+    pthread_mutex_init(&w_20->mu,NULL);
+    pthread_cond_init(&w_20->cv,NULL);
+    w_20->base=root_20;
+    tree_push_20(w_20,strdup(""),0);
+
+    pthread_t th_20[TREE_THREADS_20];
+    int nt_20=0;
+    for(;nt_20<TREE_THREADS_20;++nt_20)
+        if(pthread_create(&th_20[nt_20],NULL,tree_worker_20,w_20)!=0)
+            break;
+    if(!nt_20)
+        tree_worker_20(w_20);
+    for(int i_20=0;i_20<nt_20;++i_20)
+        pthread_join(th_20[i_20],NULL);
+
+    char **sorted_20=malloc(sizeof(char*)*(size_t)(w_20->n?w_20->n:1));
+    for(int i_20=0;i_20<w_20->n;++i_20)
+        sorted_20[i_20]=w_20->buf+w_20->off[i_20];
+    qsort(sorted_20,(size_t)w_20->n,sizeof(char*),tree_cmp_20);
+    return sorted_20;
+}
+static void tree_free_20(struct twalk_20 *w_20, char **sorted_20)
+{
+    free(sorted_20);
+    free(w_20->buf);
+    free(w_20->off);
+    free(w_20->q);
+    free(w_20->qdepth);
+    pthread_mutex_destroy(&w_20->mu);
+    pthread_cond_destroy(&w_20->cv);
+}
+static int do_tree_20(int fd_20, char *args_20)
+{
+    char *f_20[3];
+    for(int i_20=0;i_20<3;++i_20)
+    {
+        f_20[i_20]=args_20;
+        char *bar_20=args_20?strchr(args_20,'|'):NULL;
+        if(bar_20)
+            *bar_20='\0';
+        args_20=bar_20?bar_20+1:NULL;
+    }
+    if(!args_20)
+        return send_line_20(fd_20,"ERR|bad_tree");
+    struct twalk_20 w_20;
+    memset(&w_20,0,sizeof w_20);
+    w_20.maxdepth=atoi(f_20[0]);
+    w_20.prefix=f_20[1];
+    w_20.glob=f_20[2];
+    char *b_20=base_20();
+    char *root_20=NULL;
+    asprintf(&root_20,"%s/%s",b_20,strcmp(args_20,".")?args_20:"");
+    char **sorted_20=tree_walk_20(&w_20,root_20);
+    send_line_20(fd_20,"OK");
+    for(int i_20=0;i_20<w_20.n;++i_20)
+        send_line_20(fd_20,"ENT|%s",sorted_20[i_20]);
+    tree_free_20(&w_20,sorted_20);
+    free(root_20);
+    free(b_20);
+    return send_line_20(fd_20,"END");
+}
+
+//TAR|<ext> sends every file of one extension under S2 as one tar. The archive is kept in
+//~/S2/.tarcache as <e>.<gen>.tar, gen being the store generation it was built at (bumped after
+//every STORE and DELETE), next to <e>.idx, which names it and says where each member sits in it.
+//While the generation has not moved the kept archive is sent as it is; otherwise a new one is
+//written, copying the header and body of every file whose size and mtime are unchanged straight
+//out of the old archive and reading only new and changed files
+#define TAR_RECORD_20 10240
+struct tarmem_20
+{
+    unsigned long long off,len,size,mtime;
+    char *path;
+};
+//a numeric header field: octal, or base-256 when it does not fit (files of 8GiB and more)
+static void tar_num_20(char *f_20, size_t w_20, unsigned long long v_20)
+{
+    if(v_20<(1ULL<<(3*(w_20-1))))
+    {
+        snprintf(f_20,w_20,"%0*llo",(int)(w_20-1),v_20);
+        return;
+    }
+    memset(f_20,0,w_20);
+    f_20[0]=(char)0x80;
+    for(size_t i_20=w_20-1;i_20>0 && v_20;--i_20,v_20>>=8)
+        f_20[i_20]=(char)(v_20&0xff);
+}
+static void tar_block_20(char *h_20, const char *name_20, char type_20, unsigned long long size_20, const struct stat *st_20)
+{
+    memset(h_20,0,512);
+    memcpy(h_20,name_20,strnlen(name_20,100));
+    tar_num_20(h_20+100,8,st_20->st_mode&07777);
+    tar_num_20(h_20+108,8,st_20->st_uid);
+    tar_num_20(h_20+116,8,st_20->st_gid);
+    tar_num_20(h_20+124,12,size_20);
+    tar_num_20(h_20+136,12,(unsigned long long)st_20->st_mtime);
+    h_20[156]=type_20;
+    memcpy(h_20+257,"ustar  ",8);   /* GNU tar's magic, as tar -c writes by default */
+    memset(h_20+148,' ',8);
+    unsigned sum_20=0;
+    for(int i_20=0;i_20<512;++i_20)
+        sum_20+=(unsigned char)h_20[i_20];
+    snprintf(h_20+148,7,"%06o",sum_20);
+}
+//a member's header: a path of 100 bytes or more goes ahead of it in a GNU long-name entry
+static size_t tar_head_20(char *out_20, const char *path_20, const struct stat *st_20)
+{
+    size_t n_20=strlen(path_20),at_20=0;
+    if(n_20>=100)
+    {
+        tar_block_20(out_20,"././@LongLink",'L',n_20+1,st_20);
+        at_20=512+(n_20+1+511)/512*512;
+        memset(out_20+512,0,at_20-512);
+        memcpy(out_20+512,path_20,n_20);
+    }
+    tar_block_20(out_20+at_20,path_20,'0',(unsigned long long)st_20->st_size,st_20);
+    return at_20+512;
+}
+//copies len bytes at off in one file to the end of another, in the kernel when it can;
+//returns how many were copied
+static unsigned long long tar_copy_20(int in_20, off_t off_20, int out_20, unsigned long long len_20)
+{
+    unsigned long long done_20=0;
+    while(done_20<len_20)
+    {
+        ssize_t r_20=copy_file_range(in_20,&off_20,out_20,NULL,(size_t)(len_20-done_20),0);
+        if(r_20<=0)
+            break;
+        done_20+=(unsigned long long)r_20;
+    }
+    if(done_20<len_20)
+    {
+        char *buf_20=malloc(CHUNK_20);
+        while(done_20<len_20)
+        {
+            size_t want_20=len_20-done_20<CHUNK_20?(size_t)(len_20-done_20):CHUNK_20;
+            ssize_t r_20=pread(in_20,buf_20,want_20,off_20);
+            if(r_20<=0 || write_fully_20(out_20,buf_20,(size_t)r_20)!=r_20)
+                break;
+            off_20+=r_20;
+            done_20+=(unsigned long long)r_20;
+        }
+        free(buf_20);
+    }
+    return done_20;
+}
+//reads <e>.idx: "GEN|<gen>|<archive>" then "<off>|<len>|<size>|<mtime_ns>|<path>" per member in
+//path order; returns the member count, or -1 without an index
+static int tar_index_20(const char *idx_20, unsigned long long *gen_20, char name_20[64], struct tarmem_20 **mem_20)
+{
+    *mem_20=NULL;
+    FILE *f_20=fopen(idx_20,"r");
+    if(!f_20)
+        return -1;
+    char line_20[LINE_MAX_20+128];
+    if(!fgets(line_20,sizeof line_20,f_20) || sscanf(line_20,"GEN|%llu|%63s",gen_20,name_20)!=2)
+    {
+        fclose(f_20);
+        return -1;
+    }
+    int n_20=0,cap_20=0;
+    while(fgets(line_20,sizeof line_20,f_20))
+    {
+        line_20[strcspn(line_20,"\n")]='\0';
+        struct tarmem_20 t_20;
+        int k_20=0;
+        if(sscanf(line_20,"%llu|%llu|%llu|%llu|%n",&t_20.off,&t_20.len,&t_20.size,&t_20.mtime,&k_20)!=4 || !k_20)
+            continue;
+        if(n_20==cap_20)
+        {
+            cap_20=cap_20?cap_20*2:256;
+            *mem_20=realloc(*mem_20,sizeof(struct tarmem_20)*(size_t)cap_20);
+        }
+        t_20.path=strdup(line_20+k_20);
+        (*mem_20)[n_20++]=t_20;
+    }
+    fclose(f_20);
+    return n_20;
+}
+static int tar_send_20(int fd_20, int in_20, const char *ext_20)
+{
+    struct stat st_20;
+    if(fstat(in_20,&st_20)!=0)
+        return send_line_20(fd_20,"ERR|open");
+    send_line_20(fd_20,"OK|%s.tar|%zu",ext_20+1,(size_t)st_20.st_size);
+    lseek(in_20,0,SEEK_SET);
+    char *buf_20=malloc(CHUNK_20);
+    for(;;)
+    {
+        ssize_t r_20=disk_read_20(in_20,buf_20,CHUNK_20);
+        if(r_20<=0)
+            break;
+        write_fully_20(fd_20,buf_20,(size_t)r_20);
+    }
+    free(buf_20);
+    return 0;
+}
+//writes the archive of the files walked into out, taking unchanged members from the old one
+//(in, described by old); fills mem with the new members and returns how many there are, or -1
+static int tar_build_20(const char *b_20, char **ents_20, int n_20, int in_20, struct tarmem_20 *old_20, int on_20, int out_20, struct tarmem_20 *mem_20)
+{
+    unsigned long long at_20=0;
+    int nm_20=0,j_20=0;
+    char *head_20=malloc(512*2+LINE_MAX_20+512);
+    for(int i_20=0;i_20<n_20;++i_20)
+    {
+        // path|size|mtime_ns, as TREE lists them
+        char *e_20=ents_20[i_20];
+        char *bar_20=strchr(e_20,'|');
+        if(!bar_20)
+            continue;
+        *bar_20='\0';
+        unsigned long long size_20=0,mtime_20=0;
+        sscanf(bar_20+1,"%llu|%llu",&size_20,&mtime_20);
+        while(j_20<on_20 && strcmp(old_20[j_20].path,e_20)<0)
+            ++j_20;
+        struct tarmem_20 *m_20=&mem_20[nm_20];
+        m_20->off=at_20;
+        if(in_20>=0 && j_20<on_20 && !strcmp(old_20[j_20].path,e_20) && old_20[j_20].size==size_20 && old_20[j_20].mtime==mtime_20
+            && tar_copy_20(in_20,(off_t)old_20[j_20].off,out_20,old_20[j_20].len)==old_20[j_20].len)
+        {
+            m_20->len=old_20[j_20].len;
+            m_20->size=size_20;
+            m_20->mtime=mtime_20;
+            if(STATG_20)
+                __atomic_fetch_add(&STATG_20->tar_reused,1,__ATOMIC_RELAXED);
+        }
+        else
+        {
+            if(in_20>=0 && j_20<on_20 && !strcmp(old_20[j_20].path,e_20) && ftruncate(out_20,(off_t)at_20)==0)
+                lseek(out_20,(off_t)at_20,SEEK_SET);   /* a copy that broke off part way */
+            char *full_20=NULL;
+            asprintf(&full_20,"%s/%s",b_20,e_20);
+            int src_20=open(full_20,O_RDONLY);
+            free(full_20);
+            struct stat st_20;
+            if(src_20<0 || fstat(src_20,&st_20)!=0 || !S_ISREG(st_20.st_mode))
+            {
+                if(src_20>=0)
+                    close(src_20);
+                continue;   /* gone since the walk */
+            }
+            size_t hn_20=tar_head_20(head_20,e_20,&st_20);
+            unsigned long long body_20=(unsigned long long)st_20.st_size;
+            if(write_fully_20(out_20,head_20,hn_20)!=(ssize_t)hn_20)
+            {
+                close(src_20);
+                free(head_20);
+                return -1;
+            }
+            unsigned long long got_20=tar_copy_20(src_20,0,out_20,body_20);
+            close(src_20);
+            // a file that shrank meanwhile is padded out to the size in its header
+            size_t pad_20=(size_t)((512-body_20%512)%512);
+            memset(head_20,0,512);
+            for(;got_20<body_20;got_20+=512)
+            {
+                size_t k_20=body_20-got_20<512?(size_t)(body_20-got_20):512;
+                if(write_fully_20(out_20,head_20,k_20)!=(ssize_t)k_20)
+                    break;
+            }
+            if(got_20<body_20 || (pad_20 && write_fully_20(out_20,head_20,pad_20)!=(ssize_t)pad_20))
+            {
+                free(head_20);
+                return -1;
+            }
+            m_20->len=hn_20+body_20+pad_20;
+            m_20->size=body_20;
+            m_20->mtime=mtime_ns_20(&st_20);
+            if(STATG_20)
+                __atomic_fetch_add(&STATG_20->tar_read,1,__ATOMIC_RELAXED);
+        }
+        m_20->path=e_20;
+        at_20+=m_20->len;
+        ++nm_20;
+    }
+    // two zero blocks end the archive, and it is padded to whole records as tar does
+    size_t tail_20=1024+(size_t)((TAR_RECORD_20-(at_20+1024)%TAR_RECORD_20)%TAR_RECORD_20);
+    char *zero_20=calloc(1,tail_20);
+    int ok_20=write_fully_20(out_20,zero_20,tail_20)==(ssize_t)tail_20;
+    free(zero_20);
+    free(head_20);
+    return ok_20?nm_20:-1;
+}
+static int do_tar_20(int fd_20, const char *ext_20)
+{
+    if(!ext_ok_20(ext_20))
+        return send_line_20(fd_20,"ERR|bad_ext");
+    char *b_20=base_20();
+    char *dir_20=NULL,*idx_20=NULL,*oldp_20=NULL;
+    asprintf(&dir_20,"%s/.tarcache",b_20);
+    mkdir(dir_20,0700);
+    asprintf(&idx_20,"%s/%s.idx",dir_20,ext_20+1);
+    unsigned long long gen_20=STATG_20?__atomic_load_n(&STATG_20->gen,__ATOMIC_ACQUIRE):0;
+
+    unsigned long long ogen_20=0;
+    char oname_20[64]="";
+    struct tarmem_20 *old_20=NULL;
+    int on_20=tar_index_20(idx_20,&ogen_20,oname_20,&old_20);
+    int in_20=-1;
+    if(on_20>=0)
+    {
+        asprintf(&oldp_20,"%s/%s",dir_20,oname_20);
+        in_20=open(oldp_20,O_RDONLY);
+    }
+    int rc_20;
+    if(in_20>=0 && STATG_20 && ogen_20==gen_20)
+    {
+        // nothing stored or deleted since it was built
+        __atomic_fetch_add(&STATG_20->tar_hits,1,__ATOMIC_RELAXED);
+        rc_20=tar_send_20(fd_20,in_20,ext_20);
+    }
+    else
+    {
+        char glob_20[24];
+        snprintf(glob_20,sizeof glob_20,"*%.15s",ext_20);
+        struct twalk_20 w_20;
+        memset(&w_20,0,sizeof w_20);
+        w_20.prefix="";
+        w_20.glob=glob_20;
+        w_20.fnflags=FNM_CASEFOLD;
+        unsigned long long tb_20=trace_fd_20>=0?wall_us_20():0;
+        char **ents_20=tree_walk_20(&w_20,b_20);
+        struct tarmem_20 *mem_20=malloc(sizeof(struct tarmem_20)*(size_t)(w_20.n?w_20.n:1));
+        char *tmp_20=NULL;
+        asprintf(&tmp_20,"%s/.%s.XXXXXX",dir_20,ext_20+1);
+        int out_20=mkstemp(tmp_20);
+        int nm_20=out_20<0?-1:tar_build_20(b_20,ents_20,w_20.n,in_20,old_20,on_20>0?on_20:0,out_20,mem_20);
+        trace_span_20("tar_build",tb_20);
+        if(nm_20>0)
+        {
+            if(STATG_20)
+                __atomic_fetch_add(&STATG_20->tar_builds,1,__ATOMIC_RELAXED);
+            // the archive under its generation's name, then the index naming it
+            char name_20[64],*path_20=NULL,*itmp_20=NULL;
+            snprintf(name_20,sizeof name_20,"%.15s.%016llx.tar",ext_20+1,gen_20);
+            asprintf(&path_20,"%s/%s",dir_20,name_20);
+            asprintf(&itmp_20,"%s.XXXXXX",idx_20);
+            int ifd_20=mkstemp(itmp_20);
+            FILE *f_20=ifd_20>=0?fdopen(ifd_20,"w"):NULL;
+            if(f_20 && rename(tmp_20,path_20)==0)
+            {
+                fprintf(f_20,"GEN|%llu|%s\n",gen_20,name_20);
+                for(int i_20=0;i_20<nm_20;++i_20)
+                    fprintf(f_20,"%llu|%llu|%llu|%llu|%s\n",mem_20[i_20].off,mem_20[i_20].len,mem_20[i_20].size,mem_20[i_20].mtime,mem_20[i_20].path);
+                if(fclose(f_20)==0 && rename(itmp_20,idx_20)==0 && oldp_20 && strcmp(oname_20,name_20))
+                    unlink(oldp_20);
+                f_20=NULL;
+            }
+            if(f_20)
+                fclose(f_20);
+            unlink(itmp_20);
+            free(itmp_20);
+            free(path_20);
+            rc_20=tar_send_20(fd_20,out_20,ext_20);
+        }
+        else
+            rc_20=send_line_20(fd_20,nm_20<0?"ERR|open":"ERR|empty");
+        if(out_20>=0)
+            close(out_20);
+        unlink(tmp_20);   /* left only when it was not published */
+        free(tmp_20);
+        free(mem_20);
+        tree_free_20(&w_20,ents_20);
+    }
+    if(in_20>=0)
+        close(in_20);
+    for(int i_20=0;i_20<on_20;++i_20)
+        free(old_20[i_20].path);
+    free(old_20);
+    free(oldp_20);
+    free(idx_20);
+    free(dir_20);
+    free(b_20);
+    return rc_20;
+}
+
+//sends every file under S2 with its size, walking folders recursively; S1 uses it to move
+//files between shards, so hidden files (unfinished stores and tars) are left out
+static void walk_dir_20(int fd_20, const char *full_20, const char *rel_20)
+{
+    DIR *d_20=opendir(full_20);
+    if(!d_20)
+        return;
+    struct dirent *e_20;
+    while((e_20=readdir(d_20)))
+    {
+        if(e_20->d_name[0]=='.')
+            continue;
+        char *f_20=NULL,*r_20=NULL;
+        asprintf(&f_20,"%s/%s",full_20,e_20->d_name);
+        asprintf(&r_20,"%s%s%s",rel_20,*rel_20?"/":"",e_20->d_name);
+        struct stat st_20;
+        if(lstat(f_20,&st_20)==0)
+        {
+            if(S_ISDIR(st_20.st_mode))
+                walk_dir_20(fd_20,f_20,r_20);
+            else if(S_ISREG(st_20.st_mode))
+                send_line_20(fd_20,"FILE|%s|%zu",r_20,(size_t)st_20.st_size);
+        }
+        free(f_20);
+        free(r_20);
+    }
+    closedir(d_20);
+}
+static int do_walk_20(int fd_20)
+{
+    char *b_20=base_20();
+    send_line_20(fd_20,"OK");
+    walk_dir_20(fd_20,b_20,"");
+    free(b_20);
+    return send_line_20(fd_20,"END");
+}
+
+//tells S1 whether a file is here (its size and mtime) without sending it
+static int do_stat_20(int fd_20, char *relfile_20)
+{
+    char *full_20=join_20(relfile_20);
+    struct stat st_20;
+    int rc_20=stat(full_20,&st_20);
+    free(full_20);
+    if(rc_20!=0 || !S_ISREG(st_20.st_mode))
+        return send_line_20(fd_20,"ERR|nofile");
+    return send_line_20(fd_20,"OK|%zu|%llu",(size_t)st_20.st_size,mtime_ns_20(&st_20));
+}
+
 // handler connected to S1, reads all the commands and calls the correct function for each command
 static void serve_20(int cfd_20)
 {
+    stat_fd_20=cfd_20;
+    obuf_20.fd=cfd_20;
+    int busy_20=0;   /* a verb that breaks out of the loop still leaves in-flight */
     for(;;)
     {
         char line_20[LINE_MAX_20];
         int n_20=read_line_20(cfd_20,line_20,sizeof line_20);
         if(n_20<=0)
             break;
-        if(strncmp(line_20,"STORE|",6)==0)
+        // "RID|<id>" ahead of a verb tags its trace span with the client's request id
+        if(strncmp(line_20,"RID|",4)==0)
         {
+            snprintf(trace_rid_20,sizeof trace_rid_20,"%.32s",line_20+4);
+            continue;
+        }
+        unsigned long long t0_20=now_us_20();
+        int verb_20=VERB_OTHER_20;
+        unsigned long long tw_20=trace_fd_20>=0?wall_us_20():0;
+        trace_net_20=trace_disk_20=0;
+        if(STATG_20)
+            __atomic_fetch_add(&STATG_20->inflight,1,__ATOMIC_RELAXED);
+        busy_20=1;
+        stat_in_20=(unsigned long long)n_20+1;
+        stat_out_20=0;
+        stat_req_err_20=0;
+        if(strncmp(line_20,"STORE|",6)==0 || strncmp(line_20,"STORENX|",8)==0)
+        {
+            verb_20=VERB_STORE_20;
+            int nx_20=line_20[5]=='N';
             char *save_20=NULL;
             strtok_r(line_20,"|",&save_20);
             char *rel_20=strtok_r(NULL,"|",&save_20);
@@ -332,38 +1654,221 @@ static void serve_20(int cfd_20)
             if(read_line_20(cfd_20,size_line_20,sizeof size_line_20)<=0)
                 break;
             size_t sz_20=(size_t)strtoull(size_line_20,NULL,10);
-            do_store_20(cfd_20, rel_20?rel_20:"", name_20?name_20:"file.pdf", sz_20);
+            do_store_20(cfd_20, rel_20?rel_20:"", name_20?name_20:"file.pdf", sz_20, nx_20);
         }
         else if(strncmp(line_20,"FETCH|",6)==0)
         {
+            verb_20=VERB_FETCH_20;
             char *relfile_20=line_20+6;
             do_fetch_20(cfd_20, relfile_20);
         }
         else if(strncmp(line_20,"DELETE|",7)==0)
         {
+            verb_20=VERB_DELETE_20;
             char *relfile_20=line_20+7;
             do_delete_20(relfile_20, cfd_20);
         }
-        else if(strncmp(line_20,"TAR|.pdf",8)==0)
+        else if(strncmp(line_20,"DELETEM|",8)==0)
+        {
+            verb_20=VERB_DELETE_20;
+            do_deletem_20(cfd_20, atoi(line_20+8));
+        }
+        else if(strncmp(line_20,"DELTREE|",8)==0)
         {
-            do_tar_20(cfd_20);
+            verb_20=VERB_DELETE_20;
+            do_deltree_20(cfd_20, line_20+8);
+        }
+        else if(strncmp(line_20,"TAR|",4)==0)
+        {
+            verb_20=VERB_TAR_20;
+            do_tar_20(cfd_20, line_20+4);
+        }
+        else if(strncmp(line_20,"LISTS|",6)==0)
+        {
+            verb_20=VERB_LIST_20;
+            do_lists_20(cfd_20, line_20+6);
         }
         else if(strncmp(line_20,"LIST|",5)==0)
         {
+            verb_20=VERB_LIST_20;
             do_list_20(cfd_20, line_20+5);
         }
+        else if(strncmp(line_20,"TREE|",5)==0)
+        {
+            verb_20=VERB_WALK_20;
+            do_tree_20(cfd_20, line_20+5);
+        }
+        else if(strcmp(line_20,"WALK")==0)
+        {
+            verb_20=VERB_WALK_20;
+            do_walk_20(cfd_20);
+        }
+        else if(strncmp(line_20,"STAT|",5)==0)
+        {
+            verb_20=VERB_STAT_20;
+            do_stat_20(cfd_20, line_20+5);
+        }
+        else if(strcmp(line_20,"STATS")==0)
+        {
+            verb_20=VERB_STATS_20;
+            do_stats_20(cfd_20);
+        }
         else
         {
             send_line_20(cfd_20,"ERR|unknown");
         }
+        if((verb_20==VERB_STORE_20 || verb_20==VERB_DELETE_20) && STATG_20)
+            __atomic_fetch_add(&STATG_20->gen,1,__ATOMIC_RELEASE);
+        obuf_flush_20();
+        stat_verb_done_20(verb_20,t0_20);
+        if(STATG_20)
+            __atomic_fetch_sub(&STATG_20->inflight,1,__ATOMIC_RELAXED);
+        busy_20=0;
+        trace_span_20(VERB_NAMES_20[verb_20],tw_20);
+        trace_flush_20();
+        trace_rid_20[0]='\0';
     }
+    if(busy_20&&STATG_20)
+        __atomic_fetch_sub(&STATG_20->inflight,1,__ATOMIC_RELAXED);
 }
 
 //cleans up finished child processes so they don't become zombies
 static void reap_20(int s)
 {
     (void)s;
-    while(waitpid(-1,NULL,WNOHANG)>0){}
+    pid_t pid_20;
+    while((pid_20=waitpid(-1,NULL,WNOHANG))>0)
+    {
+        if(STATG_20&&pid_20!=metrics_pid_20)
+            __atomic_fetch_sub(&STATG_20->active,1,__ATOMIC_RELAXED);
+    }
+}
+
+// SOCKETS: the "socket" lines of the DFS_CONF file S1 reads (backlog, nodelay, buffers,
+// keepalive, defer_accept) apply to this listener as well; S2 takes no other line from it.
+// Connections from S1 inherit the options from the listener
+static int SOCK_BACKLOG_20=BACKLOG_20;
+static int SOCK_NODELAY_20=1;
+static int SOCK_BUF_KB_20=0;     /* 0: the kernel sizes them */
+static int SOCK_KA_IDLE_20=60;   /* 0: no keepalive */
+static int SOCK_KA_INTVL_20=10;
+static int SOCK_KA_CNT_20=5;
+static int SOCK_DEFER_S_20=5;    /* 0: off */
+
+static int sock_conf_20(const char *opt_20,char **save_20)
+{
+    char *v_20=strtok_r(NULL," \t\r\n",save_20);
+    if(!v_20)
+        return -1;
+    int off_20=!strcmp(v_20,"off"),n_20=atoi(v_20);
+    if(!strcmp(opt_20,"backlog")&&n_20>0)
+        SOCK_BACKLOG_20=n_20;
+    else if(!strcmp(opt_20,"nodelay")&&(off_20||!strcmp(v_20,"on")))
+        SOCK_NODELAY_20=!off_20;
+    else if(!strcmp(opt_20,"buffers")&&(off_20||n_20>0))
+        SOCK_BUF_KB_20=off_20?0:n_20;
+    else if(!strcmp(opt_20,"defer_accept")&&(off_20||n_20>0))
+        SOCK_DEFER_S_20=off_20?0:n_20;
+    else if(!strcmp(opt_20,"keepalive")&&(off_20||n_20>0))
+    {
+        char *i_20=strtok_r(NULL," \t\r\n",save_20);
+        char *c_20=strtok_r(NULL," \t\r\n",save_20);
+        if((i_20&&atoi(i_20)<1)||(c_20&&atoi(c_20)<1))
+            return -1;
+        SOCK_KA_IDLE_20=off_20?0:n_20;
+        if(i_20)
+            SOCK_KA_INTVL_20=atoi(i_20);
+        if(c_20)
+            SOCK_KA_CNT_20=atoi(c_20);
+    }
+    else
+        return -1;
+    return 0;
+}
+
+static void sock_load_20(void)
+{
+    const char *path_20=getenv("DFS_CONF");
+    if(!path_20||!*path_20)
+        return;
+    FILE *f_20=fopen(path_20,"r");
+    if(!f_20)
+        return;
+    char buf_20[LINE_MAX_20];
+    int lno_20=0;
+    while(fgets(buf_20,sizeof buf_20,f_20))
+    {
+        ++lno_20;
+        char *hash_20=strchr(buf_20,'#');
+        if(hash_20)
+            *hash_20='\0';
+        char *save_20=NULL;
+        char *kw_20=strtok_r(buf_20," \t\r\n",&save_20);
+        if(!kw_20||strcmp(kw_20,"socket"))
+            continue;
+        char *opt_20=strtok_r(NULL," \t\r\n",&save_20);
+        if(!opt_20||sock_conf_20(opt_20,&save_20)!=0)
+            fprintf(stderr,"[S2] %s:%d: bad socket line, ignored\n",path_20,lno_20);
+    }
+    fclose(f_20);
+}
+
+// before listen(), so a receive buffer set here is the one the handshake scales the window for
+static void sock_tune_20(int fd_20)
+{
+    int one_20=1;
+    if(SOCK_NODELAY_20)
+        setsockopt(fd_20,IPPROTO_TCP,TCP_NODELAY,&one_20,sizeof one_20);
+    if(SOCK_BUF_KB_20)
+    {
+        int b_20=SOCK_BUF_KB_20*1024;
+        setsockopt(fd_20,SOL_SOCKET,SO_SNDBUF,&b_20,sizeof b_20);
+        setsockopt(fd_20,SOL_SOCKET,SO_RCVBUF,&b_20,sizeof b_20);
+    }
+    if(SOCK_KA_IDLE_20)
+    {
+        setsockopt(fd_20,SOL_SOCKET,SO_KEEPALIVE,&one_20,sizeof one_20);
+        setsockopt(fd_20,IPPROTO_TCP,TCP_KEEPIDLE,&SOCK_KA_IDLE_20,sizeof SOCK_KA_IDLE_20);
+        setsockopt(fd_20,IPPROTO_TCP,TCP_KEEPINTVL,&SOCK_KA_INTVL_20,sizeof SOCK_KA_INTVL_20);
+        setsockopt(fd_20,IPPROTO_TCP,TCP_KEEPCNT,&SOCK_KA_CNT_20,sizeof SOCK_KA_CNT_20);
+    }
+    if(SOCK_DEFER_S_20)
+        setsockopt(fd_20,IPPROTO_TCP,TCP_DEFER_ACCEPT,&SOCK_DEFER_S_20,sizeof SOCK_DEFER_S_20);
+}
+
+// the second listener for "unix:<path>": an S1 on this machine skips the TCP stack on every
+// call. A socket file left by an earlier run is replaced; one a running server answers on is not
+static int listen_unix_20(const char *path_20)
+{
+    struct sockaddr_un u_20;
+    memset(&u_20,0,sizeof u_20);
+    u_20.sun_family=AF_UNIX;
+    if(!*path_20||strlen(path_20)>=sizeof u_20.sun_path)
+    {
+        fprintf(stderr,"[S2] unix:%s: bad socket path\n",path_20);
+        exit(1);
+    }
+    memcpy(u_20.sun_path,path_20,strlen(path_20)+1);
+    int fd_20=socket(AF_UNIX,SOCK_STREAM,0);
+    struct stat st_20;
+    if(fd_20>=0&&lstat(path_20,&st_20)==0&&S_ISSOCK(st_20.st_mode))
+    {
+        if(connect(fd_20,(struct sockaddr*)&u_20,sizeof u_20)==0)
+        {
+            fprintf(stderr,"[S2] unix:%s: in use\n",path_20);
+            exit(1);
+        }
+        close(fd_20);
+        unlink(path_20);
+        fd_20=socket(AF_UNIX,SOCK_STREAM,0);
+    }
+    if(fd_20<0||bind(fd_20,(struct sockaddr*)&u_20,sizeof u_20)!=0||listen(fd_20,SOCK_BACKLOG_20)!=0)
+    {
+        perror(path_20);
+        exit(1);
+    }
+    fprintf(stderr,"[S2] listening on unix:%s\n",path_20);
+    return fd_20;
 }
 
 //main()
@@ -371,6 +1876,11 @@ int main(int argc, char **argv)
 {
     if(argc>=2) S2_PORT_20=atoi(argv[1]);
     signal(SIGCHLD,reap_20);
+    if(stats_init_20()!=0)
+        perror("stats mmap");
+    trace_init_20();
+    sock_load_20();
+    metrics_start_20();
 
     char *b_20=base_20(); free(b_20);
 
@@ -388,21 +1898,40 @@ int main(int argc, char **argv)
         exit(1);
     }
 
-    if(listen(lfd_20,BACKLOG_20)!=0)
+    sock_tune_20(lfd_20);
+    if(listen(lfd_20,SOCK_BACKLOG_20)!=0)
     {
         perror("listen");
         exit(1);
     }
     fprintf(stderr,"[S2] listening on %s:%d\n",HOST_20,S2_PORT_20);
 
+    // "unix:<path>" after the port adds a listener for an S1 on this machine
+    int ufd_20=-1;
+    if(argc>=3&&!strncmp(argv[2],"unix:",5))
+    {
+        ufd_20=listen_unix_20(argv[2]+5);
+        // with two listeners a connection that is gone by the time of accept() must not block it
+        fcntl(lfd_20,F_SETFL,fcntl(lfd_20,F_GETFL,0)|O_NONBLOCK);
+        fcntl(ufd_20,F_SETFL,fcntl(ufd_20,F_GETFL,0)|O_NONBLOCK);
+    }
+
     for(;;)
     {
-        struct sockaddr_in c_20;
+        int from_20=lfd_20;
+        if(ufd_20>=0)
+        {
+            struct pollfd pf_20[2]={{lfd_20,POLLIN,0},{ufd_20,POLLIN,0}};
+            if(poll(pf_20,2,-1)<0)
+                continue;
+            from_20=(pf_20[1].revents&POLLIN)?ufd_20:lfd_20;
+        }
+        struct sockaddr_storage c_20;
         socklen_t cl_20=sizeof c_20;
-        int cfd_20=accept(lfd_20,(struct sockaddr*)&c_20,&cl_20);
+        int cfd_20=accept(from_20,(struct sockaddr*)&c_20,&cl_20);
         if(cfd_20<0)
         {
-            if(errno==EINTR)
+            if(errno==EINTR||errno==EAGAIN)
                 continue;
             perror("accept");
             continue;
@@ -411,10 +1940,17 @@ int main(int argc, char **argv)
         if(p_20==0)
         {
             close(lfd_20);
+            if(ufd_20>=0)
+                close(ufd_20);
             serve_20(cfd_20);
             close(cfd_20);
             _exit(0);
         }
+        if(p_20>0&&STATG_20)
+        {
+            __atomic_fetch_add(&STATG_20->accepted,1,__ATOMIC_RELAXED);
+            __atomic_fetch_add(&STATG_20->active,1,__ATOMIC_RELAXED);
+        }
         close(cfd_20);
     }
 }
@@ -3,30 +3,144 @@
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <fnmatch.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <strings.h>
 #include <string.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
 #include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
-#define BACKLOG_30 16
+#define BACKLOG_30 1024
 #define LINE_MAX_30 4096
 #define CHUNK_30 8192
 
-//S3 listens and you can override the port: ./S3<port>
+//S3 listens and you can override the port: ./S3<port> [unix:<path>]
 static int S3_PORT_30 = 5003;
 static const char *HOST_30 = "0.0.0.0";
 
+// byte/error accounting for STATS on the connection from S1
+static int stat_fd_30=-1,stat_req_err_30;
+static unsigned long long stat_in_30,stat_out_30;
+
+// tracing: request id from S1 and the socket/disk time spent on the current verb
+static int trace_fd_30=-1;
+static char trace_rid_30[33];
+static unsigned long long trace_net_30,trace_disk_30;
+static unsigned long long wall_us_30(void)
+{
+    struct timespec ts_30;
+    clock_gettime(CLOCK_REALTIME,&ts_30);
+    return (unsigned long long)ts_30.tv_sec*1000000ULL+(unsigned long long)ts_30.tv_nsec/1000ULL;
+}
+
+// OUTPUT: replies to S1 are gathered in obuf_30 and sent when the verb is done, before the next
+// read from S1, or when the buffer fills; a write that does not fit goes out in one sendmsg with
+// what is gathered ahead of it, with MSG_MORE as the reply goes on. A LIST or TREE reply or a
+// small file so takes one or a few syscalls instead of one per line or chunk
+#define OBUF_30 65536
+static struct
+{
+    int fd,held;   /* held: a MSG_MORE send may have left a partial segment queued */
+    size_t n;
+    char buf[OBUF_30];
+} obuf_30={-1,0,0,{0}};
+
+static int obuf_send_30(struct iovec *iov_30,int cnt_30,int more_30)
+{
+    unsigned long long tt_30=trace_fd_30>=0?wall_us_30():0;
+    while(cnt_30>0)
+    {
+        struct msghdr m_30;
+        memset(&m_30,0,sizeof m_30);
+        m_30.msg_iov=iov_30;
+        m_30.msg_iovlen=(size_t)cnt_30;
+        ssize_t w_30=sendmsg(obuf_30.fd,&m_30,more_30?MSG_MORE:0);
+        if(w_30<0)
+        {
+            if(errno==EINTR)
+                continue;
+            return -1;
+        }
+        for(;cnt_30>0 && (size_t)w_30>=iov_30->iov_len;++iov_30,--cnt_30)
+            w_30-=(ssize_t)iov_30->iov_len;
+        if(cnt_30>0)
+        {
+            iov_30->iov_base=(char*)iov_30->iov_base+w_30;
+            iov_30->iov_len-=(size_t)w_30;
+        }
+    }
+    obuf_30.held=more_30;
+    if(tt_30)
+        trace_net_30+=wall_us_30()-tt_30;
+    return 0;
+}
+static int SOCK_NODELAY_30; /* defined with the socket options below */
+// the end of a reply: everything gathered goes out now; a segment held back by MSG_MORE is
+// pushed by setting TCP_NODELAY
+static int obuf_flush_30(void)
+{
+    if(obuf_30.n)
+    {
+        struct iovec iov_30={obuf_30.buf,obuf_30.n};
+        obuf_30.n=0;
+        return obuf_send_30(&iov_30,1,0);
+    }
+    if(obuf_30.held)
+    {
+        int one_30=1;
+        setsockopt(obuf_30.fd,IPPROTO_TCP,TCP_NODELAY,&one_30,sizeof one_30);
+        if(!SOCK_NODELAY_30)
+        {
+            /* push done: back to the configured socket nodelay off */
+            one_30=0;
+            setsockopt(obuf_30.fd,IPPROTO_TCP,TCP_NODELAY,&one_30,sizeof one_30);
+        }
+        obuf_30.held=0;
+    }
+    return 0;
+}
+static ssize_t obuf_write_30(const void *buf_30,size_t n_30)
+{
+    if(obuf_30.n+n_30<=OBUF_30)
+    {
+        memcpy(obuf_30.buf+obuf_30.n,buf_30,n_30);
+        obuf_30.n+=n_30;
+    }
+    else
+    {
+        struct iovec iov_30[2]={{obuf_30.buf,obuf_30.n},{(void*)buf_30,n_30}};
+        obuf_30.n=0;
+        if(obuf_send_30(iov_30,2,1)!=0)
+            return -1;
+    }
+    stat_out_30+=n_30;
+    return (ssize_t)n_30;
+}
+
 //sends all the bytes to a file/socket
 static ssize_t write_fully_30(int fd_30,const void*buf_30,size_t n_30)
 {
+    if(fd_30==obuf_30.fd)
+        return obuf_write_30(buf_30,n_30);
+    unsigned long long tt_30=trace_fd_30>=0?wall_us_30():0;
     const char*p_30=buf_30;
     size_t L_30=n_30;
     while(L_30)
@@ -41,19 +155,30 @@ static ssize_t write_fully_30(int fd_30,const void*buf_30,size_t n_30)
         L_30-=(size_t)w_30;
         p_30+=w_30;
     }
+    if(fd_30==stat_fd_30)
+        stat_out_30+=n_30;
+    if(tt_30)
+        *(fd_30==stat_fd_30?&trace_net_30:&trace_disk_30)+=wall_us_30()-tt_30;
     return (ssize_t)n_30;
 }
 
 //reads up to N bytes and stops early if connection is closed (r_30 == 0)
 static ssize_t read_fully_30(int fd_30,void*buf_30,size_t n_30)
 {
+    if(fd_30==obuf_30.fd&&obuf_flush_30()!=0)
+        return -1;
+    unsigned long long tt_30=trace_fd_30>=0&&fd_30==stat_fd_30?wall_us_30():0;
     char*p_30=buf_30;
     size_t L_30=n_30;
     while(L_30)
     {
         ssize_t r_30=read(fd_30,p_30,L_30);
         if(r_30==0)
+        {
+            if(tt_30)
+                trace_net_30+=wall_us_30()-tt_30;
             return (ssize_t)(n_30-L_30);
+        }
         if(r_30<0)
         {
             if(errno==EINTR)
@@ -62,13 +187,19 @@ static ssize_t read_fully_30(int fd_30,void*buf_30,size_t n_30)
         }
         L_30-=(size_t)r_30;
         p_30+=r_30;
+        if(fd_30==stat_fd_30)
+            stat_in_30+=(size_t)r_30;
     }
+    if(tt_30)
+        trace_net_30+=wall_us_30()-tt_30;
     return (ssize_t)n_30;
 }
 
 //read characters until we see a newline '\n' then we remove the newline and return a clean C string.
 static int read_line_30(int fd_30,char*buf_30,size_t cap_30)
 {
+    if(fd_30==obuf_30.fd&&obuf_flush_30()!=0)
+        return -1;
     size_t i_30=0;
     while(i_30+1<cap_30)
     { char c_30;
@@ -81,6 +212,8 @@ static int read_line_30(int fd_30,char*buf_30,size_t cap_30)
                 continue;
             return -1;
         }
+        if(fd_30==stat_fd_30)
+            stat_in_30++;
         if(c_30=='\n')
             break;
         buf_30[i_30++]=c_30;
@@ -97,10 +230,426 @@ static int send_line_30(int fd_30, const char*fmt_30, ...)
     vsnprintf(b_30,sizeof b_30,fmt_30,ap_30);
     va_end(ap_30);
     size_t L_30=strlen(b_30);
+    if(fd_30==stat_fd_30&&strncmp(b_30,"ERR|",4)==0)
+        stat_req_err_30=1;
     b_30[L_30++]='\n';
     return write_fully_30(fd_30,b_30,L_30)==(ssize_t)L_30?0:-1;
 }
 
+// STATS: per-verb counters and latency histograms shared by all S3 children
+// mmap'd MAP_SHARED before the accept loop; children add into the stripe picked by their pid
+// with relaxed atomics, so the request path never takes a lock
+#define STAT_STRIPES_30 16
+#define STAT_BUCKETS_30 128   /* 4 buckets per power of two of microseconds */
+
+enum { VERB_STORE_30, VERB_FETCH_30, VERB_DELETE_30, VERB_TAR_30, VERB_LIST_30, VERB_WALK_30, VERB_STAT_30, VERB_STATS_30, VERB_OTHER_30, VERB_COUNT_30 };
+static const char *VERB_NAMES_30[VERB_COUNT_30]={"STORE","FETCH","DELETE","TAR","LIST","WALK","STAT","STATS","OTHER"};
+
+struct op_stats_30
+{
+    unsigned long long requests,errors,bytes_in,bytes_out,lat_sum_us;
+    unsigned long long hist[STAT_BUCKETS_30];
+};
+struct stat_stripe_30
+{
+    struct op_stats_30 verb[VERB_COUNT_30];
+} __attribute__((aligned(64)));
+
+// connection and in-flight gauges, kept after the stripes
+struct stat_global_30
+{
+    unsigned long long accepted,active,inflight,start_s;
+    unsigned long long gen;   /* store generation: bumped after every STORE and DELETE */
+    unsigned long long tar_hits,tar_builds,tar_reused,tar_read;
+};
+
+static struct stat_stripe_30 *STATS_30=NULL;
+static struct stat_global_30 *STATG_30=NULL;
+
+static int stats_init_30(void)
+{
+    size_t sz_30=sizeof(struct stat_stripe_30)*STAT_STRIPES_30+sizeof(struct stat_global_30);
+    void *p_30=mmap(NULL,sz_30,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_ANONYMOUS,-1,0);
+    if(p_30==MAP_FAILED)
+        return -1;
+    STATS_30=(struct stat_stripe_30*)p_30;
+    STATG_30=(struct stat_global_30*)(STATS_30+STAT_STRIPES_30);
+    STATG_30->start_s=(unsigned long long)time(NULL);
+    STATG_30->gen=wall_us_30();   /* never one an archive kept by an earlier run was built at */
+    return 0;
+}
+
+static unsigned long long now_us_30(void)
+{
+    struct timespec ts_30;
+    clock_gettime(CLOCK_MONOTONIC,&ts_30);
+    return (unsigned long long)ts_30.tv_sec*1000000ULL+(unsigned long long)ts_30.tv_nsec/1000ULL;
+}
+
+// same bucket layout as S1 so the histograms line up
+static int stat_bucket_30(unsigned long long us_30)
+{
+    if(us_30<4)
+        return (int)us_30;
+    int lg_30=63-__builtin_clzll(us_30);
+    int b_30=lg_30*4+(int)((us_30>>(lg_30-2))&3);
+    return b_30<STAT_BUCKETS_30?b_30:STAT_BUCKETS_30-1;
+}
+static unsigned long long stat_bucket_upper_30(int b_30)
+{
+    if(b_30<4)
+        return (unsigned long long)b_30+1;
+    if(b_30<8)
+        return 4;   /* unused: 4us and up start at bucket 8 */
+    int lg_30=b_30/4;
+    return (1ULL<<lg_30)+((unsigned long long)(b_30%4+1)<<(lg_30-2));
+}
+
+static void stat_verb_done_30(int verb_30,unsigned long long t0_30)
+{
+    if(!STATS_30)
+        return;
+    unsigned long long us_30=now_us_30()-t0_30;
+    struct op_stats_30 *o_30=&STATS_30[(unsigned)getpid()%STAT_STRIPES_30].verb[verb_30];
+    __atomic_fetch_add(&o_30->requests,1,__ATOMIC_RELAXED);
+    if(stat_req_err_30)
+        __atomic_fetch_add(&o_30->errors,1,__ATOMIC_RELAXED);
+    __atomic_fetch_add(&o_30->bytes_in,stat_in_30,__ATOMIC_RELAXED);
+    __atomic_fetch_add(&o_30->bytes_out,stat_out_30,__ATOMIC_RELAXED);
+    __atomic_fetch_add(&o_30->lat_sum_us,us_30,__ATOMIC_RELAXED);
+    __atomic_fetch_add(&o_30->hist[stat_bucket_30(us_30)],1,__ATOMIC_RELAXED);
+}
+
+// upper bound of the bucket holding the p-th quantile
+static unsigned long long stat_pct_30(const struct op_stats_30 *o_30,double p_30)
+{
+    if(o_30->requests==0)
+        return 0;
+    unsigned long long total_30=0,seen_30=0;
+    for(int b_30=0;b_30<STAT_BUCKETS_30;++b_30)
+        total_30+=o_30->hist[b_30];
+    unsigned long long want_30=(unsigned long long)(p_30*(double)total_30+0.999999);
+    for(int b_30=0;b_30<STAT_BUCKETS_30;++b_30)
+    {
+        seen_30+=o_30->hist[b_30];
+        if(seen_30>=want_30&&seen_30>0)
+            return stat_bucket_upper_30(b_30);
+    }
+    return stat_bucket_upper_30(STAT_BUCKETS_30-1);
+}
+
+// sums one verb over all stripes
+static void stat_sum_30(struct op_stats_30 *o_30,int v_30)
+{
+    memset(o_30,0,sizeof *o_30);
+    for(int s_30=0;s_30<STAT_STRIPES_30;++s_30)
+    {
+        const struct op_stats_30 *x_30=&STATS_30[s_30].verb[v_30];
+        o_30->requests+=__atomic_load_n(&x_30->requests,__ATOMIC_RELAXED);
+        o_30->errors+=__atomic_load_n(&x_30->errors,__ATOMIC_RELAXED);
+        o_30->bytes_in+=__atomic_load_n(&x_30->bytes_in,__ATOMIC_RELAXED);
+        o_30->bytes_out+=__atomic_load_n(&x_30->bytes_out,__ATOMIC_RELAXED);
+        o_30->lat_sum_us+=__atomic_load_n(&x_30->lat_sum_us,__ATOMIC_RELAXED);
+        for(int b_30=0;b_30<STAT_BUCKETS_30;++b_30)
+            o_30->hist[b_30]+=__atomic_load_n(&x_30->hist[b_30],__ATOMIC_RELAXED);
+    }
+}
+
+// STATS reply: STATSBEGIN|S3, then per verb
+// CMD|verb|requests|errors|bytes_in|bytes_out|mean_us|p50_us|p99_us|p999_us and HIST|verb|upper_us:count,...
+static void do_stats_30(int fd_30)
+{
+    if(!STATS_30)
+    {
+        send_line_30(fd_30,"ERR|stats_unavailable");
+        return;
+    }
+    struct op_stats_30 *o_30=malloc(sizeof *o_30);
+    if(!o_30)
+    {
+        send_line_30(fd_30,"ERR|oom");
+        return;
+    }
+    send_line_30(fd_30,"STATSBEGIN|S3");
+    for(int v_30=0;v_30<VERB_COUNT_30;++v_30)
+    {
+        stat_sum_30(o_30,v_30);
+        send_line_30(fd_30,"CMD|%s|%llu|%llu|%llu|%llu|%llu|%llu|%llu|%llu",VERB_NAMES_30[v_30],
+            o_30->requests,o_30->errors,o_30->bytes_in,o_30->bytes_out,
+            o_30->requests?o_30->lat_sum_us/o_30->requests:0ULL,
+            stat_pct_30(o_30,0.50),stat_pct_30(o_30,0.99),stat_pct_30(o_30,0.999));
+        char h_30[LINE_MAX_30-64];
+        size_t n_30=0;
+        h_30[0]='\0';
+        for(int b_30=0;b_30<STAT_BUCKETS_30&&n_30+48<sizeof h_30;++b_30)
+            if(o_30->hist[b_30])
+                n_30+=(size_t)snprintf(h_30+n_30,sizeof h_30-n_30,"%s%llu:%llu",n_30?",":"",stat_bucket_upper_30(b_30),o_30->hist[b_30]);
+        send_line_30(fd_30,"HIST|%s|%s",VERB_NAMES_30[v_30],h_30);
+    }
+    send_line_30(fd_30,"STATSEND");
+    free(o_30);
+}
+
+static char *base_30(void);
+
+// METRICS: with S3_METRICS_PORT=<port> a separate process serves GET /metrics in the
+// Prometheus text format straight from the shared counters, off the request path
+static pid_t metrics_pid_30=-1;
+static const double PROM_LE_30[]={0.0001,0.00025,0.0005,0.001,0.0025,0.005,0.01,0.025,0.05,0.1,0.25,0.5,1,2.5,5,10};
+#define PROM_NLE_30 (sizeof PROM_LE_30/sizeof PROM_LE_30[0])
+
+struct mbuf_30 { char *p; size_t n,cap; };
+static void mprintf_30(struct mbuf_30 *b_30,const char *fmt_30,...)
+{
+    for(;;)
+    {
+        va_list ap_30;
+        va_start(ap_30,fmt_30);
+        int k_30=vsnprintf(b_30->p?b_30->p+b_30->n:NULL,b_30->p?b_30->cap-b_30->n:0,fmt_30,ap_30);
+        va_end(ap_30);
+        if(k_30<0)
+            return;
+        if(b_30->p&&b_30->n+(size_t)k_30<b_30->cap)
+        {
+            b_30->n+=(size_t)k_30;
+            return;
+        }
+        size_t cap_30=b_30->cap?b_30->cap*2:16384;
+        while(cap_30<b_30->n+(size_t)k_30+1)
+            cap_30*=2;
+        char *np_30=realloc(b_30->p,cap_30);
+        if(!np_30)
+            return;
+        b_30->p=np_30;
+        b_30->cap=cap_30;
+    }
+}
+
+static void prom_counter_30(struct mbuf_30 *b_30,const char *fam_30,const char *help_30,const struct op_stats_30 *ops_30,size_t field_30)
+{
+    mprintf_30(b_30,"# HELP %s %s\n# TYPE %s counter\n",fam_30,help_30,fam_30);
+    for(int v_30=0;v_30<VERB_COUNT_30;++v_30)
+        mprintf_30(b_30,"%s{cmd=\"%s\"} %llu\n",fam_30,VERB_NAMES_30[v_30],*(const unsigned long long*)((const char*)&ops_30[v_30]+field_30));
+}
+
+static void metrics_render_30(struct mbuf_30 *b_30)
+{
+    static struct op_stats_30 ops_30[VERB_COUNT_30];
+    for(int v_30=0;v_30<VERB_COUNT_30;++v_30)
+        stat_sum_30(&ops_30[v_30],v_30);
+    mprintf_30(b_30,"# HELP dfs_start_time_seconds Unix time the server started.\n# TYPE dfs_start_time_seconds gauge\ndfs_start_time_seconds %llu\n",STATG_30->start_s);
+    mprintf_30(b_30,"# HELP dfs_connections_accepted_total Connections accepted from S1.\n# TYPE dfs_connections_accepted_total counter\ndfs_connections_accepted_total %llu\n",
+        __atomic_load_n(&STATG_30->accepted,__ATOMIC_RELAXED));
+    mprintf_30(b_30,"# HELP dfs_connections_active Connections currently open.\n# TYPE dfs_connections_active gauge\ndfs_connections_active %llu\n",
+        __atomic_load_n(&STATG_30->active,__ATOMIC_RELAXED));
+    mprintf_30(b_30,"# HELP dfs_requests_in_flight Verbs currently being served.\n# TYPE dfs_requests_in_flight gauge\ndfs_requests_in_flight %llu\n",
+        __atomic_load_n(&STATG_30->inflight,__ATOMIC_RELAXED));
+    mprintf_30(b_30,"# HELP dfs_tar_cache_hits_total TARs sent from the kept archive.\n# TYPE dfs_tar_cache_hits_total counter\ndfs_tar_cache_hits_total %llu\n",
+        __atomic_load_n(&STATG_30->tar_hits,__ATOMIC_RELAXED));
+    mprintf_30(b_30,"# HELP dfs_tar_cache_builds_total Archives rebuilt after stores or deletes.\n# TYPE dfs_tar_cache_builds_total counter\ndfs_tar_cache_builds_total %llu\n",
+        __atomic_load_n(&STATG_30->tar_builds,__ATOMIC_RELAXED));
+    mprintf_30(b_30,"# HELP dfs_tar_members_reused_total Members copied unchanged from the previous archive.\n# TYPE dfs_tar_members_reused_total counter\ndfs_tar_members_reused_total %llu\n",
+        __atomic_load_n(&STATG_30->tar_reused,__ATOMIC_RELAXED));
+    mprintf_30(b_30,"# HELP dfs_tar_members_read_total Members read from their files.\n# TYPE dfs_tar_members_read_total counter\ndfs_tar_members_read_total %llu\n",
+        __atomic_load_n(&STATG_30->tar_read,__ATOMIC_RELAXED));
+    prom_counter_30(b_30,"dfs_requests_total","Verbs served.",ops_30,offsetof(struct op_stats_30,requests));
+    prom_counter_30(b_30,"dfs_request_errors_total","Verbs that sent an error reply.",ops_30,offsetof(struct op_stats_30,errors));
+    prom_counter_30(b_30,"dfs_received_bytes_total","Bytes read from S1.",ops_30,offsetof(struct op_stats_30,bytes_in));
+    prom_counter_30(b_30,"dfs_sent_bytes_total","Bytes written to S1.",ops_30,offsetof(struct op_stats_30,bytes_out));
+    mprintf_30(b_30,"# HELP dfs_request_duration_seconds Verb latency.\n# TYPE dfs_request_duration_seconds histogram\n");
+    for(int v_30=0;v_30<VERB_COUNT_30;++v_30)
+    {
+        const struct op_stats_30 *o_30=&ops_30[v_30];
+        unsigned long long cum_30=0,total_30=0;
+        int k_30=0;
+        for(int j_30=0;j_30<STAT_BUCKETS_30;++j_30)
+            total_30+=o_30->hist[j_30];
+        for(size_t l_30=0;l_30<PROM_NLE_30;++l_30)
+        {
+            while(k_30<STAT_BUCKETS_30&&(double)stat_bucket_upper_30(k_30)<=PROM_LE_30[l_30]*1e6)
+                cum_30+=o_30->hist[k_30++];
+            mprintf_30(b_30,"dfs_request_duration_seconds_bucket{cmd=\"%s\",le=\"%g\"} %llu\n",VERB_NAMES_30[v_30],PROM_LE_30[l_30],cum_30);
+        }
+        mprintf_30(b_30,"dfs_request_duration_seconds_bucket{cmd=\"%s\",le=\"+Inf\"} %llu\n",VERB_NAMES_30[v_30],total_30);
+        mprintf_30(b_30,"dfs_request_duration_seconds_sum{cmd=\"%s\"} %.6f\n",VERB_NAMES_30[v_30],(double)o_30->lat_sum_us/1e6);
+        mprintf_30(b_30,"dfs_request_duration_seconds_count{cmd=\"%s\"} %llu\n",VERB_NAMES_30[v_30],total_30);
+    }
+    char *root_30=base_30();
+    struct statvfs vfs_30;
+    if(root_30&&statvfs(root_30,&vfs_30)==0)
+    {
+        mprintf_30(b_30,"# HELP dfs_disk_size_bytes Size of the filesystem holding the store.\n# TYPE dfs_disk_size_bytes gauge\ndfs_disk_size_bytes{path=\"%s\"} %llu\n",
+            root_30,(unsigned long long)vfs_30.f_blocks*vfs_30.f_frsize);
+        mprintf_30(b_30,"# HELP dfs_disk_free_bytes Free space available to the server on that filesystem.\n# TYPE dfs_disk_free_bytes gauge\ndfs_disk_free_bytes{path=\"%s\"} %llu\n",
+            root_30,(unsigned long long)vfs_30.f_bavail*vfs_30.f_frsize);
+    }
+    free(root_30);
+}
+
+// one scrape per connection: GET /metrics or GET /healthz
+static void metrics_serve_one_30(int cfd_30)
+{
+    struct timeval tv_30={2,0};
+    setsockopt(cfd_30,SOL_SOCKET,SO_RCVTIMEO,&tv_30,sizeof tv_30);
+    setsockopt(cfd_30,SOL_SOCKET,SO_SNDTIMEO,&tv_30,sizeof tv_30);
+    char req_30[2048];
+    size_t n_30=0;
+    while(n_30+1<sizeof req_30)
+    {
+        ssize_t r_30=read(cfd_30,req_30+n_30,sizeof req_30-1-n_30);
+        if(r_30<=0)
+            break;
+        n_30+=(size_t)r_30;
+        req_30[n_30]='\0';
+        if(strstr(req_30,"\r\n\r\n")||strstr(req_30,"\n\n"))
+            break;
+    }
+    req_30[n_30]='\0';
+    struct mbuf_30 body_30={NULL,0,0};
+    const char *status_30="200 OK",*ctype_30="text/plain; version=0.0.4; charset=utf-8";
+    if(strncmp(req_30,"GET /metrics",12)==0)
+        metrics_render_30(&body_30);
+    else if(strncmp(req_30,"GET /healthz",12)==0)
+        mprintf_30(&body_30,"ok\n");
+    else
+    {
+        status_30="404 Not Found";
+        ctype_30="text/plain";
+        mprintf_30(&body_30,"try /metrics\n");
+    }
+    char head_30[256];
+    int h_30=snprintf(head_30,sizeof head_30,"HTTP/1.0 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",status_30,ctype_30,body_30.n);
+    write_fully_30(cfd_30,head_30,(size_t)h_30);
+    if(body_30.n)
+        write_fully_30(cfd_30,body_30.p,body_30.n);
+    free(body_30.p);
+}
+
+// binds in the parent so a bad port shows at startup; the child dies with the server
+static void metrics_start_30(void)
+{
+    const char *port_30=getenv("S3_METRICS_PORT");
+    if(!port_30||!*port_30||!STATS_30)
+        return;
+    int lfd_30=socket(AF_INET,SOCK_STREAM,0);
+    int opt_30=1;
+    setsockopt(lfd_30,SOL_SOCKET,SO_REUSEADDR,&opt_30,sizeof opt_30);
+    struct sockaddr_in a_30;
+    memset(&a_30,0,sizeof a_30);
+    a_30.sin_family=AF_INET;
+    a_30.sin_port=htons((uint16_t)atoi(port_30));
+    inet_pton(AF_INET,HOST_30,&a_30.sin_addr);
+    if(bind(lfd_30,(struct sockaddr*)&a_30,sizeof a_30)!=0||listen(lfd_30,16)!=0)
+    {
+        perror("metrics bind");
+        close(lfd_30);
+        return;
+    }
+    pid_t pid_30=fork();
+    if(pid_30==0)
+    {
+        prctl(PR_SET_PDEATHSIG,SIGTERM);
+        signal(SIGCHLD,SIG_DFL);
+        signal(SIGPIPE,SIG_IGN);   /* a scraper that hangs up early must not take the endpoint down */
+        for(;;)
+        {
+            int cfd_30=accept(lfd_30,NULL,NULL);
+            if(cfd_30<0)
+                continue;
+            metrics_serve_one_30(cfd_30);
+            close(cfd_30);
+        }
+    }
+    if(pid_30<0)
+        perror("metrics fork");
+    close(lfd_30);
+    metrics_pid_30=pid_30;
+    fprintf(stderr,"[S3] metrics on %s:%s/metrics\n",HOST_30,port_30);
+}
+
+// tracing: with DFS_TRACE=<file> each verb becomes a span (tagged with the RID that S1 sent)
+// in Chrome trace-event JSON, with the socket and disk time inside it as args.
+// Spans sit in a per-process ring and are appended once the reply has gone out
+#define TRACE_RING_30 64
+struct span_30
+{
+    const char *name;
+    unsigned long long ts_us,dur_us,net_us,disk_us;
+    char rid[33];
+};
+static struct span_30 spans_30[TRACE_RING_30];
+static unsigned span_head_30,span_flushed_30;
+static int trace_named_30;
+
+static void trace_init_30(void)
+{
+    const char *path_30=getenv("DFS_TRACE");
+    if(!path_30||!*path_30)
+        return;
+    int fd_30=open(path_30,O_WRONLY|O_CREAT|O_EXCL|O_APPEND,0644);
+    if(fd_30>=0)
+        write_fully_30(fd_30,"[\n",2);
+    else
+        fd_30=open(path_30,O_WRONLY|O_APPEND);
+    if(fd_30<0)
+        perror("DFS_TRACE");
+    trace_fd_30=fd_30;
+}
+
+static void trace_span_30(const char *name_30,unsigned long long t0_30)
+{
+    if(trace_fd_30<0||!t0_30)
+        return;
+    struct span_30 *sp_30=&spans_30[span_head_30++%TRACE_RING_30];
+    sp_30->name=name_30;
+    sp_30->ts_us=t0_30;
+    sp_30->dur_us=wall_us_30()-t0_30;
+    sp_30->net_us=trace_net_30;
+    sp_30->disk_us=trace_disk_30;
+    memcpy(sp_30->rid,trace_rid_30,sizeof sp_30->rid);
+}
+
+static void trace_flush_30(void)
+{
+    if(trace_fd_30<0)
+        return;
+    if(span_head_30-span_flushed_30>TRACE_RING_30)
+        span_flushed_30=span_head_30-TRACE_RING_30;
+    char buf_30[4096];
+    size_t n_30=0;
+    int pid_30=(int)getpid();
+    if(!trace_named_30)
+    {
+        trace_named_30=1;
+        n_30+=(size_t)snprintf(buf_30,sizeof buf_30,
+            "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"S3 worker %d\"}},\n",pid_30,pid_30);
+    }
+    while(span_flushed_30!=span_head_30)
+    {
+        const struct span_30 *sp_30=&spans_30[span_flushed_30++%TRACE_RING_30];
+        if(n_30+256>sizeof buf_30)
+        {
+            write_fully_30(trace_fd_30,buf_30,n_30);
+            n_30=0;
+        }
+        n_30+=(size_t)snprintf(buf_30+n_30,sizeof buf_30-n_30,
+            "{\"name\":\"%s\",\"cat\":\"S3\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":%d,\"tid\":%d,\"args\":{\"rid\":\"%s\",\"net_us\":%llu,\"disk_us\":%llu}},\n",
+            sp_30->name,sp_30->ts_us,sp_30->dur_us,pid_30,pid_30,sp_30->rid,sp_30->net_us,sp_30->disk_us);
+    }
+    if(n_30)
+        write_fully_30(trace_fd_30,buf_30,n_30);
+}
+
+// file reads for FETCH/TAR, timed as disk time when tracing
+static ssize_t disk_read_30(int fd_30,void *buf_30,size_t n_30)
+{
+    unsigned long long tt_30=trace_fd_30>=0?wall_us_30():0;
+    ssize_t r_30=read(fd_30,buf_30,n_30);
+    if(tt_30)
+        trace_disk_30+=wall_us_30()-tt_30;
+    return r_30;
+}
+
 //checks if S3 exists in the directory
 static char *base_30(void)
 {
@@ -132,49 +681,76 @@ static char *join_30(const char *rel_30)
     return o_30;
 }
 
+//reads and drops sz_30 bytes so the connection stays in sync after a failed store
+static void drain_30(int fd_30, size_t sz_30)
+{
+    char buf_30[CHUNK_30];
+    while(sz_30)
+    {
+        size_t want_30=sz_30>CHUNK_30?CHUNK_30:sz_30;
+        ssize_t r_30=read_fully_30(fd_30,buf_30,want_30);
+        if(r_30<=0)
+            return;
+        sz_30-=(size_t)r_30;
+    }
+}
+
 //recieves files from S1 and saves them
-static int do_store_30(int fd_30, char*rel_30, char*name_30, size_t sz_30)
+//writes to a hidden temp file first and renames it into place, so readers never see a partial file
+static int do_store_30(int fd_30, char*rel_30, char*name_30, size_t sz_30, int nx_30)
 {
     char *dir_30=join_30(rel_30);
     char *dst_30=NULL;
+    char *tmp_30=NULL;
     asprintf(&dst_30,"%s/%s",dir_30,name_30);
+    asprintf(&tmp_30,"%s/.%s.XXXXXX",dir_30,name_30);
     free(dir_30);
-    int out_30=open(dst_30,O_CREAT|O_TRUNC|O_WRONLY,0600);
+    int out_30=mkstemp(tmp_30);
     if(out_30<0)
     {
+        drain_30(fd_30,sz_30);
         free(dst_30);
-        return -1;
+        free(tmp_30);
+        return send_line_30(fd_30,"ERR|open");
     }
     char *buf_30=malloc(CHUNK_30);
     size_t left_30=sz_30;
 
-    while(left_30)
+    while(buf_30 && left_30)
     {
         size_t want_30=left_30>CHUNK_30?CHUNK_30:left_30;
         ssize_t r_30=read_fully_30(fd_30,buf_30,want_30);
         if(r_30<=0)
-        {
-            free(buf_30);
-            close(out_30);
-            free(dst_30);
-            return -1;
-        }
+            break;
         if(write_fully_30(out_30,buf_30,(size_t)r_30)!=r_30)
-        {
-            free(buf_30);
-            close(out_30);
-            free(dst_30);
-            return -1;
-        }
+            break;
         left_30-=(size_t)r_30;
     }
     free(buf_30);
     close(out_30);
+    // STORENX publishes with link(), which fails instead of replacing a file that is already there
+    if(!buf_30 || left_30 || (nx_30 ? link(tmp_30,dst_30) : rename(tmp_30,dst_30))!=0)
+    {
+        int exists_30=!(!buf_30 || left_30) && nx_30 && errno==EEXIST;
+        unlink(tmp_30);
+        free(dst_30);
+        free(tmp_30);
+        return exists_30 ? send_line_30(fd_30,"ERR|exists") : -1;
+    }
+    if(nx_30)
+        unlink(tmp_30);
     free(dst_30);
+    free(tmp_30);
     send_line_30(fd_30,"OK");
     return 0;
 }
 
+//mtime in nanoseconds; S1 checks its cached copy of a file against it and the size
+static unsigned long long mtime_ns_30(const struct stat *st_30)
+{
+    return (unsigned long long)st_30->st_mtim.tv_sec*1000000000ULL+(unsigned long long)st_30->st_mtim.tv_nsec;
+}
+
 //send a file back to S1 if required
 static int do_fetch_30(int fd_30, char *relfile_30)
 {
@@ -189,11 +765,11 @@ static int do_fetch_30(int fd_30, char *relfile_30)
     fstat(in_30,&st_30);
     const char *bn_30=strrchr(full_30,'/');
     bn_30=bn_30?bn_30+1:full_30;
-    send_line_30(fd_30,"OK|%s|%zu",bn_30,(size_t)st_30.st_size);
+    send_line_30(fd_30,"OK|%s|%zu|%llu",bn_30,(size_t)st_30.st_size,mtime_ns_30(&st_30));
     char *buf_30=malloc(CHUNK_30);
     for(;;)
     {
-        ssize_t r_30=read(in_30,buf_30,CHUNK_30);
+        ssize_t r_30=disk_read_30(in_30,buf_30,CHUNK_30);
         if(r_30<=0)
             break;
         write_fully_30(fd_30,buf_30,(size_t)r_30);
@@ -213,42 +789,133 @@ static int do_delete_30(char *relfile_30, int fd_30)
     return send_line_30(fd_30, rc_30==0? "OK":"ERR|unlink");
 }
 
-//created tar file for all .txt files under S3
-static int do_tar_30(int fd_30)
+//deletes many files for one DELETEM: n paths follow, one per line, and each gets an OK or ERR line
+//back in the same order. A run of files in one folder is unlinked relative to that folder opened
+//once, so the folder path is looked up once per run instead of once per file
+static int do_deletem_30(int fd_30, int n_30)
 {
     char *b_30=base_30();
-    char *tar_30=NULL;
-    asprintf(&tar_30,"%s/text.tar",b_30);
-    char *cmd_30=NULL;
-    asprintf(&cmd_30,"cd '%s' && tar -cf '%s' $(find . -type f -name '*.txt' | sed 's|^\\./||') 2>/dev/null", b_30, tar_30);
-    int rc_30=system(cmd_30);
-    (void)rc_30; free(cmd_30);
-    struct stat st_30;
-    if(stat(tar_30,&st_30)!=0)
+    char dir_30[LINE_MAX_30]="";
+    int dfd_30=-1, derr_30=ENOENT;
+    for(int i_30=0;i_30<n_30;++i_30)
     {
-        free(tar_30);
-        free(b_30);
-        return send_line_30(fd_30,"ERR|empty");
-    }
-    send_line_30(fd_30,"OK|text.tar|%zu",(size_t)st_30.st_size);
-    int in_30=open(tar_30,O_RDONLY);
-    char *buf_30=malloc(CHUNK_30);
-    for(;;)
-    {
-        ssize_t r_30=read(in_30,buf_30,CHUNK_30);
-        if(r_30<=0)
+        char rel_30[LINE_MAX_30];
+        if(read_line_30(fd_30,rel_30,sizeof rel_30)<=0)
             break;
-        write_fully_30(fd_30,buf_30,(size_t)r_30);
+        char *slash_30=strrchr(rel_30,'/');
+        const char *name_30=slash_30?slash_30+1:rel_30;
+        if(slash_30)
+            *slash_30='\0';
+        const char *d_30=slash_30?rel_30:"";
+        if(i_30==0 || strcmp(d_30,dir_30))
+        {
+            if(dfd_30>=0)
+                close(dfd_30);
+            char *full_30=NULL;
+            asprintf(&full_30,"%s/%s",b_30,d_30);
+            dfd_30=open(full_30,O_RDONLY|O_DIRECTORY);
+            derr_30=errno;
+            free(full_30);
+            snprintf(dir_30,sizeof dir_30,"%s",d_30);
+        }
+        int rc_30=-1, err_30=dfd_30<0?derr_30:EINVAL;
+        if(dfd_30>=0 && *name_30 && *name_30!='.')
+        {
+            rc_30=unlinkat(dfd_30,name_30,0);
+            err_30=errno;
+        }
+        if(rc_30==0)
+            send_line_30(fd_30,"OK");
+        else
+            send_line_30(fd_30,"ERR|%s",strerror(err_30));
     }
-    free(buf_30);
-    close(in_30);
-    unlink(tar_30);
-    free(tar_30);
+    if(dfd_30>=0)
+        close(dfd_30);
     free(b_30);
     return 0;
 }
 
-//list the name of all the txt files under S3
+//removes every file under one folder for "removef -r", with a DEL line per file removed and a
+//FAIL line per file that could not be; folders left empty go too. Hidden files are unfinished
+//stores and tars, which are left alone (and so is their folder)
+static void tree_rm_30(int fd_30, int dfd_30, const char *rel_30)
+{
+    DIR *d_30=fdopendir(dfd_30);
+    if(!d_30)
+    {
+        close(dfd_30);
+        return;
+    }
+    struct dirent *e_30;
+    while((e_30=readdir(d_30)))
+    {
+        if(e_30->d_name[0]=='.')
+            continue;
+        char *r_30=NULL;
+        asprintf(&r_30,"%s/%s",rel_30,e_30->d_name);
+        struct stat st_30;
+        if(fstatat(dirfd(d_30),e_30->d_name,&st_30,AT_SYMLINK_NOFOLLOW)==0)
+        {
+            if(S_ISDIR(st_30.st_mode))
+            {
+                int sub_30=openat(dirfd(d_30),e_30->d_name,O_RDONLY|O_DIRECTORY|O_NOFOLLOW);
+                if(sub_30>=0)
+                {
+                    tree_rm_30(fd_30,sub_30,r_30);
+                    unlinkat(dirfd(d_30),e_30->d_name,AT_REMOVEDIR);   /* fails while anything is left */
+                }
+            }
+            else if(S_ISREG(st_30.st_mode))
+            {
+                if(unlinkat(dirfd(d_30),e_30->d_name,0)==0)
+                    send_line_30(fd_30,"DEL|%s",r_30);
+                else
+                    send_line_30(fd_30,"FAIL|%s|%s",r_30,strerror(errno));
+            }
+        }
+        free(r_30);
+    }
+    closedir(d_30);
+}
+static int do_deltree_30(int fd_30, char *reldir_30)
+{
+    size_t n_30=strlen(reldir_30);
+    while(n_30 && reldir_30[n_30-1]=='/')
+        reldir_30[--n_30]='\0';
+    if(!n_30 || reldir_30[0]=='.')
+        return send_line_30(fd_30,"ERR|bad_path");
+    char *b_30=base_30();
+    char *full_30=NULL;
+    asprintf(&full_30,"%s/%s",b_30,reldir_30);
+    send_line_30(fd_30,"OK");
+    int dfd_30=open(full_30,O_RDONLY|O_DIRECTORY|O_NOFOLLOW);
+    if(dfd_30>=0)
+    {
+        tree_rm_30(fd_30,dfd_30,reldir_30);
+        rmdir(full_30);
+    }
+    free(full_30);
+    free(b_30);
+    return send_line_30(fd_30,"END");
+}
+
+//S1 routes any extension here, but it ends up inside a shell command, so only a dot and
+//up to 15 of [a-z0-9_+-] are accepted
+static int ext_ok_30(const char *ext_30)
+{
+    size_t n_30=strlen(ext_30);
+    if(ext_30[0]!='.' || n_30<2 || n_30>15)
+        return 0;
+    for(size_t i_30=1;i_30<n_30;++i_30)
+    {
+        char ch_30=ext_30[i_30];
+        if(!((ch_30>='a'&&ch_30<='z') || (ch_30>='0'&&ch_30<='9') || ch_30=='_' || ch_30=='+' || ch_30=='-'))
+            return 0;
+    }
+    return 1;
+}
+
+//list the name of every file in one folder of S3 (hidden files are unfinished stores or tars)
 static int do_list_30(int fd_30, char *reldir_30)
 {
     char *full_30=join_30(reldir_30);
@@ -264,29 +931,734 @@ static int do_list_30(int fd_30, char *reldir_30)
     struct dirent *e_30;
     while((e_30=readdir(d_30)))
     {
-        if(e_30->d_type==DT_REG)
-        {
-            const char *dot_30=strrchr(e_30->d_name,'.');
-            if(dot_30 && strcasecmp(dot_30,".txt")==0)
-                send_line_30(fd_30,"NAME|%s", e_30->d_name);
-        }
+        if(e_30->d_type==DT_REG && e_30->d_name[0]!='.')
+            send_line_30(fd_30,"NAME|%s", e_30->d_name);
     }
     closedir(d_30); free(full_30);
     send_line_30(fd_30,"END");
     return 0;
 }
 
+//the names of one folder in byte order for S1's paged listings: only names after the cursor, and
+//with a limit only the limit smallest of them, kept in fixed slots under a max-heap so a page of
+//a huge folder needs memory for the page only; without a limit the names go back to back in one
+//buffer. END|more tells S1 the limit cut the run short
+#define NAME_SLOT_30 256
+struct namerun_30
+{
+    char *buf;
+    size_t used,cap;
+    size_t *off;
+    int n,cap_n,limit,more;
+};
+static int namerun_less_30(const struct namerun_30 *r_30,int a_30,int b_30)
+{
+    return strcmp(r_30->buf+r_30->off[a_30],r_30->buf+r_30->off[b_30])<0;
+}
+static void namerun_swap_30(struct namerun_30 *r_30,int a_30,int b_30)
+{
+    size_t t_30=r_30->off[a_30]; r_30->off[a_30]=r_30->off[b_30]; r_30->off[b_30]=t_30;
+}
+static void namerun_add_30(struct namerun_30 *r_30,const char *name_30,const char *after_30)
+{
+    size_t len_30=strlen(name_30)+1;
+    if(*after_30 && strcmp(name_30,after_30)<=0)
+        return;
+    if(r_30->limit<=0)
+    {
+        if(r_30->used+len_30>r_30->cap)
+        {
+            r_30->cap=(r_30->cap?r_30->cap*2:65536)+len_30;
+            r_30->buf=realloc(r_30->buf,r_30->cap);
+        }
+        if(r_30->n==r_30->cap_n)
+        {
+            r_30->cap_n=r_30->cap_n?r_30->cap_n*2:1024;
+            r_30->off=realloc(r_30->off,sizeof(size_t)*(size_t)r_30->cap_n);
+        }
+        memcpy(r_30->buf+r_30->used,name_30,len_30);
+        r_30->off[r_30->n++]=r_30->used;
+        r_30->used+=len_30;
+        return;
+    }
+    if(len_30>NAME_SLOT_30)
+        return;
+    int i_30;
+    if(r_30->n<r_30->limit)
+    {
+        i_30=r_30->n;
+        r_30->off[i_30]=(size_t)i_30*NAME_SLOT_30;
+        memcpy(r_30->buf+r_30->off[i_30],name_30,len_30);
+        ++r_30->n;
+        for(;i_30>0 && namerun_less_30(r_30,(i_30-1)/2,i_30);i_30=(i_30-1)/2)
+            namerun_swap_30(r_30,i_30,(i_30-1)/2);
+        return;
+    }
+    r_30->more=1;
+    if(strcmp(name_30,r_30->buf+r_30->off[0])>=0)
+        return;
+    memcpy(r_30->buf+r_30->off[0],name_30,len_30);
+    for(i_30=0;;)
+    {
+        int c_30=2*i_30+1;
+        if(c_30>=r_30->n)
+            break;
+        if(c_30+1<r_30->n && namerun_less_30(r_30,c_30,c_30+1))
+            ++c_30;
+        if(!namerun_less_30(r_30,i_30,c_30))
+            break;
+        namerun_swap_30(r_30,i_30,c_30);
+        i_30=c_30;
+    }
+}
+static int namerun_cmp_30(const void *a_30,const void *b_30)
+{
+    return strcmp(*(char* const*)a_30,*(char* const*)b_30);
+}
+static int do_lists_30(int fd_30, char *args_30)
+{
+    char *save_30=NULL;
+    char *lim_30=strtok_r(args_30,"|",&save_30);
+    char *reldir_30=strtok_r(NULL,"|",&save_30);
+    const char *after_30=save_30?save_30:"";
+    struct namerun_30 r_30;
+    memset(&r_30,0,sizeof r_30);
+    r_30.limit=lim_30?atoi(lim_30):0;
+    if(r_30.limit<0 || r_30.limit>100000 || !reldir_30)
+        return send_line_30(fd_30,"ERR|bad_list");
+    if(r_30.limit>0)
+    {
+        r_30.buf=malloc((size_t)r_30.limit*NAME_SLOT_30);
+        r_30.off=malloc(sizeof(size_t)*(size_t)r_30.limit);
+    }
+    char *b_30=base_30();
+    char *full_30=NULL;
+    asprintf(&full_30,"%s/%s",b_30,reldir_30);
+    DIR *d_30=opendir(full_30);
+    struct dirent *e_30;
+    while(d_30 && (e_30=readdir(d_30)))
+        if(e_30->d_type==DT_REG && e_30->d_name[0]!='.')
+            namerun_add_30(&r_30,e_30->d_name,after_30);
+    if(d_30)
+        closedir(d_30);
+    free(full_30);
+    free(b_30);
+
+    char **sorted_30=malloc(sizeof(char*)*(size_t)(r_30.n?r_30.n:1));
+    for(int i_30=0;i_30<r_30.n;++i_30)
+        sorted_30[i_30]=r_30.buf+r_30.off[i_30];
+    qsort(sorted_30,(size_t)r_30.n,sizeof(char*),namerun_cmp_30);
+    send_line_30(fd_30,"OK");
+    for(int i_30=0;i_30<r_30.n;++i_30)
+        send_line_30(fd_30,"NAME|%s",sorted_30[i_30]);
+    free(sorted_30);
+    free(r_30.buf);
+    free(r_30.off);
+    return send_line_30(fd_30,r_30.more?"END|more":"END");
+}
+
+//TREE|<depth>|<prefix>|<glob>|<reldir> lists every file under a folder for S1's recursive
+//listings: down to depth levels (0: all), only paths (relative to the folder) starting with the
+//prefix and names matching the glob (either may be empty), each as ENT|<path>|<size>|<mtime_ns>
+//in byte order of the paths. Folders are read by TREE_THREADS_30 threads at once, taking them
+//from a shared queue, and the entries are gathered in one buffer and sorted before they are sent
+#define TREE_THREADS_30 4
+struct twalk_30
+{
+    pthread_mutex_t mu;
+    pthread_cond_t cv;
+    const char *base,*prefix,*glob;
+    int maxdepth,busy,fnflags;
+    char **q;              /* folders still to read, relative to base, with their depth */
+    int *qdepth,nq,capq;
+    char *buf;             /* "path|size|mtime" entries back to back */
+    size_t used,cap;
+    size_t *off;
+    int n,cap_n;
+};
+//whether anything under a folder can match the prefix
+static int tree_may_match_30(const char *rel_30, const char *prefix_30)
+{
+    size_t r_30=strlen(rel_30),p_30=strlen(prefix_30);
+    return r_30<p_30 ? !strncmp(prefix_30,rel_30,r_30) && (!r_30 || prefix_30[r_30]=='/') : !strncmp(rel_30,prefix_30,p_30);
+}
+static void tree_push_30(struct twalk_30 *w_30, char *rel_30, int depth_30)
+{
+    if(w_30->nq==w_30->capq)
+    {
+        w_30->capq=w_30->capq?w_30->capq*2:64;
+        w_30->q=realloc(w_30->q,sizeof(char*)*(size_t)w_30->capq);
+        w_30->qdepth=realloc(w_30->qdepth,sizeof(int)*(size_t)w_30->capq);
+    }
+    w_30->q[w_30->nq]=rel_30;
+    w_30->qdepth[w_30->nq++]=depth_30;
+}
+static void tree_add_30(struct twalk_30 *w_30, const char *ent_30, size_t len_30)
+{
+    if(w_30->used+len_30>w_30->cap)
+    {
+        w_30->cap=(w_30->cap?w_30->cap*2:65536)+len_30;
+        w_30->buf=realloc(w_30->buf,w_30->cap);
+    }
+    if(w_30->n==w_30->cap_n)
+    {
+        w_30->cap_n=w_30->cap_n?w_30->cap_n*2:1024;
+        w_30->off=realloc(w_30->off,sizeof(size_t)*(size_t)w_30->cap_n);
+    }
+    memcpy(w_30->buf+w_30->used,ent_30,len_30);
+    w_30->off[w_30->n++]=w_30->used;
+    w_30->used+=len_30;
+}
+//reads one folder: its files go to a local batch and its folders to a local list, both handed
+//over under the lock at the end, so threads only meet once per folder
+static void *tree_worker_30(void *arg_30)
+{
+    struct twalk_30 *w_30=arg_30;
+    pthread_mutex_lock(&w_30->mu);
+    for(;;)
+    {
+        while(!w_30->nq && w_30->busy)
+            pthread_cond_wait(&w_30->cv,&w_30->mu);
+        if(!w_30->nq)
+            break;
+        char *rel_30=w_30->q[--w_30->nq];
+        int depth_30=w_30->qdepth[w_30->nq];
+        ++w_30->busy;
+        pthread_mutex_unlock(&w_30->mu);
+
+        char *full_30=NULL;
+        asprintf(&full_30,"%s/%s",w_30->base,rel_30);
+        DIR *d_30=opendir(full_30);
+        free(full_30);
+        char *files_30=NULL;
+        size_t nf_30=0,capf_30=0;
+        char **subs_30=NULL;
+        int ns_30=0;
+        struct dirent *e_30;
+        while(d_30 && (e_30=readdir(d_30)))
+        {
+            if(e_30->d_name[0]=='.')
+                continue;
+            struct stat st_30;
+            if(fstatat(dirfd(d_30),e_30->d_name,&st_30,AT_SYMLINK_NOFOLLOW)!=0)
+                continue;
+            char *path_30=NULL;
+            asprintf(&path_30,"%s%s%s",rel_30,*rel_30?"/":"",e_30->d_name);
+            if(S_ISDIR(st_30.st_mode) && (!w_30->maxdepth || depth_30+1<w_30->maxdepth) && tree_may_match_30(path_30,w_30->prefix))
+            {
+                subs_30=realloc(subs_30,sizeof(char*)*(size_t)(ns_30+1));
+                subs_30[ns_30++]=path_30;
+                continue;
+            }
+            if(S_ISREG(st_30.st_mode) && !strncmp(path_30,w_30->prefix,strlen(w_30->prefix))
+                && (!*w_30->glob || fnmatch(w_30->glob,e_30->d_name,w_30->fnflags)==0))
+            {
+                char ent_30[LINE_MAX_30];
+                int k_30=snprintf(ent_30,sizeof ent_30,"%s|%zu|%llu",path_30,(size_t)st_30.st_size,mtime_ns_30(&st_30));
+                if(k_30>0 && (size_t)k_30<sizeof ent_30)
+                {
+                    if(nf_30+(size_t)k_30+1>capf_30)
+                    {
+                        capf_30=(capf_30?capf_30*2:16384)+(size_t)k_30+1;
+                        files_30=realloc(files_30,capf_30);
+                    }
+                    memcpy(files_30+nf_30,ent_30,(size_t)k_30+1);
+                    nf_30+=(size_t)k_30+1;
+                }
+            }
+            free(path_30);
+        }
+        if(d_30)
+            closedir(d_30);
+
+        pthread_mutex_lock(&w_30->mu);
+        for(size_t at_30=0;at_30<nf_30;at_30+=strlen(files_30+at_30)+1)
+            tree_add_30(w_30,files_30+at_30,strlen(files_30+at_30)+1);
+        for(int i_30=0;i_30<ns_30;++i_30)
+            tree_push_30(w_30,subs_30[i_30],depth_30+1);
+        --w_30->busy;
+        pthread_cond_broadcast(&w_30->cv);
+        free(files_30);
+        free(subs_30);
+        free(rel_30);
+    }
+    pthread_cond_broadcast(&w_30->cv);
+    pthread_mutex_unlock(&w_30->mu);
+    return NULL;
+}
+//orders entries by path: the part before the first '|'
+static int tree_cmp_30(const void *a_30,const void *b_30)
+{
+    const unsigned char *x_30=*(const unsigned char* const*)a_30,*y_30=*(const unsigned char* const*)b_30;
+    for(;;++x_30,++y_30)
+    {
+        int cx_30=*x_30=='|'?0:*x_30, cy_30=*y_30=='|'?0:*y_30;
+        if(cx_30!=cy_30 || !cx_30)
+            return cx_30-cy_30;
+    }
+}
+//walks the folder root with the filters set in w and returns its entries sorted by path; they
+//point into w->buf, which tree_free_30 frees with the rest of the walk
+static char **tree_walk_30(struct twalk_30 *w_30, const char *root_30)
+{
+    pthread_mutex_init(&w_30->mu,NULL);
+    pthread_cond_init(&w_30->cv,NULL);
+    w_30->base=root_30;
+    tree_push_30(w_30,strdup(""),0);
+
+    pthread_t th_30[TREE_THREADS_30];
+    int nt_30=0;
+    for(;nt_30<TREE_THREADS_30;++nt_30)
+        if(pthread_create(&th_30[nt_30],NULL,tree_worker_30,w_30)!=0)
+            break;
+    if(!nt_30)
+        tree_worker_30(w_30);
+    for(int i_30=0;i_30<nt_30;++i_30)
+        pthread_join(th_30[i_30],NULL);
+
+    char **sorted_30=malloc(sizeof(char*)*(size_t)(w_30->n?w_30->n:1));
+    for(int i_30=0;i_30<w_30->n;++i_30)
+        sorted_30[i_30]=w_30->buf+w_30->off[i_30];
+    qsort(sorted_30,(size_t)w_30->n,sizeof(char*),tree_cmp_30);
+    return sorted_30;
+}
+static void tree_free_30(struct twalk_30 *w_30, char **sorted_30)
+{
+    free(sorted_30);
+    free(w_30->buf);
+    free(w_30->off);
+    free(w_30->q);
+    free(w_30->qdepth);
+    pthread_mutex_destroy(&w_30->mu);
+    pthread_cond_destroy(&w_30->cv);
+}
+static int do_tree_30(int fd_30, char *args_30)
+{
+    char *f_30[3];
+    for(int i_30=0;i_30<3;++i_30)
+    {
+        f_30[i_30]=args_30;
+        char *bar_30=args_30?strchr(args_30,'|'):NULL;
+        if(bar_30)
+            *bar_30='\0';
+        args_30=bar_30?bar_30+1:NULL;
+    }
+    if(!args_30)
+        return send_line_30(fd_30,"ERR|bad_tree");
+    struct twalk_30 w_30;
+    memset(&w_30,0,sizeof w_30);
+    w_30.maxdepth=atoi(f_30[0]);
+    w_30.prefix=f_30[1];
+    w_30.glob=f_30[2];
+    char *b_30=base_30();
+    char *root_30=NULL;
+    asprintf(&root_30,"%s/%s",b_30,strcmp(args_30,".")?args_30:"");
+    char **sorted_30=tree_walk_30(&w_30,root_30);
+    send_line_30(fd_30,"OK");
+    for(int i_30=0;i_30<w_30.n;++i_30)
+        send_line_30(fd_30,"ENT|%s",sorted_30[i_30]);
+    tree_free_30(&w_30,sorted_30);
+    free(root_30);
+    free(b_30);
+    return send_line_30(fd_30,"END");
+}
+
+//TAR|<ext> sends every file of one extension under S3 as one tar. The archive is kept in
+//~/S3/.tarcache as <e>.<gen>.tar, gen being the store generation it was built at (bumped after
+//every STORE and DELETE), next to <e>.idx, which names it and says where each member sits in it.
+//While the generation has not moved the kept archive is sent as it is; otherwise a new one is
+//written, copying the header and body of every file whose size and mtime are unchanged straight
+//out of the old archive and reading only new and changed files
+#define TAR_RECORD_30 10240
+struct tarmem_30
+{
+    unsigned long long off,len,size,mtime;
+    char *path;
+};
+//a numeric header field: octal, or base-256 when it does not fit (files of 8GiB and more)
+static void tar_num_30(char *f_30, size_t w_30, unsigned long long v_30)
+{
+    if(v_30<(1ULL<<(3*(w_30-1))))
+    {
+        snprintf(f_30,w_30,"%0*llo",(int)(w_30-1),v_30);
+        return;
+    }
+    memset(f_30,0,w_30);
+    f_30[0]=(char)0x80;
+    for(size_t i_30=w_30-1;i_30>0 && v_30;--i_30,v_30>>=8)
+        f_30[i_30]=(char)(v_30&0xff);
+}
+static void tar_block_30(char *h_30, const char *name_30, char type_30, unsigned long long size_30, const struct stat *st_30)
+{
+    memset(h_30,0,512);
+    memcpy(h_30,name_30,strnlen(name_30,100));
+    tar_num_30(h_30+100,8,st_30->st_mode&07777);
+    tar_num_30(h_30+108,8,st_30->st_uid);
+    tar_num_30(h_30+116,8,st_30->st_gid);
+    tar_num_30(h_30+124,12,size_30);
+    tar_num_30(h_30+136,12,(unsigned long long)st_30->st_mtime);
+    h_30[156]=type_30;
+    memcpy(h_30+257,"ustar  ",8);   /* GNU tar's magic, as tar -c writes by default */
+    memset(h_30+148,' ',8);
+    unsigned sum_30=0;
+    for(int i_30=0;i_30<512;++i_30)
+        sum_30+=(unsigned char)h_30[i_30];
+    snprintf(h_30+148,7,"%06o",sum_30);
+}
+//a member's header: a path of 100 bytes or more goes ahead of it in a GNU long-name entry
+static size_t tar_head_30(char *out_30, const char *path_30, const struct stat *st_30)
+{
+    size_t n_30=strlen(path_30),at_30=0;
+    if(n_30>=100)
+    {
+        tar_block_30(out_30,"././@LongLink",'L',n_30+1,st_30);
+        at_30=512+(n_30+1+511)/512*512;
+        memset(out_30+512,0,at_30-512);
+        memcpy(out_30+512,path_30,n_30);
+    }
+    tar_block_30(out_30+at_30,path_30,'0',(unsigned long long)st_30->st_size,st_30);
+    return at_30+512;
+}
+//copies len bytes at off in one file to the end of another, in the kernel when it can;
+//returns how many were copied
+static unsigned long long tar_copy_30(int in_30, off_t off_30, int out_30, unsigned long long len_30)
+{
+    unsigned long long done_30=0;
+    while(done_30<len_30)
+    {
+        ssize_t r_30=copy_file_range(in_30,&off_30,out_30,NULL,(size_t)(len_30-done_30),0);
+        if(r_30<=0)
+            break;
+        done_30+=(unsigned long long)r_30;
+    }
+    if(done_30<len_30)
+    {
+        char *buf_30=malloc(CHUNK_30);
+        while(done_30<len_30)
+        {
+            size_t want_30=len_30-done_30<CHUNK_30?(size_t)(len_30-done_30):CHUNK_30;
+            ssize_t r_30=pread(in_30,buf_30,want_30,off_30);
+            if(r_30<=0 || write_fully_30(out_30,buf_30,(size_t)r_30)!=r_30)
+                break;
+            off_30+=r_30;
+            done_30+=(unsigned long long)r_30;
+        }
+        free(buf_30);
+    }
+    return done_30;
+}
+//reads <e>.idx: "GEN|<gen>|<archive>" then "<off>|<len>|<size>|<mtime_ns>|<path>" per member in
+//path order; returns the member count, or -1 without an index
+static int tar_index_30(const char *idx_30, unsigned long long *gen_30, char name_30[64], struct tarmem_30 **mem_30)
+{
+    *mem_30=NULL;
+    FILE *f_30=fopen(idx_30,"r");
+    if(!f_30)
+        return -1;
+    char line_30[LINE_MAX_30+128];
+    if(!fgets(line_30,sizeof line_30,f_30) || sscanf(line_30,"GEN|%llu|%63s",gen_30,name_30)!=2)
+    {
+        fclose(f_30);
+        return -1;
+    }
+    int n_30=0,cap_30=0;
+    while(fgets(line_30,sizeof line_30,f_30))
+    {
+        line_30[strcspn(line_30,"\n")]='\0';
+        struct tarmem_30 t_30;
+        int k_30=0;
+        if(sscanf(line_30,"%llu|%llu|%llu|%llu|%n",&t_30.off,&t_30.len,&t_30.size,&t_30.mtime,&k_30)!=4 || !k_30)
+            continue;
+        if(n_30==cap_30)
+        {
+            cap_30=cap_30?cap_30*2:256;
+            *mem_30=realloc(*mem_30,sizeof(struct tarmem_30)*(size_t)cap_30);
+        }
+        t_30.path=strdup(line_30+k_30);
+        (*mem_30)[n_30++]=t_30;
+    }
+    fclose(f_30);
+    return n_30;
+}
+static int tar_send_30(int fd_30, int in_30, const char *ext_30)
+{
+    struct stat st_30;
+    if(fstat(in_30,&st_30)!=0)
+        return send_line_30(fd_30,"ERR|open");
+    send_line_30(fd_30,"OK|%s.tar|%zu",ext_30+1,(size_t)st_30.st_size);
+    lseek(in_30,0,SEEK_SET);
+    char *buf_30=malloc(CHUNK_30);
+    for(;;)
+    {
+        ssize_t r_30=disk_read_30(in_30,buf_30,CHUNK_30);
+        if(r_30<=0)
+            break;
+        write_fully_30(fd_30,buf_30,(size_t)r_30);
+    }
+    free(buf_30);
+    return 0;
+}
+//writes the archive of the files walked into out, taking unchanged members from the old one
+//(in, described by old); fills mem with the new members and returns how many there are, or -1
+static int tar_build_30(const char *b_30, char **ents_30, int n_30, int in_30, struct tarmem_30 *old_30, int on_30, int out_30, struct tarmem_30 *mem_30)
+{
+    unsigned long long at_30=0;
+    int nm_30=0,j_30=0;
+    char *head_30=malloc(512*2+LINE_MAX_30+512);
+    for(int i_30=0;i_30<n_30;++i_30)
+    {
+        // path|size|mtime_ns, as TREE lists them
+        char *e_30=ents_30[i_30];
+        char *bar_30=strchr(e_30,'|');
+        if(!bar_30)
+            continue;
+        *bar_30='\0';
+        unsigned long long size_30=0,mtime_30=0;
+        sscanf(bar_30+1,"%llu|%llu",&size_30,&mtime_30);
+        while(j_30<on_30 && strcmp(old_30[j_30].path,e_30)<0)
+            ++j_30;
+        struct tarmem_30 *m_30=&mem_30[nm_30];
+        m_30->off=at_30;
+        if(in_30>=0 && j_30<on_30 && !strcmp(old_30[j_30].path,e_30) && old_30[j_30].size==size_30 && old_30[j_30].mtime==mtime_30
+            && tar_copy_30(in_30,(off_t)old_30[j_30].off,out_30,old_30[j_30].len)==old_30[j_30].len)
+        {
+            m_30->len=old_30[j_30].len;
+            m_30->size=size_30;
+            m_30->mtime=mtime_30;
+            if(STATG_30)
+                __atomic_fetch_add(&STATG_30->tar_reused,1,__ATOMIC_RELAXED);
+        }
+        else
+        {
+            if(in_30>=0 && j_30<on_30 && !strcmp(old_30[j_30].path,e_30) && ftruncate(out_30,(off_t)at_30)==0)
+                lseek(out_30,(off_t)at_30,SEEK_SET);   /* a copy that broke off part way */
+            char *full_30=NULL;
+            asprintf(&full_30,"%s/%s",b_30,e_30);
+            int src_30=open(full_30,O_RDONLY);
+            free(full_30);
+            struct stat st_30;
+            if(src_30<0 || fstat(src_30,&st_30)!=0 || !S_ISREG(st_30.st_mode))
+            {
+                if(src_30>=0)
+                    close(src_30);
+                continue;   /* gone since the walk */
+            }
+            size_t hn_30=tar_head_30(head_30,e_30,&st_30);
+            unsigned long long body_30=(unsigned long long)st_30.st_size;
+            if(write_fully_30(out_30,head_30,hn_30)!=(ssize_t)hn_30)
+            {
+                close(src_30);
+                free(head_30);
+                return -1;
+            }
+            unsigned long long got_30=tar_copy_30(src_30,0,out_30,body_30);
+            close(src_30);
+            // a file that shrank meanwhile is padded out to the size in its header
+            size_t pad_30=(size_t)((512-body_30%512)%512);
+            memset(head_30,0,512);
+            for(;got_30<body_30;got_30+=512)
+            {
+                size_t k_30=body_30-got_30<512?(size_t)(body_30-got_30):512;
+                if(write_fully_30(out_30,head_30,k_30)!=(ssize_t)k_30)
+                    break;
+            }
+            if(got_30<body_30 || (pad_30 && write_fully_30(out_30,head_30,pad_30)!=(ssize_t)pad_30))
+            {
+                free(head_30);
+                return -1;
+            }
+            m_30->len=hn_30+body_30+pad_30;
+            m_30->size=body_30;
+            m_30->mtime=mtime_ns_30(&st_30);
+            if(STATG_30)
+                __atomic_fetch_add(&STATG_30->tar_read,1,__ATOMIC_RELAXED);
+        }
+        m_30->path=e_30;
+        at_30+=m_30->len;
+        ++nm_30;
+    }
+    // two zero blocks end the archive, and it is padded to whole records as tar does
+    size_t tail_30=1024+(size_t)((TAR_RECORD_30-(at_30+1024)%TAR_RECORD_30)%TAR_RECORD_30);
+    char *zero_30=calloc(1,tail_30);
+    int ok_30=write_fully_30(out_30,zero_30,tail_30)==(ssize_t)tail_30;
+    free(zero_30);
+    free(head_30);
+    return ok_30?nm_30:-1;
+}
+static int do_tar_30(int fd_30, const char *ext_30)
+{
+    if(!ext_ok_30(ext_30))
+        return send_line_30(fd_30,"ERR|bad_ext");
+    char *b_30=base_30();
+    char *dir_30=NULL,*idx_30=NULL,*oldp_30=NULL;
+    asprintf(&dir_30,"%s/.tarcache",b_30);
+    mkdir(dir_30,0700);
+    asprintf(&idx_30,"%s/%s.idx",dir_30,ext_30+1);
+    unsigned long long gen_30=STATG_30?__atomic_load_n(&STATG_30->gen,__ATOMIC_ACQUIRE):0;
+
+    unsigned long long ogen_30=0;
+    char oname_30[64]="";
+    struct tarmem_30 *old_30=NULL;
+    int on_30=tar_index_30(idx_30,&ogen_30,oname_30,&old_30);
+    int in_30=-1;
+    if(on_30>=0)
+    {
+        asprintf(&oldp_30,"%s/%s",dir_30,oname_30);
+        in_30=open(oldp_30,O_RDONLY);
+    }
+    int rc_30;
+    if(in_30>=0 && STATG_30 && ogen_30==gen_30)
+    {
+        // nothing stored or deleted since it was built
+        __atomic_fetch_add(&STATG_30->tar_hits,1,__ATOMIC_RELAXED);
+        rc_30=tar_send_30(fd_30,in_30,ext_30);
+    }
+    else
+    {
+        char glob_30[24];
+        snprintf(glob_30,sizeof glob_30,"*%.15s",ext_30);
+        struct twalk_30 w_30;
+        memset(&w_30,0,sizeof w_30);
+        w_30.prefix="";
+        w_30.glob=glob_30;
+        w_30.fnflags=FNM_CASEFOLD;
+        unsigned long long tb_30=trace_fd_30>=0?wall_us_30():0;
+        char **ents_30=tree_walk_30(&w_30,b_30);
+        struct tarmem_30 *mem_30=malloc(sizeof(struct tarmem_30)*(size_t)(w_30.n?w_30.n:1));
+        char *tmp_30=NULL;
+        asprintf(&tmp_30,"%s/.%s.XXXXXX",dir_30,ext_30+1);
+        int out_30=mkstemp(tmp_30);
+        int nm_30=out_30<0?-1:tar_build_30(b_30,ents_30,w_30.n,in_30,old_30,on_30>0?on_30:0,out_30,mem_30);
+        trace_span_30("tar_build",tb_30);
+        if(nm_30>0)
+        {
+            if(STATG_30)
+                __atomic_fetch_add(&STATG_30->tar_builds,1,__ATOMIC_RELAXED);
+            // the archive under its generation's name, then the index naming it
+            char name_30[64],*path_30=NULL,*itmp_30=NULL;
+            snprintf(name_30,sizeof name_30,"%.15s.%016llx.tar",ext_30+1,gen_30);
+            asprintf(&path_30,"%s/%s",dir_30,name_30);
+            asprintf(&itmp_30,"%s.XXXXXX",idx_30);
+            int ifd_30=mkstemp(itmp_30);
+            FILE *f_30=ifd_30>=0?fdopen(ifd_30,"w"):NULL;
+            if(f_30 && rename(tmp_30,path_30)==0)
+            {
+                fprintf(f_30,"GEN|%llu|%s\n",gen_30,name_30);
+                for(int i_30=0;i_30<nm_30;++i_30)
+                    fprintf(f_30,"%llu|%llu|%llu|%llu|%s\n",mem_30[i_30].off,mem_30[i_30].len,mem_30[i_30].size,mem_30[i_30].mtime,mem_30[i_30].path);
+                if(fclose(f_30)==0 && rename(itmp_30,idx_30)==0 && oldp_30 && strcmp(oname_30,name_30))
+                    unlink(oldp_30);
+                f_30=NULL;
+            }
+            if(f_30)
+                fclose(f_30);
+            unlink(itmp_30);
+            free(itmp_30);
+            free(path_30);
+            rc_30=tar_send_30(fd_30,out_30,ext_30);
+        }
+        else
+            rc_30=send_line_30(fd_30,nm_30<0?"ERR|open":"ERR|empty");
+        if(out_30>=0)
+            close(out_30);
+        unlink(tmp_30);   /* left only when it was not published */
+        free(tmp_30);
+        free(mem_30);
+        tree_free_30(&w_30,ents_30);
+    }
+    if(in_30>=0)
+        close(in_30);
+    for(int i_30=0;i_30<on_30;++i_30)
+        free(old_30[i_30].path);
+    free(old_30);
+    free(oldp_30);
+    free(idx_30);
+    free(dir_30);
+    free(b_30);
+    return rc_30;
+}
+
+//sends every file under S3 with its size, walking folders recursively; S1 uses it to move
+//files between shards, so hidden files (unfinished stores and tars) are left out
+static void walk_dir_30(int fd_30, const char *full_30, const char *rel_30)
+{
+    DIR *d_30=opendir(full_30);
+    if(!d_30)
+        return;
+    struct dirent *e_30;
+    while((e_30=readdir(d_30)))
+    {
+        if(e_30->d_name[0]=='.')
+            continue;
+        char *f_30=NULL,*r_30=NULL;
+        asprintf(&f_30,"%s/%s",full_30,e_30->d_name);
+        asprintf(&r_30,"%s%s%s",rel_30,*rel_30?"/":"",e_30->d_name);
+        struct stat st_30;
+        if(lstat(f_30,&st_30)==0)
+        {
+            if(S_ISDIR(st_30.st_mode))
+                walk_dir_30(fd_30,f_30,r_30);
+            else if(S_ISREG(st_30.st_mode))
+                send_line_30(fd_30,"FILE|%s|%zu",r_30,(size_t)st_30.st_size);
+        }
+        free(f_30);
+        free(r_30);
+    }
+    closedir(d_30);
+}
+static int do_walk_30(int fd_30)
+{
+    char *b_30=base_30();
+    send_line_30(fd_30,"OK");
+    walk_dir_30(fd_30,b_30,"");
+    free(b_30);
+    return send_line_30(fd_30,"END");
+}
+
+//tells S1 whether a file is here (its size and mtime) without sending it
+static int do_stat_30(int fd_30, char *relfile_30)
+{
+    char *full_30=join_30(relfile_30);
+    struct stat st_30;
+    int rc_30=stat(full_30,&st_30);
+    free(full_30);
+    if(rc_30!=0 || !S_ISREG(st_30.st_mode))
+        return send_line_30(fd_30,"ERR|nofile");
+    return send_line_30(fd_30,"OK|%zu|%llu",(size_t)st_30.st_size,mtime_ns_30(&st_30));
+}
+
 //handles connection from S1 and call right handler for each function
 static void serve_30(int cfd_30)
 {
+    stat_fd_30=cfd_30;
+    obuf_30.fd=cfd_30;
+    int busy_30=0;   /* a verb that breaks out of the loop still leaves in-flight */
     for(;;)
     {
         char line_30[LINE_MAX_30];
         int n_30=read_line_30(cfd_30,line_30,sizeof line_30);
         if(n_30<=0)
             break;
-        if(strncmp(line_30,"STORE|",6)==0)
+        // "RID|<id>" ahead of a verb tags its trace span with the client's request id
+        if(strncmp(line_30,"RID|",4)==0)
+        {
+            snprintf(trace_rid_30,sizeof trace_rid_30,"%.32s",line_30+4);
+            continue;
+        }
+        unsigned long long t0_30=now_us_30();
+        int verb_30=VERB_OTHER_30;
+        unsigned long long tw_30=trace_fd_30>=0?wall_us_30():0;
+        trace_net_30=trace_disk_30=0;
+        if(STATG_30)
+            __atomic_fetch_add(&STATG_30->inflight,1,__ATOMIC_RELAXED);
+        busy_30=1;
+        stat_in_30=(unsigned long long)n_30+1;
+        stat_out_30=0;
+        stat_req_err_30=0;
+        if(strncmp(line_30,"STORE|",6)==0 || strncmp(line_30,"STORENX|",8)==0)
         {
+            verb_30=VERB_STORE_30;
+            int nx_30=line_30[5]=='N';
             char *sv_30=NULL; strtok_r(line_30,"|",&sv_30);
             char *rel_30=strtok_r(NULL,"|",&sv_30);
             char *name_30=strtok_r(NULL,"|",&sv_30);
@@ -294,36 +1666,219 @@ static void serve_30(int cfd_30)
             if(read_line_30(cfd_30,szl_30,sizeof szl_30)<=0)
                 break;
             size_t sz_30=(size_t)strtoull(szl_30,NULL,10);
-            do_store_30(cfd_30, rel_30?rel_30:"", name_30?name_30:"file.txt", sz_30);
+            do_store_30(cfd_30, rel_30?rel_30:"", name_30?name_30:"file.txt", sz_30, nx_30);
         }
         else if(strncmp(line_30,"FETCH|",6)==0)
         {
+            verb_30=VERB_FETCH_30;
             do_fetch_30(cfd_30, line_30+6);
         }
         else if(strncmp(line_30,"DELETE|",7)==0)
         {
+            verb_30=VERB_DELETE_30;
             do_delete_30(line_30+7, cfd_30);
         }
-        else if(strncmp(line_30,"TAR|.txt",8)==0)
+        else if(strncmp(line_30,"DELETEM|",8)==0)
+        {
+            verb_30=VERB_DELETE_30;
+            do_deletem_30(cfd_30, atoi(line_30+8));
+        }
+        else if(strncmp(line_30,"DELTREE|",8)==0)
         {
-            do_tar_30(cfd_30);
+            verb_30=VERB_DELETE_30;
+            do_deltree_30(cfd_30, line_30+8);
+        }
+        else if(strncmp(line_30,"TAR|",4)==0)
+        {
+            verb_30=VERB_TAR_30;
+            do_tar_30(cfd_30, line_30+4);
+        }
+        else if(strncmp(line_30,"LISTS|",6)==0)
+        {
+            verb_30=VERB_LIST_30;
+            do_lists_30(cfd_30, line_30+6);
         }
         else if(strncmp(line_30,"LIST|",5)==0)
         {
+            verb_30=VERB_LIST_30;
             do_list_30(cfd_30, line_30+5);
         }
+        else if(strncmp(line_30,"TREE|",5)==0)
+        {
+            verb_30=VERB_WALK_30;
+            do_tree_30(cfd_30, line_30+5);
+        }
+        else if(strcmp(line_30,"WALK")==0)
+        {
+            verb_30=VERB_WALK_30;
+            do_walk_30(cfd_30);
+        }
+        else if(strncmp(line_30,"STAT|",5)==0)
+        {
+            verb_30=VERB_STAT_30;
+            do_stat_30(cfd_30, line_30+5);
+        }
+        else if(strcmp(line_30,"STATS")==0)
+        {
+            verb_30=VERB_STATS_30;
+            do_stats_30(cfd_30);
+        }
         else
         {
             send_line_30(cfd_30,"ERR|unknown");
         }
+        if((verb_30==VERB_STORE_30 || verb_30==VERB_DELETE_30) && STATG_30)
+            __atomic_fetch_add(&STATG_30->gen,1,__ATOMIC_RELEASE);
+        obuf_flush_30();
+        stat_verb_done_30(verb_30,t0_30);
+        if(STATG_30)
+            __atomic_fetch_sub(&STATG_30->inflight,1,__ATOMIC_RELAXED);
+        busy_30=0;
+        trace_span_30(VERB_NAMES_30[verb_30],tw_30);
+        trace_flush_30();
+        trace_rid_30[0]='\0';
     }
+    if(busy_30&&STATG_30)
+        __atomic_fetch_sub(&STATG_30->inflight,1,__ATOMIC_RELAXED);
 }
 
 //cleans up the child processes
 static void reap_30(int s)
 {
     (void)s;
-    while(waitpid(-1,NULL,WNOHANG)>0){}
+    pid_t pid_30;
+    while((pid_30=waitpid(-1,NULL,WNOHANG))>0)
+    {
+        if(STATG_30&&pid_30!=metrics_pid_30)
+            __atomic_fetch_sub(&STATG_30->active,1,__ATOMIC_RELAXED);
+    }
+}
+
+// SOCKETS: the "socket" lines of the DFS_CONF file S1 reads (backlog, nodelay, buffers,
+// keepalive, defer_accept) apply to this listener as well; S3 takes no other line from it.
+// Connections from S1 inherit the options from the listener
+static int SOCK_BACKLOG_30=BACKLOG_30;
+static int SOCK_NODELAY_30=1;
+static int SOCK_BUF_KB_30=0;     /* 0: the kernel sizes them */
+static int SOCK_KA_IDLE_30=60;   /* 0: no keepalive */
+static int SOCK_KA_INTVL_30=10;
+static int SOCK_KA_CNT_30=5;
+static int SOCK_DEFER_S_30=5;    /* 0: off */
+
+static int sock_conf_30(const char *opt_30,char **save_30)
+{
+    char *v_30=strtok_r(NULL," \t\r\n",save_30);
+    if(!v_30)
+        return -1;
+    int off_30=!strcmp(v_30,"off"),n_30=atoi(v_30);
+    if(!strcmp(opt_30,"backlog")&&n_30>0)
+        SOCK_BACKLOG_30=n_30;
+    else if(!strcmp(opt_30,"nodelay")&&(off_30||!strcmp(v_30,"on")))
+        SOCK_NODELAY_30=!off_30;
+    else if(!strcmp(opt_30,"buffers")&&(off_30||n_30>0))
+        SOCK_BUF_KB_30=off_30?0:n_30;
+    else if(!strcmp(opt_30,"defer_accept")&&(off_30||n_30>0))
+        SOCK_DEFER_S_30=off_30?0:n_30;
+    else if(!strcmp(opt_30,"keepalive")&&(off_30||n_30>0))
+    {
+        char *i_30=strtok_r(NULL," \t\r\n",save_30);
+        char *c_30=strtok_r(NULL," \t\r\n",save_30);
+        if((i_30&&atoi(i_30)<1)||(c_30&&atoi(c_30)<1))
+            return -1;
+        SOCK_KA_IDLE_30=off_30?0:n_30;
+        if(i_30)
+            SOCK_KA_INTVL_30=atoi(i_30);
+        if(c_30)
+            SOCK_KA_CNT_30=atoi(c_30);
+    }
+    else
+        return -1;
+    return 0;
+}
+
+static void sock_load_30(void)
+{
+    const char *path_30=getenv("DFS_CONF");
+    if(!path_30||!*path_30)
+        return;
+    FILE *f_30=fopen(path_30,"r");
+    if(!f_30)
+        return;
+    char buf_30[LINE_MAX_30];
+    int lno_30=0;
+    while(fgets(buf_30,sizeof buf_30,f_30))
+    {
+        ++lno_30;
+        char *hash_30=strchr(buf_30,'#');
+        if(hash_30)
+            *hash_30='\0';
+        char *save_30=NULL;
+        char *kw_30=strtok_r(buf_30," \t\r\n",&save_30);
+        if(!kw_30||strcmp(kw_30,"socket"))
+            continue;
+        char *opt_30=strtok_r(NULL," \t\r\n",&save_30);
+        if(!opt_30||sock_conf_30(opt_30,&save_30)!=0)
+            fprintf(stderr,"[S3] %s:%d: bad socket line, ignored\n",path_30,lno_30);
+    }
+    fclose(f_30);
+}
+
+// before listen(), so a receive buffer set here is the one the handshake scales the window for
+static void sock_tune_30(int fd_30)
+{
+    int one_30=1;
+    if(SOCK_NODELAY_30)
+        setsockopt(fd_30,IPPROTO_TCP,TCP_NODELAY,&one_30,sizeof one_30);
+    if(SOCK_BUF_KB_30)
+    {
+        int b_30=SOCK_BUF_KB_30*1024;
+        setsockopt(fd_30,SOL_SOCKET,SO_SNDBUF,&b_30,sizeof b_30);
+        setsockopt(fd_30,SOL_SOCKET,SO_RCVBUF,&b_30,sizeof b_30);
+    }
+    if(SOCK_KA_IDLE_30)
+    {
+        setsockopt(fd_30,SOL_SOCKET,SO_KEEPALIVE,&one_30,sizeof one_30);
+        setsockopt(fd_30,IPPROTO_TCP,TCP_KEEPIDLE,&SOCK_KA_IDLE_30,sizeof SOCK_KA_IDLE_30);
+        setsockopt(fd_30,IPPROTO_TCP,TCP_KEEPINTVL,&SOCK_KA_INTVL_30,sizeof SOCK_KA_INTVL_30);
+        setsockopt(fd_30,IPPROTO_TCP,TCP_KEEPCNT,&SOCK_KA_CNT_30,sizeof SOCK_KA_CNT_30);
+    }
+    if(SOCK_DEFER_S_30)
+        setsockopt(fd_30,IPPROTO_TCP,TCP_DEFER_ACCEPT,&SOCK_DEFER_S_30,sizeof SOCK_DEFER_S_30);
+}
+
+// the second listener for "unix:<path>": an S1 on this machine skips the TCP stack on every
+// call. A socket file left by an earlier run is replaced; one a running server answers on is not
+static int listen_unix_30(const char *path_30)
+{
+    struct sockaddr_un u_30;
+    memset(&u_30,0,sizeof u_30);
+    u_30.sun_family=AF_UNIX;
+    if(!*path_30||strlen(path_30)>=sizeof u_30.sun_path)
+    {
+        fprintf(stderr,"[S3] unix:%s: bad socket path\n",path_30);
+        exit(1);
+    }
+    memcpy(u_30.sun_path,path_30,strlen(path_30)+1);
+    int fd_30=socket(AF_UNIX,SOCK_STREAM,0);
+    struct stat st_30;
+    if(fd_30>=0&&lstat(path_30,&st_30)==0&&S_ISSOCK(st_30.st_mode))
+    {
+        if(connect(fd_30,(struct sockaddr*)&u_30,sizeof u_30)==0)
+        {
+            fprintf(stderr,"[S3] unix:%s: in use\n",path_30);
+            exit(1);
+        }
+        close(fd_30);
+        unlink(path_30);
+        fd_30=socket(AF_UNIX,SOCK_STREAM,0);
+    }
+    if(fd_30<0||bind(fd_30,(struct sockaddr*)&u_30,sizeof u_30)!=0||listen(fd_30,SOCK_BACKLOG_30)!=0)
+    {
+        perror(path_30);
+        exit(1);
+    }
+    fprintf(stderr,"[S3] listening on unix:%s\n",path_30);
+    return fd_30;
 }
 
 //main () and starts the server S3 and performs the other functions
@@ -332,6 +1887,11 @@ int main(int argc,char**argv)
     if(argc>=2)
         S3_PORT_30=atoi(argv[1]);
     signal(SIGCHLD,reap_30);
+    if(stats_init_30()!=0)
+        perror("stats mmap");
+    trace_init_30();
+    sock_load_30();
+    metrics_start_30();
     char *b_30=base_30();
     free(b_30);
 
@@ -349,21 +1909,40 @@ int main(int argc,char**argv)
         perror("bind");
         exit(1);
     }
-    if(listen(lfd_30,BACKLOG_30)!=0)
+    sock_tune_30(lfd_30);
+    if(listen(lfd_30,SOCK_BACKLOG_30)!=0)
     {
         perror("listen");
         exit(1);
     }
     fprintf(stderr,"[S3] listening on %s:%d\n",HOST_30,S3_PORT_30);
 
+    // "unix:<path>" after the port adds a listener for an S1 on this machine
+    int ufd_30=-1;
+    if(argc>=3&&!strncmp(argv[2],"unix:",5))
+    {
+        ufd_30=listen_unix_30(argv[2]+5);
+        // with two listeners a connection that is gone by the time of accept() must not block it
+        fcntl(lfd_30,F_SETFL,fcntl(lfd_30,F_GETFL,0)|O_NONBLOCK);
+        fcntl(ufd_30,F_SETFL,fcntl(ufd_30,F_GETFL,0)|O_NONBLOCK);
+    }
+
     for(;;)
     {
-        struct sockaddr_in c_30;
+        int from_30=lfd_30;
+        if(ufd_30>=0)
+        {
+            struct pollfd pf_30[2]={{lfd_30,POLLIN,0},{ufd_30,POLLIN,0}};
+            if(poll(pf_30,2,-1)<0)
+                continue;
+            from_30=(pf_30[1].revents&POLLIN)?ufd_30:lfd_30;
+        }
+        struct sockaddr_storage c_30;
         socklen_t cl_30=sizeof c_30;
-        int cfd_30=accept(lfd_30,(struct sockaddr*)&c_30,&cl_30);
+        int cfd_30=accept(from_30,(struct sockaddr*)&c_30,&cl_30);
         if(cfd_30<0)
         {
-            if(errno==EINTR)
+            if(errno==EINTR||errno==EAGAIN)
                 continue;
             perror("accept");
             continue;
@@ -372,10 +1951,17 @@ int main(int argc,char**argv)
         if(p_30==0)
         {
             close(lfd_30);
+            if(ufd_30>=0)
+                close(ufd_30);
             serve_30(cfd_30);
             close(cfd_30);
             _exit(0);
         }
+        if(p_30>0&&STATG_30)
+        {
+            __atomic_fetch_add(&STATG_30->accepted,1,__ATOMIC_RELAXED);
+            __atomic_fetch_add(&STATG_30->active,1,__ATOMIC_RELAXED);
+        }
         close(cfd_30);
     }
 }
@@ -3,30 +3,144 @@
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <fnmatch.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <strings.h>
 #include <string.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
 #include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
-#define BACKLOG_40 16
+#define BACKLOG_40 1024
 #define LINE_MAX_40 4096
 #define CHUNK_40 8192
 
-//S4 listens and we can override the port using ./S4 <port>
+//S4 listens and we can override the port using ./S4 <port> [unix:<path>]
 static int S4_PORT_40 = 5004;
 static const char *HOST_40 = "0.0.0.0";
 
+// byte/error accounting for STATS on the connection from S1
+static int stat_fd_40=-1,stat_req_err_40;
+static unsigned long long stat_in_40,stat_out_40;
+
+// tracing: request id from S1 and the socket/disk time spent on the current verb
+static int trace_fd_40=-1;
+static char trace_rid_40[33];
+static unsigned long long trace_net_40,trace_disk_40;
+static unsigned long long wall_us_40(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME,&ts);
+    return (unsigned long long)ts.tv_sec*1000000ULL+(unsigned long long)ts.tv_nsec/1000ULL;
+}
+
+// OUTPUT: replies to S1 are gathered in obuf_40 and sent when the verb is done, before the next
+// read from S1, or when the buffer fills; a write that does not fit goes out in one sendmsg with
+// what is gathered ahead of it, with MSG_MORE as the reply goes on. A LIST or TREE reply or a
+// small file so takes one or a few syscalls instead of one per line or chunk
+#define OBUF_40 65536
+static struct
+{
+    int fd,held;   /* held: a MSG_MORE send may have left a partial segment queued */
+    size_t n;
+    char buf[OBUF_40];
+} obuf_40={-1,0,0,{0}};
+
+static int obuf_send_40(struct iovec *iov,int cnt,int more)
+{
+    unsigned long long tt=trace_fd_40>=0?wall_us_40():0;
+    while(cnt>0)
+    {
+        struct msghdr m;
+        memset(&m,0,sizeof m);
+        m.msg_iov=iov;
+        m.msg_iovlen=(size_t)cnt;
+        ssize_t w=sendmsg(obuf_40.fd,&m,more?MSG_MORE:0);
+        if(w<0)
+        {
+            if(errno==EINTR)
+                continue;
+            return -1;
+        }
+        for(;cnt>0 && (size_t)w>=iov->iov_len;++iov,--cnt)
+            w-=(ssize_t)iov->iov_len;
+        if(cnt>0)
+        {
+            iov->iov_base=(char*)iov->iov_base+w;
+            iov->iov_len-=(size_t)w;
+        }
+    }
+    obuf_40.held=more;
+    if(tt)
+        trace_net_40+=wall_us_40()-tt;
+    return 0;
+}
+static int SOCK_NODELAY_40; /* defined with the socket options below */
+// the end of a reply: everything gathered goes out now; a segment held back by MSG_MORE is
+// pushed by setting TCP_NODELAY
+static int obuf_flush_40(void)
+{
+    if(obuf_40.n)
+    {
+        struct iovec iov={obuf_40.buf,obuf_40.n};
+        obuf_40.n=0;
+        return obuf_send_40(&iov,1,0);
+    }
+    if(obuf_40.held)
+    {
+        int one=1;
+        setsockopt(obuf_40.fd,IPPROTO_TCP,TCP_NODELAY,&one,sizeof one);
+        if(!SOCK_NODELAY_40)
+        {
+            /* push done: back to the configured socket nodelay off */
+            one=0;
+            setsockopt(obuf_40.fd,IPPROTO_TCP,TCP_NODELAY,&one,sizeof one);
+        }
+        obuf_40.held=0;
+    }
+    return 0;
+}
+static ssize_t obuf_write_40(const void *buf,size_t n)
+{
+    if(obuf_40.n+n<=OBUF_40)
+    {
+        memcpy(obuf_40.buf+obuf_40.n,buf,n);
+        obuf_40.n+=n;
+    }
+    else
+    {
+        struct iovec iov[2]={{obuf_40.buf,obuf_40.n},{(void*)buf,n}};
+        obuf_40.n=0;
+        if(obuf_send_40(iov,2,1)!=0)
+            return -1;
+    }
+    stat_out_40+=n;
+    return (ssize_t)n;
+}
+
 //makes sure we send all the bytes to the socket
 static ssize_t write_fully_40(int fd,const void*buf,size_t n)
 {
+    if(fd==obuf_40.fd)
+        return obuf_write_40(buf,n);
+    unsigned long long tt=trace_fd_40>=0?wall_us_40():0;
     const char*p=buf; size_t L=n;
     while(L)
     {
@@ -40,19 +154,30 @@ static ssize_t write_fully_40(int fd,const void*buf,size_t n)
         L-=(size_t)w;
         p+=w;
     }
+    if(fd==stat_fd_40)
+        stat_out_40+=n;
+    if(tt)
+        *(fd==stat_fd_40?&trace_net_40:&trace_disk_40)+=wall_us_40()-tt;
     return (ssize_t)n;
 }
 
 //reads up to N bytes and stops early if connection is closed
 static ssize_t read_fully_40(int fd,void*buf,size_t n)
 {
+    if(fd==obuf_40.fd&&obuf_flush_40()!=0)
+        return -1;
+    unsigned long long tt=trace_fd_40>=0&&fd==stat_fd_40?wall_us_40():0;
     char*p=buf;
     size_t L=n;
     while(L)
     {
         ssize_t r=read(fd,p,L);
         if(r==0)
+        {
+            if(tt)
+                trace_net_40+=wall_us_40()-tt;
             return (ssize_t)(n-L);
+        }
         if(r<0)
         {
             if(errno==EINTR)
@@ -61,13 +186,19 @@ static ssize_t read_fully_40(int fd,void*buf,size_t n)
         }
         L-=(size_t)r;
         p+=r;
+        if(fd==stat_fd_40)
+            stat_in_40+=(size_t)r;
     }
+    if(tt)
+        trace_net_40+=wall_us_40()-tt;
     return (ssize_t)n;
 }
 
 //reads characters one by one until we hit newline '\n' the we remove the newline, so the caller gets a clean string
 static int read_line_40(int fd,char*b,size_t cap)
 {
+    if(fd==obuf_40.fd&&obuf_flush_40()!=0)
+        return -1;
     size_t i=0;
     while(i+1<cap)
     {
@@ -80,7 +211,10 @@ static int read_line_40(int fd,char*b,size_t cap)
             if(errno==EINTR)
                 continue;
             return -1;
-        } if(c=='\n')
+        }
+        if(fd==stat_fd_40)
+            stat_in_40++;
+        if(c=='\n')
             break;
         b[i++]=c;
     }
@@ -95,9 +229,425 @@ static int send_line_40(int fd, const char*fmt, ...)
     va_start(ap,fmt);
     vsnprintf(buf,sizeof buf,fmt,ap);
     va_end(ap); size_t L=strlen(buf);
+    if(fd==stat_fd_40&&strncmp(buf,"ERR|",4)==0)
+        stat_req_err_40=1;
     buf[L++]='\n';
     return write_fully_40(fd,buf,L)==(ssize_t)L?0:-1; }
 
+// STATS: per-verb counters and latency histograms shared by all S4 children
+// mmap'd MAP_SHARED before the accept loop; children add into the stripe picked by their pid
+// with relaxed atomics, so the request path never takes a lock
+#define STAT_STRIPES_40 16
+#define STAT_BUCKETS_40 128   /* 4 buckets per power of two of microseconds */
+
+enum { VERB_STORE_40, VERB_FETCH_40, VERB_DELETE_40, VERB_TAR_40, VERB_LIST_40, VERB_WALK_40, VERB_STAT_40, VERB_STATS_40, VERB_OTHER_40, VERB_COUNT_40 };
+static const char *VERB_NAMES_40[VERB_COUNT_40]={"STORE","FETCH","DELETE","TAR","LIST","WALK","STAT","STATS","OTHER"};
+
+struct op_stats_40
+{
+    unsigned long long requests,errors,bytes_in,bytes_out,lat_sum_us;
+    unsigned long long hist[STAT_BUCKETS_40];
+};
+struct stat_stripe_40
+{
+    struct op_stats_40 verb[VERB_COUNT_40];
+} __attribute__((aligned(64)));
+
+// connection and in-flight gauges, kept after the stripes
+struct stat_global_40
+{
+    unsigned long long accepted,active,inflight,start_s;
+    unsigned long long gen;   /* store generation: bumped after every STORE and DELETE */
+    unsigned long long tar_hits,tar_builds,tar_reused,tar_read;
+};
+
+static struct stat_stripe_40 *STATS_40=NULL;
+static struct stat_global_40 *STATG_40=NULL;
+
+static int stats_init_40(void)
+{
+    size_t sz=sizeof(struct stat_stripe_40)*STAT_STRIPES_40+sizeof(struct stat_global_40);
+    void *p=mmap(NULL,sz,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_ANONYMOUS,-1,0);
+    if(p==MAP_FAILED)
+        return -1;
+    STATS_40=(struct stat_stripe_40*)p;
+    STATG_40=(struct stat_global_40*)(STATS_40+STAT_STRIPES_40);
+    STATG_40->start_s=(unsigned long long)time(NULL);
+    STATG_40->gen=wall_us_40();   /* never one an archive kept by an earlier run was built at */
+    return 0;
+}
+
+static unsigned long long now_us_40(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (unsigned long long)ts.tv_sec*1000000ULL+(unsigned long long)ts.tv_nsec/1000ULL;
+}
+
+// same bucket layout as S1 so the histograms line up
+static int stat_bucket_40(unsigned long long us)
+{
+    if(us<4)
+        return (int)us;
+    int lg=63-__builtin_clzll(us);
+    int b=lg*4+(int)((us>>(lg-2))&3);
+    return b<STAT_BUCKETS_40?b:STAT_BUCKETS_40-1;
+}
+static unsigned long long stat_bucket_upper_40(int b)
+{
+    if(b<4)
+        return (unsigned long long)b+1;
+    if(b<8)
+        return 4;   /* unused: 4us and up start at bucket 8 */
+    int lg=b/4;
+    return (1ULL<<lg)+((unsigned long long)(b%4+1)<<(lg-2));
+}
+
+static void stat_verb_done_40(int verb,unsigned long long t0)
+{
+    if(!STATS_40)
+        return;
+    unsigned long long us=now_us_40()-t0;
+    struct op_stats_40 *o=&STATS_40[(unsigned)getpid()%STAT_STRIPES_40].verb[verb];
+    __atomic_fetch_add(&o->requests,1,__ATOMIC_RELAXED);
+    if(stat_req_err_40)
+        __atomic_fetch_add(&o->errors,1,__ATOMIC_RELAXED);
+    __atomic_fetch_add(&o->bytes_in,stat_in_40,__ATOMIC_RELAXED);
+    __atomic_fetch_add(&o->bytes_out,stat_out_40,__ATOMIC_RELAXED);
+    __atomic_fetch_add(&o->lat_sum_us,us,__ATOMIC_RELAXED);
+    __atomic_fetch_add(&o->hist[stat_bucket_40(us)],1,__ATOMIC_RELAXED);
+}
+
+// upper bound of the bucket holding the p-th quantile
+static unsigned long long stat_pct_40(const struct op_stats_40 *o,double p)
+{
+    if(o->requests==0)
+        return 0;
+    unsigned long long total=0,seen=0;
+    for(int b=0;b<STAT_BUCKETS_40;++b)
+        total+=o->hist[b];
+    unsigned long long want=(unsigned long long)(p*(double)total+0.999999);
+    for(int b=0;b<STAT_BUCKETS_40;++b)
+    {
+        seen+=o->hist[b];
+        if(seen>=want&&seen>0)
+            return stat_bucket_upper_40(b);
+    }
+    return stat_bucket_upper_40(STAT_BUCKETS_40-1);
+}
+
+// sums one verb over all stripes
+static void stat_sum_40(struct op_stats_40 *o,int v)
+{
+    memset(o,0,sizeof *o);
+    for(int s=0;s<STAT_STRIPES_40;++s)
+    {
+        const struct op_stats_40 *x=&STATS_40[s].verb[v];
+        o->requests+=__atomic_load_n(&x->requests,__ATOMIC_RELAXED);
+        o->errors+=__atomic_load_n(&x->errors,__ATOMIC_RELAXED);
+        o->bytes_in+=__atomic_load_n(&x->bytes_in,__ATOMIC_RELAXED);
+        o->bytes_out+=__atomic_load_n(&x->bytes_out,__ATOMIC_RELAXED);
+        o->lat_sum_us+=__atomic_load_n(&x->lat_sum_us,__ATOMIC_RELAXED);
+        for(int b=0;b<STAT_BUCKETS_40;++b)
+            o->hist[b]+=__atomic_load_n(&x->hist[b],__ATOMIC_RELAXED);
+    }
+}
+
+// STATS reply: STATSBEGIN|S4, then per verb
+// CMD|verb|requests|errors|bytes_in|bytes_out|mean_us|p50_us|p99_us|p999_us and HIST|verb|upper_us:count,...
+static void do_stats_40(int fd)
+{
+    if(!STATS_40)
+    {
+        send_line_40(fd,"ERR|stats_unavailable");
+        return;
+    }
+    struct op_stats_40 *o=malloc(sizeof *o);
+    if(!o)
+    {
+        send_line_40(fd,"ERR|oom");
+        return;
+    }
+    send_line_40(fd,"STATSBEGIN|S4");
+    for(int v=0;v<VERB_COUNT_40;++v)
+    {
+        stat_sum_40(o,v);
+        send_line_40(fd,"CMD|%s|%llu|%llu|%llu|%llu|%llu|%llu|%llu|%llu",VERB_NAMES_40[v],
+            o->requests,o->errors,o->bytes_in,o->bytes_out,
+            o->requests?o->lat_sum_us/o->requests:0ULL,
+            stat_pct_40(o,0.50),stat_pct_40(o,0.99),stat_pct_40(o,0.999));
+        char h[LINE_MAX_40-64];
+        size_t n=0;
+        h[0]='\0';
+        for(int b=0;b<STAT_BUCKETS_40&&n+48<sizeof h;++b)
+            if(o->hist[b])
+                n+=(size_t)snprintf(h+n,sizeof h-n,"%s%llu:%llu",n?",":"",stat_bucket_upper_40(b),o->hist[b]);
+        send_line_40(fd,"HIST|%s|%s",VERB_NAMES_40[v],h);
+    }
+    send_line_40(fd,"STATSEND");
+    free(o);
+}
+
+static char *base_40(void);
+
+// METRICS: with S4_METRICS_PORT=<port> a separate process serves GET /metrics in the
+// Prometheus text format straight from the shared counters, off the request path
+static pid_t metrics_pid_40=-1;
+static const double PROM_LE_40[]={0.0001,0.00025,0.0005,0.001,0.0025,0.005,0.01,0.025,0.05,0.1,0.25,0.5,1,2.5,5,10};
+#define PROM_NLE_40 (sizeof PROM_LE_40/sizeof PROM_LE_40[0])
+
+struct mbuf_40 { char *p; size_t n,cap; };
+static void mprintf_40(struct mbuf_40 *b,const char *fmt,...)
+{
+    for(;;)
+    {
+        va_list ap;
+        va_start(ap,fmt);
+        int k=vsnprintf(b->p?b->p+b->n:NULL,b->p?b->cap-b->n:0,fmt,ap);
+        va_end(ap);
+        if(k<0)
+            return;
+        if(b->p&&b->n+(size_t)k<b->cap)
+        {
+            b->n+=(size_t)k;
+            return;
+        }
+        size_t cap=b->cap?b->cap*2:16384;
+        while(cap<b->n+(size_t)k+1)
+            cap*=2;
+        char *np=realloc(b->p,cap);
+        if(!np)
+            return;
+        b->p=np;
+        b->cap=cap;
+    }
+}
+
+static void prom_counter_40(struct mbuf_40 *b,const char *fam,const char *help,const struct op_stats_40 *ops,size_t field)
+{
+    mprintf_40(b,"# HELP %s %s\n# TYPE %s counter\n",fam,help,fam);
+    for(int v=0;v<VERB_COUNT_40;++v)
+        mprintf_40(b,"%s{cmd=\"%s\"} %llu\n",fam,VERB_NAMES_40[v],*(const unsigned long long*)((const char*)&ops[v]+field));
+}
+
+static void metrics_render_40(struct mbuf_40 *b)
+{
+    static struct op_stats_40 ops[VERB_COUNT_40];
+    for(int v=0;v<VERB_COUNT_40;++v)
+        stat_sum_40(&ops[v],v);
+    mprintf_40(b,"# HELP dfs_start_time_seconds Unix time the server started.\n# TYPE dfs_start_time_seconds gauge\ndfs_start_time_seconds %llu\n",STATG_40->start_s);
+    mprintf_40(b,"# HELP dfs_connections_accepted_total Connections accepted from S1.\n# TYPE dfs_connections_accepted_total counter\ndfs_connections_accepted_total %llu\n",
+        __atomic_load_n(&STATG_40->accepted,__ATOMIC_RELAXED));
+    mprintf_40(b,"# HELP dfs_connections_active Connections currently open.\n# TYPE dfs_connections_active gauge\ndfs_connections_active %llu\n",
+        __atomic_load_n(&STATG_40->active,__ATOMIC_RELAXED));
+    mprintf_40(b,"# HELP dfs_requests_in_flight Verbs currently being served.\n# TYPE dfs_requests_in_flight gauge\ndfs_requests_in_flight %llu\n",
+        __atomic_load_n(&STATG_40->inflight,__ATOMIC_RELAXED));
+    mprintf_40(b,"# HELP dfs_tar_cache_hits_total TARs sent from the kept archive.\n# TYPE dfs_tar_cache_hits_total counter\ndfs_tar_cache_hits_total %llu\n",
+        __atomic_load_n(&STATG_40->tar_hits,__ATOMIC_RELAXED));
+    mprintf_40(b,"# HELP dfs_tar_cache_builds_total Archives rebuilt after stores or deletes.\n# TYPE dfs_tar_cache_builds_total counter\ndfs_tar_cache_builds_total %llu\n",
+        __atomic_load_n(&STATG_40->tar_builds,__ATOMIC_RELAXED));
+    mprintf_40(b,"# HELP dfs_tar_members_reused_total Members copied unchanged from the previous archive.\n# TYPE dfs_tar_members_reused_total counter\ndfs_tar_members_reused_total %llu\n",
+        __atomic_load_n(&STATG_40->tar_reused,__ATOMIC_RELAXED));
+    mprintf_40(b,"# HELP dfs_tar_members_read_total Members read from their files.\n# TYPE dfs_tar_members_read_total counter\ndfs_tar_members_read_total %llu\n",
+        __atomic_load_n(&STATG_40->tar_read,__ATOMIC_RELAXED));
+    prom_counter_40(b,"dfs_requests_total","Verbs served.",ops,offsetof(struct op_stats_40,requests));
+    prom_counter_40(b,"dfs_request_errors_total","Verbs that sent an error reply.",ops,offsetof(struct op_stats_40,errors));
+    prom_counter_40(b,"dfs_received_bytes_total","Bytes read from S1.",ops,offsetof(struct op_stats_40,bytes_in));
+    prom_counter_40(b,"dfs_sent_bytes_total","Bytes written to S1.",ops,offsetof(struct op_stats_40,bytes_out));
+    mprintf_40(b,"# HELP dfs_request_duration_seconds Verb latency.\n# TYPE dfs_request_duration_seconds histogram\n");
+    for(int v=0;v<VERB_COUNT_40;++v)
+    {
+        const struct op_stats_40 *o=&ops[v];
+        unsigned long long cum=0,total=0;
+        int k=0;
+        for(int j=0;j<STAT_BUCKETS_40;++j)
+            total+=o->hist[j];
+        for(size_t l=0;l<PROM_NLE_40;++l)
+        {
+            while(k<STAT_BUCKETS_40&&(double)stat_bucket_upper_40(k)<=PROM_LE_40[l]*1e6)
+                cum+=o->hist[k++];
+            mprintf_40(b,"dfs_request_duration_seconds_bucket{cmd=\"%s\",le=\"%g\"} %llu\n",VERB_NAMES_40[v],PROM_LE_40[l],cum);
+        }
+        mprintf_40(b,"dfs_request_duration_seconds_bucket{cmd=\"%s\",le=\"+Inf\"} %llu\n",VERB_NAMES_40[v],total);
+        mprintf_40(b,"dfs_request_duration_seconds_sum{cmd=\"%s\"} %.6f\n",VERB_NAMES_40[v],(double)o->lat_sum_us/1e6);
+        mprintf_40(b,"dfs_request_duration_seconds_count{cmd=\"%s\"} %llu\n",VERB_NAMES_40[v],total);
+    }
+    char *root=base_40();
+    struct statvfs vfs;
+    if(root&&statvfs(root,&vfs)==0)
+    {
+        mprintf_40(b,"# HELP dfs_disk_size_bytes Size of the filesystem holding the store.\n# TYPE dfs_disk_size_bytes gauge\ndfs_disk_size_bytes{path=\"%s\"} %llu\n",
+            root,(unsigned long long)vfs.f_blocks*vfs.f_frsize);
+        mprintf_40(b,"# HELP dfs_disk_free_bytes Free space available to the server on that filesystem.\n# TYPE dfs_disk_free_bytes gauge\ndfs_disk_free_bytes{path=\"%s\"} %llu\n",
+            root,(unsigned long long)vfs.f_bavail*vfs.f_frsize);
+    }
+    free(root);
+}
+
+// one scrape per connection: GET /metrics or GET /healthz
+static void metrics_serve_one_40(int cfd)
+{
+    struct timeval tv={2,0};
+    setsockopt(cfd,SOL_SOCKET,SO_RCVTIMEO,&tv,sizeof tv);
+    setsockopt(cfd,SOL_SOCKET,SO_SNDTIMEO,&tv,sizeof tv);
+    char req[2048];
+    size_t n=0;
+    while(n+1<sizeof req)
+    {
+        ssize_t r=read(cfd,req+n,sizeof req-1-n);
+        if(r<=0)
+            break;
+        n+=(size_t)r;
+        req[n]='\0';
+        if(strstr(req,"\r\n\r\n")||strstr(req,"\n\n"))
+            break;
+    }
+    req[n]='\0';
+    struct mbuf_40 body={NULL,0,0};
+    const char *status="200 OK",*ctype="text/plain; version=0.0.4; charset=utf-8";
+    if(strncmp(req,"GET /metrics",12)==0)
+        metrics_render_40(&body);
+    else if(strncmp(req,"GET /healthz",12)==0)
+        mprintf_40(&body,"ok\n");
+    else
+    {
+        status="404 Not Found";
+        ctype="text/plain";
+        mprintf_40(&body,"try /metrics\n");
+    }
+    char head[256];
+    int h=snprintf(head,sizeof head,"HTTP/1.0 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",status,ctype,body.n);
+    write_fully_40(cfd,head,(size_t)h);
+    if(body.n)
+        write_fully_40(cfd,body.p,body.n);
+    free(body.p);
+}
+
+// binds in the parent so a bad port shows at startup; the child dies with the server
+static void metrics_start_40(void)
+{
+    const char *port=getenv("S4_METRICS_PORT");
+    if(!port||!*port||!STATS_40)
+        return;
+    int lfd=socket(AF_INET,SOCK_STREAM,0);
+    int opt=1;
+    setsockopt(lfd,SOL_SOCKET,SO_REUSEADDR,&opt,sizeof opt);
+    struct sockaddr_in a;
+    memset(&a,0,sizeof a);
+    a.sin_family=AF_INET;
+    a.sin_port=htons((uint16_t)atoi(port));
+    inet_pton(AF_INET,HOST_40,&a.sin_addr);
+    if(bind(lfd,(struct sockaddr*)&a,sizeof a)!=0||listen(lfd,16)!=0)
+    {
+        perror("metrics bind");
+        close(lfd);
+        return;
+    }
+    pid_t pid=fork();
+    if(pid==0)
+    {
+        prctl(PR_SET_PDEATHSIG,SIGTERM);
+        signal(SIGCHLD,SIG_DFL);
+        signal(SIGPIPE,SIG_IGN);   /* a scraper that hangs up early must not take the endpoint down */
+        for(;;)
+        {
+            int cfd=accept(lfd,NULL,NULL);
+            if(cfd<0)
+                continue;
+            metrics_serve_one_40(cfd);
+            close(cfd);
+        }
+    }
+    if(pid<0)
+        perror("metrics fork");
+    close(lfd);
+    metrics_pid_40=pid;
+    fprintf(stderr,"[S4] metrics on %s:%s/metrics\n",HOST_40,port);
+}
+
+// tracing: with DFS_TRACE=<file> each verb becomes a span (tagged with the RID that S1 sent)
+// in Chrome trace-event JSON, with the socket and disk time inside it as args.
+// Spans sit in a per-process ring and are appended once the reply has gone out
+#define TRACE_RING_40 64
+struct span_40
+{
+    const char *name;
+    unsigned long long ts_us,dur_us,net_us,disk_us;
+    char rid[33];
+};
+static struct span_40 spans_40[TRACE_RING_40];
+static unsigned span_head_40,span_flushed_40;
+static int trace_named_40;
+
+static void trace_init_40(void)
+{
+    const char *path=getenv("DFS_TRACE");
+    if(!path||!*path)
+        return;
+    int fd=open(path,O_WRONLY|O_CREAT|O_EXCL|O_APPEND,0644);
+    if(fd>=0)
+        write_fully_40(fd,"[\n",2);
+    else
+        fd=open(path,O_WRONLY|O_APPEND);
+    if(fd<0)
+        perror("DFS_TRACE");
+    trace_fd_40=fd;
+}
+
+static void trace_span_40(const char *name,unsigned long long t0)
+{
+    if(trace_fd_40<0||!t0)
+        return;
+    struct span_40 *sp=&spans_40[span_head_40++%TRACE_RING_40];
+    sp->name=name;
+    sp->ts_us=t0;
+    sp->dur_us=wall_us_40()-t0;
+    sp->net_us=trace_net_40;
+    sp->disk_us=trace_disk_40;
+    memcpy(sp->rid,trace_rid_40,sizeof sp->rid);
+}
+
+static void trace_flush_40(void)
+{
+    if(trace_fd_40<0)
+        return;
+    if(span_head_40-span_flushed_40>TRACE_RING_40)
+        span_flushed_40=span_head_40-TRACE_RING_40;
+    char buf[4096];
+    size_t n=0;
+    int pid=(int)getpid();
+    if(!trace_named_40)
+    {
+        trace_named_40=1;
+        n+=(size_t)snprintf(buf,sizeof buf,
+            "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"S4 worker %d\"}},\n",pid,pid);
+    }
+    while(span_flushed_40!=span_head_40)
+    {
+        const struct span_40 *sp=&spans_40[span_flushed_40++%TRACE_RING_40];
+        if(n+256>sizeof buf)
+        {
+            write_fully_40(trace_fd_40,buf,n);
+            n=0;
+        }
+        n+=(size_t)snprintf(buf+n,sizeof buf-n,
+            "{\"name\":\"%s\",\"cat\":\"S4\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":%d,\"tid\":%d,\"args\":{\"rid\":\"%s\",\"net_us\":%llu,\"disk_us\":%llu}},\n",
+            sp->name,sp->ts_us,sp->dur_us,pid,pid,sp->rid,sp->net_us,sp->disk_us);
+    }
+    if(n)
+        write_fully_40(trace_fd_40,buf,n);
+}
+
+// file reads for FETCH/TAR, timed as disk time when tracing
+static ssize_t disk_read_40(int fd,void *buf,size_t n)
+{
+    unsigned long long tt=trace_fd_40>=0?wall_us_40():0;
+    ssize_t r=read(fd,buf,n);
+    if(tt)
+        trace_disk_40+=wall_us_40()-tt;
+    return r;
+}
+
 //ensures that S4 exists
 static char *base_40(void)
 {
@@ -126,48 +676,75 @@ static char *join_40(const char *rel)
     } free(t); return o;
 }
 
+//reads and drops sz bytes so the connection stays in sync after a failed store
+static void drain_40(int fd, size_t sz)
+{
+    char buf[CHUNK_40];
+    while(sz)
+    {
+        size_t want=sz>CHUNK_40?CHUNK_40:sz;
+        ssize_t r=read_fully_40(fd,buf,want);
+        if(r<=0)
+            return;
+        sz-=(size_t)r;
+    }
+}
+
 //receives files from S1 and saves them
-static int do_store_40(int fd, char*rel, char*name, size_t sz)
+//the bytes land in a hidden temp file which is renamed into place once complete
+static int do_store_40(int fd, char*rel, char*name, size_t sz, int nx)
 {
     char *dir=join_40(rel);
     char *dst=NULL;
+    char *tmp=NULL;
     asprintf(&dst,"%s/%s",dir,name);
+    asprintf(&tmp,"%s/.%s.XXXXXX",dir,name);
     free(dir);
-    int out=open(dst,O_CREAT|O_TRUNC|O_WRONLY,0600);
+    int out=mkstemp(tmp);
     if(out<0)
     {
+        drain_40(fd,sz);
         free(dst);
-        return -1;
+        free(tmp);
+        return send_line_40(fd,"ERR|open");
     }
     char *buf=malloc(CHUNK_40);
     size_t left=sz;
-    while(left)
+    while(buf && left)
     {
         size_t want=left>CHUNK_40?CHUNK_40:left;
         ssize_t r=read_fully_40(fd,buf,want);
         if(r<=0)
-        {
-            free(buf);
-            close(out);
-            free(dst);
-            return -1;
-        }
+            break;
         if (write_fully_40(out, buf, (size_t)r) != r)
-        {
-            free(buf);
-            close(out);
-            free(dst);
-            return -1;
-        }
+            break;
         left-=(size_t)r;
     }
     free(buf);
     close(out);
+    // STORENX publishes with link(), which fails instead of replacing a file that is already there
+    if(!buf || left || (nx ? link(tmp,dst) : rename(tmp,dst))!=0)
+    {
+        int exists=!(!buf || left) && nx && errno==EEXIST;
+        unlink(tmp);
+        free(dst);
+        free(tmp);
+        return exists ? send_line_40(fd,"ERR|exists") : -1;
+    }
+    if(nx)
+        unlink(tmp);
     free(dst);
+    free(tmp);
     send_line_40(fd,"OK");
     return 0;
 }
 
+//mtime in nanoseconds; S1 checks its cached copy of a file against it and the size
+static unsigned long long mtime_ns_40(const struct stat *s)
+{
+    return (unsigned long long)s->st_mtim.tv_sec*1000000000ULL+(unsigned long long)s->st_mtim.tv_nsec;
+}
+
 //sead a file from disk and send it back to S1
 static int do_fetch_40(int fd, char *relfile)
 {
@@ -182,11 +759,11 @@ static int do_fetch_40(int fd, char *relfile)
     fstat(in,&st);
     const char *bn=strrchr(full,'/');
     bn=bn?bn+1:full;
-    send_line_40(fd,"OK|%s|%zu",bn,(size_t)st.st_size);
+    send_line_40(fd,"OK|%s|%zu|%llu",bn,(size_t)st.st_size,mtime_ns_40(&st));
     char *buf=malloc(CHUNK_40);
     for(;;)
     {
-        ssize_t r=read(in,buf,CHUNK_40);
+        ssize_t r=disk_read_40(in,buf,CHUNK_40);
         if(r<=0)
             break;
         write_fully_40(fd,buf,(size_t)r);
@@ -206,7 +783,133 @@ static int do_delete_40(char *relfile, int fd)
     return send_line_40(fd, rc==0? "OK":"ERR|unlink");
 }
 
-//lists the name of all the .zip files under S4
+//deletes many files for one DELETEM: n paths follow, one per line, and each gets an OK or ERR line
+//back in the same order. A run of files in one folder is unlinked relative to that folder opened
+//once, so the folder path is looked up once per run instead of once per file
+static int do_deletem_40(int fd, int n)
+{
+    char *b=base_40();
+    char dir[LINE_MAX_40]="";
+    int dfd=-1, derr=ENOENT;
+    for(int i=0;i<n;++i)
+    {
+        char rel[LINE_MAX_40];
+        if(read_line_40(fd,rel,sizeof rel)<=0)
+            break;
+        char *slash=strrchr(rel,'/');
+        const char *name=slash?slash+1:rel;
+        if(slash)
+            *slash='\0';
+        const char *d=slash?rel:"";
+        if(i==0 || strcmp(d,dir))
+        {
+            if(dfd>=0)
+                close(dfd);
+            char *full=NULL;
+            asprintf(&full,"%s/%s",b,d);
+            dfd=open(full,O_RDONLY|O_DIRECTORY);
+            derr=errno;
+            free(full);
+            snprintf(dir,sizeof dir,"%s",d);
+        }
+        int rc=-1, err=dfd<0?derr:EINVAL;
+        if(dfd>=0 && *name && *name!='.')
+        {
+            rc=unlinkat(dfd,name,0);
+            err=errno;
+        }
+        if(rc==0)
+            send_line_40(fd,"OK");
+        else
+            send_line_40(fd,"ERR|%s",strerror(err));
+    }
+    if(dfd>=0)
+        close(dfd);
+    free(b);
+    return 0;
+}
+
+//removes every file under one folder for "removef -r", with a DEL line per file removed and a
+//FAIL line per file that could not be; folders left empty go too. Hidden files are unfinished
+//stores and tars, which are left alone (and so is their folder)
+static void tree_rm_40(int fd, int dfd, const char *rel)
+{
+    DIR *d=fdopendir(dfd);
+    if(!d)
+    {
+        close(dfd);
+        return;
+    }
+    struct dirent *e;
+    while((e=readdir(d)))
+    {
+        if(e->d_name[0]=='.')
+            continue;
+        char *r=NULL;
+        asprintf(&r,"%s/%s",rel,e->d_name);
+        struct stat st;
+        if(fstatat(dirfd(d),e->d_name,&st,AT_SYMLINK_NOFOLLOW)==0)
+        {
+            if(S_ISDIR(st.st_mode))
+            {
+                int sub=openat(dirfd(d),e->d_name,O_RDONLY|O_DIRECTORY|O_NOFOLLOW);
+                if(sub>=0)
+                {
+                    tree_rm_40(fd,sub,r);
+                    unlinkat(dirfd(d),e->d_name,AT_REMOVEDIR);   /* fails while anything is left */
+                }
+            }
+            else if(S_ISREG(st.st_mode))
+            {
+                if(unlinkat(dirfd(d),e->d_name,0)==0)
+                    send_line_40(fd,"DEL|%s",r);
+                else
+                    send_line_40(fd,"FAIL|%s|%s",r,strerror(errno));
+            }
+        }
+        free(r);
+    }
+    closedir(d);
+}
+static int do_deltree_40(int fd, char *reldir)
+{
+    size_t n=strlen(reldir);
+    while(n && reldir[n-1]=='/')
+        reldir[--n]='\0';
+    if(!n || reldir[0]=='.')
+        return send_line_40(fd,"ERR|bad_path");
+    char *b=base_40();
+    char *full=NULL;
+    asprintf(&full,"%s/%s",b,reldir);
+    send_line_40(fd,"OK");
+    int dfd=open(full,O_RDONLY|O_DIRECTORY|O_NOFOLLOW);
+    if(dfd>=0)
+    {
+        tree_rm_40(fd,dfd,reldir);
+        rmdir(full);
+    }
+    free(full);
+    free(b);
+    return send_line_40(fd,"END");
+}
+
+//S1 routes any extension here, but it ends up inside a shell command, so only a dot and
+//up to 15 of [a-z0-9_+-] are accepted
+static int ext_ok_40(const char *ext)
+{
+    size_t n=strlen(ext);
+    if(ext[0]!='.' || n<2 || n>15)
+        return 0;
+    for(size_t i=1;i<n;++i)
+    {
+        char ch=ext[i];
+        if(!((ch>='a'&&ch<='z') || (ch>='0'&&ch<='9') || ch=='_' || ch=='+' || ch=='-'))
+            return 0;
+    }
+    return 1;
+}
+
+//lists the name of every file in one folder of S4 (hidden files are unfinished stores or tars)
 static int do_list_40(int fd, char *reldir)
 {
     char *full=join_40(reldir);
@@ -222,29 +925,734 @@ static int do_list_40(int fd, char *reldir)
     struct dirent *e;
     while((e=readdir(d)))
     {
-        if(e->d_type==DT_REG)
-        {
-            const char *dot=strrchr(e->d_name,'.');
-            if(dot && strcasecmp(dot,".zip")==0)
-                send_line_40(fd,"NAME|%s", e->d_name);
-        }
+        if(e->d_type==DT_REG && e->d_name[0]!='.')
+            send_line_40(fd,"NAME|%s", e->d_name);
     }
     closedir(d); free(full);
     send_line_40(fd,"END");
     return 0;
 }
 
+//the names of one folder in byte order for S1's paged listings: only names after the cursor, and
+//with a limit only the limit smallest of them, kept in fixed slots under a max-heap so a page of
+//a huge folder needs memory for the page only; without a limit the names go back to back in one
+//buffer. END|more tells S1 the limit cut the run short
+#define NAME_SLOT_40 256
+struct namerun_40
+{
+    char *buf;
+    size_t used,cap;
+    size_t *off;
+    int n,cap_n,limit,more;
+};
+static int namerun_less_40(const struct namerun_40 *r,int a,int b)
+{
+    return strcmp(r->buf+r->off[a],r->buf+r->off[b])<0;
+}
+static void namerun_swap_40(struct namerun_40 *r,int a,int b)
+{
+    size_t t=r->off[a]; r->off[a]=r->off[b]; r->off[b]=t;
+}
+static void namerun_add_40(struct namerun_40 *r,const char *name,const char *after)
+{
+    size_t len=strlen(name)+1;
+    if(*after && strcmp(name,after)<=0)
+        return;
+    if(r->limit<=0)
+    {
+        if(r->used+len>r->cap)
+        {
+            r->cap=(r->cap?r->cap*2:65536)+len;
+            r->buf=realloc(r->buf,r->cap);
+        }
+        if(r->n==r->cap_n)
+        {
+            r->cap_n=r->cap_n?r->cap_n*2:1024;
+            r->off=realloc(r->off,sizeof(size_t)*(size_t)r->cap_n);
+        }
+        memcpy(r->buf+r->used,name,len);
+        r->off[r->n++]=r->used;
+        r->used+=len;
+        return;
+    }
+    if(len>NAME_SLOT_40)
+        return;
+    int i;
+    if(r->n<r->limit)
+    {
+        i=r->n;
+        r->off[i]=(size_t)i*NAME_SLOT_40;
+        memcpy(r->buf+r->off[i],name,len);
+        ++r->n;
+        for(;i>0 && namerun_less_40(r,(i-1)/2,i);i=(i-1)/2)
+            namerun_swap_40(r,i,(i-1)/2);
+        return;
+    }
+    r->more=1;
+    if(strcmp(name,r->buf+r->off[0])>=0)
+        return;
+    memcpy(r->buf+r->off[0],name,len);
+    for(i=0;;)
+    {
+        int c=2*i+1;
+        if(c>=r->n)
+            break;
+        if(c+1<r->n && namerun_less_40(r,c,c+1))
+            ++c;
+        if(!namerun_less_40(r,i,c))
+            break;
+        namerun_swap_40(r,i,c);
+        i=c;
+    }
+}
+static int namerun_cmp_40(const void *a,const void *b)
+{
+    return strcmp(*(char* const*)a,*(char* const*)b);
+}
+static int do_lists_40(int fd, char *args)
+{
+    char *save=NULL;
+    char *lim=strtok_r(args,"|",&save);
+    char *reldir=strtok_r(NULL,"|",&save);
+    const char *after=save?save:"";
+    struct namerun_40 r;
+    memset(&r,0,sizeof r);
+    r.limit=lim?atoi(lim):0;
+    if(r.limit<0 || r.limit>100000 || !reldir)
+        return send_line_40(fd,"ERR|bad_list");
+    if(r.limit>0)
+    {
+        r.buf=malloc((size_t)r.limit*NAME_SLOT_40);
+        r.off=malloc(sizeof(size_t)*(size_t)r.limit);
+    }
+    char *b=base_40();
+    char *full=NULL;
+    asprintf(&full,"%s/%s",b,reldir);
+    DIR *d=opendir(full);
+    struct dirent *e;
+    while(d && (e=readdir(d)))
+        if(e->d_type==DT_REG && e->d_name[0]!='.')
+            namerun_add_40(&r,e->d_name,after);
+    if(d)
+        closedir(d);
+    free(full);
+    free(b);
+
+    char **sorted=malloc(sizeof(char*)*(size_t)(r.n?r.n:1));
+    for(int i=0;i<r.n;++i)
+        sorted[i]=r.buf+r.off[i];
+    qsort(sorted,(size_t)r.n,sizeof(char*),namerun_cmp_40);
+    send_line_40(fd,"OK");
+    for(int i=0;i<r.n;++i)
+        send_line_40(fd,"NAME|%s",sorted[i]);
+    free(sorted);
+    free(r.buf);
+    free(r.off);
+    return send_line_40(fd,r.more?"END|more":"END");
+}
+
+//TREE|<depth>|<prefix>|<glob>|<reldir> lists every file under a folder for S1's recursive
+//listings: down to depth levels (0: all), only paths (relative to the folder) starting with the
+//prefix and names matching the glob (either may be empty), each as ENT|<path>|<size>|<mtime_ns>
+//in byte order of the paths. Folders are read by TREE_THREADS_40 threads at once, taking them
+//from a shared queue, and the entries are gathered in one buffer and sorted before they are sent
+#define TREE_THREADS_40 4
+struct twalk_40
+{
+    pthread_mutex_t mu;
+    pthread_cond_t cv;
+    const char *base,*prefix,*glob;
+    int maxdepth,busy,fnflags;
+    char **q;              /* folders still to read, relative to base, with their depth */
+    int *qdepth,nq,capq;
+    char *buf;             /* "path|size|mtime" entries back to back */
+    size_t used,cap;
+    size_t *off;
+    int n,cap_n;
+};
+//whether anything under a folder can match the prefix
+static int tree_may_match_40(const char *rel, const char *prefix)
+{
+    size_t r=strlen(rel),p=strlen(prefix);
+    return r<p ? !strncmp(prefix,rel,r) && (!r || prefix[r]=='/') : !strncmp(rel,prefix,p);
+}
+static void tree_push_40(struct twalk_40 *w, char *rel, int depth)
+{
+    if(w->nq==w->capq)
+    {
+        w->capq=w->capq?w->capq*2:64;
+        w->q=realloc(w->q,sizeof(char*)*(size_t)w->capq);
+        w->qdepth=realloc(w->qdepth,sizeof(int)*(size_t)w->capq);
+    }
+    w->q[w->nq]=rel;
+    w->qdepth[w->nq++]=depth;
+}
+static void tree_add_40(struct twalk_40 *w, const char *ent, size_t len)
+{
+    if(w->used+len>w->cap)
+    {
+        w->cap=(w->cap?w->cap*2:65536)+len;
+        w->buf=realloc(w->buf,w->cap);
+    }
+    if(w->n==w->cap_n)
+    {
+        w->cap_n=w->cap_n?w->cap_n*2:1024;
+        w->off=realloc(w->off,sizeof(size_t)*(size_t)w->cap_n);
+    }
+    memcpy(w->buf+w->used,ent,len);
+    w->off[w->n++]=w->used;
+    w->used+=len;
+}
+//reads one folder: its files go to a local batch and its folders to a local list, both handed
+//over under the lock at the end, so threads only meet once per folder
+static void *tree_worker_40(void *arg)
+{
+    struct twalk_40 *w=arg;
+    pthread_mutex_lock(&w->mu);
+    for(;;)
+    {
+        while(!w->nq && w->busy)
+            pthread_cond_wait(&w->cv,&w->mu);
+        if(!w->nq)
+            break;
+        char *rel=w->q[--w->nq];
+        int depth=w->qdepth[w->nq];
+        ++w->busy;
+        pthread_mutex_unlock(&w->mu);
+
+        char *full=NULL;
+        asprintf(&full,"%s/%s",w->base,rel);
+        DIR *d=opendir(full);
+        free(full);
+        char *files=NULL;
+        size_t nf=0,capf=0;
+        char **subs=NULL;
+        int ns=0;
+        struct dirent *e;
+        while(d && (e=readdir(d)))
+        {
+            if(e->d_name[0]=='.')
+                continue;
+            struct stat st;
+            if(fstatat(dirfd(d),e->d_name,&st,AT_SYMLINK_NOFOLLOW)!=0)
+                continue;
+            char *path=NULL;
+            asprintf(&path,"%s%s%s",rel,*rel?"/":"",e->d_name);
+            if(S_ISDIR(st.st_mode) && (!w->maxdepth || depth+1<w->maxdepth) && tree_may_match_40(path,w->prefix))
+            {
+                subs=realloc(subs,sizeof(char*)*(size_t)(ns+1));
+                subs[ns++]=path;
+                continue;
+            }
+            if(S_ISREG(st.st_mode) && !strncmp(path,w->prefix,strlen(w->prefix))
+                && (!*w->glob || fnmatch(w->glob,e->d_name,w->fnflags)==0))
+            {
+                char ent[LINE_MAX_40];
+                int k=snprintf(ent,sizeof ent,"%s|%zu|%llu",path,(size_t)st.st_size,mtime_ns_40(&st));
+                if(k>0 && (size_t)k<sizeof ent)
+                {
+                    if(nf+(size_t)k+1>capf)
+                    {
+                        capf=(capf?capf*2:16384)+(size_t)k+1;
+                        files=realloc(files,capf);
+                    }
+                    memcpy(files+nf,ent,(size_t)k+1);
+                    nf+=(size_t)k+1;
+                }
+            }
+            free(path);
+        }
+        if(d)
+            closedir(d);
+
+        pthread_mutex_lock(&w->mu);
+        for(size_t at=0;at<nf;at+=strlen(files+at)+1)
+            tree_add_40(w,files+at,strlen(files+at)+1);
+        for(int i=0;i<ns;++i)
+            tree_push_40(w,subs[i],depth+1);
+        --w->busy;
+        pthread_cond_broadcast(&w->cv);
+        free(files);
+        free(subs);
+        free(rel);
+    }
+    pthread_cond_broadcast(&w->cv);
+    pthread_mutex_unlock(&w->mu);
+    return NULL;
+}
+//orders entries by path: the part before the first '|'
+static int tree_cmp_40(const void *a,const void *b)
+{
+    const unsigned char *x=*(const unsigned char* const*)a,*y=*(const unsigned char* const*)b;
+    for(;;++x,++y)
+    {
+        int cx=*x=='|'?0:*x, cy=*y=='|'?0:*y;
+        if(cx!=cy || !cx)
+            return cx-cy;
+    }
+}
+//walks the folder root with the filters set in w and returns its entries sorted by path; they
+//point into w->buf, which tree_free_40 frees with the rest of the walk
+static char **tree_walk_40(struct twalk_40 *w, const char *root)
+{
+    pthread_mutex_init(&w->mu,NULL);
+    pthread_cond_init(&w->cv,NULL);
+    w->base=root;
+    tree_push_40(w,strdup(""),0);
+
+    pthread_t th[TREE_THREADS_40];
+    int nt=0;
+    for(;nt<TREE_THREADS_40;++nt)
+        if(pthread_create(&th[nt],NULL,tree_worker_40,w)!=0)
+            break;
+    if(!nt)
+        tree_worker_40(w);
+    for(int i=0;i<nt;++i)
+        pthread_join(th[i],NULL);
+
+    char **sorted=malloc(sizeof(char*)*(size_t)(w->n?w->n:1));
+    for(int i=0;i<w->n;++i)
+        sorted[i]=w->buf+w->off[i];
+    qsort(sorted,(size_t)w->n,sizeof(char*),tree_cmp_40);
+    return sorted;
+}
+static void tree_free_40(struct twalk_40 *w, char **sorted)
+{
+    free(sorted);
+    free(w->buf);
+    free(w->off);
+    free(w->q);
+    free(w->qdepth);
+    pthread_mutex_destroy(&w->mu);
+    pthread_cond_destroy(&w->cv);
+}
+static int do_tree_40(int fd, char *args)
+{
+    char *f[3];
+    for(int i=0;i<3;++i)
+    {
+        f[i]=args;
+        char *bar=args?strchr(args,'|'):NULL;
+        if(bar)
+            *bar='\0';
+        args=bar?bar+1:NULL;
+    }
+    if(!args)
+        return send_line_40(fd,"ERR|bad_tree");
+    struct twalk_40 w;
+    memset(&w,0,sizeof w);
+    w.maxdepth=atoi(f[0]);
+    w.prefix=f[1];
+    w.glob=f[2];
+    char *b=base_40();
+    char *root=NULL;
+    asprintf(&root,"%s/%s",b,strcmp(args,".")?args:"");
+    char **sorted=tree_walk_40(&w,root);
+    send_line_40(fd,"OK");
+    for(int i=0;i<w.n;++i)
+        send_line_40(fd,"ENT|%s",sorted[i]);
+    tree_free_40(&w,sorted);
+    free(root);
+    free(b);
+    return send_line_40(fd,"END");
+}
+
+//TAR|<ext> sends every file of one extension under S4 as one tar. The archive is kept in
+//~/S4/.tarcache as <e>.<gen>.tar, gen being the store generation it was built at (bumped after
+//every STORE and DELETE), next to <e>.idx, which names it and says where each member sits in it.
+//While the generation has not moved the kept archive is sent as it is; otherwise a new one is
+//written, copying the header and body of every file whose size and mtime are unchanged straight
+//out of the old archive and reading only new and changed files
+#define TAR_RECORD_40 10240
+struct tarmem_40
+{
+    unsigned long long off,len,size,mtime;
+    char *path;
+};
+//a numeric header field: octal, or base-256 when it does not fit (files of 8GiB and more)
+static void tar_num_40(char *f, size_t w, unsigned long long v)
+{
+    if(v<(1ULL<<(3*(w-1))))
+    {
+        snprintf(f,w,"%0*llo",(int)(w-1),v);
+        return;
+    }
+    memset(f,0,w);
+    f[0]=(char)0x80;
+    for(size_t i=w-1;i>0 && v;--i,v>>=8)
+        f[i]=(char)(v&0xff);
+}
+static void tar_block_40(char *h, const char *name, char type, unsigned long long size, const struct stat *st)
+{
+    memset(h,0,512);
+    memcpy(h,name,strnlen(name,100));
+    tar_num_40(h+100,8,st->st_mode&07777);
+    tar_num_40(h+108,8,st->st_uid);
+    tar_num_40(h+116,8,st->st_gid);
+    tar_num_40(h+124,12,size);
+    tar_num_40(h+136,12,(unsigned long long)st->st_mtime);
+    h[156]=type;
+    memcpy(h+257,"ustar  ",8);   /* GNU tar's magic, as tar -c writes by default */
+    memset(h+148,' ',8);
+    unsigned sum=0;
+    for(int i=0;i<512;++i)
+        sum+=(unsigned char)h[i];
+    snprintf(h+148,7,"%06o",sum);
+}
+//a member's header: a path of 100 bytes or more goes ahead of it in a GNU long-name entry
+static size_t tar_head_40(char *out, const char *path, const struct stat *st)
+{
+    size_t n=strlen(path),at=0;
+    if(n>=100)
+    {
+        tar_block_40(out,"././@LongLink",'L',n+1,st);
+        at=512+(n+1+511)/512*512;
+        memset(out+512,0,at-512);
+        memcpy(out+512,path,n);
+    }
+    tar_block_40(out+at,path,'0',(unsigned long long)st->st_size,st);
+    return at+512;
+}
+//copies len bytes at off in one file to the end of another, in the kernel when it can;
+//returns how many were copied
+static unsigned long long tar_copy_40(int in, off_t off, int out, unsigned long long len)
+{
+    unsigned long long done=0;
+    while(done<len)
+    {
+        ssize_t r=copy_file_range(in,&off,out,NULL,(size_t)(len-done),0);
+        if(r<=0)
+            break;
+        done+=(unsigned long long)r;
+    }
+    if(done<len)
+    {
+        char *buf=malloc(CHUNK_40);
+        while(done<len)
+        {
+            size_t want=len-done<CHUNK_40?(size_t)(len-done):CHUNK_40;
+            ssize_t r=pread(in,buf,want,off);
+            if(r<=0 || write_fully_40(out,buf,(size_t)r)!=r)
+                break;
+            off+=r;
+            done+=(unsigned long long)r;
+        }
+        free(buf);
+    }
+    return done;
+}
+//reads <e>.idx: "GEN|<gen>|<archive>" then "<off>|<len>|<size>|<mtime_ns>|<path>" per member in
+//path order; returns the member count, or -1 without an index
+static int tar_index_40(const char *idx, unsigned long long *gen, char name[64], struct tarmem_40 **mem)
+{
+    *mem=NULL;
+    FILE *f=fopen(idx,"r");
+    if(!f)
+        return -1;
+    char line[LINE_MAX_40+128];
+    if(!fgets(line,sizeof line,f) || sscanf(line,"GEN|%llu|%63s",gen,name)!=2)
+    {
+        fclose(f);
+        return -1;
+    }
+    int n=0,cap=0;
+    while(fgets(line,sizeof line,f))
+    {
+        line[strcspn(line,"\n")]='\0';
+        struct tarmem_40 t;
+        int k=0;
+        if(sscanf(line,"%llu|%llu|%llu|%llu|%n",&t.off,&t.len,&t.size,&t.mtime,&k)!=4 || !k)
+            continue;
+        if(n==cap)
+        {
+            cap=cap?cap*2:256;
+            *mem=realloc(*mem,sizeof(struct tarmem_40)*(size_t)cap);
+        }
+        t.path=strdup(line+k);
+        (*mem)[n++]=t;
+    }
+    fclose(f);
+    return n;
+}
+static int tar_send_40(int fd, int in, const char *ext)
+{
+    struct stat st;
+    if(fstat(in,&st)!=0)
+        return send_line_40(fd,"ERR|open");
+    send_line_40(fd,"OK|%s.tar|%zu",ext+1,(size_t)st.st_size);
+    lseek(in,0,SEEK_SET);
+    char *buf=malloc(CHUNK_40);
+    for(;;)
+    {
+        ssize_t r=disk_read_40(in,buf,CHUNK_40);
+        if(r<=0)
+            break;
+        write_fully_40(fd,buf,(size_t)r);
+    }
+    free(buf);
+    return 0;
+}
+//writes the archive of the files walked into out, taking unchanged members from the old one
+//(in, described by old); fills mem with the new members and returns how many there are, or -1
+static int tar_build_40(const char *b, char **ents, int n, int in, struct tarmem_40 *old, int on, int out, struct tarmem_40 *mem)
+{
+    unsigned long long at=0;
+    int nm=0,j=0;
+    char *head=malloc(512*2+LINE_MAX_40+512);
+    for(int i=0;i<n;++i)
+    {
+        // path|size|mtime_ns, as TREE lists them
+        char *e=ents[i];
+        char *bar=strchr(e,'|');
+        if(!bar)
+            continue;
+        *bar='\0';
+        unsigned long long size=0,mtime=0;
+        sscanf(bar+1,"%llu|%llu",&size,&mtime);
+        while(j<on && strcmp(old[j].path,e)<0)
+            ++j;
+        struct tarmem_40 *m=&mem[nm];
+        m->off=at;
+        if(in>=0 && j<on && !strcmp(old[j].path,e) && old[j].size==size && old[j].mtime==mtime
+            && tar_copy_40(in,(off_t)old[j].off,out,old[j].len)==old[j].len)
+        {
+            m->len=old[j].len;
+            m->size=size;
+            m->mtime=mtime;
+            if(STATG_40)
+                __atomic_fetch_add(&STATG_40->tar_reused,1,__ATOMIC_RELAXED);
+        }
+        else
+        {
+            if(in>=0 && j<on && !strcmp(old[j].path,e) && ftruncate(out,(off_t)at)==0)
+                lseek(out,(off_t)at,SEEK_SET);   /* a copy that broke off part way */
+            char *full=NULL;
+            asprintf(&full,"%s/%s",b,e);
+            int src=open(full,O_RDONLY);
+            free(full);
+            struct stat st;
+            if(src<0 || fstat(src,&st)!=0 || !S_ISREG(st.st_mode))
+            {
+                if(src>=0)
+                    close(src);
+                continue;   /* gone since the walk */
+            }
+            size_t hn=tar_head_40(head,e,&st);
+            unsigned long long body=(unsigned long long)st.st_size;
+            if(write_fully_40(out,head,hn)!=(ssize_t)hn)
+            {
+                close(src);
+                free(head);
+                return -1;
+            }
+            unsigned long long got=tar_copy_40(src,0,out,body);
+            close(src);
+            // a file that shrank meanwhile is padded out to the size in its header
+            size_t pad=(size_t)((512-body%512)%512);
+            memset(head,0,512);
+            for(;got<body;got+=512)
+            {
+                size_t k=body-got<512?(size_t)(body-got):512;
+                if(write_fully_40(out,head,k)!=(ssize_t)k)
+                    break;
+            }
+            if(got<body || (pad && write_fully_40(out,head,pad)!=(ssize_t)pad))
+            {
+                free(head);
+                return -1;
+            }
+            m->len=hn+body+pad;
+            m->size=body;
+            m->mtime=mtime_ns_40(&st);
+            if(STATG_40)
+                __atomic_fetch_add(&STATG_40->tar_read,1,__ATOMIC_RELAXED);
+        }
+        m->path=e;
+        at+=m->len;
+        ++nm;
+    }
+    // two zero blocks end the archive, and it is padded to whole records as tar does
+    size_t tail=1024+(size_t)((TAR_RECORD_40-(at+1024)%TAR_RECORD_40)%TAR_RECORD_40);
+    char *zero=calloc(1,tail);
+    int ok=write_fully_40(out,zero,tail)==(ssize_t)tail;
+    free(zero);
+    free(head);
+    return ok?nm:-1;
+}
+static int do_tar_40(int fd, const char *ext)
+{
+    if(!ext_ok_40(ext))
+        return send_line_40(fd,"ERR|bad_ext");
+    char *b=base_40();
+    char *dir=NULL,*idx=NULL,*oldp=NULL;
+    asprintf(&dir,"%s/.tarcache",b);
+    mkdir(dir,0700);
+    asprintf(&idx,"%s/%s.idx",dir,ext+1);
+    unsigned long long gen=STATG_40?__atomic_load_n(&STATG_40->gen,__ATOMIC_ACQUIRE):0;
+
+    unsigned long long ogen=0;
+    char oname[64]="";
+    struct tarmem_40 *old=NULL;
+    int on=tar_index_40(idx,&ogen,oname,&old);
+    int in=-1;
+    if(on>=0)
+    {
+        asprintf(&oldp,"%s/%s",dir,oname);
+        in=open(oldp,O_RDONLY);
+    }
+    int rc;
+    if(in>=0 && STATG_40 && ogen==gen)
+    {
+        // nothing stored or deleted since it was built
+        __atomic_fetch_add(&STATG_40->tar_hits,1,__ATOMIC_RELAXED);
+        rc=tar_send_40(fd,in,ext);
+    }
+    else
+    {
+        char glob[24];
+        snprintf(glob,sizeof glob,"*%.15s",ext);
+        struct twalk_40 w;
+        memset(&w,0,sizeof w);
+        w.prefix="";
+        w.glob=glob;
+        w.fnflags=FNM_CASEFOLD;
+        unsigned long long tb=trace_fd_40>=0?wall_us_40():0;
+        char **ents=tree_walk_40(&w,b);
+        struct tarmem_40 *mem=malloc(sizeof(struct tarmem_40)*(size_t)(w.n?w.n:1));
+        char *tmp=NULL;
+        asprintf(&tmp,"%s/.%s.XXXXXX",dir,ext+1);
+        int out=mkstemp(tmp);
+        int nm=out<0?-1:tar_build_40(b,ents,w.n,in,old,on>0?on:0,out,mem);
+        trace_span_40("tar_build",tb);
+        if(nm>0)
+        {
+            if(STATG_40)
+                __atomic_fetch_add(&STATG_40->tar_builds,1,__ATOMIC_RELAXED);
+            // the archive under its generation's name, then the index naming it
+            char name[64],*path=NULL,*itmp=NULL;
+            snprintf(name,sizeof name,"%.15s.%016llx.tar",ext+1,gen);
+            asprintf(&path,"%s/%s",dir,name);
+            asprintf(&itmp,"%s.XXXXXX",idx);
+            int ifd=mkstemp(itmp);
+            FILE *f=ifd>=0?fdopen(ifd,"w"):NULL;
+            if(f && rename(tmp,path)==0)
+            {
+                fprintf(f,"GEN|%llu|%s\n",gen,name);
+                for(int i=0;i<nm;++i)
+                    fprintf(f,"%llu|%llu|%llu|%llu|%s\n",mem[i].off,mem[i].len,mem[i].size,mem[i].mtime,mem[i].path);
+                if(fclose(f)==0 && rename(itmp,idx)==0 && oldp && strcmp(oname,name))
+                    unlink(oldp);
+                f=NULL;
+            }
+            if(f)
+                fclose(f);
+            unlink(itmp);
+            free(itmp);
+            free(path);
+            rc=tar_send_40(fd,out,ext);
+        }
+        else
+            rc=send_line_40(fd,nm<0?"ERR|open":"ERR|empty");
+        if(out>=0)
+            close(out);
+        unlink(tmp);   /* left only when it was not published */
+        free(tmp);
+        free(mem);
+        tree_free_40(&w,ents);
+    }
+    if(in>=0)
+        close(in);
+    for(int i=0;i<on;++i)
+        free(old[i].path);
+    free(old);
+    free(oldp);
+    free(idx);
+    free(dir);
+    free(b);
+    return rc;
+}
+
+//sends every file under S4 with its size, walking folders recursively; S1 uses it to move
+//files between shards, so hidden files (unfinished stores and tars) are left out
+static void walk_dir_40(int fd, const char *full, const char *rel)
+{
+    DIR *d=opendir(full);
+    if(!d)
+        return;
+    struct dirent *e;
+    while((e=readdir(d)))
+    {
+        if(e->d_name[0]=='.')
+            continue;
+        char *f=NULL,*r=NULL;
+        asprintf(&f,"%s/%s",full,e->d_name);
+        asprintf(&r,"%s%s%s",rel,*rel?"/":"",e->d_name);
+        struct stat st;
+        if(lstat(f,&st)==0)
+        {
+            if(S_ISDIR(st.st_mode))
+                walk_dir_40(fd,f,r);
+            else if(S_ISREG(st.st_mode))
+                send_line_40(fd,"FILE|%s|%zu",r,(size_t)st.st_size);
+        }
+        free(f);
+        free(r);
+    }
+    closedir(d);
+}
+static int do_walk_40(int fd)
+{
+    char *b=base_40();
+    send_line_40(fd,"OK");
+    walk_dir_40(fd,b,"");
+    free(b);
+    return send_line_40(fd,"END");
+}
+
+//tells S1 whether a file is here (its size and mtime) without sending it
+static int do_stat_40(int fd, char *relfile)
+{
+    char *full=join_40(relfile);
+    struct stat st;
+    int rc=stat(full,&st);
+    free(full);
+    if(rc!=0 || !S_ISREG(st.st_mode))
+        return send_line_40(fd,"ERR|nofile");
+    return send_line_40(fd,"OK|%zu|%llu",(size_t)st.st_size,mtime_ns_40(&st));
+}
+
 //handles connection from S1 and calls the right function for each command.
 static void serve_40(int cfd)
 {
+    stat_fd_40=cfd;
+    obuf_40.fd=cfd;
+    int busy=0;   /* a verb that breaks out of the loop still leaves in-flight */
     for(;;)
     {
         char line[LINE_MAX_40];
         int n=read_line_40(cfd,line,sizeof line);
         if(n<=0)
             break;
-        if(strncmp(line,"STORE|",6)==0)
+        // "RID|<id>" ahead of a verb tags its trace span with the client's request id
+        if(strncmp(line,"RID|",4)==0)
+        {
+            snprintf(trace_rid_40,sizeof trace_rid_40,"%.32s",line+4);
+            continue;
+        }
+        unsigned long long t0=now_us_40();
+        int verb=VERB_OTHER_40;
+        unsigned long long tw=trace_fd_40>=0?wall_us_40():0;
+        trace_net_40=trace_disk_40=0;
+        if(STATG_40)
+            __atomic_fetch_add(&STATG_40->inflight,1,__ATOMIC_RELAXED);
+        busy=1;
+        stat_in_40=(unsigned long long)n+1;
+        stat_out_40=0;
+        stat_req_err_40=0;
+        if(strncmp(line,"STORE|",6)==0 || strncmp(line,"STORENX|",8)==0)
         {
+            verb=VERB_STORE_40;
+            int nx=line[5]=='N';
             char *sv=NULL; strtok_r(line,"|",&sv);
             char *rel=strtok_r(NULL,"|",&sv);
             char *name=strtok_r(NULL,"|",&sv);
@@ -253,32 +1661,219 @@ static void serve_40(int cfd)
             if(read_line_40(cfd,szl,sizeof szl)<=0)
                 break;
             size_t sz=(size_t)strtoull(szl,NULL,10);
-            do_store_40(cfd, rel?rel:"", name?name:"file.zip", sz);
+            do_store_40(cfd, rel?rel:"", name?name:"file.zip", sz, nx);
         }
         else if(strncmp(line,"FETCH|",6)==0)
         {
+            verb=VERB_FETCH_40;
             do_fetch_40(cfd, line+6);
         }
         else if(strncmp(line,"DELETE|",7)==0)
         {
+            verb=VERB_DELETE_40;
             do_delete_40(line+7, cfd);
         }
+        else if(strncmp(line,"DELETEM|",8)==0)
+        {
+            verb=VERB_DELETE_40;
+            do_deletem_40(cfd, atoi(line+8));
+        }
+        else if(strncmp(line,"DELTREE|",8)==0)
+        {
+            verb=VERB_DELETE_40;
+            do_deltree_40(cfd, line+8);
+        }
+        else if(strncmp(line,"TAR|",4)==0)
+        {
+            verb=VERB_TAR_40;
+            do_tar_40(cfd, line+4);
+        }
+        else if(strncmp(line,"LISTS|",6)==0)
+        {
+            verb=VERB_LIST_40;
+            do_lists_40(cfd, line+6);
+        }
         else if(strncmp(line,"LIST|",5)==0)
         {
+            verb=VERB_LIST_40;
             do_list_40(cfd, line+5);
         }
+        else if(strncmp(line,"TREE|",5)==0)
+        {
+            verb=VERB_WALK_40;
+            do_tree_40(cfd, line+5);
+        }
+        else if(strcmp(line,"WALK")==0)
+        {
+            verb=VERB_WALK_40;
+            do_walk_40(cfd);
+        }
+        else if(strncmp(line,"STAT|",5)==0)
+        {
+            verb=VERB_STAT_40;
+            do_stat_40(cfd, line+5);
+        }
+        else if(strcmp(line,"STATS")==0)
+        {
+            verb=VERB_STATS_40;
+            do_stats_40(cfd);
+        }
         else
         {
             send_line_40(cfd,"ERR|unknown");
         }
+        if((verb==VERB_STORE_40 || verb==VERB_DELETE_40) && STATG_40)
+            __atomic_fetch_add(&STATG_40->gen,1,__ATOMIC_RELEASE);
+        obuf_flush_40();
+        stat_verb_done_40(verb,t0);
+        if(STATG_40)
+            __atomic_fetch_sub(&STATG_40->inflight,1,__ATOMIC_RELAXED);
+        busy=0;
+        trace_span_40(VERB_NAMES_40[verb],tw);
+        trace_flush_40();
+        trace_rid_40[0]='\0';
     }
+    if(busy&&STATG_40)
+        __atomic_fetch_sub(&STATG_40->inflight,1,__ATOMIC_RELAXED);
 }
 
 //cleans up finished child processes
 static void reap_40(int s)
 {
     (void)s;
-    while(waitpid(-1,NULL,WNOHANG)>0){}
+    pid_t pid;
+    while((pid=waitpid(-1,NULL,WNOHANG))>0)
+    {
+        if(STATG_40&&pid!=metrics_pid_40)
+            __atomic_fetch_sub(&STATG_40->active,1,__ATOMIC_RELAXED);
+    }
+}
+
+// SOCKETS: the "socket" lines of the DFS_CONF file S1 reads (backlog, nodelay, buffers,
+// keepalive, defer_accept) apply to this listener as well; S4 takes no other line from it.
+// Connections from S1 inherit the options from the listener
+static int SOCK_BACKLOG_40=BACKLOG_40;
+static int SOCK_NODELAY_40=1;
+static int SOCK_BUF_KB_40=0;     /* 0: the kernel sizes them */
+static int SOCK_KA_IDLE_40=60;   /* 0: no keepalive */
+static int SOCK_KA_INTVL_40=10;
+static int SOCK_KA_CNT_40=5;
+static int SOCK_DEFER_S_40=5;    /* 0: off */
+
+static int sock_conf_40(const char *opt,char **save)
+{
+    char *v=strtok_r(NULL," \t\r\n",save);
+    if(!v)
+        return -1;
+    int off=!strcmp(v,"off"),n=atoi(v);
+    if(!strcmp(opt,"backlog")&&n>0)
+        SOCK_BACKLOG_40=n;
+    else if(!strcmp(opt,"nodelay")&&(off||!strcmp(v,"on")))
+        SOCK_NODELAY_40=!off;
+    else if(!strcmp(opt,"buffers")&&(off||n>0))
+        SOCK_BUF_KB_40=off?0:n;
+    else if(!strcmp(opt,"defer_accept")&&(off||n>0))
+        SOCK_DEFER_S_40=off?0:n;
+    else if(!strcmp(opt,"keepalive")&&(off||n>0))
+    {
+        char *i=strtok_r(NULL," \t\r\n",save);
+        char *c=strtok_r(NULL," \t\r\n",save);
+        if((i&&atoi(i)<1)||(c&&atoi(c)<1))
+            return -1;
+        SOCK_KA_IDLE_40=off?0:n;
+        if(i)
+            SOCK_KA_INTVL_40=atoi(i);
+        if(c)
+            SOCK_KA_CNT_40=atoi(c);
+    }
+    else
+        return -1;
+    return 0;
+}
+
+static void sock_load_40(void)
+{
+    const char *path=getenv("DFS_CONF");
+    if(!path||!*path)
+        return;
+    FILE *f=fopen(path,"r");
+    if(!f)
+        return;
+    char buf[LINE_MAX_40];
+    int lno=0;
+    while(fgets(buf,sizeof buf,f))
+    {
+        ++lno;
+        char *hash=strchr(buf,'#');
+        if(hash)
+            *hash='\0';
+        char *save=NULL;
+        char *kw=strtok_r(buf," \t\r\n",&save);
+        if(!kw||strcmp(kw,"socket"))
+            continue;
+        char *opt=strtok_r(NULL," \t\r\n",&save);
+        if(!opt||sock_conf_40(opt,&save)!=0)
+            fprintf(stderr,"[S4] %s:%d: bad socket line, ignored\n",path,lno);
+    }
+    fclose(f);
+}
+
+// before listen(), so a receive buffer set here is the one the handshake scales the window for
+static void sock_tune_40(int fd)
+{
+    int one=1;
+    if(SOCK_NODELAY_40)
+        setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,&one,sizeof one);
+    if(SOCK_BUF_KB_40)
+    {
+        int b=SOCK_BUF_KB_40*1024;
+        setsockopt(fd,SOL_SOCKET,SO_SNDBUF,&b,sizeof b);
+        setsockopt(fd,SOL_SOCKET,SO_RCVBUF,&b,sizeof b);
+    }
+    if(SOCK_KA_IDLE_40)
+    {
+        setsockopt(fd,SOL_SOCKET,SO_KEEPALIVE,&one,sizeof one);
+        setsockopt(fd,IPPROTO_TCP,TCP_KEEPIDLE,&SOCK_KA_IDLE_40,sizeof SOCK_KA_IDLE_40);
+        setsockopt(fd,IPPROTO_TCP,TCP_KEEPINTVL,&SOCK_KA_INTVL_40,sizeof SOCK_KA_INTVL_40);
+        setsockopt(fd,IPPROTO_TCP,TCP_KEEPCNT,&SOCK_KA_CNT_40,sizeof SOCK_KA_CNT_40);
+    }
+    if(SOCK_DEFER_S_40)
+        setsockopt(fd,IPPROTO_TCP,TCP_DEFER_ACCEPT,&SOCK_DEFER_S_40,sizeof SOCK_DEFER_S_40);
+}
+
+// the second listener for "unix:<path>": an S1 on this machine skips the TCP stack on every
+// call. A socket file left by an earlier run is replaced; one a running server answers on is not
+static int listen_unix_40(const char *path)
+{
+    struct sockaddr_un u;
+    memset(&u,0,sizeof u);
+    u.sun_family=AF_UNIX;
+    if(!*path||strlen(path)>=sizeof u.sun_path)
+    {
+        fprintf(stderr,"[S4] unix:%s: bad socket path\n",path);
+        exit(1);
+    }
+    memcpy(u.sun_path,path,strlen(path)+1);
+    int fd=socket(AF_UNIX,SOCK_STREAM,0);
+    struct stat st;
+    if(fd>=0&&lstat(path,&st)==0&&S_ISSOCK(st.st_mode))
+    {
+        if(connect(fd,(struct sockaddr*)&u,sizeof u)==0)
+        {
+            fprintf(stderr,"[S4] unix:%s: in use\n",path);
+            exit(1);
+        }
+        close(fd);
+        unlink(path);
+        fd=socket(AF_UNIX,SOCK_STREAM,0);
+    }
+    if(fd<0||bind(fd,(struct sockaddr*)&u,sizeof u)!=0||listen(fd,SOCK_BACKLOG_40)!=0)
+    {
+        perror(path);
+        exit(1);
+    }
+    fprintf(stderr,"[S4] listening on unix:%s\n",path);
+    return fd;
 }
 
 //main() starts the server S4 and performs the other functions
@@ -288,6 +1883,11 @@ int main(int argc,char**argv)
         S4_PORT_40=atoi(argv[1]);
 
     signal(SIGCHLD,reap_40);
+    if(stats_init_40()!=0)
+        perror("stats mmap");
+    trace_init_40();
+    sock_load_40();
+    metrics_start_40();
 
     char *b=base_40(); free(b);
     int lfd=socket(AF_INET,SOCK_STREAM,0);
@@ -303,20 +1903,39 @@ int main(int argc,char**argv)
         perror("bind");
         exit(1);
     }
-    if(listen(lfd,BACKLOG_40)!=0)
+    sock_tune_40(lfd);
+    if(listen(lfd,SOCK_BACKLOG_40)!=0)
     {
         perror("listen");
         exit(1);
     }
     fprintf(stderr,"[S4] listening on %s:%d\n",HOST_40,S4_PORT_40);
+    // "unix:<path>" after the port adds a listener for an S1 on this machine
+    int ufd=-1;
+    if(argc>=3&&!strncmp(argv[2],"unix:",5))
+    {
+        ufd=listen_unix_40(argv[2]+5);
+        // with two listeners a connection that is gone by the time of accept() must not block it
+        fcntl(lfd,F_SETFL,fcntl(lfd,F_GETFL,0)|O_NONBLOCK);
+        fcntl(ufd,F_SETFL,fcntl(ufd,F_GETFL,0)|O_NONBLOCK);
+    }
+
     for(;;)
     {
-        struct sockaddr_in c;
+        int from=lfd;
+        if(ufd>=0)
+        {
+            struct pollfd pf[2]={{lfd,POLLIN,0},{ufd,POLLIN,0}};
+            if(poll(pf,2,-1)<0)
+                continue;
+            from=(pf[1].revents&POLLIN)?ufd:lfd;
+        }
+        struct sockaddr_storage c;
         socklen_t cl=sizeof c;
-        int cfd=accept(lfd,(struct sockaddr*)&c,&cl);
+        int cfd=accept(from,(struct sockaddr*)&c,&cl);
         if(cfd<0)
         {
-            if(errno==EINTR)
+            if(errno==EINTR||errno==EAGAIN)
                 continue;
             perror("accept");
             continue;
@@ -325,10 +1944,17 @@ int main(int argc,char**argv)
         if(p==0)
         {
             close(lfd);
+            if(ufd>=0)
+                close(ufd);
             serve_40(cfd);
             close(cfd);
             _exit(0);
         }
+        if(p>0&&STATG_40)
+        {
+            __atomic_fetch_add(&STATG_40->accepted,1,__ATOMIC_RELAXED);
+            __atomic_fetch_add(&STATG_40->active,1,__ATOMIC_RELAXED);
+        }
         close(cfd);
     }
 }
@@ -0,0 +1,783 @@
+/*HOW TO RUN
+    - Closed loop: ./dfsbench -c 8 -t 30
+    - Open loop:   ./dfsbench -c 32 -r 500 -t 60 -m downlf=80,uploadf=20 -s exp:65536
+    - Help:        ./dfsbench -h
+   dfsbench speaks the same text protocol as s25client and prints one JSON
+   document with throughput and latency percentiles per operation.
+   ===================================================================== */
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+// maximum length of one protocol line
+#define LINE_MAX_60 4096
+
+//size of the per connection read buffer
+#define CHUNK_60 65536
+
+//operations we can drive, same order as the client commands
+enum { OP_UPLOADF_60, OP_DOWNLF_60, OP_REMOVEF_60, OP_DOWNLTAR_60, OP_DISPFNAMES_60, OP_COUNT_60 };
+static const char *OP_NAMES_60[OP_COUNT_60] = { "uploadf", "downlf", "removef", "downltar", "dispfnames" };
+
+//file size distributions for uploads
+enum { SIZE_FIXED_60, SIZE_UNIFORM_60, SIZE_EXP_60 };
+
+//global benchmark configuration, filled from argv
+static const char *S1_HOST_60 = "127.0.0.1";
+static int S1_PORT_60 = 5001;
+static int CLIENTS_60 = 4;
+static double DURATION_60 = 10.0;
+static double RATE_60 = 0.0;           /* 0 = closed loop */
+static int KEEPALIVE_60 = 0;           /* reuse one S1 connection per client */
+static int SEED_FILES_60 = 8;          /* files per extension uploaded before measuring */
+static const char *DIR_60 = "~S1/dfsbench";
+static const char *OUT_60 = NULL;
+static unsigned long long RNG_SEED_60 = 42;
+static int MIX_60[OP_COUNT_60] = { 20, 60, 5, 5, 10 };
+static int SIZE_KIND_60 = SIZE_FIXED_60;
+static size_t SIZE_A_60 = 65536, SIZE_B_60 = 65536;
+static const char *EXTS_60[8];
+static int NEXTS_60 = 0;
+
+//random payload shared by all clients, sized for the largest upload
+static char *PAYLOAD_60 = NULL;
+static size_t PAYLOAD_CAP_60 = 0;
+
+//small xorshift generator, one state per client thread
+static uint64_t rng_next_60(uint64_t *s_60)
+{
+    uint64_t x_60 = *s_60;
+    x_60 ^= x_60 >> 12; x_60 ^= x_60 << 25; x_60 ^= x_60 >> 27;
+    *s_60 = x_60;
+    return x_60 * 2685821657736338717ULL;
+}
+static double rng_unit_60(uint64_t *s_60)
+{
+    return (double)(rng_next_60(s_60) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static uint64_t now_ns_60(void)
+{
+    struct timespec ts_60;
+    clock_gettime(CLOCK_MONOTONIC, &ts_60);
+    return (uint64_t)ts_60.tv_sec * 1000000000ULL + (uint64_t)ts_60.tv_nsec;
+}
+static void sleep_until_ns_60(uint64_t t_60)
+{
+    struct timespec ts_60;
+    ts_60.tv_sec = (time_t)(t_60 / 1000000000ULL);
+    ts_60.tv_nsec = (long)(t_60 % 1000000000ULL);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts_60, NULL) == EINTR) {}
+}
+
+//I/O helpers
+
+//one connection to S1 with a small read buffer so we don't read byte by byte
+struct conn_60
+{
+    int fd;
+    size_t pos, len;
+    char buf[CHUNK_60];
+};
+
+static ssize_t write_fully_60(int fd_60, const void *buf_60, size_t n_60)
+{
+    const char *p_60=(const char*)buf_60; size_t left_60=n_60;
+    while(left_60>0)
+    {
+        ssize_t w_60=write(fd_60,p_60,left_60);
+        if(w_60<0)
+        {
+            if(errno==EINTR)
+                continue;
+            return -1;
+        }
+        left_60 -= (size_t)w_60;
+        p_60 += w_60;
+    }
+    return (ssize_t)n_60;
+}
+
+static int fill_60(struct conn_60 *c_60)
+{
+    for(;;)
+    {
+        ssize_t r_60=read(c_60->fd,c_60->buf,sizeof c_60->buf);
+        if(r_60<0 && errno==EINTR)
+            continue;
+        if(r_60<=0)
+            return -1;
+        c_60->pos=0; c_60->len=(size_t)r_60;
+        return 0;
+    }
+}
+
+//reads one line without the '\n', returns its length or -1 on EOF/error
+static int read_line_60(struct conn_60 *c_60, char *out_60, size_t cap_60)
+{
+    size_t i_60=0;
+    for(;;)
+    {
+        if(c_60->pos==c_60->len && fill_60(c_60)!=0)
+            return i_60 ? (int)i_60 : -1;
+        char ch_60=c_60->buf[c_60->pos++];
+        if(ch_60=='\n')
+            break;
+        if(i_60+1<cap_60)
+            out_60[i_60++]=ch_60;
+    }
+    out_60[i_60]='\0';
+    return (int)i_60;
+}
+
+//reads and throws away exactly n_60 body bytes
+static int skip_bytes_60(struct conn_60 *c_60, size_t n_60)
+{
+    while(n_60>0)
+    {
+        if(c_60->pos==c_60->len && fill_60(c_60)!=0)
+            return -1;
+        size_t have_60=c_60->len-c_60->pos;
+        size_t take_60=have_60<n_60?have_60:n_60;
+        c_60->pos+=take_60; n_60-=take_60;
+    }
+    return 0;
+}
+
+static int send_line_60(int fd_60, const char *fmt_60, ...)
+{
+    char line_60[LINE_MAX_60];
+    va_list ap_60; va_start(ap_60,fmt_60);
+    int L_60=vsnprintf(line_60,sizeof line_60,fmt_60,ap_60);
+    va_end(ap_60);
+    if(L_60<0 || (size_t)L_60+1>=sizeof line_60)
+        return -1;
+    line_60[L_60++]='\n';
+    return (write_fully_60(fd_60,line_60,(size_t)L_60)==L_60)?0:-1;
+}
+
+static int connect_s1_60(struct conn_60 *c_60)
+{
+    int fd_60=socket(AF_INET,SOCK_STREAM,0);
+    if(fd_60<0)
+        return -1;
+    struct sockaddr_in a_60;
+    memset(&a_60,0,sizeof a_60);
+    a_60.sin_family=AF_INET;
+    a_60.sin_port=htons((uint16_t)S1_PORT_60);
+    if(inet_pton(AF_INET,S1_HOST_60,&a_60.sin_addr)!=1 || connect(fd_60,(struct sockaddr*)&a_60,sizeof a_60)!=0)
+    {
+        close(fd_60);
+        return -1;
+    }
+    c_60->fd=fd_60; c_60->pos=c_60->len=0;
+    return 0;
+}
+
+//per client state and results
+
+//all latencies of one operation type seen by one client
+struct samples_60
+{
+    uint64_t *v;
+    size_t n, cap;
+    unsigned long long errors;
+    unsigned long long bytes;
+};
+
+struct client_60
+{
+    int id;
+    pthread_t th;
+    uint64_t rng;
+    uint64_t start_ns, end_ns;
+    struct conn_60 *conn;
+    int connected;
+    unsigned long long seq;
+    char **own;          /* files this client uploaded and may remove */
+    size_t own_head, own_n, own_cap;
+    struct samples_60 ops[OP_COUNT_60];
+};
+
+static void record_60(struct samples_60 *s_60, uint64_t lat_60, int ok_60, size_t bytes_60)
+{
+    if(!ok_60)
+    {
+        s_60->errors++;
+        return;
+    }
+    if(s_60->n==s_60->cap)
+    {
+        s_60->cap = s_60->cap ? s_60->cap*2 : 1024;
+        s_60->v = realloc(s_60->v, sizeof(uint64_t)*s_60->cap);
+    }
+    s_60->v[s_60->n++]=lat_60;
+    s_60->bytes+=bytes_60;
+}
+
+//opens (or reuses) the client's connection to S1
+static struct conn_60 *get_conn_60(struct client_60 *cl_60)
+{
+    if(cl_60->connected)
+        return cl_60->conn;
+    if(connect_s1_60(cl_60->conn)!=0)
+        return NULL;
+    cl_60->connected=1;
+    return cl_60->conn;
+}
+static void put_conn_60(struct client_60 *cl_60, int ok_60)
+{
+    if(!cl_60->connected)
+        return;
+    if(!KEEPALIVE_60 || !ok_60)
+    {
+        close(cl_60->conn->fd);
+        cl_60->connected=0;
+    }
+}
+
+static size_t pick_size_60(uint64_t *rng_60)
+{
+    double v_60;
+    switch(SIZE_KIND_60)
+    {
+    case SIZE_UNIFORM_60:
+        v_60 = (double)SIZE_A_60 + rng_unit_60(rng_60)*(double)(SIZE_B_60-SIZE_A_60);
+        break;
+    case SIZE_EXP_60:
+        v_60 = -log(1.0-rng_unit_60(rng_60)) * (double)SIZE_A_60;
+        break;
+    default:
+        v_60 = (double)SIZE_A_60;
+    }
+    if(v_60<1) v_60=1;
+    if(v_60>(double)PAYLOAD_CAP_60) v_60=(double)PAYLOAD_CAP_60;
+    return (size_t)v_60;
+}
+
+//the protocol operations, each returns 0 on success and adds moved bytes to *bytes_60
+
+static int op_upload_60(struct conn_60 *c_60, const char *dir_60, const char *name_60, size_t sz_60, size_t *bytes_60)
+{
+    if(send_line_60(c_60->fd,"UPLOADF|1|%s/",dir_60)!=0)
+        return -1;
+    if(send_line_60(c_60->fd,"FILEMETA|%s|%zu",name_60,sz_60)!=0)
+        return -1;
+    if(write_fully_60(c_60->fd,PAYLOAD_60,sz_60)!=(ssize_t)sz_60)
+        return -1;
+    char line_60[LINE_MAX_60];
+    if(read_line_60(c_60,line_60,sizeof line_60)<=0 || strncmp(line_60,"OK",2)!=0)
+        return -1;
+    *bytes_60+=sz_60;
+    return 0;
+}
+
+static int op_download_60(struct conn_60 *c_60, const char *path_60, size_t *bytes_60)
+{
+    if(send_line_60(c_60->fd,"DOWNLF|1|%s",path_60)!=0)
+        return -1;
+    char line_60[LINE_MAX_60];
+    int ok_60=0;
+    for(;;)
+    {
+        if(read_line_60(c_60,line_60,sizeof line_60)<=0)
+            return -1;
+        if(!strncmp(line_60,"FILERESP|",9))
+        {
+            char *sz_60=strrchr(line_60,'|');
+            size_t n_60=(size_t)strtoull(sz_60+1,NULL,10);
+            if(skip_bytes_60(c_60,n_60)!=0)
+                return -1;
+            *bytes_60+=n_60;
+            ok_60=1;
+        }
+        else if(!strcmp(line_60,"DONE"))
+            return ok_60 ? 0 : -1;
+        else if(strncmp(line_60,"FILENOTFOUND|",13)!=0)
+            return -1;
+    }
+}
+
+static int op_remove_60(struct conn_60 *c_60, const char *path_60)
+{
+    if(send_line_60(c_60->fd,"REMOVEF|1|%s",path_60)!=0)
+        return -1;
+    char line_60[LINE_MAX_60];
+    if(read_line_60(c_60,line_60,sizeof line_60)<=0)
+        return -1;
+    return strncmp(line_60,"REMOK|",6)==0 ? 0 : -1;
+}
+
+static int op_downltar_60(struct conn_60 *c_60, const char *type_60, size_t *bytes_60)
+{
+    if(send_line_60(c_60->fd,"DOWNTAR|%s",type_60)!=0)
+        return -1;
+    char line_60[LINE_MAX_60];
+    if(read_line_60(c_60,line_60,sizeof line_60)<=0 || strncmp(line_60,"FILERESP|",9)!=0)
+        return -1;
+    char *sz_60=strrchr(line_60,'|');
+    size_t n_60=(size_t)strtoull(sz_60+1,NULL,10);
+    if(skip_bytes_60(c_60,n_60)!=0)
+        return -1;
+    *bytes_60+=n_60;
+    return 0;
+}
+
+static int op_disp_60(struct conn_60 *c_60, const char *dir_60, size_t *bytes_60)
+{
+    if(send_line_60(c_60->fd,"DISP|%s",dir_60)!=0)
+        return -1;
+    char line_60[LINE_MAX_60];
+    int n_60;
+    while((n_60=read_line_60(c_60,line_60,sizeof line_60))>=0)
+    {
+        *bytes_60+=(size_t)n_60+1;
+        if(!strcmp(line_60,"LISTEND"))
+            return 0;
+        if(!strncmp(line_60,"ERR|",4))
+            return -1;
+    }
+    return -1;
+}
+
+//picks a type for downltar among the configured extensions that S1 can archive
+static const char *pick_tar_type_60(uint64_t *rng_60)
+{
+    const char *ok_60[8]; int n_60=0;
+    for(int i=0;i<NEXTS_60;i++)
+        if(!strcmp(EXTS_60[i],".c") || !strcmp(EXTS_60[i],".pdf") || !strcmp(EXTS_60[i],".txt"))
+            ok_60[n_60++]=EXTS_60[i];
+    if(n_60==0)
+        return ".c";
+    return ok_60[rng_next_60(rng_60)%(uint64_t)n_60];
+}
+
+static int pick_op_60(uint64_t *rng_60)
+{
+    int total_60=0;
+    for(int i=0;i<OP_COUNT_60;i++)
+        total_60+=MIX_60[i];
+    int r_60=(int)(rng_next_60(rng_60)%(uint64_t)total_60);
+    for(int i=0;i<OP_COUNT_60;i++)
+    {
+        if(r_60<MIX_60[i])
+            return i;
+        r_60-=MIX_60[i];
+    }
+    return OP_DOWNLF_60;
+}
+
+//runs one operation of type op_60 and records its latency from intended_60
+static void run_one_60(struct client_60 *cl_60, int op_60, uint64_t intended_60)
+{
+    char path_60[LINE_MAX_60];
+    size_t bytes_60=0;
+    int rc_60=-1;
+
+    //nothing of our own to remove yet, upload instead so the mix stays balanced
+    if(op_60==OP_REMOVEF_60 && cl_60->own_n==0)
+        op_60=OP_UPLOADF_60;
+
+    struct conn_60 *c_60=get_conn_60(cl_60);
+    if(c_60)
+    {
+        const char *ext_60=EXTS_60[rng_next_60(&cl_60->rng)%(uint64_t)NEXTS_60];
+        switch(op_60)
+        {
+        case OP_UPLOADF_60:
+        {
+            char name_60[128];
+            snprintf(name_60,sizeof name_60,"c%d_%llu%s",cl_60->id,cl_60->seq++,ext_60);
+            snprintf(path_60,sizeof path_60,"%s/run",DIR_60);
+            rc_60=op_upload_60(c_60,path_60,name_60,pick_size_60(&cl_60->rng),&bytes_60);
+            if(rc_60==0)
+            {
+                if(cl_60->own_n==cl_60->own_cap)
+                {
+                    //grow the ring of own files, unrolling it into the new buffer
+                    size_t ncap_60=cl_60->own_cap?cl_60->own_cap*2:64;
+                    char **nv_60=malloc(sizeof(char*)*ncap_60);
+                    for(size_t i=0;i<cl_60->own_n;i++)
+                        nv_60[i]=cl_60->own[(cl_60->own_head+i)%cl_60->own_cap];
+                    free(cl_60->own);
+                    cl_60->own=nv_60; cl_60->own_cap=ncap_60; cl_60->own_head=0;
+                }
+                char *full_60=NULL; asprintf(&full_60,"%s/run/%s",DIR_60,name_60);
+                cl_60->own[(cl_60->own_head+cl_60->own_n)%cl_60->own_cap]=full_60;
+                cl_60->own_n++;
+            }
+            break;
+        }
+        case OP_DOWNLF_60:
+            snprintf(path_60,sizeof path_60,"%s/seed/seed_%d%s",DIR_60,
+                (int)(rng_next_60(&cl_60->rng)%(uint64_t)SEED_FILES_60),ext_60);
+            rc_60=op_download_60(c_60,path_60,&bytes_60);
+            break;
+        case OP_REMOVEF_60:
+        {
+            char *victim_60=cl_60->own[cl_60->own_head];
+            cl_60->own_head=(cl_60->own_head+1)%cl_60->own_cap;
+            cl_60->own_n--;
+            rc_60=op_remove_60(c_60,victim_60);
+            free(victim_60);
+            break;
+        }
+        case OP_DOWNLTAR_60:
+            rc_60=op_downltar_60(c_60,pick_tar_type_60(&cl_60->rng),&bytes_60);
+            break;
+        case OP_DISPFNAMES_60:
+            snprintf(path_60,sizeof path_60,"%s/seed",DIR_60);
+            rc_60=op_disp_60(c_60,path_60,&bytes_60);
+            break;
+        }
+        put_conn_60(cl_60,rc_60==0);
+    }
+    record_60(&cl_60->ops[op_60], now_ns_60()-intended_60, rc_60==0, bytes_60);
+}
+
+//client thread: closed loop issues back to back, open loop follows a fixed schedule
+//and measures from the intended start so a stalled server is not hidden (coordinated omission)
+static void *client_main_60(void *arg_60)
+{
+    struct client_60 *cl_60=(struct client_60*)arg_60;
+    uint64_t end_60=cl_60->start_ns+(uint64_t)(DURATION_60*1e9);
+    double per_client_60 = RATE_60>0 ? RATE_60/(double)CLIENTS_60 : 0;
+    uint64_t next_60=cl_60->start_ns;
+    if(per_client_60>0)
+        next_60 += (uint64_t)(rng_unit_60(&cl_60->rng)*1e9/per_client_60); /* spread the clients out */
+
+    for(;;)
+    {
+        uint64_t intended_60;
+        if(per_client_60>0)
+        {
+            if(next_60>=end_60)
+                break;
+            sleep_until_ns_60(next_60);
+            intended_60=next_60;
+            //poisson arrivals: exponential gaps around the target rate
+            next_60 += (uint64_t)(-log(1.0-rng_unit_60(&cl_60->rng))*1e9/per_client_60);
+        }
+        else
+        {
+            intended_60=now_ns_60();
+            if(intended_60>=end_60)
+                break;
+        }
+        run_one_60(cl_60,pick_op_60(&cl_60->rng),intended_60);
+    }
+    put_conn_60(cl_60,0);
+    cl_60->end_ns=now_ns_60();
+    return NULL;
+}
+
+//uploads the seed files that downlf, downltar and dispfnames read from
+static int seed_60(void)
+{
+    struct conn_60 *c_60=malloc(sizeof *c_60);
+    if(!c_60 || connect_s1_60(c_60)!=0)
+    {
+        fprintf(stderr,"dfsbench: cannot connect to S1 at %s:%d\n",S1_HOST_60,S1_PORT_60);
+        free(c_60);
+        return -1;
+    }
+    uint64_t rng_60=RNG_SEED_60^0x5eedULL;
+    char dir_60[LINE_MAX_60];
+    snprintf(dir_60,sizeof dir_60,"%s/seed",DIR_60);
+    for(int e=0;e<NEXTS_60;e++)
+    {
+        for(int i=0;i<SEED_FILES_60;i++)
+        {
+            char name_60[128]; size_t moved_60=0;
+            snprintf(name_60,sizeof name_60,"seed_%d%s",i,EXTS_60[e]);
+            if(op_upload_60(c_60,dir_60,name_60,pick_size_60(&rng_60),&moved_60)!=0)
+            {
+                fprintf(stderr,"dfsbench: seeding %s failed\n",name_60);
+                close(c_60->fd); free(c_60);
+                return -1;
+            }
+        }
+    }
+    close(c_60->fd);
+    free(c_60);
+    return 0;
+}
+
+//results
+
+static int cmp_u64_60(const void *a_60, const void *b_60)
+{
+    uint64_t x_60=*(const uint64_t*)a_60, y_60=*(const uint64_t*)b_60;
+    return x_60<y_60 ? -1 : x_60>y_60;
+}
+static double pct_us_60(const uint64_t *v_60, size_t n_60, double p_60)
+{
+    if(n_60==0)
+        return 0;
+    size_t i_60=(size_t)ceil(p_60*(double)n_60);
+    if(i_60>0) i_60--;
+    if(i_60>=n_60) i_60=n_60-1;
+    return (double)v_60[i_60]/1000.0;
+}
+
+static void report_60(struct client_60 *cl_60, uint64_t start_60, uint64_t end_60)
+{
+    FILE *out_60=stdout;
+    if(OUT_60 && !(out_60=fopen(OUT_60,"w")))
+    {
+        perror(OUT_60);
+        out_60=stdout;
+    }
+    double secs_60=(double)(end_60-start_60)/1e9;
+    unsigned long long tot_ok_60=0, tot_err_60=0;
+
+    fprintf(out_60,"{\n  \"config\": {\"host\": \"%s\", \"port\": %d, \"clients\": %d, \"duration_s\": %.3f, "
+        "\"rate\": %.1f, \"mode\": \"%s\", \"keepalive\": %s, \"size\": [\"%s\", %zu, %zu]},\n",
+        S1_HOST_60, S1_PORT_60, CLIENTS_60, DURATION_60, RATE_60, RATE_60>0?"open":"closed",
+        KEEPALIVE_60?"true":"false",
+        SIZE_KIND_60==SIZE_FIXED_60?"fixed":SIZE_KIND_60==SIZE_UNIFORM_60?"uniform":"exp", SIZE_A_60, SIZE_B_60);
+    fprintf(out_60,"  \"elapsed_s\": %.3f,\n  \"ops\": {",secs_60);
+
+    int first_60=1;
+    for(int op=0;op<OP_COUNT_60;op++)
+    {
+        size_t n_60=0; unsigned long long err_60=0, bytes_60=0;
+        for(int c=0;c<CLIENTS_60;c++)
+        {
+            n_60+=cl_60[c].ops[op].n;
+            err_60+=cl_60[c].ops[op].errors;
+            bytes_60+=cl_60[c].ops[op].bytes;
+        }
+        if(n_60==0 && err_60==0)
+            continue;
+        uint64_t *all_60=malloc(sizeof(uint64_t)*(n_60?n_60:1));
+        size_t k_60=0; double sum_60=0;
+        for(int c=0;c<CLIENTS_60;c++)
+        {
+            memcpy(all_60+k_60,cl_60[c].ops[op].v,sizeof(uint64_t)*cl_60[c].ops[op].n);
+            k_60+=cl_60[c].ops[op].n;
+        }
+        qsort(all_60,n_60,sizeof(uint64_t),cmp_u64_60);
+        for(size_t i=0;i<n_60;i++)
+            sum_60+=(double)all_60[i];
+        fprintf(out_60,"%s\n    \"%s\": {\"count\": %zu, \"errors\": %llu, \"ops_per_s\": %.2f, \"mb_per_s\": %.3f, "
+            "\"lat_us\": {\"mean\": %.1f, \"p50\": %.1f, \"p99\": %.1f, \"p999\": %.1f, \"max\": %.1f}}",
+            first_60?"":",", OP_NAMES_60[op], n_60, err_60, (double)n_60/secs_60, (double)bytes_60/secs_60/1e6,
+            n_60?sum_60/(double)n_60/1000.0:0.0, pct_us_60(all_60,n_60,0.50), pct_us_60(all_60,n_60,0.99),
+            pct_us_60(all_60,n_60,0.999), n_60?(double)all_60[n_60-1]/1000.0:0.0);
+        first_60=0;
+        tot_ok_60+=n_60; tot_err_60+=err_60;
+        free(all_60);
+    }
+    fprintf(out_60,"\n  },\n  \"total\": {\"count\": %llu, \"errors\": %llu, \"ops_per_s\": %.2f}\n}\n",
+        tot_ok_60, tot_err_60, (double)tot_ok_60/secs_60);
+    if(out_60!=stdout)
+        fclose(out_60);
+}
+
+//argument parsing
+
+static size_t parse_size_60(const char *s_60)
+{
+    char *end_60=NULL;
+    double v_60=strtod(s_60,&end_60);
+    if(end_60 && (*end_60=='k'||*end_60=='K')) v_60*=1024;
+    else if(end_60 && (*end_60=='m'||*end_60=='M')) v_60*=1024*1024;
+    else if(end_60 && (*end_60=='g'||*end_60=='G')) v_60*=1024.0*1024*1024;
+    return (size_t)v_60;
+}
+
+//"downlf=60,uploadf=20,..."; operations not named get weight 0
+static int parse_mix_60(const char *s_60)
+{
+    int mix_60[OP_COUNT_60]={0}, total_60=0;
+    char *tmp_60=strdup(s_60), *save_60=NULL;
+    for(char *tok_60=strtok_r(tmp_60,",",&save_60); tok_60; tok_60=strtok_r(NULL,",",&save_60))
+    {
+        char *eq_60=strchr(tok_60,'=');
+        int w_60 = eq_60 ? atoi(eq_60+1) : 1;
+        if(eq_60) *eq_60='\0';
+        int found_60=0;
+        for(int i=0;i<OP_COUNT_60;i++)
+            if(!strcmp(tok_60,OP_NAMES_60[i]))
+            {
+                mix_60[i]=w_60; found_60=1;
+            }
+        if(!found_60 || w_60<0)
+        {
+            free(tmp_60);
+            return -1;
+        }
+        total_60+=w_60;
+    }
+    free(tmp_60);
+    if(total_60<=0)
+        return -1;
+    memcpy(MIX_60,mix_60,sizeof mix_60);
+    return 0;
+}
+
+//"fixed:64k", "uniform:1k:1m" or "exp:256k" (exponential with that mean)
+static int parse_dist_60(const char *s_60)
+{
+    const char *c1_60=strchr(s_60,':');
+    if(!c1_60)
+        return -1;
+    const char *c2_60=strchr(c1_60+1,':');
+    if(!strncmp(s_60,"fixed:",6))
+    {
+        SIZE_KIND_60=SIZE_FIXED_60; SIZE_A_60=SIZE_B_60=parse_size_60(c1_60+1);
+    }
+    else if(!strncmp(s_60,"uniform:",8) && c2_60)
+    {
+        SIZE_KIND_60=SIZE_UNIFORM_60; SIZE_A_60=parse_size_60(c1_60+1); SIZE_B_60=parse_size_60(c2_60+1);
+        if(SIZE_B_60<SIZE_A_60)
+            return -1;
+    }
+    else if(!strncmp(s_60,"exp:",4))
+    {
+        SIZE_KIND_60=SIZE_EXP_60; SIZE_A_60=parse_size_60(c1_60+1);
+        SIZE_B_60 = c2_60 ? parse_size_60(c2_60+1) : SIZE_A_60*16;   /* cap */
+    }
+    else
+        return -1;
+    return SIZE_A_60>0 ? 0 : -1;
+}
+
+static void usage_60(void)
+{
+    fprintf(stderr,
+        "usage: dfsbench [options]\n"
+        "  -H host      S1 host (127.0.0.1)\n"
+        "  -p port      S1 port (5001)\n"
+        "  -c clients   concurrent clients (4)\n"
+        "  -t seconds   measurement time (10)\n"
+        "  -r rate      total target ops/s, poisson arrivals (0 = closed loop)\n"
+        "  -m mix       op weights, e.g. uploadf=20,downlf=60,removef=5,downltar=5,dispfnames=10\n"
+        "  -s dist      upload sizes: fixed:64k | uniform:1k:1m | exp:256k[:cap]\n"
+        "  -e exts      extensions to use (.pdf,.txt,.zip,.c)\n"
+        "  -d dir       S1 directory for benchmark files (~S1/dfsbench)\n"
+        "  -w n         seed files per extension (8)\n"
+        "  -k           keep one S1 connection per client instead of one per op\n"
+        "  -S seed      random seed (42)\n"
+        "  -o file      write the JSON report to file instead of stdout\n");
+}
+
+int main(int argc_60, char **argv_60)
+{
+    const char *exts_60=".pdf,.txt,.zip,.c";
+    int opt_60;
+    while((opt_60=getopt(argc_60,argv_60,"H:p:c:t:r:m:s:e:d:w:kS:o:h"))!=-1)
+    {
+        switch(opt_60)
+        {
+        case 'H': S1_HOST_60=optarg; break;
+        case 'p': S1_PORT_60=atoi(optarg); break;
+        case 'c': CLIENTS_60=atoi(optarg); break;
+        case 't': DURATION_60=atof(optarg); break;
+        case 'r': RATE_60=atof(optarg); break;
+        case 'm':
+            if(parse_mix_60(optarg)!=0)
+            {
+                fprintf(stderr,"dfsbench: bad mix '%s'\n",optarg);
+                return 2;
+            }
+            break;
+        case 's':
+            if(parse_dist_60(optarg)!=0)
+            {
+                fprintf(stderr,"dfsbench: bad size distribution '%s'\n",optarg);
+                return 2;
+            }
+            break;
+        case 'e': exts_60=optarg; break;
+        case 'd': DIR_60=optarg; break;
+        case 'w': SEED_FILES_60=atoi(optarg); break;
+        case 'k': KEEPALIVE_60=1; break;
+        case 'S': RNG_SEED_60=strtoull(optarg,NULL,10); break;
+        case 'o': OUT_60=optarg; break;
+        default: usage_60(); return 2;
+        }
+    }
+    if(CLIENTS_60<1 || DURATION_60<=0 || SEED_FILES_60<1 || strncmp(DIR_60,"~S1/",4)!=0)
+    {
+        usage_60();
+        return 2;
+    }
+    char *exts_copy_60=strdup(exts_60), *save_60=NULL;
+    for(char *tok_60=strtok_r(exts_copy_60,",",&save_60); tok_60 && NEXTS_60<8; tok_60=strtok_r(NULL,",",&save_60))
+        EXTS_60[NEXTS_60++]=tok_60;
+    if(NEXTS_60==0)
+    {
+        usage_60();
+        return 2;
+    }
+
+    PAYLOAD_CAP_60 = SIZE_B_60>SIZE_A_60 ? SIZE_B_60 : SIZE_A_60;
+    PAYLOAD_60=malloc(PAYLOAD_CAP_60);
+    uint64_t prng_60=RNG_SEED_60|1;
+    for(size_t i=0;i<PAYLOAD_CAP_60;i++)
+        PAYLOAD_60[i]=(char)rng_next_60(&prng_60);
+
+    if(seed_60()!=0)
+        return 1;
+
+    struct client_60 *cl_60=calloc((size_t)CLIENTS_60,sizeof *cl_60);
+    uint64_t start_60=now_ns_60();
+    for(int i=0;i<CLIENTS_60;i++)
+    {
+        cl_60[i].id=i;
+        cl_60[i].rng=(RNG_SEED_60+(uint64_t)i*0x9E3779B97F4A7C15ULL)|1;
+        cl_60[i].start_ns=start_60;
+        cl_60[i].conn=malloc(sizeof(struct conn_60));
+        pthread_create(&cl_60[i].th,NULL,client_main_60,&cl_60[i]);
+    }
+    uint64_t end_60=start_60;
+    for(int i=0;i<CLIENTS_60;i++)
+    {
+        pthread_join(cl_60[i].th,NULL);
+        if(cl_60[i].end_ns>end_60)
+            end_60=cl_60[i].end_ns;
+    }
+    report_60(cl_60,start_60,end_60);
+
+    //best effort cleanup of files the run left behind
+    struct conn_60 c_60;
+    for(int i=0;i<CLIENTS_60;i++)
+    {
+        for(size_t k=0;k<cl_60[i].own_n;k++)
+        {
+            char *p_60=cl_60[i].own[(cl_60[i].own_head+k)%cl_60[i].own_cap];
+            if(connect_s1_60(&c_60)==0)
+            {
+                op_remove_60(&c_60,p_60);
+                close(c_60.fd);
+            }
+            free(p_60);
+        }
+        free(cl_60[i].own);
+        free(cl_60[i].conn);
+        for(int op=0;op<OP_COUNT_60;op++)
+            free(cl_60[i].ops[op].v);
+    }
+    free(cl_60);
+    free(PAYLOAD_60);
+    free(exts_copy_60);
+    return 0;
+}
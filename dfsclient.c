@@ -0,0 +1,772 @@
+/* =====================================================================
+   libdfsclient: see dfsclient.h
+   The same requests and replies as s25client's commands, over one kept
+   connection and a buffered reader instead of a new connection and
+   byte-at-a-time reads per command.
+   ===================================================================== */
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "dfsclient.h"
+
+#define LINE_MAX_50 4096
+#define RBUF_50     65536
+#define CHUNK_50    65536   /* a file passed by descriptor moves this much per read and write */
+
+struct dfs_client
+{
+    char host[256];
+    int port, fd, timeout_ms;
+    size_t rpos, rlen;      /* unread bytes of rbuf */
+    char rid[40];           /* RID|<id> line for the next request, or empty */
+    char err[LINE_MAX_50];
+    char rbuf[RBUF_50];
+};
+
+static void set_err_50(struct dfs_client *c_50, const char *fmt_50, ...)
+{
+    va_list ap_50;
+    va_start(ap_50, fmt_50);
+    vsnprintf(c_50->err, sizeof c_50->err, fmt_50, ap_50);
+    va_end(ap_50);
+}
+
+//I/O helpers
+
+static ssize_t write_fully_50(int fd_50, const void *buf_50, size_t n_50)
+{
+    const char *p_50=(const char*)buf_50; size_t left_50=n_50;
+    while(left_50>0)
+    {
+        ssize_t w_50=send(fd_50,p_50,left_50,MSG_NOSIGNAL);
+        if(w_50<0)
+        {
+            if(errno==EINTR)
+                continue;
+            return -1;
+        }
+        left_50 -= (size_t)w_50;
+        p_50 += w_50;
+    }
+    return (ssize_t)n_50;
+}
+
+// the iovecs whole, in as few sends as the socket takes them
+static int writev_fully_50(int fd_50, struct iovec *iov_50, int cnt_50)
+{
+    while(cnt_50>0)
+    {
+        struct msghdr m_50;
+        memset(&m_50,0,sizeof m_50);
+        m_50.msg_iov=iov_50;
+        m_50.msg_iovlen=(size_t)cnt_50;
+        ssize_t w_50=sendmsg(fd_50,&m_50,MSG_NOSIGNAL);
+        if(w_50<0)
+        {
+            if(errno==EINTR)
+                continue;
+            return -1;
+        }
+        for(;cnt_50>0 && (size_t)w_50>=iov_50->iov_len;++iov_50,--cnt_50)
+            w_50-=(ssize_t)iov_50->iov_len;
+        if(cnt_50>0)
+        {
+            iov_50->iov_base=(char*)iov_50->iov_base+w_50;
+            iov_50->iov_len-=(size_t)w_50;
+        }
+    }
+    return 0;
+}
+
+// more bytes into rbuf; 0 at the end of the connection
+static ssize_t fill_50(struct dfs_client *c_50)
+{
+    if(c_50->rpos==c_50->rlen)
+        c_50->rpos=c_50->rlen=0;
+    for(;;)
+    {
+        ssize_t r_50=read(c_50->fd,c_50->rbuf+c_50->rlen,sizeof c_50->rbuf-c_50->rlen);
+        if(r_50<0 && errno==EINTR)
+            continue;
+        if(r_50>0)
+            c_50->rlen += (size_t)r_50;
+        return r_50;
+    }
+}
+
+// n bytes, the buffered ones first; the rest of a large read goes straight into buf
+static int read_fully_50(struct dfs_client *c_50, void *buf_50, size_t n_50)
+{
+    char *p_50=(char*)buf_50;
+    size_t have_50=c_50->rlen-c_50->rpos, k_50=have_50<n_50?have_50:n_50;
+    memcpy(p_50,c_50->rbuf+c_50->rpos,k_50);
+    c_50->rpos += k_50;
+    for(size_t got_50=k_50; got_50<n_50; )
+    {
+        ssize_t r_50=read(c_50->fd,p_50+got_50,n_50-got_50);
+        if(r_50<0 && errno==EINTR)
+            continue;
+        if(r_50<=0)
+            return -1;
+        got_50 += (size_t)r_50;
+    }
+    return 0;
+}
+
+// one line without its '\n'; -1 at the end of the connection or when it is too long
+static int read_line_50(struct dfs_client *c_50, char *buf_50, size_t cap_50)
+{
+    for(;;)
+    {
+        char *nl_50=memchr(c_50->rbuf+c_50->rpos,'\n',c_50->rlen-c_50->rpos);
+        if(nl_50)
+        {
+            size_t n_50=(size_t)(nl_50-(c_50->rbuf+c_50->rpos));
+            if(n_50>=cap_50)
+                return -1;
+            memcpy(buf_50,c_50->rbuf+c_50->rpos,n_50);
+            buf_50[n_50]='\0';
+            c_50->rpos += n_50+1;
+            return (int)n_50;
+        }
+        if(c_50->rpos>0)
+        {
+            memmove(c_50->rbuf,c_50->rbuf+c_50->rpos,c_50->rlen-c_50->rpos);
+            c_50->rlen -= c_50->rpos;
+            c_50->rpos = 0;
+        }
+        if(c_50->rlen==sizeof c_50->rbuf || fill_50(c_50)<=0)
+            return -1;
+    }
+}
+
+// a local file's bytes (a descriptor the caller passed), all of them
+static int write_file_50(int fd_50, const char *buf_50, size_t n_50)
+{
+    while(n_50>0)
+    {
+        ssize_t w_50=write(fd_50,buf_50,n_50);
+        if(w_50<0 && errno==EINTR)
+            continue;
+        if(w_50<=0)
+            return -1;
+        n_50 -= (size_t)w_50;
+        buf_50 += w_50;
+    }
+    return 0;
+}
+
+// a request's first line, behind the RID| line dfs_set_request_id asked for; its length, or -1
+static int vrequest_50(struct dfs_client *c_50, char *out_50, size_t cap_50, const char *fmt_50, va_list ap_50)
+{
+    int k_50=c_50->rid[0] ? snprintf(out_50,cap_50,"RID|%s\n",c_50->rid) : 0;
+    int L_50=vsnprintf(out_50+k_50,cap_50-(size_t)k_50,fmt_50,ap_50);
+    if(L_50<0 || (size_t)(k_50+L_50)+1>=cap_50)
+    {
+        set_err_50(c_50,"request too long");
+        return -1;
+    }
+    c_50->rid[0]='\0';
+    out_50[k_50+L_50]='\n';
+    return k_50+L_50+1;
+}
+static int request_50(struct dfs_client *c_50, char *out_50, size_t cap_50, const char *fmt_50, ...)
+{
+    va_list ap_50; va_start(ap_50,fmt_50);
+    int n_50=vrequest_50(c_50,out_50,cap_50,fmt_50,ap_50);
+    va_end(ap_50);
+    return n_50;
+}
+
+static int send_line_50(struct dfs_client *c_50, const char *fmt_50, ...)
+{
+    char line_50[LINE_MAX_50+48];
+    va_list ap_50; va_start(ap_50,fmt_50);
+    int L_50=vrequest_50(c_50,line_50,sizeof line_50,fmt_50,ap_50);
+    va_end(ap_50);
+    if(L_50<0)
+        return -1;
+    return write_fully_50(c_50->fd,line_50,(size_t)L_50)==L_50?0:-1;
+}
+
+//sockets: the "socket" lines of DFS_CONF (nodelay, buffers, keepalive) apply here as they do to
+//s25client's connections; the listener options in it are S1's business. The connection is kept
+//between calls, so keepalive is on unless a line turns it off: it finds an S1 host that went
+//away while the connection sat idle (or keeps a NAT entry for it) instead of the next call
+//hanging on a dead peer
+static int SOCK_NODELAY_50=1;
+static int SOCK_BUF_KB_50=0;     /* 0: the kernel sizes them */
+static int SOCK_KA_IDLE_50=60;
+static int SOCK_KA_INTVL_50=10;
+static int SOCK_KA_CNT_50=5;
+static pthread_once_t sock_once_50=PTHREAD_ONCE_INIT;
+
+static int sock_conf_50(const char *opt_50,char **save_50)
+{
+    char *v_50=strtok_r(NULL," \t\r\n",save_50);
+    if(!v_50)
+        return -1;
+    int off_50=!strcmp(v_50,"off"),n_50=atoi(v_50);
+    if(!strcmp(opt_50,"backlog")||!strcmp(opt_50,"defer_accept"))
+        return 0;
+    else if(!strcmp(opt_50,"nodelay")&&(off_50||!strcmp(v_50,"on")))
+        SOCK_NODELAY_50=!off_50;
+    else if(!strcmp(opt_50,"buffers")&&(off_50||n_50>0))
+        SOCK_BUF_KB_50=off_50?0:n_50;
+    else if(!strcmp(opt_50,"keepalive")&&(off_50||n_50>0))
+    {
+        char *i_50=strtok_r(NULL," \t\r\n",save_50);
+        char *c_50=strtok_r(NULL," \t\r\n",save_50);
+        if((i_50&&atoi(i_50)<1)||(c_50&&atoi(c_50)<1))
+            return -1;
+        SOCK_KA_IDLE_50=off_50?0:n_50;
+        if(i_50)
+            SOCK_KA_INTVL_50=atoi(i_50);
+        if(c_50)
+            SOCK_KA_CNT_50=atoi(c_50);
+    }
+    else
+        return -1;
+    return 0;
+}
+
+// once per process, at the first dfs_open
+static void sock_load_50(void)
+{
+    const char *path_50=getenv("DFS_CONF");
+    if(!path_50||!*path_50)
+        return;
+    FILE *f_50=fopen(path_50,"r");
+    if(!f_50)
+        return;
+    char buf_50[LINE_MAX_50];
+    while(fgets(buf_50,sizeof buf_50,f_50))
+    {
+        char *hash_50=strchr(buf_50,'#');
+        if(hash_50)
+            *hash_50='\0';
+        char *save_50=NULL;
+        char *kw_50=strtok_r(buf_50," \t\r\n",&save_50);
+        if(!kw_50||strcmp(kw_50,"socket"))
+            continue;
+        char *opt_50=strtok_r(NULL," \t\r\n",&save_50);
+        if(opt_50)
+            sock_conf_50(opt_50,&save_50);   /* s25client reports a bad line; a library keeps quiet */
+    }
+    fclose(f_50);
+}
+
+// before connect(), so a receive buffer set here is the one the handshake scales the window for
+static void sock_tune_50(int fd_50)
+{
+    int one_50=1;
+    // a request's header line and its data may go out as separate writes; without this the
+    // data waits for the ack of the header on a warm connection
+    if(SOCK_NODELAY_50)
+        setsockopt(fd_50,IPPROTO_TCP,TCP_NODELAY,&one_50,sizeof one_50);
+    if(SOCK_BUF_KB_50)
+    {
+        int b_50=SOCK_BUF_KB_50*1024;
+        setsockopt(fd_50,SOL_SOCKET,SO_SNDBUF,&b_50,sizeof b_50);
+        setsockopt(fd_50,SOL_SOCKET,SO_RCVBUF,&b_50,sizeof b_50);
+    }
+    if(SOCK_KA_IDLE_50)
+    {
+        setsockopt(fd_50,SOL_SOCKET,SO_KEEPALIVE,&one_50,sizeof one_50);
+        setsockopt(fd_50,IPPROTO_TCP,TCP_KEEPIDLE,&SOCK_KA_IDLE_50,sizeof SOCK_KA_IDLE_50);
+        setsockopt(fd_50,IPPROTO_TCP,TCP_KEEPINTVL,&SOCK_KA_INTVL_50,sizeof SOCK_KA_INTVL_50);
+        setsockopt(fd_50,IPPROTO_TCP,TCP_KEEPCNT,&SOCK_KA_CNT_50,sizeof SOCK_KA_CNT_50);
+    }
+}
+
+//connection--------------------
+
+static void drop_50(struct dfs_client *c_50)
+{
+    if(c_50->fd>=0)
+        close(c_50->fd);
+    c_50->fd=-1;
+    c_50->rpos=c_50->rlen=0;
+}
+
+static void apply_timeout_50(struct dfs_client *c_50)
+{
+    struct timeval tv_50;
+    tv_50.tv_sec=c_50->timeout_ms/1000;
+    tv_50.tv_usec=(c_50->timeout_ms%1000)*1000;
+    setsockopt(c_50->fd,SOL_SOCKET,SO_RCVTIMEO,&tv_50,sizeof tv_50);
+    setsockopt(c_50->fd,SOL_SOCKET,SO_SNDTIMEO,&tv_50,sizeof tv_50);
+}
+
+static int connect_s1_50(struct dfs_client *c_50)
+{
+    char port_50[16];
+    snprintf(port_50,sizeof port_50,"%d",c_50->port);
+    struct addrinfo hints_50, *res_50=NULL;
+    memset(&hints_50,0,sizeof hints_50);
+    hints_50.ai_family=AF_UNSPEC;
+    hints_50.ai_socktype=SOCK_STREAM;
+    int gai_50=getaddrinfo(c_50->host,port_50,&hints_50,&res_50);
+    if(gai_50!=0)
+    {
+        set_err_50(c_50,"%s: %s",c_50->host,gai_strerror(gai_50));
+        errno=EHOSTUNREACH;
+        return -1;
+    }
+    int fd_50=-1;
+    for(struct addrinfo *a_50=res_50; a_50 && fd_50<0; a_50=a_50->ai_next)
+    {
+        fd_50=socket(a_50->ai_family,a_50->ai_socktype,a_50->ai_protocol);
+        if(fd_50>=0)
+            sock_tune_50(fd_50);
+        if(fd_50>=0 && connect(fd_50,a_50->ai_addr,a_50->ai_addrlen)!=0)
+        {
+            int e_50=errno;
+            close(fd_50);
+            fd_50=-1;
+            errno=e_50;
+        }
+    }
+    freeaddrinfo(res_50);
+    if(fd_50<0)
+    {
+        set_err_50(c_50,"connect %s:%d: %s",c_50->host,c_50->port,strerror(errno));
+        return -1;
+    }
+    c_50->fd=fd_50;
+    c_50->rpos=c_50->rlen=0;
+    apply_timeout_50(c_50);
+    return 0;
+}
+
+// before a call: a connection S1 closed while it sat idle reads as ended; open a new one
+static int ready_50(struct dfs_client *c_50)
+{
+    c_50->err[0]='\0';
+    if(c_50->fd>=0)
+    {
+        struct pollfd p_50={ c_50->fd, POLLIN, 0 };
+        char b_50;
+        if(poll(&p_50,1,0)==1 && recv(c_50->fd,&b_50,1,MSG_PEEK|MSG_DONTWAIT)<=0)
+            drop_50(c_50);
+    }
+    return c_50->fd>=0 ? 0 : connect_s1_50(c_50);
+}
+
+// a call broke off mid-reply: the connection is out of step with S1, so the next call gets a new one
+static int fail_50(struct dfs_client *c_50, const char *what_50)
+{
+    if(!c_50->err[0])
+        set_err_50(c_50,"%s: %s",what_50,errno?strerror(errno):"connection closed");
+    drop_50(c_50);
+    return -1;
+}
+
+struct dfs_client *dfs_open(const char *host, int port)
+{
+    pthread_once(&sock_once_50,sock_load_50);
+    struct dfs_client *c_50=calloc(1,sizeof *c_50);
+    if(!c_50)
+        return NULL;
+    snprintf(c_50->host,sizeof c_50->host,"%s",host&&*host?host:"127.0.0.1");
+    c_50->port=port;
+    c_50->fd=-1;
+    if(connect_s1_50(c_50)!=0)
+    {
+        int e_50=errno;
+        free(c_50);
+        errno=e_50;
+        return NULL;
+    }
+    return c_50;
+}
+
+void dfs_close(struct dfs_client *c)
+{
+    if(!c)
+        return;
+    drop_50(c);
+    free(c);
+}
+
+void dfs_set_timeout(struct dfs_client *c, int ms)
+{
+    c->timeout_ms = ms>0 ? ms : 0;
+    if(c->fd>=0)
+        apply_timeout_50(c);
+}
+
+const char *dfs_last_error(const struct dfs_client *c)
+{
+    return c ? c->err : "no client";
+}
+
+void dfs_set_request_id(struct dfs_client *c, const char *rid)
+{
+    snprintf(c->rid,sizeof c->rid,"%s",rid&&!strpbrk(rid,"|\n")?rid:"");
+}
+
+void dfs_free(void *p)
+{
+    free(p);
+}
+
+//requests--------------------
+
+// UPLOADF|1|<dest> FILEMETA|<name>|<len>: the two lines, behind a RID| line if one is due
+static int bad_name_50(const char *name_50)
+{
+    return !name_50 || !*name_50 || strpbrk(name_50,"|/\n")!=NULL;
+}
+static int upload_head_50(struct dfs_client *c_50, char *head_50, size_t cap_50, const char *dest_dir_50, int n_50, const char *name_50, size_t len_50)
+{
+    if(!dest_dir_50 || strncmp(dest_dir_50,"~S1/",4) || bad_name_50(name_50))
+    {
+        set_err_50(c_50,"bad path");
+        return -1;
+    }
+    if(ready_50(c_50)!=0)
+        return -1;
+    return request_50(c_50,head_50,cap_50,"UPLOADF|%d|%s\nFILEMETA|%s|%zu",n_50,dest_dir_50,name_50,len_50);
+}
+// OK, or ERR|<why>
+static int upload_reply_50(struct dfs_client *c_50)
+{
+    char line_50[LINE_MAX_50];
+    if(read_line_50(c_50,line_50,sizeof line_50)<0)
+        return fail_50(c_50,"upload");
+    if(!strcmp(line_50,"OK"))
+        return 0;
+    set_err_50(c_50,"%s",!strncmp(line_50,"ERR|",4)?line_50+4:line_50);
+    // any other refusal comes before S1 read the file, which it would then take for commands
+    if(strncmp(line_50,"ERR|not_stored|",15))
+        drop_50(c_50);
+    return -1;
+}
+
+// UPLOADF|1|<dest> FILEMETA|<name>|<len> <bytes>, answered by OK or ERR|<why>
+int dfs_upload(struct dfs_client *c, const char *dest_dir, const char *name, const void *data, size_t len)
+{
+    // both lines and the bytes in one send
+    char head_50[2*LINE_MAX_50+48];
+    int hn_50=upload_head_50(c,head_50,sizeof head_50,dest_dir,1,name,len);
+    if(hn_50<0)
+        return -1;
+    struct iovec iov_50[2]={{head_50,(size_t)hn_50},{(void*)data,len}};
+    errno=0;
+    if(writev_fully_50(c->fd,iov_50,2)!=0)
+        return fail_50(c,"upload");
+    return upload_reply_50(c);
+}
+
+// the same request with the bytes read from fd a chunk at a time
+int dfs_upload_fd(struct dfs_client *c, const char *dest_dir, const char *name, int fd, size_t len)
+{
+    struct dfs_upfile f_50={name,fd,len};
+    return dfs_upload_files(c,dest_dir,&f_50,1);
+}
+
+// UPLOADF|<n>|<dest> and then FILEMETA|<name>|<len> <bytes> per file, each file read from its fd
+// a chunk at a time; every FILEMETA line goes out with its file's first chunk, the UPLOADF line
+// with the first file's
+int dfs_upload_files(struct dfs_client *c, const char *dest_dir, const struct dfs_upfile *files, int n)
+{
+    if(n<1 || n>3)
+    {
+        set_err_50(c,"1 to 3 files per upload");
+        return -1;
+    }
+    for(int i_50=1;i_50<n;i_50++)
+        if(bad_name_50(files[i_50].name))
+        {
+            set_err_50(c,"bad path");
+            return -1;
+        }
+    char head_50[2*LINE_MAX_50+48];
+    int hn_50=upload_head_50(c,head_50,sizeof head_50,dest_dir,n,files[0].name,files[0].len);
+    if(hn_50<0)
+        return -1;
+    char *buf_50=malloc(CHUNK_50);
+    if(!buf_50)
+    {
+        set_err_50(c,"out of memory");
+        return -1;
+    }
+    errno=0;
+    for(int i_50=0;i_50<n;i_50++)
+    {
+        if(i_50>0)
+            hn_50=snprintf(head_50,sizeof head_50,"FILEMETA|%s|%zu\n",files[i_50].name,files[i_50].len);
+        struct iovec iov_50[2]={{head_50,(size_t)hn_50},{buf_50,0}};
+        for(size_t left_50=files[i_50].len, first_50=1; first_50 || left_50>0; first_50=0)
+        {
+            ssize_t r_50=0;
+            if(left_50>0)
+                while((r_50=read(files[i_50].fd,buf_50,left_50<CHUNK_50?left_50:CHUNK_50))<0 && errno==EINTR)
+                    ;
+            if(left_50>0 && r_50<=0)
+            {
+                // S1 is owed the rest of the file; only a new connection gets back in step
+                set_err_50(c,"read %s: %s",files[i_50].name,r_50<0?strerror(errno):"file shorter than its size");
+                free(buf_50);
+                return fail_50(c,"upload");
+            }
+            iov_50[1].iov_len=(size_t)r_50;
+            if(writev_fully_50(c->fd,first_50?iov_50:iov_50+1,first_50?2:1)!=0)
+            {
+                free(buf_50);
+                return fail_50(c,"upload");
+            }
+            left_50 -= (size_t)r_50;
+        }
+    }
+    free(buf_50);
+    return upload_reply_50(c);
+}
+
+// the n bytes of a FILERESP into fd, through rbuf
+static int recv_to_fd_50(struct dfs_client *c_50, int fd_50, size_t n_50)
+{
+    while(n_50>0)
+    {
+        if(c_50->rpos==c_50->rlen && fill_50(c_50)<=0)
+            return fail_50(c_50,"download");
+        size_t k_50=c_50->rlen-c_50->rpos;
+        k_50=k_50<n_50?k_50:n_50;
+        if(write_file_50(fd_50,c_50->rbuf+c_50->rpos,k_50)!=0)
+        {
+            // the rest of the file is still on its way; only a new connection gets back in step
+            set_err_50(c_50,"write: %s",strerror(errno));
+            return fail_50(c_50,"download");
+        }
+        c_50->rpos += k_50;
+        n_50 -= k_50;
+    }
+    return 0;
+}
+
+// DOWNLF|1|<path>: FILERESP|<name>|<size> and the bytes, or FILENOTFOUND|<path>; then DONE.
+// The bytes go to a malloc'd buffer in *data, or to fd when data is NULL
+static int download_50(struct dfs_client *c_50, const char *path_50, void **data_50, int fd_50, size_t *len_50)
+{
+    if(data_50)
+        *data_50=NULL;
+    *len_50=0;
+    if(!path_50 || strncmp(path_50,"~S1/",4) || strchr(path_50,'|'))
+    {
+        set_err_50(c_50,"bad path");
+        return -1;
+    }
+    if(ready_50(c_50)!=0)
+        return -1;
+    errno=0;
+    if(send_line_50(c_50,"DOWNLF|1|%s",path_50)!=0)
+        return fail_50(c_50,"download");
+    char line_50[LINE_MAX_50];
+    int rc_50=-1;
+    while(read_line_50(c_50,line_50,sizeof line_50)>=0)
+    {
+        if(!strncmp(line_50,"FILERESP|",9))
+        {
+            const char *sz_50=strrchr(line_50,'|');
+            size_t n_50=(size_t)strtoull(sz_50+1,NULL,10);
+            if(!data_50)
+            {
+                if(recv_to_fd_50(c_50,fd_50,n_50)!=0)
+                    return -1;
+            }
+            else
+            {
+                char *buf_50=malloc(n_50?n_50:1);
+                if(!buf_50 || read_fully_50(c_50,buf_50,n_50)!=0)
+                {
+                    free(buf_50);
+                    if(!buf_50)
+                        set_err_50(c_50,"out of memory");
+                    return fail_50(c_50,"download");
+                }
+                *data_50=buf_50;
+            }
+            *len_50=n_50;
+            rc_50=0;
+            continue;
+        }
+        if(!strncmp(line_50,"FILENOTFOUND|",13))
+        {
+            set_err_50(c_50,"not found: %s",line_50+13);
+            rc_50=1;
+            continue;
+        }
+        if(!strcmp(line_50,"DONE"))
+            return rc_50;
+        set_err_50(c_50,"%s",!strncmp(line_50,"ERR|",4)?line_50+4:line_50);
+        return -1;
+    }
+    if(rc_50==0 && data_50)
+    {
+        free(*data_50);
+        *data_50=NULL;
+    }
+    *len_50=0;
+    return fail_50(c_50,"download");
+}
+
+int dfs_download(struct dfs_client *c, const char *path, void **data, size_t *len)
+{
+    return download_50(c,path,data,-1,len);
+}
+
+int dfs_download_fd(struct dfs_client *c, const char *path, int fd, size_t *len)
+{
+    return download_50(c,path,NULL,fd,len);
+}
+
+// DOWNLF|<n>|<path>|...: a FILERESP and its bytes per file found, FILENOTFOUND per file not, then
+// DONE. Each file goes to the fd open_fn gives for it, and close_fn hands that back once the
+// bytes are in or the request failed on the way
+int dfs_download_files(struct dfs_client *c, const char *const *paths, int n, dfs_open_fn open_fn, dfs_close_fn close_fn, void *arg)
+{
+    if(n<1 || n>2)
+    {
+        set_err_50(c,"1 or 2 files per download");
+        return -1;
+    }
+    char req_50[LINE_MAX_50];
+    int rn_50=snprintf(req_50,sizeof req_50,"DOWNLF|%d",n);
+    for(int i_50=0;i_50<n;i_50++)
+    {
+        if(!paths[i_50] || strncmp(paths[i_50],"~S1/",4) || strchr(paths[i_50],'|'))
+        {
+            set_err_50(c,"bad path");
+            return -1;
+        }
+        rn_50+=snprintf(req_50+rn_50,sizeof req_50-(size_t)rn_50,"|%s",paths[i_50]);
+        if((size_t)rn_50>=sizeof req_50)
+        {
+            set_err_50(c,"path too long");
+            return -1;
+        }
+    }
+    if(ready_50(c)!=0)
+        return -1;
+    errno=0;
+    if(send_line_50(c,"%s",req_50)!=0)
+        return fail_50(c,"download");
+    char line_50[LINE_MAX_50];
+    size_t nerr_50=0;
+    int rc_50=0;
+    while(read_line_50(c,line_50,sizeof line_50)>=0)
+    {
+        if(!strncmp(line_50,"FILERESP|",9))
+        {
+            char *sz_50=strrchr(line_50,'|');
+            size_t len_50=(size_t)strtoull(sz_50+1,NULL,10);
+            *sz_50='\0';
+            int fd_50=open_fn(arg,line_50+9,len_50);
+            if(fd_50<0)
+            {
+                // the file is still owed to us; only a new connection gets back in step
+                set_err_50(c,"cannot save %s",line_50+9);
+                return fail_50(c,"download");
+            }
+            int ok_50=recv_to_fd_50(c,fd_50,len_50)==0;
+            close_fn(arg,fd_50,line_50+9,ok_50);
+            if(!ok_50)
+                return -1;
+            continue;
+        }
+        if(!strncmp(line_50,"FILENOTFOUND|",13))
+        {
+            if(nerr_50<sizeof c->err)
+                nerr_50+=(size_t)snprintf(c->err+nerr_50,sizeof c->err-nerr_50,"%s%s",nerr_50?", ":"not found: ",line_50+13);
+            rc_50=1;
+            continue;
+        }
+        if(!strcmp(line_50,"DONE"))
+            return rc_50;
+        set_err_50(c,"%s",!strncmp(line_50,"ERR|",4)?line_50+4:line_50);
+        return -1;
+    }
+    return fail_50(c,"download");
+}
+
+// REMOVEF|1|<path>: REMOK|<path> or REMERR|<path>|<why>
+int dfs_remove(struct dfs_client *c, const char *path)
+{
+    if(!path || strncmp(path,"~S1/",4) || strchr(path,'|'))
+    {
+        set_err_50(c,"bad path");
+        return -1;
+    }
+    if(ready_50(c)!=0)
+        return -1;
+    errno=0;
+    char line_50[LINE_MAX_50];
+    if(send_line_50(c,"REMOVEF|1|%s",path)!=0 || read_line_50(c,line_50,sizeof line_50)<0)
+        return fail_50(c,"remove");
+    if(!strncmp(line_50,"REMOK|",6))
+        return 0;
+    if(!strncmp(line_50,"REMERR|",7))
+    {
+        const char *why_50=strrchr(line_50,'|');
+        set_err_50(c,"%s",why_50+1);
+        return 1;
+    }
+    set_err_50(c,"%s",!strncmp(line_50,"ERR|",4)?line_50+4:line_50);
+    return -1;
+}
+
+// DISP|<dir>: LISTBEGIN, NAME|<ext>|<name> per file, LISTEND; a listing that fn stops early is
+// still read to its end, so the connection stays in step
+int dfs_list(struct dfs_client *c, const char *dir, dfs_list_fn fn, void *arg)
+{
+    if(!dir || strncmp(dir,"~S1/",4) || strchr(dir,'|'))
+    {
+        set_err_50(c,"bad path");
+        return -1;
+    }
+    if(ready_50(c)!=0)
+        return -1;
+    errno=0;
+    if(send_line_50(c,"DISP|%s",dir)!=0)
+        return fail_50(c,"list");
+    char line_50[LINE_MAX_50];
+    int begun_50=0, stop_50=0;
+    while(read_line_50(c,line_50,sizeof line_50)>=0)
+    {
+        if(!begun_50)
+        {
+            if(!strcmp(line_50,"LISTBEGIN"))
+            {
+                begun_50=1;
+                continue;
+            }
+            set_err_50(c,"%s",!strncmp(line_50,"ERR|",4)?line_50+4:line_50);
+            return -1;
+        }
+        if(!strcmp(line_50,"LISTEND"))
+            return 0;
+        char *nm_50;
+        if(stop_50 || strncmp(line_50,"NAME|",5) || !(nm_50=strchr(line_50+5,'|')) || !nm_50[1])
+            continue;
+        *nm_50++='\0';
+        if(fn)
+            stop_50=fn(arg,line_50+5,nm_50)!=0;
+    }
+    return fail_50(c,"list");
+}
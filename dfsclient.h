@@ -0,0 +1,70 @@
+/* =====================================================================
+   libdfsclient: the S1 protocol of s25client as a library
+   One dfs_client holds one connection to S1 and sends every call over it;
+   S1 serves a connection's commands one after another until it is closed.
+   A connection S1 dropped while idle (a restart) is opened again before the
+   next call. Calls return 0 on success, 1 when S1 refused the one file
+   (not found, not removed), -1 when the request failed; dfs_last_error()
+   then says why (S1's ERR| reason or the system error). The "socket" lines
+   of DFS_CONF (nodelay, buffers, keepalive) apply to the connection.
+
+   Build: make bin/libdfsclient.so; Python: dfsclient.py; s25client's
+   uploadf, downlf, removef and dispfnames are built on it
+   ===================================================================== */
+#ifndef DFSCLIENT_H
+#define DFSCLIENT_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct dfs_client;
+
+// connects to S1; NULL when it cannot (errno says why)
+struct dfs_client *dfs_open(const char *host, int port);
+void dfs_close(struct dfs_client *c);
+// bounds each read and write of a call to ms (0: no bound, the default)
+void dfs_set_timeout(struct dfs_client *c, int ms);
+const char *dfs_last_error(const struct dfs_client *c);
+// names the next call's request for tracing (DFS_TRACE): S1 gets RID|<rid> ahead of it
+void dfs_set_request_id(struct dfs_client *c, const char *rid);
+
+// stores len bytes as <dest_dir>/<name>; dest_dir is a ~S1/ folder
+int dfs_upload(struct dfs_client *c, const char *dest_dir, const char *name, const void *data, size_t len);
+// the same from the next len bytes of fd (a local file), read a chunk at a time
+int dfs_upload_fd(struct dfs_client *c, const char *dest_dir, const char *name, int fd, size_t len);
+// a file's bytes into *data (malloc'd, free with dfs_free) and its size into *len
+int dfs_download(struct dfs_client *c, const char *path, void **data, size_t *len);
+// the same written to fd as they arrive
+int dfs_download_fd(struct dfs_client *c, const char *path, int fd, size_t *len);
+// several files in one request, as uploadf and downlf send them: up to 3 uploads into one
+// folder, each read from the next len bytes of its fd; 0 when S1 stored them all
+struct dfs_upfile
+{
+    const char *name;
+    int fd;
+    size_t len;
+};
+int dfs_upload_files(struct dfs_client *c, const char *dest_dir, const struct dfs_upfile *files, int n);
+// up to 2 downloads: open_fn gets the name and size of each file S1 sends and returns the fd its
+// bytes go to (-1 fails the call), close_fn then gets that fd back with ok 1 once they are all
+// written, 0 when the call failed on the way. 1 when some paths were not found (dfs_last_error
+// lists them), the others are still delivered
+typedef int (*dfs_open_fn)(void *arg, const char *name, size_t len);
+typedef void (*dfs_close_fn)(void *arg, int fd, const char *name, int ok);
+int dfs_download_files(struct dfs_client *c, const char *const *paths, int n, dfs_open_fn open_fn, dfs_close_fn close_fn, void *arg);
+int dfs_remove(struct dfs_client *c, const char *path);
+// the files of a ~S1/ folder, grouped by type as dispfnames shows them: fn is called once per
+// file with its extension ("" for none) and name; a non-zero return stops the listing there
+typedef int (*dfs_list_fn)(void *arg, const char *ext, const char *name);
+int dfs_list(struct dfs_client *c, const char *dir, dfs_list_fn fn, void *arg);
+
+void dfs_free(void *p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,125 @@
+"""Python binding for libdfsclient (dfsclient.h).
+
+One Client keeps one connection to S1 for all its calls, so a call costs one
+request/reply on a warm socket instead of a new connection per command.
+
+    from dfsclient import Client
+    with Client("127.0.0.1", 5001) as c:
+        c.upload("~S1/proj/", "a.c", b"int main(){}\\n")
+        data = c.download("~S1/proj/a.c")
+        for ext, name in c.list("~S1/proj/"):
+            ...
+        c.remove("~S1/proj/a.c")
+
+The library is bin/libdfsclient.so next to this file (make bin/libdfsclient.so),
+or the path in DFSCLIENT_LIB.
+"""
+import ctypes
+import os
+from pathlib import Path
+
+_LIST_FN = ctypes.CFUNCTYPE(ctypes.c_int, ctypes.c_void_p, ctypes.c_char_p, ctypes.c_char_p)
+
+
+class DFSError(Exception):
+    """A call S1 refused or that failed on the connection."""
+
+
+class NotFound(DFSError):
+    """The file is not in the DFS (download), or could not be removed (remove)."""
+
+
+def _load():
+    path = os.environ.get("DFSCLIENT_LIB") or str(Path(__file__).resolve().parent / "bin" / "libdfsclient.so")
+    lib = ctypes.CDLL(path, use_errno=True)
+    lib.dfs_open.argtypes = [ctypes.c_char_p, ctypes.c_int]
+    lib.dfs_open.restype = ctypes.c_void_p
+    lib.dfs_close.argtypes = [ctypes.c_void_p]
+    lib.dfs_close.restype = None
+    lib.dfs_set_timeout.argtypes = [ctypes.c_void_p, ctypes.c_int]
+    lib.dfs_set_timeout.restype = None
+    lib.dfs_last_error.argtypes = [ctypes.c_void_p]
+    lib.dfs_last_error.restype = ctypes.c_char_p
+    lib.dfs_upload.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t]
+    lib.dfs_upload.restype = ctypes.c_int
+    lib.dfs_download.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.POINTER(ctypes.c_void_p), ctypes.POINTER(ctypes.c_size_t)]
+    lib.dfs_download.restype = ctypes.c_int
+    lib.dfs_remove.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+    lib.dfs_remove.restype = ctypes.c_int
+    lib.dfs_list.argtypes = [ctypes.c_void_p, ctypes.c_char_p, _LIST_FN, ctypes.c_void_p]
+    lib.dfs_list.restype = ctypes.c_int
+    lib.dfs_free.argtypes = [ctypes.c_void_p]
+    lib.dfs_free.restype = None
+    return lib
+
+
+_lib = None
+
+
+def _library():
+    global _lib
+    if _lib is None:
+        _lib = _load()
+    return _lib
+
+
+class Client:
+    """A connection to S1. Not for use from several threads at once."""
+
+    def __init__(self, host="127.0.0.1", port=5001, timeout=10.0):
+        self._lib = _library()
+        self._c = self._lib.dfs_open(host.encode(), int(port))
+        if not self._c:
+            err = ctypes.get_errno()
+            raise DFSError(f"connect {host}:{port}: {os.strerror(err)}")
+        if timeout:
+            self._lib.dfs_set_timeout(self._c, int(timeout * 1000))
+
+    def close(self):
+        if self._c:
+            self._lib.dfs_close(self._c)
+            self._c = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    def __del__(self):
+        self.close()
+
+    def _check(self, rc):
+        if rc == 0:
+            return
+        msg = self._lib.dfs_last_error(self._c).decode(errors="replace")
+        raise (NotFound if rc == 1 else DFSError)(msg)
+
+    def upload(self, dest_dir, name, data):
+        """Stores data (bytes) as <dest_dir>/<name>."""
+        data = bytes(data)
+        self._check(self._lib.dfs_upload(self._c, dest_dir.encode(), name.encode(), data, len(data)))
+
+    def download(self, path):
+        """The bytes of a file; NotFound when it is not there."""
+        buf = ctypes.c_void_p()
+        n = ctypes.c_size_t()
+        self._check(self._lib.dfs_download(self._c, path.encode(), ctypes.byref(buf), ctypes.byref(n)))
+        try:
+            return ctypes.string_at(buf, n.value) if n.value else b""
+        finally:
+            self._lib.dfs_free(buf)
+
+    def remove(self, path):
+        self._check(self._lib.dfs_remove(self._c, path.encode()))
+
+    def list(self, directory):
+        """[(ext, name)] of a folder's files, grouped by type as S1 sends them."""
+        out = []
+
+        def add(_arg, ext, name):
+            out.append((ext.decode(errors="replace"), name.decode(errors="replace")))
+            return 0
+
+        self._check(self._lib.dfs_list(self._c, directory.encode(), _LIST_FN(add), None))
+        return out
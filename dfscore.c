@@ -0,0 +1,497 @@
+/* =====================================================================
+   dfscore: see dfscore.h
+   ===================================================================== */
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "dfscore.h"
+
+// S1 ------------------------------------------------------------------
+
+// sends exactly n_10 bytes to fd_10
+ssize_t write_all_10(int fd_10, const void *buf_10, size_t n_10)
+{
+    const char *p_10 = (const char*)buf_10; size_t left_10 = n_10;
+    while (left_10 > 0)
+    {
+        ssize_t w_10 = write(fd_10, p_10, left_10);
+        if (w_10 < 0)
+        {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        left_10 -= (size_t)w_10; p_10 += w_10;
+    }
+    return (ssize_t)n_10;
+}
+// reads text until a newline and stoes it into into buf_10
+int read_line_fd_10(int fd_10, char *buf_10, size_t cap_10, size_t *nread_10)
+{
+    size_t i_10 = 0;
+    *nread_10 = 0;
+    while (i_10 + 1 < cap_10)
+    {
+        char c_10; ssize_t r_10 = read(fd_10, &c_10, 1);
+        if (r_10 == 0)
+            break;
+        if (r_10 < 0)
+        {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        ++*nread_10;
+        if (c_10 == '\n') break;
+        buf_10[i_10++] = c_10;
+    }
+    buf_10[i_10] = '\0';
+    return (int)i_10;
+}
+
+// Turn "~S1/.." from the argument into an absolute path under "/home/USER/S1/..."
+// also creates the directory if it does not exists
+char *build_s1_path_10(const char *rel_10, int mk_10)
+{
+    const char *home_10 = getenv("HOME"); if (!home_10) home_10 = ".";
+    char *base_10 = NULL; asprintf(&base_10, "%s/%s", home_10, "S1");
+    if (mk_10)
+        mkdir(base_10, 0700);
+
+    char *out_10 = NULL;
+    if (rel_10 && rel_10[0])
+    {
+        const char *r_10 = rel_10;
+        if (strncmp(r_10, "~S1/", 4) == 0) r_10 += 4;  /* strip prefix */
+        asprintf(&out_10, "%s/%s", base_10, r_10);
+    }
+    else
+    {
+        out_10 = strdup(base_10);
+    }
+    free(base_10);
+
+    if (mk_10 && out_10)
+    {
+        // mkdir -p for parents
+        char *tmp_10 = strdup(out_10);
+        for (char *p_10 = tmp_10 + 1; *p_10; ++p_10)
+        {
+            if (*p_10 == '/')
+            {
+                *p_10 = '\0';
+                mkdir(tmp_10, 0700);
+                *p_10 = '/';
+            }
+        }
+        struct stat st_10;
+        if (stat(out_10, &st_10) != 0)
+            mkdir(out_10, 0700);
+        free(tmp_10);
+    }
+    return out_10;
+}
+//this functions gets the file extension from the arguments
+const char *ext_lower_10(const char *name_10)
+{
+    static char out_10[16];
+    const char *slash_10 = strrchr(name_10, '/');
+    if (slash_10)
+        name_10 = slash_10 + 1;   /* a dot in a directory name is not an extension */
+    const char *dot_10 = strrchr(name_10, '.');
+    if (!dot_10)
+        return "";
+    size_t n_10 = sizeof(out_10) - 1;
+    strncpy(out_10, dot_10, n_10); out_10[n_10] = 0;
+    for (char *p_10 = out_10; *p_10; ++p_10)
+        *p_10 = (char)tolower((unsigned char)*p_10);
+    return out_10;
+}
+
+struct route_10 ROUTES_10[MAX_ROUTES_10];
+int NROUTES_10;
+int DEFAULT_CLASS_10 = -1;
+
+// two level perfect hash (hash and displace): the first hash picks a bucket, the bucket's
+// displacement seeds the second hash that picks the slot holding the route index
+static unsigned PH_NB_10 = 1, PH_NS_10 = 1;
+static unsigned short PH_DISP_10[PH_BUCKETS_10];
+static short PH_SLOT_10[PH_SLOTS_10];
+
+unsigned ph_hash_10(const char *s_10, unsigned seed_10)
+{
+    unsigned h_10 = 2166136261u ^ (seed_10 * 0x9e3779b9u);
+    for (; *s_10; ++s_10)
+        h_10 = (h_10 ^ (unsigned char)*s_10) * 16777619u;
+    h_10 ^= h_10 >> 16;
+    h_10 *= 0x45d9f3bu;
+    h_10 ^= h_10 >> 16;
+    return h_10;
+}
+
+// places the biggest buckets first, trying displacements until every key of a bucket lands
+// in a free slot; with the table at most half full this takes a handful of tries per bucket
+int ph_build_10(void)
+{
+    PH_NS_10 = 8;
+    while (PH_NS_10 < 2u * (unsigned)NROUTES_10)
+        PH_NS_10 <<= 1;
+    PH_NB_10 = 1;
+    while (PH_NB_10 * 2 <= (unsigned)NROUTES_10 / 2 && PH_NB_10 < PH_BUCKETS_10)
+        PH_NB_10 <<= 1;
+    memset(PH_SLOT_10, 0xff, sizeof PH_SLOT_10);
+    memset(PH_DISP_10, 0, sizeof PH_DISP_10);
+
+    int size_10[PH_BUCKETS_10] = { 0 }, max_10 = 0;
+    for (int r_10 = 0; r_10 < NROUTES_10; ++r_10)
+    {
+        int b_10 = (int)(ph_hash_10(ROUTES_10[r_10].ext, 0) & (PH_NB_10 - 1));
+        if (++size_10[b_10] > max_10)
+            max_10 = size_10[b_10];
+    }
+    for (int want_10 = max_10; want_10 > 0; --want_10)
+    {
+        for (unsigned b_10 = 0; b_10 < PH_NB_10; ++b_10)
+        {
+            if (size_10[b_10] != want_10)
+                continue;
+            int keys_10[MAX_ROUTES_10], nk_10 = 0;
+            for (int r_10 = 0; r_10 < NROUTES_10; ++r_10)
+                if ((ph_hash_10(ROUTES_10[r_10].ext, 0) & (PH_NB_10 - 1)) == b_10)
+                    keys_10[nk_10++] = r_10;
+            unsigned d_10;
+            for (d_10 = 1; d_10 < 65535; ++d_10)
+            {
+                unsigned s_10[MAX_ROUTES_10];
+                int ok_10 = 1;
+                for (int k_10 = 0; k_10 < nk_10 && ok_10; ++k_10)
+                {
+                    s_10[k_10] = ph_hash_10(ROUTES_10[keys_10[k_10]].ext, d_10) & (PH_NS_10 - 1);
+                    if (PH_SLOT_10[s_10[k_10]] >= 0)
+                        ok_10 = 0;
+                    for (int j_10 = 0; j_10 < k_10 && ok_10; ++j_10)
+                        if (s_10[j_10] == s_10[k_10])
+                            ok_10 = 0;
+                }
+                if (!ok_10)
+                    continue;
+                for (int k_10 = 0; k_10 < nk_10; ++k_10)
+                    PH_SLOT_10[s_10[k_10]] = (short)keys_10[k_10];
+                PH_DISP_10[b_10] = (unsigned short)d_10;
+                break;
+            }
+            if (d_10 == 65535)
+                return -1;
+        }
+    }
+    return 0;
+}
+
+// class of an already lowercased extension ("" for none), or -1 when it is refused
+int route_ext_10(const char *ext_10)
+{
+    if (NROUTES_10)
+    {
+        unsigned b_10 = ph_hash_10(ext_10, 0) & (PH_NB_10 - 1);
+        int r_10 = PH_SLOT_10[ph_hash_10(ext_10, PH_DISP_10[b_10]) & (PH_NS_10 - 1)];
+        if (r_10 >= 0 && !strcmp(ROUTES_10[r_10].ext, ext_10))
+            return ROUTES_10[r_10].cls;
+    }
+    return DEFAULT_CLASS_10;
+}
+// class for a file name or path
+int route_10(const char *name_10)
+{
+    return route_ext_10(ext_lower_10(name_10));
+}
+// a later route for the same extension replaces the earlier one
+int route_add_10(const char *ext_10, int cls_10)
+{
+    char low_10[EXT_MAX_10];
+    size_t n_10 = strlen(ext_10);
+    if (ext_10[0] != '.' || n_10 < 2 || n_10 >= sizeof low_10)
+        return -1;
+    for (size_t i_10 = 0; i_10 <= n_10; ++i_10)
+        low_10[i_10] = (char)tolower((unsigned char)ext_10[i_10]);
+    for (int r_10 = 0; r_10 < NROUTES_10; ++r_10)
+        if (!strcmp(ROUTES_10[r_10].ext, low_10))
+        {
+            ROUTES_10[r_10].cls = cls_10;
+            return 0;
+        }
+    if (NROUTES_10 == MAX_ROUTES_10)
+        return -1;
+    memcpy(ROUTES_10[NROUTES_10].ext, low_10, n_10 + 1);
+    ROUTES_10[NROUTES_10++].cls = cls_10;
+    return 0;
+}
+
+//sends the entire file to fd_10 (reads a file and push bytes to the socket)
+int send_file_from_path_10(int fd_10, const char *src_path_10, size_t *osz_10, ssize_t (*wr_10)(int, const void *, size_t))
+{
+    int in_10 = open(src_path_10, O_RDONLY);
+    if (in_10 < 0)
+        return -1;
+    struct stat st_10;
+    if (fstat(in_10, &st_10) != 0)
+    {
+        close(in_10);
+        return -1;
+    }
+    if (osz_10) *osz_10 = (size_t)st_10.st_size;
+
+    char *buf_10 = (char*)malloc(CHUNK_10);
+    if (!buf_10)
+    {
+        close(in_10);
+        return -1;
+    }
+    for (;;)
+    {
+        ssize_t r_10 = read(in_10, buf_10, CHUNK_10);
+        if (r_10 < 0)
+        {
+            if (errno==EINTR) continue;
+            free(buf_10); close(in_10);
+            return -1;
+        }
+        if (r_10 == 0) break;
+        if (wr_10(fd_10, buf_10, (size_t)r_10) != r_10)
+        {
+            free(buf_10);
+            close(in_10);
+            return -1;
+        }
+    }
+    free(buf_10);
+    close(in_10);
+    return 0;
+}
+
+// small helper for saving copies
+//keeps files that user downloads like tar files etc
+static int path_exists_10(const char *p_10)
+{
+    struct stat st_10; return (stat(p_10, &st_10) == 0);
+}
+char *unique_dest_path_10(const char *dir_10, const char *name_10)
+{
+    char *dst_10 = NULL;
+    asprintf(&dst_10, "%s/%s", dir_10, name_10);
+    if(!path_exists_10(dst_10))
+        return dst_10;
+
+    const char *dot_10 = strrchr(name_10, '.');
+    size_t base_len_10 = (dot_10 && dot_10 != name_10) ? (size_t)(dot_10 - name_10) : strlen(name_10);
+    char *base_10 = strndup(name_10, base_len_10);
+    const char *ext_10 = (dot_10 && dot_10 != name_10) ? dot_10 : "";
+
+    free(dst_10); dst_10 = NULL;
+    for(int n_10=1;;++n_10)
+    {
+        asprintf(&dst_10, "%s/%s_%d%s", dir_10, base_10, n_10, ext_10);
+        if(!path_exists_10(dst_10))
+        {
+            free(base_10);
+            return dst_10;
+        }
+        free(dst_10);
+        dst_10 = NULL;
+    }
+}
+
+// copies files to S1 directory
+int archive_copy_10(const char *subdir_10, const char *name_10, const char *src_path_10)
+{
+    char *rel_10 = NULL;
+    asprintf(&rel_10, "~S1/%s", subdir_10);
+    char *adir_10 = build_s1_path_10(rel_10, 1);  /* ensure dir exists */
+    free(rel_10);
+
+    char *dst_10 = unique_dest_path_10(adir_10, name_10);
+    free(adir_10);
+    if(!dst_10)
+        return -1;
+
+    int in_10 = open(src_path_10, O_RDONLY);
+    if (in_10 < 0)
+    {
+        free(dst_10);
+        return -1;
+    }
+    int out_10 = open(dst_10, O_CREAT|O_TRUNC|O_WRONLY, 0600);
+    if (out_10 < 0)
+    {
+        close(in_10);
+        free(dst_10);
+        return -1;
+    }
+
+    char *buf_10 = (char*)malloc(CHUNK_10);
+    if(!buf_10)
+    {
+        close(in_10);
+        close(out_10);
+        free(dst_10);
+        return -1;
+    }
+    for(;;)
+    {
+        ssize_t r_10 = read(in_10, buf_10, CHUNK_10);
+        if(r_10 < 0)
+        {
+            if(errno==EINTR) continue;
+            free(buf_10); close(in_10);
+            close(out_10);
+            free(dst_10);
+            return -1;
+        }
+        if(r_10 == 0) break;
+
+        if(write_all_10(out_10, buf_10, (size_t)r_10) != r_10)
+        {
+            free(buf_10); close(in_10); close(out_10); free(dst_10);
+            return -1;
+        }
+    }
+    free(buf_10); close(in_10); close(out_10); free(dst_10);
+    return 0;
+}
+
+int compare_str_10(const void *a_10, const void *b_10)
+{
+    char * const *aa_10 = (char* const*)a_10;
+    char * const *bb_10 = (char* const*)b_10;
+    return strcasecmp(*aa_10, *bb_10);
+}
+
+// S2 ------------------------------------------------------------------
+
+//builds the root folder for S2
+char *base_20(void)
+{
+    const char *home_20=getenv("HOME");
+    if(!home_20) home_20=".";
+    char *p_20=NULL;
+    asprintf(&p_20,"%s/%s",home_20,"S2");
+    mkdir(p_20,0700);
+    return p_20;
+}
+
+//creates absolute path inside S2 if needed
+char *join_20(const char *rel_20)
+{
+    char *b_20=base_20();
+    char *out_20=NULL;
+    asprintf(&out_20,"%s/%s",b_20, rel_20 && *rel_20? rel_20:"");
+    free(b_20);
+
+    //creates missing folders one by one
+    char *tmp_20=strdup(out_20);
+    for(char *p_20=tmp_20+1; *p_20; ++p_20)
+    {
+        if(*p_20=='/')
+        {
+            *p_20=0;
+            mkdir(tmp_20,0700);
+            *p_20='/';
+        }
+    }
+    free(tmp_20);
+    return out_20;
+}
+
+//sends the rest of an open file to fd, a buffer at a time
+int send_fd_20(int in_20, int fd_20, ssize_t (*rd_20)(int, void *, size_t), ssize_t (*wr_20)(int, const void *, size_t))
+{
+    char *buf_20=malloc(CHUNK_20);
+    if(!buf_20)
+        return -1;
+    int rc_20=0;
+    for(;;)
+    {
+        ssize_t r_20=rd_20(in_20,buf_20,CHUNK_20);
+        if(r_20<0)
+        {
+            if(errno==EINTR)
+                continue;
+            rc_20=-1;
+            break;
+        }
+        if(r_20==0)
+            break;
+        if(wr_20(fd_20,buf_20,(size_t)r_20)!=r_20)
+        {
+            rc_20=-1;
+            break;
+        }
+    }
+    free(buf_20);
+    return rc_20;
+}
+
+// s25client -----------------------------------------------------------
+
+static ssize_t write_all_50(int fd_50, const void *buf_50, size_t n_50)
+{
+    const char *p_50=(const char*)buf_50; size_t left_50=n_50;
+    while(left_50>0)
+    {
+        ssize_t w_50=write(fd_50,p_50,left_50);
+        if(w_50<0)
+        {
+            if(errno==EINTR)
+                continue;
+            return -1;
+        }
+        left_50 -= (size_t)w_50;
+        p_50 += w_50;
+    }
+    return (ssize_t)n_50;
+}
+
+//saves bytes from S1 into a local file
+int recv_file_50(int fd_50, const char *out_50, size_t sz_50)
+{
+    int outfd_50=open(out_50,O_CREAT|O_TRUNC|O_WRONLY,0600);
+    if(outfd_50<0)
+    {
+        perror("open out");
+        return -1;
+    }
+    char *buf_50 = malloc(CHUNK_50);
+    if(!buf_50)
+    {
+        close(outfd_50);
+        return -1;
+    }
+    size_t left_50=sz_50;
+    while(left_50>0)
+    {
+        size_t want_50 = left_50>CHUNK_50 ? CHUNK_50 : left_50;
+        ssize_t r_50 = read(fd_50,buf_50,want_50);
+        if(r_50<0 && errno==EINTR)
+            continue;
+        if(r_50<=0)
+        {
+            free(buf_50);
+            close(outfd_50);
+            return -1;
+        }
+        if(write_all_50(outfd_50,buf_50,(size_t)r_50)!=r_50)
+        {
+            free(buf_50);
+            close(outfd_50);
+            return -1;
+        }
+        left_50 -= (size_t)r_50;
+    }
+    free(buf_50); close(outfd_50); return 0;
+}
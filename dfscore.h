@@ -0,0 +1,65 @@
+/* =====================================================================
+   dfscore: the copy loops, line reader, path and routing helpers that
+   S1, S2 and s25client run on every request, in one place so microbench
+   times the same code. Each keeps the suffix of the program it belongs to;
+   the programs wrap them with their own buffering and byte accounting.
+   ===================================================================== */
+#ifndef DFSCORE_H
+#define DFSCORE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+//the size of the copy buffers of S1, S2 and s25client
+#define CHUNK_10 8192
+#define CHUNK_20 8192
+#define CHUNK_50 8192
+
+// S1 ------------------------------------------------------------------
+
+#define MAX_ROUTES_10 256
+#define EXT_MAX_10 16
+#define PH_SLOTS_10 512   /* power of two, at least 2 * MAX_ROUTES_10 */
+#define PH_BUCKETS_10 128
+
+// the routing table: lowercased extension -> storage class (S1's CLASSES_10 index)
+struct route_10
+{
+    char ext[EXT_MAX_10];
+    int cls;
+};
+extern struct route_10 ROUTES_10[MAX_ROUTES_10];
+extern int NROUTES_10;
+extern int DEFAULT_CLASS_10;
+
+// writes all n bytes to fd, retrying short writes and EINTR
+ssize_t write_all_10(int fd_10, const void *buf_10, size_t n_10);
+// reads one line a byte at a time (the newline is dropped); *nread_10 gets the bytes consumed
+int read_line_fd_10(int fd_10, char *buf_10, size_t cap_10, size_t *nread_10);
+// a whole file to fd through wr_10, which S1 passes as its buffered, counted write_fully_10
+int send_file_from_path_10(int fd_10, const char *src_path_10, size_t *osz_10, ssize_t (*wr_10)(int, const void *, size_t));
+char *build_s1_path_10(const char *rel_10, int mk_10);
+char *unique_dest_path_10(const char *dir_10, const char *name_10);
+int archive_copy_10(const char *subdir_10, const char *name_10, const char *src_path_10);
+int compare_str_10(const void *a_10, const void *b_10);
+const char *ext_lower_10(const char *name_10);
+// FNV-1a with a seed and a final mix; the perfect hash's two hashes and the ring's points
+unsigned ph_hash_10(const char *s_10, unsigned seed_10);
+int route_add_10(const char *ext_10, int cls_10);
+int ph_build_10(void);
+int route_ext_10(const char *ext_10);
+int route_10(const char *name_10);
+
+// S2 ------------------------------------------------------------------
+
+char *base_20(void);
+char *join_20(const char *rel_20);
+// the rest of an open file to fd, read through rd_20 and written through wr_20 (S2 passes its
+// timed disk_read_20 and write_fully_20); 0 at the end of the file, -1 when either side failed
+int send_fd_20(int in_20, int fd_20, ssize_t (*rd_20)(int, void *, size_t), ssize_t (*wr_20)(int, const void *, size_t));
+
+// s25client -----------------------------------------------------------
+
+int recv_file_50(int fd_50, const char *out_50, size_t sz_50);
+
+#endif
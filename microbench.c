@@ -0,0 +1,602 @@
+/*HOW TO RUN
+    - All benchmarks:   ./microbench
+    - Only some:        ./microbench -f copy
+    - JSON output:      ./microbench -j > micro.json
+   The copy loops, line reader and helpers under test live in dfscore.c,
+   which S1/S2/s25client are built from as well, so every number here
+   comes from the code they run in production.
+   ===================================================================== */
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dfscore.h"
+
+//longest line the line reader benchmark reads, as S1's LINE_MAX_10
+#define LINE_MAX_70 4096
+
+//benchmark settings, overridable from argv
+static size_t FILE_MB_70 = 64;
+static double MIN_SECS_70 = 0.3;
+static const char *FILTER_70 = NULL;
+static int JSON_70 = 0;
+static size_t SORT_MAX_70 = 1000000;
+static int first_result_70 = 1;
+
+static double now_s_70(void)
+{
+    struct timespec ts_70;
+    clock_gettime(CLOCK_MONOTONIC, &ts_70);
+    return (double)ts_70.tv_sec + (double)ts_70.tv_nsec/1e9;
+}
+
+static int wanted_70(const char *name_70)
+{
+    return !FILTER_70 || strstr(name_70, FILTER_70) != NULL;
+}
+
+//prints one result as a table row or a JSON array element
+static void result_70(const char *name_70, const char *param_70, double value_70, const char *unit_70)
+{
+    if (JSON_70)
+    {
+        printf("%s\n    {\"name\": \"%s\", \"param\": \"%s\", \"value\": %.3f, \"unit\": \"%s\"}",
+            first_result_70 ? "" : ",", name_70, param_70, value_70, unit_70);
+    }
+    else
+    {
+        printf("%-28s %-18s %14.2f %s\n", name_70, param_70, value_70, unit_70);
+    }
+    first_result_70 = 0;
+    fflush(stdout);
+}
+
+//loopback sockets with a helper thread on the far end
+
+//the drain thread reads and drops everything, counting the bytes it saw
+struct peer_70
+{
+    int fd;
+    pthread_t th;
+    volatile unsigned long long seen;
+    char *buf;
+    size_t buflen;
+};
+
+static void *drain_main_70(void *arg_70)
+{
+    struct peer_70 *p_70 = (struct peer_70*)arg_70;
+    char *buf_70 = malloc(1<<20);
+    for (;;)
+    {
+        ssize_t r_70 = read(p_70->fd, buf_70, 1<<20);
+        if (r_70 < 0 && errno == EINTR)
+            continue;
+        if (r_70 <= 0)
+            break;
+        __atomic_add_fetch(&p_70->seen, (unsigned long long)r_70, __ATOMIC_RELEASE);
+    }
+    free(buf_70);
+    return NULL;
+}
+
+//the feed thread writes p_70->buf over and over until the other side closes
+static void *feed_main_70(void *arg_70)
+{
+    struct peer_70 *p_70 = (struct peer_70*)arg_70;
+    for (;;)
+    {
+        if (write_all_10(p_70->fd, p_70->buf, p_70->buflen) < 0)
+            break;
+    }
+    return NULL;
+}
+
+//connected TCP pair over 127.0.0.1, like S1 <-> backend in the default deployment
+static int tcp_pair_70(int *a_70, int *b_70)
+{
+    int l_70 = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in sa_70; memset(&sa_70, 0, sizeof sa_70);
+    sa_70.sin_family = AF_INET;
+    sa_70.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t sl_70 = sizeof sa_70;
+    if (l_70 < 0 || bind(l_70, (struct sockaddr*)&sa_70, sizeof sa_70) != 0 || listen(l_70, 1) != 0 ||
+        getsockname(l_70, (struct sockaddr*)&sa_70, &sl_70) != 0)
+        return -1;
+    *a_70 = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(*a_70, (struct sockaddr*)&sa_70, sizeof sa_70) != 0)
+        return -1;
+    *b_70 = accept(l_70, NULL, NULL);
+    close(l_70);
+    return *b_70 < 0 ? -1 : 0;
+}
+
+static void start_drain_70(struct peer_70 *p_70, int fd_70)
+{
+    memset(p_70, 0, sizeof *p_70);
+    p_70->fd = fd_70;
+    pthread_create(&p_70->th, NULL, drain_main_70, p_70);
+}
+static void wait_drained_70(struct peer_70 *p_70, unsigned long long total_70)
+{
+    while (__atomic_load_n(&p_70->seen, __ATOMIC_ACQUIRE) < total_70)
+        sched_yield();
+}
+static void stop_peer_70(struct peer_70 *p_70, int my_fd_70)
+{
+    shutdown(my_fd_70, SHUT_RDWR);
+    close(my_fd_70);
+    pthread_join(p_70->th, NULL);
+    close(p_70->fd);
+}
+
+//file -> socket copies
+
+enum { COPY_RW_70, COPY_SENDFILE_70, COPY_SPLICE_70 };
+
+//one pass of src file to socket with the given technique and chunk size
+static int copy_once_70(int kind_70, const char *src_70, int out_70, size_t chunk_70, char *buf_70, int pipefd_70[2])
+{
+    int in_70 = open(src_70, O_RDONLY);
+    if (in_70 < 0)
+        return -1;
+    int rc_70 = 0;
+    if (kind_70 == COPY_RW_70)
+    {
+        for (;;)
+        {
+            ssize_t r_70 = read(in_70, buf_70, chunk_70);
+            if (r_70 < 0 && errno == EINTR)
+                continue;
+            if (r_70 <= 0)
+                break;
+            if (write_all_10(out_70, buf_70, (size_t)r_70) != r_70)
+            {
+                rc_70 = -1;
+                break;
+            }
+        }
+    }
+    else if (kind_70 == COPY_SENDFILE_70)
+    {
+        for (;;)
+        {
+            ssize_t r_70 = sendfile(out_70, in_70, NULL, chunk_70);
+            if (r_70 < 0 && errno == EINTR)
+                continue;
+            if (r_70 <= 0)
+            {
+                rc_70 = r_70 < 0 ? -1 : 0;
+                break;
+            }
+        }
+    }
+    else
+    {
+        for (;;)
+        {
+            ssize_t r_70 = splice(in_70, NULL, pipefd_70[1], NULL, chunk_70, SPLICE_F_MOVE);
+            if (r_70 < 0 && errno == EINTR)
+                continue;
+            if (r_70 <= 0)
+            {
+                rc_70 = r_70 < 0 ? -1 : 0;
+                break;
+            }
+            while (r_70 > 0)
+            {
+                ssize_t w_70 = splice(pipefd_70[0], NULL, out_70, NULL, (size_t)r_70, SPLICE_F_MOVE|SPLICE_F_MORE);
+                if (w_70 < 0 && errno == EINTR)
+                    continue;
+                if (w_70 <= 0)
+                {
+                    close(in_70);
+                    return -1;
+                }
+                r_70 -= w_70;
+            }
+        }
+    }
+    close(in_70);
+    return rc_70;
+}
+
+static void bench_copy_techniques_70(const char *src_70, size_t size_70)
+{
+    static const size_t chunks_70[] = { 4096, 8192, 65536, 262144, 1048576 };
+    static const char *names_70[] = { "copy.read_write", "copy.sendfile", "copy.splice" };
+    for (int kind_70 = COPY_RW_70; kind_70 <= COPY_SPLICE_70; ++kind_70)
+    {
+        if (!wanted_70(names_70[kind_70]))
+            continue;
+        for (size_t c = 0; c < sizeof chunks_70/sizeof chunks_70[0]; ++c)
+        {
+            int a_70, b_70, pfd_70[2];
+            if (tcp_pair_70(&a_70, &b_70) != 0 || pipe(pfd_70) != 0)
+                return;
+            fcntl(pfd_70[1], F_SETPIPE_SZ, (int)chunks_70[c]);
+            struct peer_70 p_70; start_drain_70(&p_70, b_70);
+            char *buf_70 = malloc(chunks_70[c]);
+            unsigned long long total_70 = 0;
+            double t0_70 = now_s_70(), el_70;
+            do
+            {
+                if (copy_once_70(kind_70, src_70, a_70, chunks_70[c], buf_70, pfd_70) != 0)
+                    break;
+                total_70 += size_70;
+                wait_drained_70(&p_70, total_70);
+                el_70 = now_s_70() - t0_70;
+            } while (el_70 < MIN_SECS_70);
+            el_70 = now_s_70() - t0_70;
+            char param_70[64]; snprintf(param_70, sizeof param_70, "chunk=%zuK", chunks_70[c]/1024);
+            result_70(names_70[kind_70], param_70, (double)total_70/el_70/1e6, "MB/s");
+            free(buf_70);
+            close(pfd_70[0]); close(pfd_70[1]);
+            stop_peer_70(&p_70, a_70);
+        }
+    }
+}
+
+//the production copy loops, each run against the same page-cached file
+
+static void bench_prod_send_70(const char *src_70, size_t size_70)
+{
+    for (int which_70 = 0; which_70 < 2; ++which_70)
+    {
+        const char *name_70 = which_70 == 0 ? "prod.send_file_from_path_10" : "prod.send_fd_20";
+        if (!wanted_70(name_70))
+            continue;
+        int a_70, b_70;
+        if (tcp_pair_70(&a_70, &b_70) != 0)
+            return;
+        struct peer_70 p_70; start_drain_70(&p_70, b_70);
+        unsigned long long total_70 = 0;
+        double t0_70 = now_s_70(), el_70;
+        do
+        {
+            int rc_70;
+            if (which_70 == 0)
+                rc_70 = send_file_from_path_10(a_70, src_70, NULL, write_all_10);
+            else
+            {
+                //S2's fetch opens the file and hands it to send_fd_20
+                int in_70 = open(src_70, O_RDONLY);
+                if (in_70 < 0)
+                    break;
+                rc_70 = send_fd_20(in_70, a_70, read, write_all_10);
+                close(in_70);
+            }
+            if (rc_70 != 0)
+                break;
+            total_70 += size_70;
+            wait_drained_70(&p_70, total_70);
+            el_70 = now_s_70() - t0_70;
+        } while (el_70 < MIN_SECS_70);
+        el_70 = now_s_70() - t0_70;
+        result_70(name_70, "file->tcp", (double)total_70/el_70/1e6, "MB/s");
+        stop_peer_70(&p_70, a_70);
+    }
+}
+
+static void bench_prod_recv_70(const char *outdir_70, size_t size_70)
+{
+    if (!wanted_70("prod.recv_file_50"))
+        return;
+    int a_70, b_70;
+    if (tcp_pair_70(&a_70, &b_70) != 0)
+        return;
+    struct peer_70 p_70; memset(&p_70, 0, sizeof p_70);
+    p_70.fd = b_70;
+    p_70.buflen = 1<<20;
+    p_70.buf = calloc(1, p_70.buflen);
+    pthread_create(&p_70.th, NULL, feed_main_70, &p_70);
+    char *out_70 = NULL; asprintf(&out_70, "%s/recv.bin", outdir_70);
+    unsigned long long total_70 = 0;
+    double t0_70 = now_s_70(), el_70;
+    do
+    {
+        if (recv_file_50(a_70, out_70, size_70) != 0)
+            break;
+        total_70 += size_70;
+        el_70 = now_s_70() - t0_70;
+    } while (el_70 < MIN_SECS_70);
+    el_70 = now_s_70() - t0_70;
+    result_70("prod.recv_file_50", "tcp->file", (double)total_70/el_70/1e6, "MB/s");
+    stop_peer_70(&p_70, a_70);
+    unlink(out_70); free(out_70); free(p_70.buf);
+}
+
+static void bench_prod_archive_70(const char *src_70, size_t size_70)
+{
+    if (!wanted_70("prod.archive_copy_10"))
+        return;
+    unsigned long long total_70 = 0;
+    double t0_70 = now_s_70(), el_70;
+    do
+    {
+        if (archive_copy_10("microbench_copies", "copy.bin", src_70) != 0)
+            break;
+        total_70 += size_70;
+        el_70 = now_s_70() - t0_70;
+    } while (el_70 < MIN_SECS_70);
+    el_70 = now_s_70() - t0_70;
+    result_70("prod.archive_copy_10", "file->file", (double)total_70/el_70/1e6, "MB/s");
+    //archive_copy_10 never overwrites, so clear out the numbered copies it made
+    char *dir_70 = build_s1_path_10("~S1/microbench_copies", 0);
+    char *cmd_70 = NULL; asprintf(&cmd_70, "rm -rf '%s'", dir_70);
+    if (system(cmd_70) != 0) {}
+    free(cmd_70); free(dir_70);
+}
+
+//line parsing
+
+//a buffered reader for comparison with the byte at a time read_line_fd_10
+struct lbuf_70
+{
+    int fd;
+    size_t pos, len;
+    char buf[65536];
+};
+static int read_line_buffered_70(struct lbuf_70 *lb_70, char *out_70, size_t cap_70)
+{
+    size_t i_70 = 0;
+    for (;;)
+    {
+        if (lb_70->pos == lb_70->len)
+        {
+            ssize_t r_70 = read(lb_70->fd, lb_70->buf, sizeof lb_70->buf);
+            if (r_70 < 0 && errno == EINTR)
+                continue;
+            if (r_70 <= 0)
+                return -1;
+            lb_70->pos = 0; lb_70->len = (size_t)r_70;
+        }
+        char *start_70 = lb_70->buf + lb_70->pos;
+        char *nl_70 = memchr(start_70, '\n', lb_70->len - lb_70->pos);
+        size_t avail_70 = nl_70 ? (size_t)(nl_70 - start_70) : lb_70->len - lb_70->pos;
+        size_t room_70 = cap_70 - 1 - i_70;
+        size_t take_70 = avail_70 < room_70 ? avail_70 : room_70;   /* overlong lines are cut */
+        memcpy(out_70 + i_70, start_70, take_70);
+        i_70 += take_70;
+        lb_70->pos += avail_70;
+        if (nl_70)
+        {
+            lb_70->pos++;
+            break;
+        }
+    }
+    out_70[i_70] = '\0';
+    return (int)i_70;
+}
+
+static void bench_lines_70(void)
+{
+    //one block of typical listing lines, written repeatedly by the feed thread
+    char *block_70 = NULL; size_t blen_70 = 0;
+    FILE *mf_70 = open_memstream(&block_70, &blen_70);
+    int lines_per_block_70 = 2000;
+    for (int i = 0; i < lines_per_block_70; ++i)
+        fprintf(mf_70, "NAME|.pdf|report_%06d_final.pdf\n", i);
+    fclose(mf_70);
+
+    for (int which_70 = 0; which_70 < 2; ++which_70)
+    {
+        const char *name_70 = which_70 == 0 ? "parse.read_line_fd_10" : "parse.read_line_buffered";
+        if (!wanted_70(name_70))
+            continue;
+        int a_70, b_70;
+        if (tcp_pair_70(&a_70, &b_70) != 0)
+            break;
+        struct peer_70 p_70; memset(&p_70, 0, sizeof p_70);
+        p_70.fd = b_70; p_70.buf = block_70; p_70.buflen = blen_70;
+        pthread_create(&p_70.th, NULL, feed_main_70, &p_70);
+        struct lbuf_70 *lb_70 = calloc(1, sizeof *lb_70);
+        lb_70->fd = a_70;
+        char line_70[LINE_MAX_70];
+        size_t got_70;
+        unsigned long long n_70 = 0;
+        double t0_70 = now_s_70(), el_70;
+        do
+        {
+            for (int i = 0; i < lines_per_block_70; ++i)
+            {
+                if (which_70 == 0)
+                    read_line_fd_10(a_70, line_70, sizeof line_70, &got_70);
+                else
+                    read_line_buffered_70(lb_70, line_70, sizeof line_70);
+            }
+            n_70 += (unsigned long long)lines_per_block_70;
+            el_70 = now_s_70() - t0_70;
+        } while (el_70 < MIN_SECS_70);
+        result_70(name_70, "listing lines", (double)n_70/el_70/1e6, "Mlines/s");
+        shutdown(a_70, SHUT_RDWR);
+        close(a_70);
+        pthread_join(p_70.th, NULL);
+        close(b_70);
+        free(lb_70);
+    }
+
+    if (wanted_70("parse.strtok_r_header"))
+    {
+        unsigned long long n_70 = 0, sum_70 = 0;
+        double t0_70 = now_s_70(), el_70;
+        do
+        {
+            for (int i = 0; i < 10000; ++i)
+            {
+                char hdr_70[] = "FILERESP|quarterly_report_2024.pdf|1048576";
+                char *save_70 = NULL;
+                char *name_70 = strtok_r(hdr_70+9, "|", &save_70);
+                char *szs_70 = strtok_r(NULL, "|", &save_70);
+                sum_70 += (unsigned long long)strtoull(szs_70, NULL, 10) + (unsigned char)name_70[0];
+            }
+            n_70 += 10000;
+            el_70 = now_s_70() - t0_70;
+        } while (el_70 < MIN_SECS_70);
+        result_70("parse.strtok_r_header", sum_70 ? "FILERESP" : "-", (double)n_70/el_70/1e6, "Mops/s");
+    }
+    free(block_70);
+}
+
+//listing sort with the same comparator handle_disp_10 uses
+static void bench_sort_70(void)
+{
+    if (!wanted_70("sort.compare_str_10"))
+        return;
+    uint64_t rng_70 = 88172645463325252ULL;
+    for (size_t n_70 = 1000; n_70 <= SORT_MAX_70; n_70 *= 10)
+    {
+        char **names_70 = malloc(sizeof(char*)*n_70);
+        char **work_70 = malloc(sizeof(char*)*n_70);
+        for (size_t i = 0; i < n_70; ++i)
+        {
+            rng_70 ^= rng_70 << 13; rng_70 ^= rng_70 >> 7; rng_70 ^= rng_70 << 17;
+            asprintf(&names_70[i], "%sFile_%012llx.pdf", (rng_70 & 1) ? "" : "the_", (unsigned long long)(rng_70 >> 8));
+        }
+        int runs_70 = 0;
+        double t0_70 = now_s_70(), el_70;
+        do
+        {
+            memcpy(work_70, names_70, sizeof(char*)*n_70);
+            qsort(work_70, n_70, sizeof(char*), compare_str_10);
+            runs_70++;
+            el_70 = now_s_70() - t0_70;
+        } while (el_70 < MIN_SECS_70);
+        char param_70[64]; snprintf(param_70, sizeof param_70, "n=%zu", n_70);
+        result_70("sort.compare_str_10", param_70, el_70/runs_70*1e3, "ms/sort");
+        for (size_t i = 0; i < n_70; ++i)
+            free(names_70[i]);
+        free(names_70); free(work_70);
+    }
+}
+
+//path building as done for every request
+static void bench_paths_70(void)
+{
+    if (!wanted_70("path.build_s1_path_10"))
+        return;
+    unsigned long long n_70 = 0;
+    double t0_70 = now_s_70(), el_70;
+    do
+    {
+        for (int i = 0; i < 10000; ++i)
+            free(build_s1_path_10("~S1/projects/2024/reports/summary.pdf", 0));
+        n_70 += 10000;
+        el_70 = now_s_70() - t0_70;
+    } while (el_70 < MIN_SECS_70);
+    result_70("path.build_s1_path_10", "mk=0", (double)n_70/el_70/1e6, "Mops/s");
+}
+
+//extension routing as done for every uploaded, fetched or removed file, with the built-in
+//table and with a large one, to show the lookup cost does not grow with the table
+static void bench_route_70(void)
+{
+    if (!wanted_70("route.route_10"))
+        return;
+    //S1's built-in table
+    route_add_10(".c", 0);
+    route_add_10(".pdf", 1);
+    route_add_10(".txt", 2);
+    route_add_10(".zip", 3);
+    DEFAULT_CLASS_10 = 0;
+    for (int pass_70 = 0; pass_70 < 2; ++pass_70)
+    {
+        if (pass_70 == 1)
+            for (int i = 0; NROUTES_10 < MAX_ROUTES_10; ++i)
+            {
+                char ext_70[16]; snprintf(ext_70, sizeof ext_70, ".x%d", i);
+                route_add_10(ext_70, 1 + i % 3);
+            }
+        if (ph_build_10() != 0)
+            return;
+        unsigned long long n_70 = 0, sum_70 = 0;
+        double t0_70 = now_s_70(), el_70;
+        do
+        {
+            for (int i = 0; i < 10000; ++i)
+                sum_70 += (unsigned)route_10((i & 1) ? "~S1/projects/2024/reports/summary.PDF" : "~S1/src/main.c");
+            n_70 += 10000;
+            el_70 = now_s_70() - t0_70;
+        } while (el_70 < MIN_SECS_70);
+        char param_70[64]; snprintf(param_70, sizeof param_70, "routes=%d", NROUTES_10);
+        result_70("route.route_10", sum_70 ? param_70 : "-", (double)n_70/el_70/1e6, "Mops/s");
+    }
+}
+
+int main(int argc_70, char **argv_70)
+{
+    int opt_70;
+    while ((opt_70 = getopt(argc_70, argv_70, "s:t:f:n:jh")) != -1)
+    {
+        switch (opt_70)
+        {
+        case 's': FILE_MB_70 = (size_t)atol(optarg); break;
+        case 't': MIN_SECS_70 = atof(optarg); break;
+        case 'f': FILTER_70 = optarg; break;
+        case 'n': SORT_MAX_70 = (size_t)atol(optarg); break;
+        case 'j': JSON_70 = 1; break;
+        default:
+            fprintf(stderr, "usage: microbench [-s file_MB] [-t min_secs] [-f name_filter] [-n max_sort] [-j]\n");
+            return 2;
+        }
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    //private $HOME so the S1/S2 helpers write into a scratch tree, not the real stores
+    char scratch_70[] = "/tmp/microbench_XXXXXX";
+    if (!mkdtemp(scratch_70))
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+    setenv("HOME", scratch_70, 1);
+
+    //source file lives in ~/S2 where S2 would serve it from
+    size_t size_70 = FILE_MB_70 << 20;
+    char *s2dir_70 = join_20("bench/");
+    char *src_70 = NULL; asprintf(&src_70, "%sdata.bin", s2dir_70);
+    int fd_70 = open(src_70, O_CREAT|O_TRUNC|O_WRONLY, 0600);
+    char *blk_70 = malloc(1<<20);
+    for (size_t i = 0; i < (1<<20); ++i)
+        blk_70[i] = (char)(i * 131u + 7u);
+    for (size_t i = 0; i < FILE_MB_70; ++i)
+        write_all_10(fd_70, blk_70, 1<<20);
+    close(fd_70);
+    free(blk_70);
+
+    if (JSON_70)
+        printf("{\n  \"file_mb\": %zu,\n  \"results\": [", FILE_MB_70);
+    else
+        printf("%-28s %-18s %14s\n", "benchmark", "param", "value");
+
+    bench_copy_techniques_70(src_70, size_70);
+    bench_prod_send_70(src_70, size_70);
+    bench_prod_recv_70(scratch_70, size_70);
+    bench_prod_archive_70(src_70, size_70);
+    bench_lines_70();
+    bench_sort_70();
+    bench_paths_70();
+    bench_route_70();
+
+    if (JSON_70)
+        printf("\n  ]\n}\n");
+
+    char *cmd_70 = NULL; asprintf(&cmd_70, "rm -rf '%s'", scratch_70);
+    if (system(cmd_70) != 0) {}
+    free(cmd_70); free(src_70); free(s2dir_70);
+    return 0;
+}
@@ -5,9 +5,11 @@
 
 #define _GNU_SOURCE
 #include <arpa/inet.h>
+#include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -17,25 +19,108 @@
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "dfsclient.h"
+#include "dfscore.h"
+
 // maximum lenght for a line
 #define LINE_MAX_50 4096
 
-//max buffer size
-#define CHUNK_50 8192
-
 //global target S1
 static const char *S1_HOST_50 = "127.0.0.1";
 
 //default port but we can override it
 static int S1_PORT_50 = 5001;
 
+//tracing: with DFS_TRACE=<file> every command gets a request id that S1 passes on to the
+//backends, and the client appends its own end-to-end span to the same trace file
+static int trace_fd_50=-1;
+static char trace_rid_50[33];
+static int rid_pending_50;
+
 //I/O helpers
 
+// what goes to S1 is gathered here and sent before the client reads the reply (or when it
+// fills): a request line with its files leaves in one or a few sends, not one per line and chunk
+#define OBUF_50 65536
+static struct
+{
+    int fd,held;   /* held: a MSG_MORE send may have left a partial segment queued */
+    size_t n;
+    char buf[OBUF_50];
+} obuf_50={-1,0,0,{0}};
+
+static int obuf_send_50(struct iovec *iov_50,int cnt_50,int more_50)
+{
+    while(cnt_50>0)
+    {
+        struct msghdr m_50;
+        memset(&m_50,0,sizeof m_50);
+        m_50.msg_iov=iov_50;
+        m_50.msg_iovlen=(size_t)cnt_50;
+        ssize_t w_50=sendmsg(obuf_50.fd,&m_50,more_50?MSG_MORE:0);
+        if(w_50<0)
+        {
+            if(errno==EINTR)
+                continue;
+            return -1;
+        }
+        for(;cnt_50>0 && (size_t)w_50>=iov_50->iov_len;++iov_50,--cnt_50)
+            w_50-=(ssize_t)iov_50->iov_len;
+        if(cnt_50>0)
+        {
+            iov_50->iov_base=(char*)iov_50->iov_base+w_50;
+            iov_50->iov_len-=(size_t)w_50;
+        }
+    }
+    obuf_50.held=more_50;
+    return 0;
+}
+static int SOCK_NODELAY_50; /* defined with the socket options below */
+//sends what is gathered; a segment held back by MSG_MORE is pushed by setting TCP_NODELAY
+static int obuf_flush_50(void)
+{
+    if(obuf_50.n)
+    {
+        struct iovec iov_50={obuf_50.buf,obuf_50.n};
+        obuf_50.n=0;
+        return obuf_send_50(&iov_50,1,0);
+    }
+    if(obuf_50.held)
+    {
+        int one_50=1;
+        setsockopt(obuf_50.fd,IPPROTO_TCP,TCP_NODELAY,&one_50,sizeof one_50);
+        if(!SOCK_NODELAY_50)
+        {
+            /* push done: back to the configured socket nodelay off */
+            one_50=0;
+            setsockopt(obuf_50.fd,IPPROTO_TCP,TCP_NODELAY,&one_50,sizeof one_50);
+        }
+        obuf_50.held=0;
+    }
+    return 0;
+}
+static ssize_t obuf_write_50(const void *buf_50,size_t n_50)
+{
+    if(obuf_50.n+n_50<=OBUF_50)
+    {
+        memcpy(obuf_50.buf+obuf_50.n,buf_50,n_50);
+        obuf_50.n+=n_50;
+        return (ssize_t)n_50;
+    }
+    struct iovec iov_50[2]={{obuf_50.buf,obuf_50.n},{(void*)buf_50,n_50}};
+    obuf_50.n=0;
+    return obuf_send_50(iov_50,2,1)==0?(ssize_t)n_50:-1;
+}
+
 //send exactly n_50 bytes to the socket
 static ssize_t write_fully_50(int fd_50, const void *buf_50, size_t n_50)
 {
+    if(fd_50==obuf_50.fd)
+        return obuf_write_50(buf_50,n_50);
     const char *p_50=(const char*)buf_50; size_t left_50=n_50;
     while(left_50>0)
     {
@@ -55,6 +140,8 @@ static ssize_t write_fully_50(int fd_50, const void *buf_50, size_t n_50)
 //reads bytes upto n_50
 static ssize_t read_fully_50(int fd_50, void *buf_50, size_t n_50)
 {
+    if(fd_50==obuf_50.fd && obuf_flush_50()!=0)
+        return -1;
     char *p_50=(char*)buf_50;
     size_t left_50=n_50;
     while(left_50>0)
@@ -77,6 +164,8 @@ static ssize_t read_fully_50(int fd_50, void *buf_50, size_t n_50)
 //reads one text line ending with '\n' and removes that newline
 static int read_line_50(int fd_50, char *buf_50, size_t cap_50)
 {
+    if(fd_50==obuf_50.fd && obuf_flush_50()!=0)
+        return -1;
     size_t i_50=0;
     while(i_50+1<cap_50)
     {
@@ -108,9 +197,104 @@ static int send_line_50(int fd_50, const char *fmt_50, ...)
     if(L_50+1>=sizeof line_50)
         return -1;
     line_50[L_50++] = '\n';
+    //the request id goes out in the same write as the first command line
+    if(rid_pending_50 && trace_rid_50[0])
+    {
+        rid_pending_50=0;
+        char out_50[LINE_MAX_50+40];
+        int k_50=snprintf(out_50,sizeof out_50,"RID|%s\n",trace_rid_50);
+        memcpy(out_50+k_50,line_50,L_50);
+        return (write_fully_50(fd_50,out_50,(size_t)k_50+L_50)==(ssize_t)((size_t)k_50+L_50))?0:-1;
+    }
     return (write_fully_50(fd_50,line_50,L_50)==(ssize_t)L_50)?0:-1;
 }
 
+//sockets: the "socket" lines of a DFS_CONF file (nodelay, buffers, keepalive) apply to the
+//connection to S1 too, e.g. "socket buffers 4096" for large downloads over a long link;
+//the listener options in it are S1's business
+static int SOCK_NODELAY_50=1;
+static int SOCK_BUF_KB_50=0;     /* 0: the kernel sizes them */
+static int SOCK_KA_IDLE_50=0;    /* 0: no keepalive; a command's connection is short */
+static int SOCK_KA_INTVL_50=10;
+static int SOCK_KA_CNT_50=5;
+
+static int sock_conf_50(const char *opt_50,char **save_50)
+{
+    char *v_50=strtok_r(NULL," \t\r\n",save_50);
+    if(!v_50)
+        return -1;
+    int off_50=!strcmp(v_50,"off"),n_50=atoi(v_50);
+    if(!strcmp(opt_50,"backlog")||!strcmp(opt_50,"defer_accept"))
+        return 0;
+    else if(!strcmp(opt_50,"nodelay")&&(off_50||!strcmp(v_50,"on")))
+        SOCK_NODELAY_50=!off_50;
+    else if(!strcmp(opt_50,"buffers")&&(off_50||n_50>0))
+        SOCK_BUF_KB_50=off_50?0:n_50;
+    else if(!strcmp(opt_50,"keepalive")&&(off_50||n_50>0))
+    {
+        char *i_50=strtok_r(NULL," \t\r\n",save_50);
+        char *c_50=strtok_r(NULL," \t\r\n",save_50);
+        if((i_50&&atoi(i_50)<1)||(c_50&&atoi(c_50)<1))
+            return -1;
+        SOCK_KA_IDLE_50=off_50?0:n_50;
+        if(i_50)
+            SOCK_KA_INTVL_50=atoi(i_50);
+        if(c_50)
+            SOCK_KA_CNT_50=atoi(c_50);
+    }
+    else
+        return -1;
+    return 0;
+}
+
+static void sock_load_50(void)
+{
+    const char *path_50=getenv("DFS_CONF");
+    if(!path_50||!*path_50)
+        return;
+    FILE *f_50=fopen(path_50,"r");
+    if(!f_50)
+        return;
+    char buf_50[LINE_MAX_50];
+    int lno_50=0;
+    while(fgets(buf_50,sizeof buf_50,f_50))
+    {
+        ++lno_50;
+        char *hash_50=strchr(buf_50,'#');
+        if(hash_50)
+            *hash_50='\0';
+        char *save_50=NULL;
+        char *kw_50=strtok_r(buf_50," \t\r\n",&save_50);
+        if(!kw_50||strcmp(kw_50,"socket"))
+            continue;
+        char *opt_50=strtok_r(NULL," \t\r\n",&save_50);
+        if(!opt_50||sock_conf_50(opt_50,&save_50)!=0)
+            fprintf(stderr,"%s:%d: bad socket line, ignored\n",path_50,lno_50);
+    }
+    fclose(f_50);
+}
+
+// before connect(), so a receive buffer set here is the one the handshake scales the window for
+static void sock_tune_50(int fd_50)
+{
+    int one_50=1;
+    if(SOCK_NODELAY_50)
+        setsockopt(fd_50,IPPROTO_TCP,TCP_NODELAY,&one_50,sizeof one_50);
+    if(SOCK_BUF_KB_50)
+    {
+        int b_50=SOCK_BUF_KB_50*1024;
+        setsockopt(fd_50,SOL_SOCKET,SO_SNDBUF,&b_50,sizeof b_50);
+        setsockopt(fd_50,SOL_SOCKET,SO_RCVBUF,&b_50,sizeof b_50);
+    }
+    if(SOCK_KA_IDLE_50)
+    {
+        setsockopt(fd_50,SOL_SOCKET,SO_KEEPALIVE,&one_50,sizeof one_50);
+        setsockopt(fd_50,IPPROTO_TCP,TCP_KEEPIDLE,&SOCK_KA_IDLE_50,sizeof SOCK_KA_IDLE_50);
+        setsockopt(fd_50,IPPROTO_TCP,TCP_KEEPINTVL,&SOCK_KA_INTVL_50,sizeof SOCK_KA_INTVL_50);
+        setsockopt(fd_50,IPPROTO_TCP,TCP_KEEPCNT,&SOCK_KA_CNT_50,sizeof SOCK_KA_CNT_50);
+    }
+}
+
 //connects to S1 using its port
 static int connect_s1_50(void)
 {
@@ -130,15 +314,82 @@ static int connect_s1_50(void)
         close(fd_50);
         return -1;
     }
+    sock_tune_50(fd_50);
     if(connect(fd_50,(struct sockaddr*)&a_50,sizeof a_50)!=0)
     {
         perror("connect");
         close(fd_50);
         return -1;
     }
+    rid_pending_50=1;
+    obuf_50.fd=fd_50;   /* one connection at a time; whatever an earlier one left is dropped */
+    obuf_50.n=0;
+    obuf_50.held=0;
     return fd_50;
 }
 
+//uploadf, downlf, removef of one or two files and dispfnames of a folder go through libdfsclient,
+//on one connection kept for the whole session; the other commands open their own as above
+static struct dfs_client *dfs_50;
+
+//the kept connection, opened at its first use; the request goes out with the command's trace id
+static struct dfs_client *dfs_conn_50(void)
+{
+    if(!dfs_50 && !(dfs_50=dfs_open(S1_HOST_50,S1_PORT_50)))
+    {
+        perror("connect");
+        return NULL;
+    }
+    if(trace_rid_50[0])
+        dfs_set_request_id(dfs_50,trace_rid_50);
+    return dfs_50;
+}
+
+//tracing helpers--------------------
+
+static unsigned long long wall_us_50(void)
+{
+    struct timespec ts_50;
+    clock_gettime(CLOCK_REALTIME,&ts_50);
+    return (unsigned long long)ts_50.tv_sec*1000000ULL+(unsigned long long)ts_50.tv_nsec/1000ULL;
+}
+
+//opens the trace file; whoever creates it writes the opening '[' of the event array
+static void trace_init_50(void)
+{
+    const char *path_50=getenv("DFS_TRACE");
+    if(!path_50 || !*path_50)
+        return;
+    int fd_50=open(path_50,O_WRONLY|O_CREAT|O_EXCL|O_APPEND,0644);
+    if(fd_50>=0)
+        write_fully_50(fd_50,"[\n",2);
+    else
+        fd_50=open(path_50,O_WRONLY|O_APPEND);
+    if(fd_50<0)
+        perror("DFS_TRACE");
+    trace_fd_50=fd_50;
+}
+
+//new request id for the next command
+static void trace_new_rid_50(void)
+{
+    static unsigned seq_50;
+    snprintf(trace_rid_50,sizeof trace_rid_50,"%08llx%04x%04x",
+        wall_us_50()&0xffffffffULL,(unsigned)getpid()&0xffff,++seq_50&0xffff);
+}
+
+//appends one complete span for the command that just finished
+static void trace_command_50(const char *cmd_50, unsigned long long t0_50)
+{
+    char ev_50[512];
+    int pid_50=(int)getpid();
+    int n_50=snprintf(ev_50,sizeof ev_50,
+        "{\"name\":\"%s\",\"cat\":\"client\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":%d,\"tid\":%d,\"args\":{\"rid\":\"%s\"}},\n",
+        cmd_50,t0_50,wall_us_50()-t0_50,pid_50,pid_50,trace_rid_50);
+    if(n_50>0 && n_50<(int)sizeof ev_50)
+        write_fully_50(trace_fd_50,ev_50,(size_t)n_50);
+}
+
 //helpers for paths and files
 
 //checks if a string starts with "~S1/"
@@ -164,82 +415,9 @@ static int get_size_50(const char *path_50, size_t *out_50)
     return 0;
 }
 
-//sends a local file's bytes to S1
-static int send_file_50(int fd_50, const char *path_50)
-{
-    int in_50=open(path_50,O_RDONLY);
-    if(in_50<0)
-        return -1;
-    char *buf_50 = malloc(CHUNK_50);
-    if(!buf_50)
-    {
-        close(in_50);
-        return -1;
-    }
-    for(;;)
-    {
-        ssize_t r_50=read(in_50,buf_50,CHUNK_50);
-        if(r_50<0)
-        {
-            if(errno==EINTR)
-                continue;
-            free(buf_50);
-            close(in_50);
-            return -1;
-        }
-        if(r_50==0)
-            break;
-        if(write_fully_50(fd_50,buf_50,(size_t)r_50)!=r_50)
-        {
-            free(buf_50);
-            close(in_50);
-            return -1;
-        }
-    }
-    free(buf_50);
-    close(in_50);
-    return 0;
-}
-
-//saves bytes from S1 into a local file
-static int recv_file_50(int fd_50, const char *out_50, size_t sz_50)
-{
-    int outfd_50=open(out_50,O_CREAT|O_TRUNC|O_WRONLY,0600);
-    if(outfd_50<0)
-    {
-        perror("open out");
-        return -1;
-    }
-    char *buf_50 = malloc(CHUNK_50);
-    if(!buf_50)
-    {
-        close(outfd_50);
-        return -1;
-    }
-    size_t left_50=sz_50;
-    while(left_50>0)
-    {
-        size_t want_50 = left_50>CHUNK_50 ? CHUNK_50 : left_50;
-        ssize_t r_50 = read_fully_50(fd_50,buf_50,want_50);
-        if(r_50<=0)
-        {
-            free(buf_50);
-            close(outfd_50);
-            return -1;
-        }
-        if(write_fully_50(outfd_50,buf_50,(size_t)r_50)!=r_50)
-        {
-            free(buf_50);
-            close(outfd_50);
-            return -1;
-        }
-        left_50 -= (size_t)r_50;
-    }
-    free(buf_50); close(outfd_50); return 0;
-}
 
 // for uploadf --------------------
-//check if there are more than 3 args and connects to S1 and uploads the file
+//check if there are more than 3 args and uploads the files
 static void cmd_uploadf_50(int argc_50, char **argv_50)
 {
     if(argc_50>5)
@@ -270,53 +448,69 @@ static void cmd_uploadf_50(int argc_50, char **argv_50)
             return;
         }
     }
-    int fd_50=connect_s1_50();
-    if(fd_50<0)
-        return;
-    if(send_line_50(fd_50,"UPLOADF|%d|%s", files_n_50, dest_50)!=0)
-    {
-        fprintf(stderr,"uploadf: send header failed\n");
-        close(fd_50);
+    //one request for them all on the kept connection, each file read from disk as it is sent
+    struct dfs_client *c_50=dfs_conn_50();
+    if(!c_50)
         return;
-    }
+    struct dfs_upfile files_50[3];
     for(int i_50=0;i_50<files_n_50;i_50++)
     {
-        const char *path_50 = argv_50[1+i_50];
-        const char *name_50 = basename_50(path_50);
-        if(send_line_50(fd_50,"FILEMETA|%s|%zu", name_50, sizes_50[i_50])!=0)
-        {
-            fprintf(stderr,"uploadf: send meta failed\n");
-            close(fd_50);
-            return;
-        }
-        if(send_file_50(fd_50,path_50)!=0)
+        files_50[i_50].name=basename_50(argv_50[1+i_50]);
+        files_50[i_50].len=sizes_50[i_50];
+        if((files_50[i_50].fd=open(argv_50[1+i_50],O_RDONLY))<0)
         {
-            fprintf(stderr,"uploadf: send data failed on %s\n", name_50);
-            close(fd_50);
+            fprintf(stderr,"uploadf: cannot read %s\n", argv_50[1+i_50]);
+            while(i_50-- > 0)
+                close(files_50[i_50].fd);
             return;
         }
     }
-    char line_50[LINE_MAX_50];
-    int r_50=read_line_50(fd_50,line_50,sizeof line_50);
-    if(r_50<=0)
-    {
-        fprintf(stderr,"uploadf: no server reply\n");
-        close(fd_50);
-        return;
-    }
-    if(!strncmp(line_50,"OK",2))
-    {
-        printf("files uploaded successfully \n");
-    }
+    int rc_50=dfs_upload_files(c_50,dest_50,files_50,files_n_50);
+    for(int i_50=0;i_50<files_n_50;i_50++)
+        close(files_50[i_50].fd);
+    if(rc_50!=0)
+        printf("uploadf: %s\n", dfs_last_error(c_50));
     else
+        printf("files uploaded successfully \n");
+}
+
+//for downlf --------------------
+// each file S1 sends goes into a hidden temp file next to where it belongs, renamed once the
+// whole file is there
+struct downlf_50
+{
+    char tmp[LINE_MAX_50+16];
+    size_t size;
+    int got;
+    char got_names[2][LINE_MAX_50];
+};
+static int downlf_open_50(void *arg_50, const char *name_50, size_t len_50)
+{
+    struct downlf_50 *d_50=arg_50;
+    if(!*name_50 || d_50->got>=2)
+        return -1;
+    snprintf(d_50->tmp,sizeof d_50->tmp,".%s.XXXXXX", name_50);
+    d_50->size=len_50;
+    int fd_50=mkstemp(d_50->tmp);
+    if(fd_50<0)
+        perror("open out");
+    return fd_50;
+}
+static void downlf_close_50(void *arg_50, int fd_50, const char *name_50, int ok_50)
+{
+    struct downlf_50 *d_50=arg_50;
+    if(close(fd_50)==0 && ok_50 && rename(d_50->tmp,name_50)==0)
     {
-        printf("%s\n", line_50);
+        printf("Downloaded %s (%zu bytes)\n", name_50, d_50->size);
+        snprintf(d_50->got_names[d_50->got++],LINE_MAX_50,"%s",name_50);
+        return;
     }
-    close(fd_50);
+    if(ok_50)
+        fprintf(stderr,"downlf: cannot save %s: %s\n", name_50, strerror(errno));
+    unlink(d_50->tmp);
 }
 
-//for downlf --------------------
-// checks args 2 and 3, then asks S1 for those files and downloads them
+// checks args 2 and 3, then asks S1 for those files in one request and downloads them
 static void cmd_downlf_50(int argc_50, char **argv_50)
 {
     if(argc_50<2 || argc_50>3 || !path_is_s1_50(argv_50[1]) || (argc_50==3 && !path_is_s1_50(argv_50[2])))
@@ -324,134 +518,189 @@ static void cmd_downlf_50(int argc_50, char **argv_50)
         fprintf(stderr,"usage: downlf ~S1/file1 ~S1/file2\n");
         return;
     }
-    int fd_50=connect_s1_50();
-    if(fd_50<0)
+    struct dfs_client *c_50=dfs_conn_50();
+    if(!c_50)
         return;
-
-    if(argc_50==2)
-        send_line_50(fd_50,"DOWNLF|1|%s", argv_50[1]);
-    else
-        send_line_50(fd_50,"DOWNLF|2|%s|%s", argv_50[1], argv_50[2]);
-
     int need_50 = argc_50-1;
-    int got_ok_50 = 0;
-    for(;;)
+    struct downlf_50 d_50;
+    d_50.got=0;
+    int rc_50=dfs_download_files(c_50,(const char *const *)(argv_50+1),need_50,downlf_open_50,downlf_close_50,&d_50);
+    if(rc_50==1)
     {
-        char line_50[LINE_MAX_50];
-        int n_50=read_line_50(fd_50,line_50,sizeof line_50);
-        if(n_50<=0)
-            break;
-
-        if(!strncmp(line_50,"FILERESP|",9))
+        // the files S1 sent are named after the paths, so whatever is missing was not found
+        for(int i_50=1;i_50<argc_50;i_50++)
         {
-            char *save_50=NULL;
-            char *name_50 = strtok_r(line_50+9,"|",&save_50);
-            char *szs_50  = strtok_r(NULL,"|",&save_50);
-            size_t sz_50 = (size_t)strtoull(szs_50?szs_50:"0",NULL,10);
-            if(!name_50)
-            {
-                fprintf(stderr,"downlf: bad header\n");
-                break;
-            }
-            if(recv_file_50(fd_50, name_50, sz_50)!=0)
-            {
-                fprintf(stderr,"downlf: receive failed for %s\n", name_50);
-                break;
-            }
-            printf("Downloaded %s (%zu bytes)\n", name_50, sz_50);
-            got_ok_50++;
-            if(got_ok_50==need_50)
-            {
-                /* optional DONE */
-                char tmp_50[LINE_MAX_50];
-                read_line_50(fd_50,tmp_50,sizeof tmp_50);
-                break;
-            }
+            int seen_50=0;
+            for(int g_50=0;g_50<d_50.got;g_50++)
+                seen_50 |= !strcmp(d_50.got_names[g_50],basename_50(argv_50[i_50]));
+            if(!seen_50)
+                printf("FILENOTFOUND|%s\n", argv_50[i_50]);
         }
-        else if(!strncmp(line_50,"FILENOTFOUND|",13))
+    }
+    else if(rc_50!=0)
+        fprintf(stderr,"downlf: %s\n", dfs_last_error(c_50));
+    if(d_50.got==need_50)
+        printf("files downloaded successfully \n");
+}
+
+//for removef --------------------
+// reads the REMOK/REMERR lines of a batched or recursive remove up to REMDONE; these print the
+// whole path, as files of many folders can be in one
+static void remove_results_50(int fd_50)
+{
+    char line_50[LINE_MAX_50];
+    while(read_line_50(fd_50,line_50,sizeof line_50)>0)
+    {
+        if(!strncmp(line_50,"REMOK|",6))
+            printf("removed file %s\n", line_50+6);
+        else if(!strncmp(line_50,"REMERR|",7))
         {
-            printf("%s\n", line_50);
+            char *save_50=NULL;
+            char *path_50 = strtok_r(line_50+7,"|",&save_50);
+            char *why_50  = strtok_r(NULL,"|",&save_50);
+            printf("failed to remove %s: %s\n", path_50?path_50:"(unknown)", why_50?why_50:"error");
         }
-        else if(!strcmp(line_50,"DONE"))
+        else if(!strncmp(line_50,"REMDONE|",8))
         {
-            break;
+            unsigned long long ok_50=0, bad_50=0;
+            sscanf(line_50+8,"%llu|%llu",&ok_50,&bad_50);
+            printf("removed %llu file(s), %llu failed\n", ok_50, bad_50);
+            return;
         }
         else
         {
             printf("%s\n", line_50);
-            break;
+            return;
         }
     }
-    close(fd_50);
-    if(got_ok_50==need_50)
-        printf("files downloaded successfully \n");
 }
 
-//for removef --------------------
-// checks args 1 and 2 and asks S1 to delete those files
-static void cmd_removef_50(int argc_50, char **argv_50)
+// many files in one request (REMOVEM): from the command line, or with -f from a list file
+static void remove_many_50(char **paths_50, int n_50)
 {
-    if(argc_50<2 || argc_50>3 || !path_is_s1_50(argv_50[1]) || (argc_50==3 && !path_is_s1_50(argv_50[2])))
+    int fd_50=connect_s1_50();
+    if(fd_50<0)
+        return;
+    int ok_50 = send_line_50(fd_50,"REMOVEM|%d", n_50)==0;
+    for(int i_50=0;ok_50 && i_50<n_50;i_50++)
+        ok_50 = send_line_50(fd_50,"%s", paths_50[i_50])==0;
+    if(ok_50)
+        remove_results_50(fd_50);
+    else
+        fprintf(stderr,"removef: send failed\n");
+    close(fd_50);
+}
+static void remove_list_50(const char *list_50)
+{
+    FILE *f_50=fopen(list_50,"r");
+    if(!f_50)
     {
-        fprintf(stderr,"usage: removef ~S1/file1 ~S1/file2\n");
+        fprintf(stderr,"removef: cannot read %s\n", list_50);
         return;
     }
+    char **paths_50=NULL;
+    int n_50=0;
+    char line_50[LINE_MAX_50];
+    while(fgets(line_50,sizeof line_50,f_50))
+    {
+        line_50[strcspn(line_50,"\r\n")]='\0';
+        if(!line_50[0])
+            continue;
+        paths_50=realloc(paths_50,sizeof(char*)*(size_t)(n_50+1));
+        paths_50[n_50++]=strdup(line_50);
+    }
+    fclose(f_50);
+    if(n_50)
+        remove_many_50(paths_50,n_50);
+    for(int i_50=0;i_50<n_50;i_50++)
+        free(paths_50[i_50]);
+    free(paths_50);
+}
+// every file under a folder (REMOVER)
+static void remove_tree_50(const char *dir_50)
+{
     int fd_50=connect_s1_50();
     if(fd_50<0)
         return;
+    if(send_line_50(fd_50,"REMOVER|%s", dir_50)==0)
+        remove_results_50(fd_50);
+    close(fd_50);
+}
 
-    int need_50 = argc_50-1;
-    if(argc_50==2)
-        send_line_50(fd_50,"REMOVEF|1|%s", argv_50[1]);
-    else
-        send_line_50(fd_50,"REMOVEF|2|%s|%s", argv_50[1], argv_50[2]);
-
-    int got_50 = 0;
-    while(got_50 < need_50)
+// checks args 1 and 2 and asks S1 to delete those files; more paths, -f <list> and -r <folder>
+// go as one batched or recursive request
+static void cmd_removef_50(int argc_50, char **argv_50)
+{
+    if(argc_50==3 && !strcmp(argv_50[1],"-r") && path_is_s1_50(argv_50[2]))
     {
-        char line_50[LINE_MAX_50];
-        int r_50=read_line_50(fd_50,line_50,sizeof line_50);
-        if(r_50<=0)
-            break;
-        if(!strncmp(line_50,"REMOK|",6))
-        {
-            const char *path_50 = line_50+6;
-            printf("removed file %s\n", basename_50(path_50));
-            got_50++;
-        }
-        else if(!strncmp(line_50,"REMERR|",7))
-        {
-            /* REMERR|path|reason */
-            char *save_50=NULL;
-            char *path_50 = strtok_r(line_50+7,"|",&save_50);
-            char *why_50  = strtok_r(NULL,"|",&save_50);
-            printf("failed to remove %s: %s\n", basename_50(path_50?path_50:"(unknown)"), why_50?why_50:"error");
-            got_50++;
-        }
+        remove_tree_50(argv_50[2]);
+        return;
+    }
+    if(argc_50==3 && !strcmp(argv_50[1],"-f"))
+    {
+        remove_list_50(argv_50[2]);
+        return;
+    }
+    int paths_ok_50 = argc_50>=2;
+    for(int i_50=1;i_50<argc_50;i_50++)
+        paths_ok_50 = paths_ok_50 && path_is_s1_50(argv_50[i_50]);
+    if(!paths_ok_50)
+    {
+        fprintf(stderr,"usage: removef ~S1/file1 ~S1/file2 ... | removef -f listfile | removef -r ~S1/folder\n");
+        return;
+    }
+    if(argc_50>3)
+    {
+        remove_many_50(argv_50+1,argc_50-1);
+        return;
+    }
+    for(int i_50=1;i_50<argc_50;i_50++)
+    {
+        struct dfs_client *c_50=dfs_conn_50();
+        if(!c_50)
+            return;
+        int rc_50=dfs_remove(c_50,argv_50[i_50]);
+        if(rc_50==0)
+            printf("removed file %s\n", basename_50(argv_50[i_50]));
+        else if(rc_50==1)
+            printf("failed to remove %s: %s\n", basename_50(argv_50[i_50]), dfs_last_error(c_50));
         else
         {
-            printf("%s\n", line_50);
-            break;
+            printf("%s\n", dfs_last_error(c_50));
+            return;
         }
     }
-    close(fd_50);
 }
 
 //downltar --------------------
-// request .c, .pdf and .txt files and for each type, we create a new connection to S1 and save the downloaded tar files
+// request the tar of one or more types and for each type, we create a new connection to S1 and save the downloaded tar files
+#define MAX_TYPES_50 32
+#define TYPE_MAX_50 16
+
+// a type is a dot and up to 15 of [a-z0-9_+-]; S1 decides whether it is routed anywhere
 static int is_valid_type_50(const char *t_50)
 {
-    return (!strcmp(t_50,".c") || !strcmp(t_50,".pdf") || !strcmp(t_50,".txt"));
+    size_t n_50=strlen(t_50);
+    if(t_50[0]!='.' || n_50<2 || n_50>=TYPE_MAX_50)
+        return 0;
+    for(size_t i=1;i<n_50;i++)
+    {
+        char ch_50=(char)tolower((unsigned char)t_50[i]);
+        if(!((ch_50>='a'&&ch_50<='z') || (ch_50>='0'&&ch_50<='9') || ch_50=='_' || ch_50=='+' || ch_50=='-'))
+            return 0;
+    }
+    return 1;
 }
-static void push_type_50(const char *t_50, const char **arr_50, int *n_50)
+static void push_type_50(const char *t_50, char arr_50[][TYPE_MAX_50], int *n_50)
 {
-    if(*n_50>=3)
+    if(*n_50>=MAX_TYPES_50)
         return;
     for(int i=0;i<*n_50;i++)
-        if(!strcmp(arr_50[i],t_50))
+        if(!strcasecmp(arr_50[i],t_50))
             return;
-    arr_50[(*n_50)++] = t_50;
+    snprintf(arr_50[(*n_50)++], TYPE_MAX_50, "%s", t_50);
 }
+
 static int do_one_downltar_50(const char *type_50)
 {
     int fd_50=connect_s1_50();
@@ -502,204 +751,441 @@ static int do_one_downltar_50(const char *type_50)
     return 0;
 }
 
+// several types (or all) come as one archive that S1 assembles while sending it:
+// TARSTREAM|<name>, DATA|<n> pieces, then TAREND|<members>|<failed>
+static int do_set_downltar_50(const char *set_50)
+{
+    int fd_50=connect_s1_50();
+    if(fd_50<0)
+        return -1;
+    char line_50[LINE_MAX_50];
+    if(send_line_50(fd_50,"DOWNTAR|%s", set_50)!=0 || read_line_50(fd_50,line_50,sizeof line_50)<=0)
+    {
+        fprintf(stderr,"downltar: no reply for %s\n", set_50);
+        close(fd_50);
+        return -1;
+    }
+    if(strncmp(line_50,"TARSTREAM|",10) || !line_50[10] || strchr(line_50+10,'/'))
+    {
+        printf("%s\n", line_50);
+        close(fd_50);
+        return -1;
+    }
+    char name_50[LINE_MAX_50];
+    snprintf(name_50,sizeof name_50,"%s",line_50+10);
+    int outfd_50=open(name_50,O_CREAT|O_TRUNC|O_WRONLY,0600);
+    if(outfd_50<0)
+    {
+        perror("open out");
+        close(fd_50);
+        return -1;
+    }
+    char *buf_50=malloc(CHUNK_50);
+    size_t total_50=0;
+    int rc_50=-1;
+    while(buf_50 && read_line_50(fd_50,line_50,sizeof line_50)>0)
+    {
+        if(!strncmp(line_50,"DATA|",5))
+        {
+            size_t left_50=(size_t)strtoull(line_50+5,NULL,10);
+            total_50+=left_50;
+            while(left_50>0)
+            {
+                size_t want_50 = left_50>CHUNK_50 ? CHUNK_50 : left_50;
+                ssize_t r_50=read_fully_50(fd_50,buf_50,want_50);
+                if(r_50<=0 || write_fully_50(outfd_50,buf_50,(size_t)r_50)!=r_50)
+                    break;
+                left_50-=(size_t)r_50;
+            }
+            if(left_50)
+                break;
+            continue;
+        }
+        if(!strncmp(line_50,"TAREND|",7))
+        {
+            unsigned long long members_50=strtoull(line_50+7,NULL,10);
+            const char *bar_50=strchr(line_50+7,'|');
+            int failed_50=bar_50?atoi(bar_50+1):0;
+            printf("Downloaded %s (%zu bytes, %llu files)\n", name_50, total_50, members_50);
+            if(failed_50)
+                fprintf(stderr,"downltar: %d server(s) broke off, %s lacks some of their files\n", failed_50, name_50);
+            rc_50=failed_50?-1:0;
+        }
+        break;
+    }
+    if(rc_50!=0 && strncmp(line_50,"TAREND|",7))
+        fprintf(stderr,"downltar: receive failed for %s\n", name_50);
+    free(buf_50);
+    close(outfd_50);
+    close(fd_50);
+    return rc_50;
+}
+
 static void cmd_downltar_50(int argc_50, char **argv_50)
 {
-    const char *want_50[3];
+    char want_50[MAX_TYPES_50][TYPE_MAX_50];
     int ntypes_50=0;
 
     if(argc_50<2)
     {
-        fprintf(stderr,"usage: downltar .c or .pdf or .txt\n");
+        fprintf(stderr,"usage: downltar [-z|-l] .ext [.ext ...] or all\n");
         return;
     }
-    if(argc_50==2)
+    int all_50=0;
+    const char *codec_50=NULL;
+    for(int i=1;i<argc_50;i++)
     {
-        if(!strcmp(argv_50[1],"all"))
-        {
-            push_type_50(".c", want_50, &ntypes_50);
-            push_type_50(".pdf", want_50, &ntypes_50);
-            push_type_50(".txt", want_50, &ntypes_50);
-        }
-        else if(strchr(argv_50[1],'|') || strchr(argv_50[1],','))
+        // -z: gzip-compressed (.tar.gz), -l: LZ4-compressed (.tar.lz4)
+        if(!strcmp(argv_50[i],"-z") || !strcmp(argv_50[i],"-l"))
         {
-            char *tmp_50=strdup(argv_50[1]);
-            for(char *tok_50=strtok(tmp_50,"|,");
-            tok_50; tok_50=strtok(NULL,"|,"))
-            {
-                if(is_valid_type_50(tok_50))
-                    push_type_50(tok_50, want_50, &ntypes_50);
-            }
-            free(tmp_50);
+            codec_50 = argv_50[i][1]=='z' ? "gz" : "lz4";
+            continue;
         }
-        else if(is_valid_type_50(argv_50[1]))
+        // each argument may itself be a "|" or "," separated list
+        char *tmp_50=strdup(argv_50[i]);
+        for(char *tok_50=strtok(tmp_50,"|,");
+        tok_50; tok_50=strtok(NULL,"|,"))
         {
-            push_type_50(argv_50[1], want_50, &ntypes_50);
+            if(!strcmp(tok_50,"all"))
+                all_50=1;
+            else if(is_valid_type_50(tok_50))
+                push_type_50(tok_50, want_50, &ntypes_50);
         }
+        free(tmp_50);
     }
-    else
+    if(ntypes_50==0 && !all_50)
     {
-        for(int i=1;i<argc_50;i++)
-        {
-            if(!strcmp(argv_50[i],"all"))
-            {
-                push_type_50(".c", want_50, &ntypes_50);
-                push_type_50(".pdf", want_50, &ntypes_50);
-                push_type_50(".txt", want_50, &ntypes_50);
-            }
-            else if(is_valid_type_50(argv_50[i]))
-            {
-                push_type_50(argv_50[i], want_50, &ntypes_50);
-            }
-        }
+        fprintf(stderr,"usage: downltar [-z|-l] .ext [.ext ...] or all\n");
+        return;
     }
-    if(ntypes_50==0)
+    // one type keeps its own tar; several, or all, come as one archive, as does anything compressed
+    if(ntypes_50==1 && !all_50 && !codec_50)
     {
-        fprintf(stderr,"usage: downltar .c or .pdf or .txt\n");
+        (void)do_one_downltar_50(want_50[0]);
         return;
     }
-    for(int i=0;i<ntypes_50;i++)
-        (void)do_one_downltar_50(want_50[i]);
+    char set_50[MAX_TYPES_50*TYPE_MAX_50+4]="all";
+    size_t n_50=0;
+    for(int i=0;i<ntypes_50 && !all_50;i++)
+        n_50+=(size_t)snprintf(set_50+n_50,sizeof set_50-n_50,"%s%s",i?",":"",want_50[i]);
+    if(codec_50)
+        snprintf(set_50+strlen(set_50),sizeof set_50-strlen(set_50),"|%s",codec_50);
+    (void)do_set_downltar_50(set_50);
 }
 
 //dispfnames--------------------
 
 //asks S1 for the list of files under each directory and lists them
-static void cmd_dispfnames_50(int argc_50, char **argv_50)
+//S1 sends them already grouped by extension and sorted, so a new heading starts whenever the extension changes
+// -s streams every name and -n <count> one page of them (DISPP): in byte order, printed as they
+// come in, so a folder of any size starts printing at once and nothing is held here
+static void disp_paged_50(int limit_50, const char *dir_50, const char *after_50)
 {
-    if(argc_50!=2 || !path_is_s1_50(argv_50[1]))
+    int fd_50=connect_s1_50();
+    if(fd_50<0)
+        return;
+    if(send_line_50(fd_50,"DISPP|%d|%s|%s", limit_50, dir_50, after_50)!=0)
     {
-        fprintf(stderr,"usage: dispfnames ~S1/dir\n");
+        close(fd_50);
         return;
     }
+    char line_50[LINE_MAX_50];
+    while(read_line_50(fd_50,line_50,sizeof line_50)>0)
+    {
+        if(!strcmp(line_50,"LISTBEGIN"))
+            continue;
+        if(!strncmp(line_50,"NAME|",5))
+        {
+            const char *nm_50=strchr(line_50+5,'|');
+            if(nm_50)
+                printf("%s\n", nm_50+1);
+            continue;
+        }
+        if(!strncmp(line_50,"LISTEND|",8) && line_50[8])
+            printf("next page: dispfnames -n %d %s %s\n", limit_50, dir_50, line_50+8);
+        else if(strncmp(line_50,"LISTEND|",8))
+            printf("%s\n", line_50);
+        break;
+    }
+    close(fd_50);
+}
+
+// -R lists every file under the folder, its subfolders included (TREE), one request for the
+// whole tree: "<path> <size> <mtime>" per file in byte order of the paths, optionally only down
+// to -d levels, paths starting with -p and names matching the -g glob
+static void disp_tree_50(int depth_50, const char *prefix_50, const char *glob_50, const char *dir_50)
+{
     int fd_50=connect_s1_50();
     if(fd_50<0)
         return;
-    if(send_line_50(fd_50,"DISP|%s", argv_50[1])!=0)
+    if(send_line_50(fd_50,"TREE|%d|%s|%s|%s", depth_50, prefix_50, glob_50, dir_50)!=0)
     {
         close(fd_50);
         return;
     }
+    char line_50[LINE_MAX_50];
+    unsigned long long n_50=0, bytes_50=0;
+    while(read_line_50(fd_50,line_50,sizeof line_50)>0)
+    {
+        if(!strcmp(line_50,"LISTBEGIN"))
+            continue;
+        if(!strncmp(line_50,"ENT|",4))
+        {
+            // ENT|<ext>|<path>|<size>|<mtime_ns>
+            char *path_50=strchr(line_50+4,'|');
+            char *mt_50=strrchr(line_50,'|');
+            if(!path_50 || mt_50<=path_50)
+                continue;
+            *mt_50++='\0';
+            char *sz_50=strrchr(path_50+1,'|');
+            if(!sz_50)
+                continue;
+            *sz_50++='\0';
+            time_t t_50=(time_t)(strtoull(mt_50,NULL,10)/1000000000ULL);
+            char when_50[32];
+            strftime(when_50,sizeof when_50,"%Y-%m-%d %H:%M:%S",localtime(&t_50));
+            printf("%s %s %s\n", path_50+1, sz_50, when_50);
+            ++n_50;
+            bytes_50+=strtoull(sz_50,NULL,10);
+            continue;
+        }
+        if(!strncmp(line_50,"LISTEND|",8))
+            printf("%llu files, %llu bytes\n", n_50, bytes_50);
+        else
+            printf("%s\n", line_50);
+        break;
+    }
+    close(fd_50);
+}
+
+// prints the files of a folder as they come, under a heading per type (S1 sends them grouped)
+struct disp_out_50
+{
+    char ext[LINE_MAX_50];
+    int n;
+};
+static int disp_name_50(void *arg_50, const char *ext_50, const char *name_50)
+{
+    struct disp_out_50 *o_50=(struct disp_out_50*)arg_50;
+    if(!o_50->n || strcmp(ext_50,o_50->ext))
+    {
+        if(o_50->n)
+            printf("\n");
+        if(ext_50[0])
+            printf("%s files\n", ext_50);
+        else
+            printf("files without extension\n");
+        snprintf(o_50->ext,sizeof o_50->ext,"%s",ext_50);
+    }
+    printf("%s\n", name_50);
+    ++o_50->n;
+    return 0;
+}
+
+static void cmd_dispfnames_50(int argc_50, char **argv_50)
+{
+    if(argc_50>=3 && !strcmp(argv_50[1],"-R"))
+    {
+        int depth_50=0, i_50=2;
+        const char *prefix_50="", *glob_50="";
+        for(; i_50+1<argc_50; i_50+=2)
+        {
+            if(!strcmp(argv_50[i_50],"-d") && atoi(argv_50[i_50+1])>0)
+                depth_50=atoi(argv_50[i_50+1]);
+            else if(!strcmp(argv_50[i_50],"-p") && !strchr(argv_50[i_50+1],'|'))
+                prefix_50=argv_50[i_50+1];
+            else if(!strcmp(argv_50[i_50],"-g") && !strchr(argv_50[i_50+1],'|'))
+                glob_50=argv_50[i_50+1];
+            else
+                break;
+        }
+        if(i_50+1==argc_50 && path_is_s1_50(argv_50[i_50]))
+        {
+            disp_tree_50(depth_50, prefix_50, glob_50, argv_50[i_50]);
+            return;
+        }
+    }
+    if(argc_50==3 && !strcmp(argv_50[1],"-s") && path_is_s1_50(argv_50[2]))
+    {
+        disp_paged_50(0, argv_50[2], "");
+        return;
+    }
+    if((argc_50==4 || argc_50==5) && !strcmp(argv_50[1],"-n") && atoi(argv_50[2])>0 && path_is_s1_50(argv_50[3]))
+    {
+        disp_paged_50(atoi(argv_50[2]), argv_50[3], argc_50==5 ? argv_50[4] : "");
+        return;
+    }
+    if(argc_50!=2 || !path_is_s1_50(argv_50[1]))
+    {
+        fprintf(stderr,"usage: dispfnames ~S1/dir | dispfnames -s ~S1/dir | dispfnames -n <count> ~S1/dir [<after>]\n"
+                       "       dispfnames -R [-d <depth>] [-p <prefix>] [-g <glob>] ~S1/dir\n");
+        return;
+    }
+    struct dfs_client *c_50=dfs_conn_50();
+    if(!c_50)
+        return;
+    struct disp_out_50 out_50={"",0};
+    if(dfs_list(c_50,argv_50[1],disp_name_50,&out_50)!=0)
+        printf("%s\n", dfs_last_error(c_50));
+    if(out_50.n>0)
+        printf("\n");
+}
 
-    /* Collect grouped names */
-    char **cvec=NULL, **pvec=NULL, **tvec=NULL, **zvec=NULL;
-    int cc=0, pc=0, tc=0, zc=0;
-    int ca=8, pa=8, ta=8, za=8;
-    cvec = malloc(sizeof(char*)*ca);
-    pvec = malloc(sizeof(char*)*pa);
-    tvec = malloc(sizeof(char*)*ta);
-    zvec = malloc(sizeof(char*)*za);
+//routes--------------------
 
-    int seen_begin_50=0;
+//prints S1's routing table: the storage classes, which extensions each one keeps and the default
+static void cmd_routes_50(int argc_50, char **argv_50)
+{
+    (void)argv_50;
+    if(argc_50!=1)
+    {
+        fprintf(stderr,"usage: routes\n");
+        return;
+    }
+    int fd_50=connect_s1_50();
+    if(fd_50<0)
+        return;
+    if(send_line_50(fd_50,"ROUTES")!=0)
+    {
+        close(fd_50);
+        return;
+    }
     char line_50[LINE_MAX_50];
+    if(read_line_50(fd_50,line_50,sizeof line_50)<=0 || strcmp(line_50,"ROUTESBEGIN")!=0)
+    {
+        fprintf(stderr,"routes: %s\n", line_50);
+        close(fd_50);
+        return;
+    }
     for(;;)
     {
         int n_50=read_line_50(fd_50,line_50,sizeof line_50);
-        if(n_50<=0)
+        if(n_50<=0 || !strcmp(line_50,"ROUTESEND"))
             break;
-        if(!seen_begin_50)
-        {
-            if(!strcmp(line_50,"LISTBEGIN"))
-            {
-                seen_begin_50=1;
-                continue;
-            }
-            if(!strncmp(line_50,"ERR|",4))
-            {
-                printf("%s\n", line_50);
-                break;
-            }
+        char *save_50=NULL;
+        char *kind_50=strtok_r(line_50,"|",&save_50);
+        char *a_50=strtok_r(NULL,"|",&save_50);
+        char *b_50=strtok_r(NULL,"|",&save_50);
+        if(!kind_50 || !a_50)
             continue;
-        }
-        if(!strcmp(line_50,"LISTEND"))
-            break;
-        if(!strncmp(line_50,"NAME|",5))
+        if(!strcmp(kind_50,"CLASS"))
+            printf("class   %-16s %s\n", a_50, b_50?b_50:"");
+        else if(!strcmp(kind_50,"REPLICAS"))
         {
-            char *save=NULL;
-            char *ext = strtok_r(line_50+5,"|",&save);
-            char *nm  = strtok_r(NULL,"|",&save);
-            if(!ext || !nm)
-                continue;
-            if(!strcmp(ext,".c"))
-            {
-                if(cc==ca)
-                {
-                    ca*=2;
-                    cvec=realloc(cvec,sizeof(char*)*ca);
-                }
-                cvec[cc++]=strdup(nm);
-            }
-            else if(!strcmp(ext,".pdf"))
-            {
-                if(pc==pa)
-                {
-                    pa*=2;
-                    pvec=realloc(pvec,sizeof(char*)*pa);
-                }
-                pvec[pc++]=strdup(nm);
-            }
-            else if(!strcmp(ext,".txt"))
-            {
-                if(tc==ta)
-                {
-                    ta*=2;
-                    tvec=realloc(tvec,sizeof(char*)*ta);
-                }
-                tvec[tc++]=strdup(nm);
-            }
-            else if(!strcmp(ext,".zip"))
-            {
-                if(zc==za)
-                { za*=2;
-                    zvec=realloc(zvec,sizeof(char*)*za);
-                }
-                zvec[zc++]=strdup(nm);
-            }
+            char *w_50=strtok_r(NULL,"|",&save_50);
+            printf("        %-16s %s copies, uploads wait for %s\n", a_50, b_50?b_50:"", w_50?w_50:"?");
         }
+        else if(!strcmp(kind_50,"FROM"))
+            printf("from    %-16s %s (being rebalanced)\n", a_50, b_50?b_50:"");
+        else if(!strcmp(kind_50,"ROUTE"))
+            printf("route   %-16s -> %s\n", a_50, b_50?b_50:"");
+        else if(!strcmp(kind_50,"DEFAULT"))
+            printf("default %-16s (every other extension)\n", a_50);
     }
     close(fd_50);
+}
 
-    // printing the files in order
-    if(cc>0)
+//rebalance--------------------
+
+//moves a class onto the shards its "class" line now lists (S1 needs a matching "from" line)
+//"rebalance <class> [KB/s]" starts it in the background, "rebalance <class> status" shows progress
+static void cmd_rebalance_50(int argc_50, char **argv_50)
+{
+    int status_50 = (argc_50==3 && !strcmp(argv_50[2],"status"));
+    if(argc_50<2 || argc_50>3 || (argc_50==3 && !status_50 && atoi(argv_50[2])<=0))
     {
-        printf(".c files\n");
-        for(int i=0;i<cc;i++)
-            printf("%s\n", cvec[i]);
-        printf("\n");
+        fprintf(stderr,"usage: rebalance <class> [KB/s|status]\n");
+        return;
     }
-    if(pc>0)
+    int fd_50=connect_s1_50();
+    if(fd_50<0)
+        return;
+    int rc_50;
+    if(status_50)
+        rc_50=send_line_50(fd_50,"REBALANCE|%s|status",argv_50[1]);
+    else if(argc_50==3)
+        rc_50=send_line_50(fd_50,"REBALANCE|%s|start|%s",argv_50[1],argv_50[2]);
+    else
+        rc_50=send_line_50(fd_50,"REBALANCE|%s|start",argv_50[1]);
+    char line_50[LINE_MAX_50];
+    if(rc_50!=0 || read_line_50(fd_50,line_50,sizeof line_50)<=0)
     {
-        printf(".pdf files\n");
-        for(int i=0;i<pc;i++)
-            printf("%s\n", pvec[i]);
-        printf("\n");
+        close(fd_50);
+        return;
     }
-    if(tc>0)
+    close(fd_50);
+    if(strncmp(line_50,"OK|",3)!=0)
     {
-        printf(".txt files\n");
-        for(int i=0;i<tc;i++)
-            printf("%s\n", tvec[i]);
-        printf("\n");
+        fprintf(stderr,"rebalance: %s\n", line_50);
+        return;
     }
-    if(zc>0)
+    //the reply is OK|key=value|key=value..., printed as "key value" rows
+    char *save_50=NULL;
+    for(char *kv_50=strtok_r(line_50+3,"|",&save_50); kv_50; kv_50=strtok_r(NULL,"|",&save_50))
     {
-        printf(".zip files\n");
-        for(int i=0;i<zc;i++)
-            printf("%s\n", zvec[i]);
-        printf("\n");
+        char *eq_50=strchr(kv_50,'=');
+        if(eq_50)
+            *eq_50='\0';
+        printf("%-10s %s\n", kv_50, eq_50?eq_50+1:"");
     }
+}
+
+//stats--------------------
 
-    for(int i=0;i<cc;i++)
-        free(cvec[i]);
-    free(cvec);
-    for(int i=0;i<pc;i++)
-        free(pvec[i]);
-    free(pvec);
-    for(int i=0;i<tc;i++)
-        free(tvec[i]);
-    free(tvec);
-    for(int i=0;i<zc;i++)
-        free(zvec[i]);
-    free(zvec);
+//asks S1 for its request counters and prints one row per command and per backend
+//"stats hist" also prints the raw latency histograms (bucket upper bound in us : count)
+static void cmd_stats_50(int argc_50, char **argv_50)
+{
+    int show_hist_50 = (argc_50==2 && !strcmp(argv_50[1],"hist"));
+    if(argc_50>2 || (argc_50==2 && !show_hist_50))
+    {
+        fprintf(stderr,"usage: stats [hist]\n");
+        return;
+    }
+    int fd_50=connect_s1_50();
+    if(fd_50<0)
+        return;
+    if(send_line_50(fd_50,"STATS")!=0)
+    {
+        close(fd_50);
+        return;
+    }
+
+    char line_50[LINE_MAX_50];
+    if(read_line_50(fd_50,line_50,sizeof line_50)<=0 || strncmp(line_50,"STATSBEGIN",10)!=0)
+    {
+        fprintf(stderr,"stats: %s\n", line_50);
+        close(fd_50);
+        return;
+    }
+    printf("%-8s %-8s %9s %7s %12s %12s %9s %9s %9s %9s\n",
+        "kind","name","requests","errors","bytes_in","bytes_out","mean_us","p50_us","p99_us","p999_us");
+    for(;;)
+    {
+        int n_50=read_line_50(fd_50,line_50,sizeof line_50);
+        if(n_50<=0 || !strcmp(line_50,"STATSEND"))
+            break;
+        char *save_50=NULL;
+        char *kind_50=strtok_r(line_50,"|",&save_50);
+        char *name_50=strtok_r(NULL,"|",&save_50);
+        if(!kind_50 || !name_50)
+            continue;
+        if(!strcmp(kind_50,"HIST"))
+        {
+            if(show_hist_50)
+                printf("  %-8s %s\n", name_50, save_50 && *save_50 ? save_50 : "-");
+            continue;
+        }
+        char *f_50[8];
+        int nf_50=0;
+        while(nf_50<8 && (f_50[nf_50]=strtok_r(NULL,"|",&save_50))!=NULL)
+            nf_50++;
+        if(nf_50<8)
+            continue;
+        printf("%-8s %-8s %9s %7s %12s %12s %9s %9s %9s %9s\n",
+            kind_50,name_50,f_50[0],f_50[1],f_50[2],f_50[3],f_50[4],f_50[5],f_50[6],f_50[7]);
+    }
+    close(fd_50);
 }
 
 //splits a command to separate them so that we can work on them separately
@@ -731,8 +1217,10 @@ int main(int argc_50, char **argv_50)
         S1_PORT_50 = atoi(argv_50[2]);
 
     /* Startup banner (no "Ctrl+D to quit.") */
+    trace_init_50();
+    sock_load_50();
     fprintf(stdout,"Connected target S1 at %s:%d\n", S1_HOST_50, S1_PORT_50);
-    fprintf(stdout,"Enter commands (uploadf/downlf/removef/downltar/dispfnames). \n");
+    fprintf(stdout,"Enter commands (uploadf/downlf/removef/downltar/dispfnames/stats/routes/rebalance). \n");
 
     char line_50[LINE_MAX_50];
     char *v_50[12];
@@ -746,6 +1234,13 @@ int main(int argc_50, char **argv_50)
         if(ac_50==0)
             continue;
 
+        unsigned long long t0_50=0;
+        if(trace_fd_50>=0)
+        {
+            trace_new_rid_50();
+            t0_50=wall_us_50();
+        }
+
         if(!strcmp(v_50[0],"uploadf"))
             cmd_uploadf_50(ac_50, v_50);
         else if(!strcmp(v_50[0],"downlf"))
@@ -756,7 +1251,20 @@ int main(int argc_50, char **argv_50)
             cmd_downltar_50(ac_50, v_50);
         else if(!strcmp(v_50[0],"dispfnames"))
             cmd_dispfnames_50(ac_50, v_50);
-        else fprintf(stderr,"Unknown command only these are allowed (uploadf/downlf/removef/downltar/dispfnames). \n");
+        else if(!strcmp(v_50[0],"stats"))
+            cmd_stats_50(ac_50, v_50);
+        else if(!strcmp(v_50[0],"routes"))
+            cmd_routes_50(ac_50, v_50);
+        else if(!strcmp(v_50[0],"rebalance"))
+            cmd_rebalance_50(ac_50, v_50);
+        else fprintf(stderr,"Unknown command only these are allowed (uploadf/downlf/removef/downltar/dispfnames/stats/routes/rebalance). \n");
+
+        if(t0_50 && v_50[0][strspn(v_50[0],"abcdefghijklmnopqrstuvwxyz")]=='\0')
+        {
+            trace_command_50(v_50[0],t0_50);
+            printf("trace id %s\n", trace_rid_50);
+        }
     }
+    dfs_close(dfs_50);
     return 0;
 }
@@ -35,6 +35,10 @@ PROJECT_ROOT="$(cd "$(dirname "${BASH_SOURCE[0]}")/.." && pwd)"
 BIN_DIR="$PROJECT_ROOT/bin"
 LOG_DIR="$PROJECT_ROOT/logs"
 STORAGE_DIRS=("$HOME/S1" "$HOME/S2" "$HOME/S3" "$HOME/S4")
+# Prometheus endpoints: S<n> serves /metrics on METRICS_PORT_BASE+n (0 disables)
+METRICS_PORT_BASE="${METRICS_PORT_BASE:-9100}"
+# With DFS_SOCK_DIR set, S2-S4 also listen on $DFS_SOCK_DIR/s<n>.sock and S1 reaches them there
+DFS_SOCK_DIR="${DFS_SOCK_DIR:-}"
 
 # Streamlit environment configuration
 STREAMLIT_ENV_PATH="$PROJECT_ROOT/streamlit_env"
@@ -110,6 +114,30 @@ build_project() {
     fi
 }
 
+# Environment for one server: S<n>_METRICS_PORT when metrics are enabled
+metrics_env() {
+    local server=$1
+    if [ "$METRICS_PORT_BASE" != "0" ]; then
+        echo "${server}_METRICS_PORT=$((METRICS_PORT_BASE + ${server#S}))"
+    fi
+}
+
+# unix:<path> of a backend's socket when DFS_SOCK_DIR is set
+unix_addr() {
+    if [ -n "$DFS_SOCK_DIR" ]; then
+        echo "unix:$DFS_SOCK_DIR/${1,,}.sock"
+    fi
+}
+
+# A backend's host and port on S1's command line
+backend_addr() {
+    if [ -n "$DFS_SOCK_DIR" ]; then
+        echo "$(unix_addr $1) 0"
+    else
+        echo "127.0.0.1 $((5000 + ${1#S}))"
+    fi
+}
+
 # Start servers in background
 start_servers_background() {
     log "Starting DFS servers in background..."
@@ -117,12 +145,16 @@ start_servers_background() {
     # Ensure log directory exists
     mkdir -p "$LOG_DIR"
     
+    if [ -n "$DFS_SOCK_DIR" ]; then
+        mkdir -p "$DFS_SOCK_DIR"
+    fi
+
     # Start S2, S3, S4 first
     for server in S2 S3 S4; do
         port=$((5000 + ${server#S}))
         log "Starting $server on port $port..."
         
-        nohup "$BIN_DIR/$server" $port > "$LOG_DIR/${server,,}.log" 2>&1 &
+        env $(metrics_env $server) nohup "$BIN_DIR/$server" $port $(unix_addr $server) > "$LOG_DIR/${server,,}.log" 2>&1 &
         echo $! > "$LOG_DIR/${server,,}.pid"
         
         sleep 1
@@ -130,7 +162,7 @@ start_servers_background() {
     
     # Start S1 (main server)
     log "Starting S1 (main server) on port 5001..."
-    nohup "$BIN_DIR/S1" 5001 127.0.0.1 5002 127.0.0.1 5003 127.0.0.1 5004 > "$LOG_DIR/s1.log" 2>&1 &
+    env $(metrics_env S1) nohup "$BIN_DIR/S1" 5001 $(backend_addr S2) $(backend_addr S3) $(backend_addr S4) > "$LOG_DIR/s1.log" 2>&1 &
     echo $! > "$LOG_DIR/s1.pid"
     
     sleep 2
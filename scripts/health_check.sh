@@ -1,7 +1,7 @@
 #!/bin/bash
 
 # Health Check Script for Distributed File System
-# Usage: ./health_check.sh [check|quick|storage|resources|logs]
+# Usage: ./health_check.sh [check|quick|storage|metrics|resources|logs]
 
 set -e
 
@@ -14,6 +14,8 @@ NC='\033[0m' # No Color
 
 # Configuration
 SERVERS=("S1:5001" "S2:5002" "S3:5003" "S4:5004")
+# Prometheus endpoints (see scripts/deploy.sh): S<n> serves /metrics on METRICS_PORT_BASE+n
+METRICS_PORT_BASE="${METRICS_PORT_BASE:-9100}"
 STORAGE_DIRS=("$HOME/S1" "$HOME/S2" "$HOME/S3" "$HOME/S4")
 PROJECT_ROOT="$(cd "$(dirname "${BASH_SOURCE[0]}")/.." && pwd)"
 LOG_DIR="$PROJECT_ROOT/logs"
@@ -57,6 +59,55 @@ check_server_connectivity() {
     fi
 }
 
+# Fetch /metrics from a server; empty output when the endpoint is not up
+scrape_metrics() {
+    local port=$1
+    [ "$METRICS_PORT_BASE" = "0" ] && return 0
+    curl -s --max-time 2 "http://127.0.0.1:$port/metrics" 2>/dev/null || true
+}
+
+# Sum of every sample of one metric family in a scrape
+metric_sum() {
+    awk -v name="$1" '$1 == name || index($1, name "{") == 1 { s += $NF } END { printf "%.0f", s }'
+}
+
+# Check servers through their Prometheus endpoints
+check_metrics() {
+    log "Checking server metrics..."
+
+    local issues=0
+
+    for server_info in "${SERVERS[@]}"; do
+        local server=$(echo "$server_info" | cut -d: -f1)
+        local mport=$((METRICS_PORT_BASE + ${server#S}))
+        local scrape
+        scrape=$(scrape_metrics "$mport")
+
+        if [ -z "$scrape" ]; then
+            error "Metrics: $server on port $mport (no answer)"
+            issues=$((issues + 1))
+            continue
+        fi
+
+        local requests=$(echo "$scrape" | metric_sum dfs_requests_total)
+        local errors=$(echo "$scrape" | metric_sum dfs_request_errors_total)
+        local active=$(echo "$scrape" | metric_sum dfs_connections_active)
+        local inflight=$(echo "$scrape" | metric_sum dfs_requests_in_flight)
+        local free=$(echo "$scrape" | metric_sum dfs_disk_free_bytes)
+        success "Metrics: $server requests=$requests errors=$errors connections=$active in_flight=$inflight disk_free=$((free / 1024 / 1024))MB"
+
+        # S1 also reports whether each backend answered its last call
+        local down
+        down=$(echo "$scrape" | awk '/^dfs_backend_up\{/ && $NF == 0 { match($1, /backend="[^"]*"/); print substr($1, RSTART + 9, RLENGTH - 10) }')
+        for backend in $down; do
+            error "Metrics: $server cannot reach backend $backend"
+            issues=$((issues + 1))
+        done
+    done
+
+    return $issues
+}
+
 # Check storage directories
 check_storage() {
     log "Checking storage directories..."
@@ -309,11 +360,17 @@ main() {
     check_storage
     total_issues=$((total_issues + $?))
     
-    check_processes
-    total_issues=$((total_issues + $?))
-    
-    check_network
-    total_issues=$((total_issues + $?))
+    # the metrics endpoints cover process and network checks when they are enabled
+    if [ -n "$(scrape_metrics $((METRICS_PORT_BASE + 1)))" ]; then
+        check_metrics
+        total_issues=$((total_issues + $?))
+    else
+        check_processes
+        total_issues=$((total_issues + $?))
+
+        check_network
+        total_issues=$((total_issues + $?))
+    fi
     
     check_resources
     total_issues=$((total_issues + $?))
@@ -352,6 +409,9 @@ case "${1:-check}" in
     "storage")
         check_storage
         ;;
+    "metrics")
+        check_metrics
+        ;;
     "resources")
         check_resources
         ;;
@@ -359,10 +419,11 @@ case "${1:-check}" in
         check_logs
         ;;
     *)
-        echo "Usage: $0 [check|quick|storage|resources|logs]"
+        echo "Usage: $0 [check|quick|storage|metrics|resources|logs]"
         echo "  check     - Full health check (default)"
         echo "  quick     - Quick check of processes and network"
         echo "  storage   - Check storage directories only"
+        echo "  metrics   - Check servers through their /metrics endpoints"
         echo "  resources - Check system resources only"
         echo "  logs      - Check log files only"
         exit 1
@@ -0,0 +1,221 @@
+#!/usr/bin/env python3
+"""Compare dfsbench JSON reports against the checked-in performance baseline.
+
+Usage:
+    perf_compare.py BASELINE name=report.json [name=report.json ...]
+    perf_compare.py --update BASELINE name=report.json [...]
+
+A scenario name may be given several times (repeated runs); each metric is
+then the median across those runs, which keeps one noisy run from failing
+the gate.
+
+The baseline holds, per scenario and operation, the metrics we gate on.
+Throughput metrics (ops_per_s, mb_per_s) regress when they drop below
+baseline * (1 - tolerance); latency metrics (p50/p99/p999, microseconds)
+regress when they rise above baseline * (1 + tolerance) and by more than
+"min_latency_slack_us". Errors regress when they exceed the baseline by
+more than "error_slack".
+
+--update rewrites the measured values and records the host they were taken
+on. A metric whose runs spread wider than its default tolerance gets an
+override of that spread (capped at MAX_DERIVED_TOLERANCE), so the gate is as
+tight as the recording host allows and no looser.
+"""
+
+import json
+import os
+import platform
+import statistics
+import sys
+import time
+
+HIGHER_IS_BETTER = ("ops_per_s", "mb_per_s")
+LATENCY_METRICS = ("p50", "p99", "p999")
+
+DEFAULT_TOLERANCES = {
+    "ops_per_s": 0.25,
+    "mb_per_s": 0.25,
+    "p50": 0.35,
+    "p99": 0.35,
+    "p999": 0.75,
+}
+MAX_DERIVED_TOLERANCE = 0.75
+
+
+def load_report(path):
+    """Flatten one dfsbench report into {op: {metric: value}}"""
+    with open(path) as f:
+        report = json.load(f)
+    flat = {}
+    for op, data in report.get("ops", {}).items():
+        entry = {
+            "ops_per_s": data["ops_per_s"],
+            "mb_per_s": data["mb_per_s"],
+            "errors": data["errors"],
+        }
+        for metric in LATENCY_METRICS:
+            entry[metric] = data["lat_us"][metric]
+        flat[op] = entry
+    return flat
+
+
+def median_runs(runs):
+    """Merge several flattened reports of one scenario into per-metric medians"""
+    merged = {}
+    ops = set()
+    for run in runs:
+        ops.update(run.keys())
+    for op in ops:
+        present = [run[op] for run in runs if op in run]
+        merged[op] = {
+            metric: statistics.median(r[metric] for r in present) for metric in present[0]
+        }
+    return merged
+
+
+def spread_overrides(runs, tolerances):
+    """{"scenario.op.metric": spread} for metrics whose runs vary more than their tolerance"""
+    overrides = {}
+    for scenario, reports in sorted(runs.items()):
+        if len(reports) < 2:
+            continue
+        for op in sorted(set().union(*reports)):
+            present = [r[op] for r in reports if op in r]
+            for metric, tol in tolerances.items():
+                values = [r[metric] for r in present]
+                mid = statistics.median(values)
+                if not mid:
+                    continue
+                spread = (max(values) - min(values)) / mid
+                if spread > tol:
+                    overrides[f"{scenario}.{op}.{metric}"] = round(min(spread, MAX_DERIVED_TOLERANCE), 2)
+    return overrides
+
+
+def host_info():
+    """Where a baseline was recorded, since its numbers only hold there"""
+    cpu = platform.processor() or platform.machine()
+    try:
+        with open("/proc/cpuinfo") as f:
+            for line in f:
+                if line.startswith("model name"):
+                    cpu = line.split(":", 1)[1].strip()
+                    break
+    except OSError:
+        pass
+    return {"cpu": cpu, "cpus": os.cpu_count(), "kernel": platform.release(),
+            "recorded": time.strftime("%Y-%m-%d")}
+
+
+def tolerance_for(baseline, scenario, op, metric):
+    """Per-metric override ("scenario.op.metric") or the metric default"""
+    overrides = baseline.get("overrides", {})
+    key = f"{scenario}.{op}.{metric}"
+    if key in overrides:
+        return overrides[key]
+    return baseline.get("tolerances", DEFAULT_TOLERANCES).get(metric, DEFAULT_TOLERANCES.get(metric, 0.25))
+
+
+def compare(baseline, results):
+    """Return (rows, regressions) where rows feed the diff table"""
+    rows = []
+    regressions = 0
+    slack = baseline.get("min_latency_slack_us", 500)
+    error_slack = baseline.get("error_slack", 2)
+    for scenario, expected_ops in sorted(baseline.get("scenarios", {}).items()):
+        current_ops = results.get(scenario)
+        if current_ops is None:
+            rows.append((scenario, "-", "-", "-", "-", "-", "MISSING"))
+            regressions += 1
+            continue
+        for op, expected in sorted(expected_ops.items()):
+            current = current_ops.get(op)
+            if current is None:
+                rows.append((scenario, op, "-", "-", "-", "-", "MISSING"))
+                regressions += 1
+                continue
+            for metric, base in sorted(expected.items()):
+                cur = current.get(metric, 0)
+                status = "ok"
+                if metric == "errors":
+                    if cur > base + error_slack:
+                        status = "REGRESSION"
+                elif metric in HIGHER_IS_BETTER:
+                    if cur < base * (1 - tolerance_for(baseline, scenario, op, metric)):
+                        status = "REGRESSION"
+                    elif cur > base * (1 + tolerance_for(baseline, scenario, op, metric)):
+                        status = "improved"
+                else:
+                    tol = tolerance_for(baseline, scenario, op, metric)
+                    if cur > base * (1 + tol) and cur - base > slack:
+                        status = "REGRESSION"
+                    elif cur < base * (1 - tol) and base - cur > slack:
+                        status = "improved"
+                if status == "REGRESSION":
+                    regressions += 1
+                delta = ((cur - base) / base * 100.0) if base else 0.0
+                rows.append((scenario, op, metric, f"{base:.1f}", f"{cur:.1f}", f"{delta:+.1f}%", status))
+    return rows, regressions
+
+
+def print_table(rows):
+    headers = ("scenario", "op", "metric", "baseline", "current", "delta", "status")
+    widths = [max(len(str(r[i])) for r in rows + [headers]) for i in range(len(headers))]
+    line = "  ".join(h.ljust(w) for h, w in zip(headers, widths))
+    print(line)
+    print("-" * len(line))
+    for r in rows:
+        print("  ".join(str(c).ljust(w) for c, w in zip(r, widths)))
+
+
+def update(baseline_path, runs, results):
+    """Rewrite the measured values, the host and the spread overrides, keeping tolerances"""
+    try:
+        with open(baseline_path) as f:
+            baseline = json.load(f)
+    except FileNotFoundError:
+        baseline = {"tolerances": DEFAULT_TOLERANCES, "min_latency_slack_us": 500,
+                    "error_slack": 2, "overrides": {}}
+    scenarios = {}
+    for scenario, ops in results.items():
+        scenarios[scenario] = {
+            op: {k: round(v, 1) for k, v in metrics.items()} for op, metrics in ops.items()
+        }
+    baseline["scenarios"] = scenarios
+    baseline["host"] = host_info()
+    baseline["overrides"] = spread_overrides(runs, baseline.get("tolerances", DEFAULT_TOLERANCES))
+    with open(baseline_path, "w") as f:
+        json.dump(baseline, f, indent=2, sort_keys=True)
+        f.write("\n")
+
+
+def main(argv):
+    do_update = False
+    if argv and argv[0] == "--update":
+        do_update = True
+        argv = argv[1:]
+    if len(argv) < 2:
+        print(__doc__)
+        return 2
+    baseline_path = argv[0]
+    runs = {}
+    for arg in argv[1:]:
+        name, _, path = arg.partition("=")
+        runs.setdefault(name, []).append(load_report(path))
+    results = {name: median_runs(r) for name, r in runs.items()}
+
+    if do_update:
+        update(baseline_path, runs, results)
+        return 0
+
+    with open(baseline_path) as f:
+        baseline = json.load(f)
+    rows, regressions = compare(baseline, results)
+    print_table(rows)
+    print()
+    print(f"{regressions} regression(s)")
+    return 1 if regressions else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
@@ -0,0 +1,137 @@
+#!/bin/bash
+
+# Performance regression gate for the Distributed File System
+# Starts S1-S4 on loopback with isolated $HOME dirs, runs a fixed dfsbench
+# matrix and compares the results against scripts/perf_baseline.json.
+# Usage: ./perfcheck.sh [check|update]
+#   check  - compare against the baseline, exit 1 on any regression (default)
+#   update - run the matrix and rewrite the baseline values, host and spread overrides (tolerances kept)
+# Every scenario gets a fresh cluster with empty stores, so what one scenario leaves behind
+# (downltar archives every file of a type) never shows in another's numbers.
+# Environment: PERF_PORT_BASE (27001), PERF_DURATION (seconds per run, 3),
+#              PERF_REPEAT (runs per scenario, medians are compared, 3)
+
+set -e
+
+# Colors for output
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+BLUE='\033[0;34m'
+NC='\033[0m' # No Color
+
+log() {
+    echo -e "${BLUE}[$(date +'%Y-%m-%d %H:%M:%S')]${NC} $1"
+}
+
+error() {
+    echo -e "${RED}[ERROR]${NC} $1"
+}
+
+success() {
+    echo -e "${GREEN}[SUCCESS]${NC} $1"
+}
+
+# Configuration
+PROJECT_ROOT="$(cd "$(dirname "${BASH_SOURCE[0]}")/.." && pwd)"
+BIN_DIR="$PROJECT_ROOT/bin"
+BASELINE="$PROJECT_ROOT/scripts/perf_baseline.json"
+COMPARE="$PROJECT_ROOT/scripts/perf_compare.py"
+# below the Linux ephemeral range (32768-60999), where outgoing connections take their ports
+PORT_BASE="${PERF_PORT_BASE:-27001}"
+DURATION="${PERF_DURATION:-3}"
+REPEAT="${PERF_REPEAT:-3}"
+MODE="${1:-check}"
+
+S1_PORT=$PORT_BASE
+S2_PORT=$((PORT_BASE + 1))
+S3_PORT=$((PORT_BASE + 2))
+S4_PORT=$((PORT_BASE + 3))
+
+# Fixed benchmark matrix: name|dfsbench arguments
+# Changing a row invalidates its baseline, so run 'update' afterwards.
+MATRIX=(
+    "read_heavy|-c 4 -m downlf=80,dispfnames=10,uploadf=10 -s fixed:64k -w 8"
+    "write_heavy|-c 4 -m uploadf=70,removef=20,downlf=10 -s uniform:4k:256k -w 4"
+    "archive|-c 2 -m downltar=1 -s fixed:32k -w 8"
+    "open_loop|-c 8 -r 150 -m downlf=90,uploadf=10 -s exp:32k -w 8"
+)
+
+WORK_DIR="$(mktemp -d /tmp/dfs_perfcheck.XXXXXX)"
+PIDS=()
+
+stop_cluster() {
+    for pid in "${PIDS[@]}"; do
+        kill "$pid" 2>/dev/null || true
+    done
+    wait 2>/dev/null || true
+    PIDS=()
+}
+
+cleanup() {
+    stop_cluster
+    rm -rf "$WORK_DIR"
+}
+trap cleanup EXIT
+
+# Wait until something accepts connections on the port
+wait_port() {
+    local port=$1
+    for _ in $(seq 1 50); do
+        if (exec 3<>"/dev/tcp/127.0.0.1/$port") 2>/dev/null; then
+            return 0
+        fi
+        sleep 0.1
+    done
+    error "nothing listening on port $port"
+    return 1
+}
+
+# Start one server with its own $HOME under the scenario's directory so benchmark data
+# never touches real stores
+start_server() {
+    local dir=$1 name=$2; shift 2
+    mkdir -p "$dir/$name"
+    HOME="$dir/$name" "$BIN_DIR/$name" "$@" > "$dir/$name.log" 2>&1 &
+    PIDS+=($!)
+}
+
+# S1-S4 on empty stores in $WORK_DIR/<scenario>
+start_cluster() {
+    local dir="$WORK_DIR/$1"
+    log "Starting S1-S4 on ports $S1_PORT-$S4_PORT (stores in $dir)..."
+    start_server "$dir" S2 "$S2_PORT"
+    start_server "$dir" S3 "$S3_PORT"
+    start_server "$dir" S4 "$S4_PORT"
+    wait_port "$S2_PORT"; wait_port "$S3_PORT"; wait_port "$S4_PORT"
+    start_server "$dir" S1 "$S1_PORT" 127.0.0.1 "$S2_PORT" 127.0.0.1 "$S3_PORT" 127.0.0.1 "$S4_PORT"
+    wait_port "$S1_PORT"
+}
+
+log "Building binaries..."
+make -C "$PROJECT_ROOT" all > /dev/null
+
+RESULTS=()
+for row in "${MATRIX[@]}"; do
+    name="${row%%|*}"
+    args="${row#*|}"
+    start_cluster "$name"
+    for run in $(seq 1 "$REPEAT"); do
+        log "Running scenario '$name' (run $run/$REPEAT, ${DURATION}s)..."
+        # shellcheck disable=SC2086
+        "$BIN_DIR/dfsbench" -p "$S1_PORT" -t "$DURATION" -d "~S1/perfcheck_$name" $args -o "$WORK_DIR/$name.$run.json"
+        RESULTS+=("$name=$WORK_DIR/$name.$run.json")
+    done
+    stop_cluster
+done
+
+if [ "$MODE" = "update" ]; then
+    python3 "$COMPARE" --update "$BASELINE" "${RESULTS[@]}"
+    success "Baseline updated: $BASELINE"
+else
+    if python3 "$COMPARE" "$BASELINE" "${RESULTS[@]}"; then
+        success "No performance regressions."
+    else
+        error "Performance regressions detected (see table above)."
+        exit 1
+    fi
+fi
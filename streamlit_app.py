@@ -7,8 +7,18 @@ from pathlib import Path
 import threading
 import os
 
+try:
+    import dfsclient
+except ImportError:
+    dfsclient = None
+
 st.set_page_config(page_title="Distributed File System", layout="wide")
 
+@st.cache_resource
+def dfs_connection():
+    """One libdfsclient connection to S1, kept across reruns and shared by the sessions"""
+    return dfsclient.Client("127.0.0.1", 5001, timeout=10), threading.Lock()
+
 class DFSManager:
     def __init__(self):
         self.base_dir = Path.cwd()
@@ -66,8 +76,45 @@ class DFSManager:
             st.error(f"Failed to stop servers: {e}")
             return False
     
+    def client(self):
+        """The kept S1 connection and its lock, or None when libdfsclient is not built or S1 is down"""
+        if dfsclient is None:
+            return None
+        try:
+            return dfs_connection()
+        except (OSError, dfsclient.DFSError):
+            return None
+
+    def run_on_client(self, command):
+        """DISP, DOWNLF and REMOVEF of one path over the kept connection, answered in S1's reply
+        format; None for anything else (or without the library)"""
+        conn = self.client()
+        parts = command.strip().split("|")
+        if conn is None:
+            return None
+        c, lock = conn
+        try:
+            with lock:
+                if parts[0] == "DISP" and len(parts) == 2:
+                    names = [f"NAME|{ext}|{name}" for ext, name in c.list(parts[1])]
+                    return "\n".join(["LISTBEGIN"] + names + ["LISTEND"])
+                if parts[0] == "DOWNLF" and parts[1:2] == ["1"] and len(parts) == 3:
+                    data = c.download(parts[2])
+                    return f"FILERESP|{Path(parts[2]).name}|{len(data)}\nDONE"
+                if parts[0] == "REMOVEF" and parts[1:2] == ["1"] and len(parts) == 3:
+                    c.remove(parts[2])
+                    return f"REMOK|{parts[2]}"
+        except dfsclient.NotFound as e:
+            return f"FILENOTFOUND|{parts[-1]}" if parts[0] == "DOWNLF" else f"REMERR|{parts[-1]}|{e}"
+        except dfsclient.DFSError as e:
+            return f"ERR|{e}"
+        return None
+
     def send_command(self, command, timeout=10):
         """Send command to S1 server and get response"""
+        result = self.run_on_client(command)
+        if result is not None:
+            return result
         try:
             with socket.socket(socket.AF_INET, socket.SOCK_STREAM) as s:
                 s.settimeout(timeout)
@@ -98,6 +145,17 @@ class DFSManager:
         if not files or len(files) > 3:
             return "Error: Upload 1-3 files only"
         
+        conn = self.client()
+        if conn is not None:
+            c, lock = conn
+            try:
+                with lock:
+                    for file in files:
+                        c.upload("~S1/", file.name, file.getvalue())
+                return f"✅ Successfully uploaded {len(files)} files to ~S1/"
+            except dfsclient.DFSError as e:
+                return f"❌ Upload failed: {e}"
+
         try:
             with socket.socket(socket.AF_INET, socket.SOCK_STREAM) as s:
                 s.settimeout(15)
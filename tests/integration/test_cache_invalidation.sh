@@ -0,0 +1,99 @@
+#!/bin/bash
+
+# read cache: a file served from the cache is dropped by S1's own upload of a new version and
+# by its remove, long before the cache period would have it checked against the backend.
+# Environment: TEST_PORT_BASE (24201)
+
+set -u
+
+PROJECT_ROOT="$(cd "$(dirname "${BASH_SOURCE[0]}")/../.." && pwd)"
+BIN_DIR="$PROJECT_ROOT/bin"
+PORT_BASE="${TEST_PORT_BASE:-24201}"
+METRICS_PORT=$((PORT_BASE + 9))
+WORK_DIR="$(mktemp -d /tmp/dfs_test_cache.XXXXXX)"
+PIDS=()
+
+cleanup() {
+    for pid in "${PIDS[@]}"; do
+        kill "$pid" 2>/dev/null || true
+    done
+    wait 2>/dev/null || true
+    rm -rf "$WORK_DIR"
+}
+trap cleanup EXIT
+
+fail() {
+    echo "FAIL: $1"
+    exit 1
+}
+
+wait_port() {
+    for _ in $(seq 1 50); do
+        if (exec 3<>"/dev/tcp/127.0.0.1/$1") 2>/dev/null; then
+            return 0
+        fi
+        sleep 0.1
+    done
+    fail "nothing listening on port $1"
+}
+
+client() {
+    : > "$WORK_DIR/client.log"
+    (cd "$WORK_DIR/out" && printf '%s\n' "$@" | "$BIN_DIR/s25client" 127.0.0.1 "$PORT_BASE" >> "$WORK_DIR/client.log" 2>&1)
+}
+
+# sum of a counter over all its labels, from S1's /metrics
+metric() {
+    (
+        exec 3<>"/dev/tcp/127.0.0.1/$METRICS_PORT" || exit 1
+        printf 'GET /metrics HTTP/1.0\r\n\r\n' >&3
+        cat <&3
+    ) | awk -v m="$1" '$1 == m || index($1, m "{") == 1 { s += $2 } END { print s + 0 }'
+}
+
+download() {
+    rm -f "$WORK_DIR/out/doc.pdf"
+    client "downlf ~S1/c/doc.pdf"
+}
+
+mkdir -p "$WORK_DIR/home0" "$WORK_DIR/home1" "$WORK_DIR/v1" "$WORK_DIR/v2" "$WORK_DIR/out"
+head -c 50000 /dev/urandom > "$WORK_DIR/v1/doc.pdf"
+head -c 60000 /dev/urandom > "$WORK_DIR/v2/doc.pdf"
+
+HOME="$WORK_DIR/home1" "$BIN_DIR/S2" $((PORT_BASE + 1)) > "$WORK_DIR/S2.log" 2>&1 &
+PIDS+=($!)
+wait_port $((PORT_BASE + 1))
+# a 10 minute cache period, so only the invalidation can make S1 look at the backend again
+cat > "$WORK_DIR/dfs.conf" <<CONF
+class docs 127.0.0.1:$((PORT_BASE + 1))
+route docs .pdf
+cache 16 0 600000
+writeback off
+CONF
+HOME="$WORK_DIR/home0" DFS_CONF="$WORK_DIR/dfs.conf" S1_METRICS_PORT="$METRICS_PORT" "$BIN_DIR/S1" "$PORT_BASE" > "$WORK_DIR/S1.log" 2>&1 &
+PIDS+=($!)
+wait_port "$PORT_BASE"
+wait_port "$METRICS_PORT"
+
+client "uploadf $WORK_DIR/v1/doc.pdf ~S1/c/"
+download
+download
+cmp -s "$WORK_DIR/out/doc.pdf" "$WORK_DIR/v1/doc.pdf" || fail "first version did not download"
+hits=$(metric dfs_cache_hits_total)
+[ "$hits" -ge 1 ] || fail "second download was not served from the cache"
+
+# upload of a new version
+client "uploadf $WORK_DIR/v2/doc.pdf ~S1/c/"
+grep -q "uploaded successfully" "$WORK_DIR/client.log" || fail "second version was not uploaded"
+download
+cmp -s "$WORK_DIR/out/doc.pdf" "$WORK_DIR/v2/doc.pdf" || fail "download after the upload of a new version served the old one"
+download
+cmp -s "$WORK_DIR/out/doc.pdf" "$WORK_DIR/v2/doc.pdf" || fail "new version did not stay cached"
+[ "$(metric dfs_cache_hits_total)" -gt "$hits" ] || fail "new version was not served from the cache"
+
+# remove
+client "removef ~S1/c/doc.pdf"
+download
+[ ! -e "$WORK_DIR/out/doc.pdf" ] || fail "download after the remove still served the file"
+grep -q "FILENOTFOUND|~S1/c/doc.pdf" "$WORK_DIR/client.log" || fail "download after the remove did not report FILENOTFOUND"
+exit 0
@@ -0,0 +1,100 @@
+#!/bin/bash
+
+# downltar -z and -l: the gzip and LZ4 archives, of a backend class, of S1's local files and of
+# both streamed together, unpack to exactly the uploaded files. The files span many of the
+# 256KiB blocks S1 compresses side by side, so the blocks must come out in order.
+# Environment: TEST_PORT_BASE (24301)
+
+set -u
+
+PROJECT_ROOT="$(cd "$(dirname "${BASH_SOURCE[0]}")/../.." && pwd)"
+BIN_DIR="$PROJECT_ROOT/bin"
+PORT_BASE="${TEST_PORT_BASE:-24301}"
+WORK_DIR="$(mktemp -d /tmp/dfs_test_compress.XXXXXX)"
+PIDS=()
+NFILES=6
+
+cleanup() {
+    for pid in "${PIDS[@]}"; do
+        kill "$pid" 2>/dev/null || true
+    done
+    wait 2>/dev/null || true
+    rm -rf "$WORK_DIR"
+}
+trap cleanup EXIT
+
+fail() {
+    echo "FAIL: $1"
+    exit 1
+}
+
+wait_port() {
+    for _ in $(seq 1 50); do
+        if (exec 3<>"/dev/tcp/127.0.0.1/$1") 2>/dev/null; then
+            return 0
+        fi
+        sleep 0.1
+    done
+    fail "nothing listening on port $1"
+}
+
+mkdir -p "$WORK_DIR/home0" "$WORK_DIR/home1" "$WORK_DIR/files" "$WORK_DIR/out"
+HOME="$WORK_DIR/home1" "$BIN_DIR/S2" $((PORT_BASE + 1)) > "$WORK_DIR/S2.log" 2>&1 &
+PIDS+=($!)
+wait_port $((PORT_BASE + 1))
+cat > "$WORK_DIR/dfs.conf" <<CONF
+class docs 127.0.0.1:$((PORT_BASE + 1))
+route docs .pdf
+route local .c
+cache off
+CONF
+HOME="$WORK_DIR/home0" DFS_CONF="$WORK_DIR/dfs.conf" "$BIN_DIR/S1" "$PORT_BASE" > "$WORK_DIR/S1.log" 2>&1 &
+PIDS+=($!)
+wait_port "$PORT_BASE"
+
+# compressible text with a random tail, about 400KB each
+cmds=""
+for i in $(seq 1 "$NFILES"); do
+    for ext in pdf c; do
+        f="$WORK_DIR/files/f$i.$ext"
+        seq "$i" 3 200000 > "$f"
+        head -c $((1000 * i)) /dev/urandom >> "$f"
+    done
+    cmds+="uploadf $WORK_DIR/files/f$i.pdf $WORK_DIR/files/f$i.c ~S1/z/d$((i % 2))/"$'\n'
+done
+cmds+="downltar -z .pdf"$'\n'"downltar -l .pdf"$'\n'"downltar -z .c"$'\n'"downltar -l .c"$'\n'
+cmds+="downltar -z .c .pdf"$'\n'"downltar -l .c .pdf"$'\n'
+(cd "$WORK_DIR/out" && printf '%s' "$cmds" | "$BIN_DIR/s25client" 127.0.0.1 "$PORT_BASE" > "$WORK_DIR/client.log" 2>&1)
+
+# unpacks an archive with the given decompressor and checks every member against its upload
+check_archive() {
+    local archive=$1 unpack=$2 want=$3
+    local dir="$WORK_DIR/x_$(basename "$archive")"
+    [ -s "$WORK_DIR/out/$archive" ] || fail "$archive was not downloaded"
+    mkdir -p "$dir"
+    $unpack < "$WORK_DIR/out/$archive" | tar -xf - -C "$dir" || fail "$archive did not unpack"
+    local count
+    count=$(find "$dir" -type f | wc -l)
+    [ "$count" -eq "$want" ] || fail "$archive has $count files, expected $want"
+    local f
+    while IFS= read -r f; do
+        cmp -s "$f" "$WORK_DIR/files/$(basename "$f")" || fail "$(basename "$f") in $archive differs from the upload"
+    done < <(find "$dir" -type f)
+    local raw
+    raw=$(du -cb "$dir" | tail -n 1 | cut -f 1)
+    [ "$(stat -c %s "$WORK_DIR/out/$archive")" -lt "$raw" ] || fail "$archive is not smaller than its contents"
+}
+check_archive pdfs.tar.gz "gzip -dc" "$NFILES"
+check_archive cfiles.tar.gz "gzip -dc" "$NFILES"
+check_archive c_pdf.tar.gz "gzip -dc" $((2 * NFILES))
+if command -v lz4 > /dev/null; then
+    check_archive pdfs.tar.lz4 "lz4 -dc" "$NFILES"
+    check_archive cfiles.tar.lz4 "lz4 -dc" "$NFILES"
+    check_archive c_pdf.tar.lz4 "lz4 -dc" $((2 * NFILES))
+else
+    echo "lz4 not installed, only checked that the .tar.lz4 archives arrived"
+    for a in pdfs.tar.lz4 cfiles.tar.lz4 c_pdf.tar.lz4; do
+        [ -s "$WORK_DIR/out/$a" ] || fail "$a was not downloaded"
+    done
+fi
+exit 0
@@ -0,0 +1,89 @@
+#!/bin/bash
+
+# downltar of a replicated class: every file is on two of three shards, and the archive
+# (single-type FILERESP and multi-type TARSTREAM alike) must hold each of them exactly once.
+# Environment: TEST_PORT_BASE (24001)
+
+set -u
+
+PROJECT_ROOT="$(cd "$(dirname "${BASH_SOURCE[0]}")/../.." && pwd)"
+BIN_DIR="$PROJECT_ROOT/bin"
+PORT_BASE="${TEST_PORT_BASE:-24001}"
+WORK_DIR="$(mktemp -d /tmp/dfs_test_tar.XXXXXX)"
+PIDS=()
+NFILES=24
+
+cleanup() {
+    for pid in "${PIDS[@]}"; do
+        kill "$pid" 2>/dev/null || true
+    done
+    wait 2>/dev/null || true
+    rm -rf "$WORK_DIR"
+}
+trap cleanup EXIT
+
+fail() {
+    echo "FAIL: $1"
+    exit 1
+}
+
+wait_port() {
+    for _ in $(seq 1 50); do
+        if (exec 3<>"/dev/tcp/127.0.0.1/$1") 2>/dev/null; then
+            return 0
+        fi
+        sleep 0.1
+    done
+    fail "nothing listening on port $1"
+}
+
+# backends with their own $HOME each, so every shard has its own store
+for i in 1 2 3; do
+    server="S$((i + 1))"
+    mkdir -p "$WORK_DIR/home$i"
+    HOME="$WORK_DIR/home$i" "$BIN_DIR/$server" $((PORT_BASE + i)) > "$WORK_DIR/$server.log" 2>&1 &
+    PIDS+=($!)
+done
+for i in 1 2 3; do
+    wait_port $((PORT_BASE + i))
+done
+cat > "$WORK_DIR/dfs.conf" <<CONF
+class docs 127.0.0.1:$((PORT_BASE + 1)) 127.0.0.1:$((PORT_BASE + 2)) 127.0.0.1:$((PORT_BASE + 3))
+replicas docs 2 2
+route docs .pdf .txt
+cache off
+CONF
+mkdir -p "$WORK_DIR/home0"
+HOME="$WORK_DIR/home0" DFS_CONF="$WORK_DIR/dfs.conf" "$BIN_DIR/S1" "$PORT_BASE" > "$WORK_DIR/S1.log" 2>&1 &
+PIDS+=($!)
+wait_port "$PORT_BASE"
+
+mkdir -p "$WORK_DIR/files" "$WORK_DIR/out"
+cmds=""
+for i in $(seq 1 "$NFILES"); do
+    echo "pdf $i" > "$WORK_DIR/files/doc$i.pdf"
+    echo "txt $i" > "$WORK_DIR/files/note$i.txt"
+    cmds+="uploadf $WORK_DIR/files/doc$i.pdf $WORK_DIR/files/note$i.txt ~S1/proj/d$((i % 4))/"$'\n'
+done
+cmds+="downltar .pdf"$'\n'"downltar .pdf .txt"$'\n'
+(cd "$WORK_DIR/out" && printf '%s' "$cmds" | "$BIN_DIR/s25client" 127.0.0.1 "$PORT_BASE" > "$WORK_DIR/client.log" 2>&1)
+
+# each file really is on two shards
+copies=$(find "$WORK_DIR"/home[123] -name 'doc*.pdf' | wc -l)
+[ "$copies" -eq $((2 * NFILES)) ] || fail "expected $((2 * NFILES)) stored copies of the pdfs, found $copies"
+
+check_tar() {
+    local tarfile=$1 want=$2
+    [ -f "$tarfile" ] || fail "$(basename "$tarfile") was not downloaded"
+    local names
+    names=$(tar -tf "$tarfile") || fail "$(basename "$tarfile") is not a valid tar"
+    local dups
+    dups=$(printf '%s\n' "$names" | sort | uniq -d)
+    [ -z "$dups" ] || fail "$(basename "$tarfile") holds members more than once: $dups"
+    local count
+    count=$(printf '%s\n' "$names" | grep -c .)
+    [ "$count" -eq "$want" ] || fail "$(basename "$tarfile") has $count members, expected $want"
+}
+check_tar "$WORK_DIR/out/pdfs.tar" "$NFILES"
+check_tar "$WORK_DIR/out/pdf_txt.tar" $((2 * NFILES))
+exit 0
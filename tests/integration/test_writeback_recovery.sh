@@ -0,0 +1,135 @@
+#!/bin/bash
+
+# writeback on: uploads are acknowledged once journaled and still reach the backend when it
+# was killed (the forwarder retries until it is back) and when the forwarder itself was killed
+# (a restarted S1 forwards what its journal holds).
+# Environment: TEST_PORT_BASE (24101)
+
+set -u
+
+PROJECT_ROOT="$(cd "$(dirname "${BASH_SOURCE[0]}")/../.." && pwd)"
+BIN_DIR="$PROJECT_ROOT/bin"
+PORT_BASE="${TEST_PORT_BASE:-24101}"
+WORK_DIR="$(mktemp -d /tmp/dfs_test_wb.XXXXXX)"
+PIDS=()
+S1_PID=""
+S2_PID=""
+
+cleanup() {
+    for pid in "${PIDS[@]}"; do
+        kill "$pid" 2>/dev/null || true
+    done
+    wait 2>/dev/null || true
+    rm -rf "$WORK_DIR"
+}
+trap cleanup EXIT
+
+fail() {
+    echo "FAIL: $1"
+    exit 1
+}
+
+wait_port() {
+    for _ in $(seq 1 50); do
+        if (exec 3<>"/dev/tcp/127.0.0.1/$1") 2>/dev/null; then
+            return 0
+        fi
+        sleep 0.1
+    done
+    fail "nothing listening on port $1"
+}
+
+start_s2() {
+    HOME="$WORK_DIR/home1" "$BIN_DIR/S2" $((PORT_BASE + 1)) >> "$WORK_DIR/S2.log" 2>&1 &
+    S2_PID=$!
+    PIDS+=("$S2_PID")
+    wait_port $((PORT_BASE + 1))
+}
+
+start_s1() {
+    HOME="$WORK_DIR/home0" DFS_CONF="$WORK_DIR/dfs.conf" "$BIN_DIR/S1" "$PORT_BASE" >> "$WORK_DIR/S1.log" 2>&1 &
+    S1_PID=$!
+    PIDS+=("$S1_PID")
+    wait_port "$PORT_BASE"
+}
+
+# kills a process outright and reaps it
+kill_hard() {
+    kill -9 "$1" 2>/dev/null
+    wait "$1" 2>/dev/null
+}
+
+client() {
+    (cd "$WORK_DIR/out" && printf '%s\n' "$@" | "$BIN_DIR/s25client" 127.0.0.1 "$PORT_BASE" >> "$WORK_DIR/client.log" 2>&1)
+}
+
+upload() {
+    : > "$WORK_DIR/client.log"
+    client "uploadf $WORK_DIR/files/$1 ~S1/wb/"
+    grep -q "uploaded successfully" "$WORK_DIR/client.log" || fail "upload of $1 was not acknowledged: $(cat "$WORK_DIR/client.log")"
+}
+
+journaled() {
+    find "$WORK_DIR/home0/S1/.journal" -name '*.meta' 2>/dev/null | wc -l
+}
+
+# waits up to 20s for the backend to hold each named file with the uploaded bytes and for
+# the journal to be empty
+wait_forwarded() {
+    for _ in $(seq 1 200); do
+        local all=1
+        for f in "$@"; do
+            stored=$(find "$WORK_DIR/home1" -name "$f" -type f | head -n 1)
+            if [ -z "$stored" ] || ! cmp -s "$stored" "$WORK_DIR/files/$f"; then
+                all=0
+            fi
+        done
+        if [ "$all" -eq 1 ] && [ "$(journaled)" -eq 0 ]; then
+            return 0
+        fi
+        sleep 0.1
+    done
+    fail "$* not forwarded to the backend ($(journaled) left in the journal)"
+}
+
+mkdir -p "$WORK_DIR/home0" "$WORK_DIR/home1" "$WORK_DIR/files" "$WORK_DIR/out"
+for f in a1 a2 a3 b1 b2; do
+    head -c $((40000 + RANDOM)) /dev/urandom > "$WORK_DIR/files/$f.pdf"
+done
+cat > "$WORK_DIR/dfs.conf" <<CONF
+class docs 127.0.0.1:$((PORT_BASE + 1))
+route docs .pdf
+cache off
+writeback on
+CONF
+start_s2
+start_s1
+
+upload a1.pdf
+wait_forwarded a1.pdf
+
+# backend killed: uploads are still acknowledged, downloads come from the journal, and the
+# forwarder retries until the backend is back
+kill_hard "$S2_PID"
+upload a2.pdf
+upload a3.pdf
+[ "$(journaled)" -eq 2 ] || fail "expected 2 journaled uploads with the backend down, found $(journaled)"
+client "downlf ~S1/wb/a2.pdf"
+cmp -s "$WORK_DIR/out/a2.pdf" "$WORK_DIR/files/a2.pdf" || fail "a2.pdf did not download from the journal"
+start_s2
+wait_forwarded a1.pdf a2.pdf a3.pdf
+
+# forwarder killed: S1 keeps acknowledging into the journal, and forwards it once restarted
+kill_hard "$S2_PID"
+upload b1.pdf
+FWD_PID=$(pgrep -o -P "$S1_PID")
+[ -n "$FWD_PID" ] || fail "no forwarder process under S1"
+kill_hard "$FWD_PID"
+upload b2.pdf
+kill_hard "$S1_PID"
+[ "$(journaled)" -eq 2 ] || fail "expected 2 journaled uploads after the forwarder died, found $(journaled)"
+start_s2
+start_s1
+grep -q "journal: 2 uploads left to forward" "$WORK_DIR/S1.log" || fail "restarted S1 did not pick up its journal"
+wait_forwarded a1.pdf a2.pdf a3.pdf b1.pdf b2.pdf
+exit 0
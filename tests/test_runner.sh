@@ -0,0 +1,50 @@
+#!/bin/bash
+
+# Test runner for the Distributed File System
+# Usage: ./test_runner.sh [all|integration]
+#   integration - start S1-S4 on loopback and check end-to-end behaviour
+# Each test is a script tests/<category>/test_*.sh that exits non-zero on failure.
+
+set -u
+
+# Colors for output
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+BLUE='\033[0;34m'
+NC='\033[0m' # No Color
+
+log() {
+    echo -e "${BLUE}[$(date +'%Y-%m-%d %H:%M:%S')]${NC} $1"
+}
+
+TEST_ROOT="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+CATEGORY="${1:-all}"
+
+case "$CATEGORY" in
+    all) CATEGORIES=(integration) ;;
+    integration) CATEGORIES=("$CATEGORY") ;;
+    *)
+        echo "Usage: $0 [all|integration]"
+        exit 1
+        ;;
+esac
+
+passed=0
+failed=0
+for category in "${CATEGORIES[@]}"; do
+    for test in "$TEST_ROOT/$category"/test_*.sh; do
+        [ -f "$test" ] || continue
+        name="$category/$(basename "$test" .sh)"
+        log "Running $name..."
+        if bash "$test"; then
+            echo -e "${GREEN}[PASS]${NC} $name"
+            passed=$((passed + 1))
+        else
+            echo -e "${RED}[FAIL]${NC} $name"
+            failed=$((failed + 1))
+        fi
+    done
+done
+
+log "$passed passed, $failed failed"
+[ "$failed" -eq 0 ]